@@ -18,6 +18,7 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <functional>
 #include <future>
 
@@ -97,10 +98,12 @@ private:
 
 static MainThreadRunner main_runner;
 
+static void publish_state();
+
 #define ENTER_MAIN_THREAD(...)                                                 \
     if (!main_runner.run([__VA_ARGS__]() {
 #define LEAVE_MAIN_THREAD()                                                    \
-    })) return false;
+    publish_state(); })) return false;
 
 static bool prefer_playing = true;
 
@@ -118,6 +121,93 @@ static Playlist current_playlist()
 
 #define CURRENT current_playlist()
 
+/* The state read by the most frequent queries, so that they can be answered
+ * without waiting for the main thread.  It is rebuilt in the main thread when
+ * playback or the playlists change, and after every method that runs in the
+ * main thread (so that a change made over D-Bus is seen at once).  The server
+ * is started before the playlists are loaded, so the state is first published
+ * from the main loop; until then, queries are answered in the main thread. */
+struct PlayerState
+{
+    bool ready = false; /* false until first published */
+    const char * status = "stopped";
+    int playlist = -1;
+    String playlist_title;
+    int length = 0;
+    int position = -1;
+    int n_queued = 0;
+    Tuple tuple; /* of the song at <position>, unless not yet scanned */
+};
+
+static aud::published<PlayerState> player_state;
+
+static void publish_state()
+{
+    PlayerState state;
+    Playlist list = CURRENT;
+
+    state.ready = true;
+
+    if (aud_drct_get_playing())
+        state.status = aud_drct_get_paused() ? "paused" : "playing";
+
+    state.playlist = list.index();
+    state.playlist_title = list.get_title();
+    state.length = list.n_entries();
+    state.position = list.get_position();
+    state.n_queued = list.n_queued();
+
+    if (state.position >= 0)
+        state.tuple = list.entry_tuple(state.position, Playlist::NoWait);
+
+    player_state.set(std::move(state));
+}
+
+static void publish_state_hook(void *, void *) { publish_state(); }
+
+static const char * const state_hooks[] = {
+    "playback begin",    "playback ready",       "playback pause",
+    "playback unpause",  "playback stop",        "playlist activate",
+    "playlist position", "playlist set playing", "playlist update"};
+
+static QueuedFunc start_publishing_func;
+
+/* called in the first iteration of the main loop, after aud_init() */
+static void start_publishing()
+{
+    publish_state();
+    for (const char * name : state_hooks)
+        hook_associate(name, publish_state_hook, nullptr);
+}
+
+/* gets the published state, going through the main thread if it has not been
+ * published yet; returns false if canceled */
+static bool get_state(PlayerState & state)
+{
+    state = player_state.get();
+    if (state.ready)
+        return true;
+
+    ENTER_MAIN_THREAD()
+    LEAVE_MAIN_THREAD()
+
+    state = player_state.get();
+    return true;
+}
+
+/* gets the tuple of the current song from the published state; returns false
+ * for any other song, or if the current song has not been scanned */
+static bool get_current_tuple(unsigned pos, Tuple & tuple)
+{
+    PlayerState state = player_state.get();
+    if (state.position < 0 || pos != (unsigned)state.position ||
+        !state.tuple.valid())
+        return false;
+
+    tuple = std::move(state.tuple);
+    return true;
+}
+
 static Index<PlaylistAddItem> strv_to_index(const char * const * strv)
 {
     Index<PlaylistAddItem> index;
@@ -253,20 +343,21 @@ static gboolean do_equalizer_activate(Obj * obj, Invoc * invoc, gboolean active)
 
 static gboolean do_get_active_playlist(Obj * obj, Invoc * invoc)
 {
-    int active_idx;
-    ENTER_MAIN_THREAD(&active_idx)
-    active_idx = CURRENT.index();
-    LEAVE_MAIN_THREAD()
-    FINISH2(get_active_playlist, active_idx);
+    PlayerState state;
+    if (!get_state(state))
+        return false;
+
+    FINISH2(get_active_playlist, state.playlist);
     return true;
 }
 
 static gboolean do_get_active_playlist_name(Obj * obj, Invoc * invoc)
 {
-    String title;
-    ENTER_MAIN_THREAD(&title)
-    title = CURRENT.get_title();
-    LEAVE_MAIN_THREAD()
+    PlayerState state;
+    if (!get_state(state))
+        return false;
+
+    const char * title = state.playlist_title;
     FINISH2(get_active_playlist_name, title ? title : "");
     return true;
 }
@@ -309,11 +400,11 @@ static gboolean do_get_info(Obj * obj, Invoc * invoc)
 
 static gboolean do_get_playqueue_length(Obj * obj, Invoc * invoc)
 {
-    int n_queued;
-    ENTER_MAIN_THREAD(&n_queued)
-    n_queued = CURRENT.n_queued();
-    LEAVE_MAIN_THREAD()
-    FINISH2(get_playqueue_length, n_queued);
+    PlayerState state;
+    if (!get_state(state))
+        return false;
+
+    FINISH2(get_playqueue_length, state.n_queued);
     return true;
 }
 
@@ -350,11 +441,11 @@ static gboolean do_jump(Obj * obj, Invoc * invoc, unsigned pos)
 
 static gboolean do_length(Obj * obj, Invoc * invoc)
 {
-    int n_entries;
-    ENTER_MAIN_THREAD(&n_entries)
-    n_entries = CURRENT.n_entries();
-    LEAVE_MAIN_THREAD()
-    FINISH2(length, n_entries);
+    PlayerState state;
+    if (!get_state(state))
+        return false;
+
+    FINISH2(length, state.length);
     return true;
 }
 
@@ -561,11 +652,11 @@ static gboolean do_plugin_is_enabled(Obj * obj, Invoc * invoc,
 
 static gboolean do_position(Obj * obj, Invoc * invoc)
 {
-    int pos;
-    ENTER_MAIN_THREAD(&pos)
-    pos = CURRENT.get_position();
-    LEAVE_MAIN_THREAD()
-    FINISH2(position, pos);
+    PlayerState state;
+    if (!get_state(state))
+        return false;
+
+    FINISH2(position, state.position);
     return true;
 }
 
@@ -841,9 +932,13 @@ static gboolean do_song_filename(Obj * obj, Invoc * invoc, unsigned pos)
 static gboolean do_song_frames(Obj * obj, Invoc * invoc, unsigned pos)
 {
     Tuple tuple;
-    ENTER_MAIN_THREAD(pos, &tuple);
-    tuple = CURRENT.entry_tuple(pos);
-    LEAVE_MAIN_THREAD()
+    if (!get_current_tuple(pos, tuple))
+    {
+        ENTER_MAIN_THREAD(pos, &tuple)
+        tuple = CURRENT.entry_tuple(pos);
+        LEAVE_MAIN_THREAD()
+    }
+
     FINISH2(song_frames, aud::max(0, tuple.get_int(Tuple::Length)));
     return true;
 }
@@ -851,9 +946,13 @@ static gboolean do_song_frames(Obj * obj, Invoc * invoc, unsigned pos)
 static gboolean do_song_length(Obj * obj, Invoc * invoc, unsigned pos)
 {
     Tuple tuple;
-    ENTER_MAIN_THREAD(pos, &tuple)
-    tuple = CURRENT.entry_tuple(pos);
-    LEAVE_MAIN_THREAD()
+    if (!get_current_tuple(pos, tuple))
+    {
+        ENTER_MAIN_THREAD(pos, &tuple)
+        tuple = CURRENT.entry_tuple(pos);
+        LEAVE_MAIN_THREAD()
+    }
+
     int length = aud::max(0, tuple.get_int(Tuple::Length));
     FINISH2(song_length, length / 1000);
     return true;
@@ -862,14 +961,33 @@ static gboolean do_song_length(Obj * obj, Invoc * invoc, unsigned pos)
 static gboolean do_song_title(Obj * obj, Invoc * invoc, unsigned pos)
 {
     Tuple tuple;
-    ENTER_MAIN_THREAD(pos, &tuple)
-    tuple = CURRENT.entry_tuple(pos);
-    LEAVE_MAIN_THREAD()
+    if (!get_current_tuple(pos, tuple))
+    {
+        ENTER_MAIN_THREAD(pos, &tuple)
+        tuple = CURRENT.entry_tuple(pos);
+        LEAVE_MAIN_THREAD()
+    }
+
     String title = tuple.get_str(Tuple::FormattedTitle);
     FINISH2(song_title, title ? title : "");
     return true;
 }
 
+static GVariant * field_to_variant(const Tuple & tuple, Tuple::Field field)
+{
+    switch (tuple.get_value_type(field))
+    {
+    case Tuple::String:
+        return g_variant_new_string(tuple.get_str(field));
+
+    case Tuple::Int:
+        return g_variant_new_int32(tuple.get_int(field));
+
+    default:
+        return nullptr;
+    }
+}
+
 static gboolean do_song_tuple(Obj * obj, Invoc * invoc, unsigned pos,
                               const char * key)
 {
@@ -879,29 +997,156 @@ static gboolean do_song_tuple(Obj * obj, Invoc * invoc, unsigned pos,
     if (field >= 0)
     {
         Tuple tuple;
-        ENTER_MAIN_THREAD(pos, &tuple)
-        tuple = CURRENT.entry_tuple(pos);
-        LEAVE_MAIN_THREAD()
+        if (!get_current_tuple(pos, tuple))
+        {
+            ENTER_MAIN_THREAD(pos, &tuple)
+            tuple = CURRENT.entry_tuple(pos);
+            LEAVE_MAIN_THREAD()
+        }
+
+        var = field_to_variant(tuple, field);
+    }
+
+    if (!var)
+        var = g_variant_new_string("");
+
+    FINISH2(song_tuple, g_variant_new_variant(var));
+    return true;
+}
 
-        switch (tuple.get_value_type(field))
+/* the most songs read in one visit to the main thread, and returned by
+ * SongTuples or SongTuplesPage, so that neither a long playlist nor a large
+ * count holds up the interface */
+#define TUPLES_PER_VISIT 1024
+
+/* reads the tuples of songs <first> up to <end> of the current playlist,
+ * optionally waiting for songs to be scanned; the playlist is chosen at the
+ * first visit to the main thread and kept for the following ones.  If it is
+ * deleted meanwhile, the songs read so far are returned. */
+static bool read_song_tuples(int first, int end, bool wait,
+                             Index<Tuple> & tuples, int & length)
+{
+    Playlist list;
+    int pos = first;
+    bool deleted = false;
+
+    do
+    {
+        int stop = pos;
+
+        ENTER_MAIN_THREAD(&)
+        if (list == Playlist())
+            list = CURRENT;
+        else if (!list.exists())
+            deleted = true;
+
+        if (!deleted)
         {
-        case Tuple::String:
-            var = g_variant_new_string(tuple.get_str(field));
-            break;
+            length = list.n_entries();
+            stop = aud::min(aud::min(end, length), pos + TUPLES_PER_VISIT);
 
-        case Tuple::Int:
-            var = g_variant_new_int32(tuple.get_int(field));
-            break;
+            for (; !wait && pos < stop; pos++)
+                tuples.append(list.entry_tuple(pos, Playlist::NoWait));
+        }
+        LEAVE_MAIN_THREAD()
 
-        default:
+        if (deleted)
             break;
+
+        /* the playlist can be read from any thread, so the songs are waited
+         * for here rather than holding up the main thread; a song read after
+         * the playlist was deleted is not kept */
+        for (; pos < stop; pos++)
+        {
+            Tuple tuple = list.entry_tuple(pos, Playlist::Wait);
+            if (!list.exists())
+            {
+                deleted = true;
+                break;
+            }
+
+            tuples.append(std::move(tuple));
+        }
+    } while (!deleted && pos < aud::min(end, length));
+
+    return true;
+}
+
+/* the variant is built outside the main thread */
+static GVariant * tuples_to_variant(const Index<Tuple> & tuples,
+                                    const char * const * names)
+{
+    Index<Tuple::Field> fields;
+    for (; *names; names++)
+    {
+        Tuple::Field field = Tuple::field_by_name(*names);
+        if (field >= 0)
+            fields.append(field);
+    }
+
+    if (!fields.len())
+    {
+        for (auto field : Tuple::all_fields())
+            fields.append(field);
+    }
+
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a(a{sv})"));
+
+    for (const Tuple & tuple : tuples)
+    {
+        g_variant_builder_open(&builder, G_VARIANT_TYPE("(a{sv})"));
+        g_variant_builder_open(&builder, G_VARIANT_TYPE("a{sv}"));
+
+        for (auto field : fields)
+        {
+            GVariant * var = field_to_variant(tuple, field);
+            if (var)
+                g_variant_builder_add(&builder, "{sv}",
+                                      Tuple::field_get_name(field), var);
         }
+
+        g_variant_builder_close(&builder);
+        g_variant_builder_close(&builder);
     }
 
-    if (!var)
-        var = g_variant_new_string("");
+    return g_variant_builder_end(&builder);
+}
 
-    FINISH2(song_tuple, g_variant_new_variant(var));
+/* D-Bus positions are unsigned, playlist positions are int */
+static int clamp_pos(int64_t pos) { return aud::min(pos, (int64_t)INT_MAX); }
+
+static gboolean do_song_tuples(Obj * obj, Invoc * invoc, unsigned first,
+                               unsigned count, const char * const * fields,
+                               gboolean wait)
+{
+    Index<Tuple> tuples;
+    int length = 0;
+
+    count = aud::min(count, (unsigned)TUPLES_PER_VISIT);
+
+    if (!read_song_tuples(clamp_pos(first), clamp_pos((int64_t)first + count),
+                          wait, tuples, length))
+        return false;
+
+    FINISH2(song_tuples, tuples_to_variant(tuples, fields));
+    return true;
+}
+
+static gboolean do_song_tuples_page(Obj * obj, Invoc * invoc, unsigned first,
+                                    unsigned count, const char * const * fields,
+                                    gboolean wait)
+{
+    Index<Tuple> tuples;
+    int length = 0;
+
+    count = aud::min(count, (unsigned)TUPLES_PER_VISIT);
+
+    if (!read_song_tuples(clamp_pos(first), clamp_pos((int64_t)first + count),
+                          wait, tuples, length))
+        return false;
+
+    FINISH2(song_tuples_page, length, tuples_to_variant(tuples, fields));
     return true;
 }
 
@@ -916,13 +1161,11 @@ static gboolean do_startup_notify(Obj * obj, Invoc * invoc, const char * id)
 
 static gboolean do_status(Obj * obj, Invoc * invoc)
 {
-    const char * status = "stopped";
-    ENTER_MAIN_THREAD(&status)
-    if (aud_drct_get_playing())
-        status = aud_drct_get_paused() ? "paused" : "playing";
+    PlayerState state;
+    if (!get_state(state))
+        return false;
 
-    LEAVE_MAIN_THREAD()
-    FINISH2(status, status);
+    FINISH2(status, state.status);
     return true;
 }
 
@@ -1083,6 +1326,8 @@ static const struct
     {"handle-song-length", (GCallback)do_song_length},
     {"handle-song-title", (GCallback)do_song_title},
     {"handle-song-tuple", (GCallback)do_song_tuple},
+    {"handle-song-tuples", (GCallback)do_song_tuples},
+    {"handle-song-tuples-page", (GCallback)do_song_tuples_page},
     {"handle-startup-notify", (GCallback)do_startup_notify},
     {"handle-status", (GCallback)do_status},
     {"handle-stop", (GCallback)do_stop},
@@ -1178,6 +1423,8 @@ bool dbus_server_init()
     init_promise = std::promise<bool>();
     init_promise_set = false;
 
+    start_publishing_func.queue(start_publishing);
+
     dbus_context = g_main_context_new();
     dbus_mainloop = g_main_loop_new(dbus_context, false);
     dbus_thread = std::thread(dbus_server_run);
@@ -1200,6 +1447,12 @@ void dbus_server_cleanup()
     dbus_thread.join();
     main_runner.reset();
 
+    start_publishing_func.stop();
+    for (const char * name : state_hooks)
+        hook_dissociate(name, publish_state_hook);
+
+    player_state.set(PlayerState());
+
     if (owner_id)
     {
         g_bus_unown_name(owner_id);
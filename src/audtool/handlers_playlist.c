@@ -246,38 +246,65 @@ void playlist_song_length_frames (int argc, char * * argv)
 
 void playlist_display (int argc, char * * argv)
 {
+    static const char * const fields[] = {"formatted-title", "length", NULL};
+
     int entries = get_playlist_length ();
 
     audtool_report ("%d track%s.", entries, entries != 1 ? "s" : "");
 
     int total = 0;
 
-    for (int entry = 0; entry < entries; entry ++)
+    /* fetch the entries a page at a time rather than one by one, waiting
+     * for any that have not been scanned yet */
+    for (int entry = 0; entry < entries; )
     {
-        char * title = get_entry_title (entry);
-        int length = get_entry_length (entry) / 1000;
+        GVariant * tuples;
+        get_entry_fields_page (entry, 1024, fields, TRUE, & tuples);
 
-        total += length;
+        int count = g_variant_n_children (tuples);
 
-        /* adjust width for multi byte characters */
-        int column = 60;
+        if (! count)
+        {
+            g_variant_unref (tuples);
+            break;
+        }
 
-        for (const char * p = title; * p; p = g_utf8_next_char (p))
+        for (int i = 0; i < count; i ++, entry ++)
         {
-            int stride = g_utf8_next_char (p) - p;
+            GVariant * dict;
+            g_variant_get_child (tuples, i, "(@a{sv})", & dict);
 
-            if (g_unichar_iswide (g_utf8_get_char (p)) ||
-             g_unichar_iswide_cjk (g_utf8_get_char (p)))
-                column += (stride - 2);
-            else
-                column += (stride - 1);
-        }
+            const char * title = "";
+            int length = 0;
+
+            g_variant_lookup (dict, "formatted-title", "&s", & title);
+            g_variant_lookup (dict, "length", "i", & length);
+
+            length = MAX (length, 0) / 1000;
+            total += length;
 
-        char * fmt = g_strdup_printf ("%%4d | %%-%ds | %%d:%%.2d", column);
-        audtool_report (fmt, entry + 1, title, length / 60, length % 60);
+            /* adjust width for multi byte characters */
+            int column = 60;
+
+            for (const char * p = title; * p; p = g_utf8_next_char (p))
+            {
+                int stride = g_utf8_next_char (p) - p;
+
+                if (g_unichar_iswide (g_utf8_get_char (p)) ||
+                 g_unichar_iswide_cjk (g_utf8_get_char (p)))
+                    column += (stride - 2);
+                else
+                    column += (stride - 1);
+            }
+
+            char * fmt = g_strdup_printf ("%%4d | %%-%ds | %%d:%%.2d", column);
+            audtool_report (fmt, entry + 1, title, length / 60, length % 60);
+
+            g_free (fmt);
+            g_variant_unref (dict);
+        }
 
-        g_free (fmt);
-        g_free (title);
+        g_variant_unref (tuples);
     }
 
     audtool_report ("Total length: %d:%.2d", total / 60, total % 60);
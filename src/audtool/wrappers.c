@@ -165,6 +165,23 @@ char * get_entry_field (int entry, const char * field)
     return str;
 }
 
+/* returns the length of the playlist and sets <tuples> to the fields of up to
+ * <count> entries starting at <first>, as an array of (a{sv}) */
+int get_entry_fields_page (int first, int count, const char * const * fields,
+ gboolean wait, GVariant * * tuples)
+{
+    unsigned length = -1;
+    * tuples = NULL;
+
+    obj_audacious_call_song_tuples_page_sync (dbus_proxy, first, count, fields,
+     wait, & length, tuples, NULL, NULL);
+
+    if (length == (unsigned) -1 || ! * tuples)
+        exit (1);
+
+    return length;
+}
+
 int get_current_time (void)
 {
     unsigned time = -1;
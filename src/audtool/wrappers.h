@@ -36,6 +36,8 @@ char * get_entry_filename (int entry);
 char * get_entry_title (int entry);
 int get_entry_length (int entry);
 char * get_entry_field (int entry, const char * field);
+int get_entry_fields_page (int first, int count, const char * const * fields,
+ gboolean wait, GVariant * * tuples);
 
 int get_current_time (void);
 void get_current_info (int * bitrate, int * samplerate, int * channels);
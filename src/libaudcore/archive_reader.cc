@@ -20,103 +20,492 @@
 #ifdef USE_LIBARCHIVE
 
 #include "archive_reader.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "audstrings.h"
+#include "internal.h"
+#include "list.h"
+#include "multihash.h"
 #include "runtime.h"
+#include "threads.h"
 
-EXPORT ArchiveReader::ArchiveReader(VFSFile && archive_file) :
-    m_archive_file (archive_file)
+/*
+ * Opening an entry used to mean rewinding the archive and decoding every
+ * header (and, without a skip callback, every byte of data) up to it, so
+ * opening each track of a large archive in turn was quadratic.  Instead, the
+ * list of entries is read once per archive and cached, keyed by the archive's
+ * URI, size and modification time.  Entries stored without compression in an
+ * unfiltered zip or tar archive are then read by seeking directly within the
+ * archive file; other entries are decompressed in blocks, which are cached so
+ * that seeking backwards does not always restart decompression.
+ */
+
+static constexpr int READ_BUF_SIZE = 65536;
+static constexpr int BLOCK_SIZE = 65536;
+static constexpr int64_t BLOCK_CACHE_BYTES = 16 * 1024 * 1024;
+static constexpr int INDEX_CACHE_MAX = 8;
+
+struct ArchiveEntryInfo
 {
+    String name;
+    int64_t header_pos; /* offset of the entry's header in the archive */
+    int64_t data_pos;   /* offset of the stored data, -1 if compressed */
+    int64_t size;       /* -1 if unknown */
+};
+
+struct ArchiveIndex : public ListNode
+{
+    String key;
+    Index<ArchiveEntryInfo> entries;
+    SimpleHash<String, int> lookup;
+};
+
+struct CachedBlock : public ListNode
+{
+    String key;
+    Index<char> data;
+};
+
+static aud::mutex mutex;
+
+/* both caches are kept in least- to most-recently used order */
+static List<ArchiveIndex> index_list;
+static int index_count;
+
+static List<CachedBlock> block_list;
+static SimpleHash<String, CachedBlock *> block_table;
+static int64_t block_bytes;
+
+static ArchiveIndex * index_get_locked (const String & key)
+{
+    ArchiveIndex * index = index_list.find ([& key] (const ArchiveIndex & node)
+        { return node.key == key; });
+
+    if (index)
+    {
+        index_list.remove (index);
+        index_list.append (index);
+    }
+
+    return index;
 }
 
-EXPORT Index<String> ArchiveReader::read_folder()
+static void index_add_locked (ArchiveIndex * index)
 {
-    Index<String> files;
-    archive * a = nullptr;
-    archive_entry * entry = nullptr;
+    index_list.append (index);
 
-    // if fseek returns non-zero, bail
-    if (m_archive_file.fseek (0, VFS_SEEK_SET))
-        return files;
+    if (++ index_count > INDEX_CACHE_MAX)
+    {
+        delete index_list.pop_head ();
+        index_count --;
+    }
+}
 
-    a = archive_read_new ();
-    archive_read_support_filter_all (a);
-    archive_read_support_format_all (a);
+static String block_key (const String & key, const char * path, int64_t index)
+{
+    return String (str_printf ("%s\n%s\n%" PRId64, (const char *) key, path,
+                               index));
+}
 
-    archive_read_open (a, this, nullptr, reader, nullptr);
+static bool block_get (const String & key, Index<char> & data)
+{
+    auto mh = mutex.take ();
 
-    while (archive_read_next_header (a, & entry) == ARCHIVE_OK)
+    CachedBlock * * block = block_table.lookup (key);
+    if (! block)
+        return false;
+
+    block_list.remove (* block);
+    block_list.append (* block);
+
+    data.clear ();
+    data.insert ((* block)->data.begin (), 0, (* block)->data.len ());
+    return true;
+}
+
+static void block_put (const String & key, const Index<char> & data)
+{
+    auto mh = mutex.take ();
+
+    if (block_table.lookup (key))
+        return;
+
+    CachedBlock * block = new CachedBlock;
+    block->key = key;
+    block->data.insert (data.begin (), 0, data.len ());
+
+    block_list.append (block);
+    block_table.add (key, std::move (block));
+    block_bytes += data.len ();
+
+    while (block_bytes > BLOCK_CACHE_BYTES)
     {
-        files.append (String (archive_entry_pathname (entry)));
+        CachedBlock * old = block_list.pop_head ();
+        block_bytes -= old->data.len ();
+        block_table.remove (old->key);
+        delete old;
     }
+}
 
-    archive_read_free (a);
+void archive_reader_cleanup ()
+{
+    auto mh = mutex.take ();
 
-    return files;
+    index_list.clear ();
+    index_count = 0;
+
+    block_table.clear ();
+    block_list.clear ();
+    block_bytes = 0;
+}
+
+static int read_le16 (const unsigned char * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static int64_t read_le32 (const unsigned char * p)
+{
+    return (int64_t) (p[0] | (p[1] << 8) | (p[2] << 16)) |
+           ((int64_t) p[3] << 24);
+}
+
+/* Checks whether the zip entry whose local header is at <header_pos> is
+ * stored uncompressed and returns the offset of its data, or -1. */
+static int64_t find_zip_data (VFSFile & file, const ArchiveEntryInfo & info)
+{
+    unsigned char header[30];
+    int name_len = strlen (info.name);
+
+    if (file.fseek (info.header_pos, VFS_SEEK_SET) ||
+        file.fread (header, 1, 30) != 30 ||
+        memcmp (header, "PK\3\4", 4))
+        return -1;
+
+    int flags = read_le16 (header + 6);
+    int method = read_le16 (header + 8);
+    int64_t csize = read_le32 (header + 18);
+
+    /* method 0 = stored; bit 0 of flags = encrypted */
+    if (method != 0 || (flags & 1) || read_le16 (header + 26) != name_len)
+        return -1;
+
+    /* bit 3 of flags = sizes given only after the data; 0xffffffff = zip64 */
+    if (! (flags & 8) && csize != 0xffffffff && csize != info.size)
+        return -1;
+
+    StringBuf name (name_len);
+    if (file.fread (name, 1, name_len) != name_len ||
+        memcmp (name, info.name, name_len))
+        return -1;
+
+    return info.header_pos + 30 + name_len + read_le16 (header + 28);
 }
 
-ssize_t ArchiveReader::reader(archive * a, void * client_data, const void ** buff)
+/* Checks whether the tar entry at <header_pos> is a plain file described by a
+ * single ustar header and returns the offset of its data, or -1.  Entries
+ * using extended (pax or GNU) headers are left to libarchive. */
+static int64_t find_tar_data (VFSFile & file, const ArchiveEntryInfo & info)
 {
-    constexpr int pagesize = 4096;
+    char header[512];
+    int name_len = strlen (info.name);
 
-    ArchiveReader * ar = (ArchiveReader *) client_data;
+    if (name_len >= 100 || file.fseek (info.header_pos, VFS_SEEK_SET) ||
+        file.fread (header, 1, 512) != 512)
+        return -1;
 
-    ar->m_buf.clear ();
-    ar->m_buf.insert (0, pagesize);
+    if ((header[156] != '0' && header[156] != '\0') ||
+        strncmp (header, info.name, 100) || header[345] != '\0')
+        return -1;
 
-    auto size = ar->m_archive_file.fread (ar->m_buf.begin (), 1, pagesize);
-    ar->m_buf.remove (size, -1);
+    char size_field[13];
+    memcpy (size_field, header + 124, 12);
+    size_field[12] = 0;
 
-    * buff = ar->m_buf.begin ();
+    if (strtoll (size_field, nullptr, 8) != info.size)
+        return -1;
 
-    return size;
+    return info.header_pos + 512;
 }
 
-EXPORT VFSFile ArchiveReader::open(const char * path)
+ArchiveSource::ArchiveSource (VFSFile && file) :
+    m_file (std::move (file))
 {
-    return VFSFile (path, read_file (path));
 }
 
-EXPORT VFSArchiveReaderImpl * ArchiveReader::read_file(const char * path)
+ArchiveSource::~ArchiveSource ()
 {
-    archive * a = nullptr;
-    archive_entry * entry = nullptr;
+    close ();
+}
+
+archive * ArchiveSource::open ()
+{
+    close ();
 
     // if fseek returns non-zero, bail
-    if (m_archive_file.fseek (0, VFS_SEEK_SET))
+    if (! m_file || m_file.fseek (0, VFS_SEEK_SET))
         return nullptr;
 
-    a = archive_read_new ();
-    archive_read_support_filter_all (a);
-    archive_read_support_format_all (a);
+    m_archive = archive_read_new ();
+    archive_read_support_filter_all (m_archive);
+    archive_read_support_format_all (m_archive);
 
-    archive_read_open (a, this, nullptr, reader, nullptr);
+    if (archive_read_open2 (m_archive, this, nullptr, reader, skipper,
+                            nullptr) != ARCHIVE_OK)
+    {
+        AUDERR ("%s: %s\n", m_file.filename (),
+                archive_error_string (m_archive));
+        close ();
+    }
+
+    return m_archive;
+}
+
+void ArchiveSource::close ()
+{
+    if (m_archive)
+        archive_read_free (m_archive);
+
+    m_archive = nullptr;
+}
+
+ssize_t ArchiveSource::reader (archive * a, void * client_data, const void ** buff)
+{
+    ArchiveSource * source = (ArchiveSource *) client_data;
+
+    if (! source->m_buf.len ())
+        source->m_buf.insert (0, READ_BUF_SIZE);
+
+    * buff = source->m_buf.begin ();
+
+    return source->m_file.fread (source->m_buf.begin (), 1, READ_BUF_SIZE);
+}
+
+int64_t ArchiveSource::skipper (archive * a, void * client_data, int64_t request)
+{
+    ArchiveSource * source = (ArchiveSource *) client_data;
+
+    /* returning 0 makes libarchive fall back to reading */
+    if (source->m_file.fseek (request, VFS_SEEK_CUR))
+        return 0;
+
+    return request;
+}
+
+EXPORT ArchiveReader::ArchiveReader(VFSFile && archive_file) :
+    m_source (std::move (archive_file))
+{
+    VFSFile & file = m_source.file ();
+    if (! file)
+        return;
+
+    FileStamp stamp;
+    if (! tuple_cache_get_stamp (file.filename (), stamp))
+        stamp = {file.fsize (), -1};
+
+    m_key = String (str_printf ("%s\n%" PRId64 "\n%" PRId64, file.filename (),
+                                stamp.size, stamp.mtime));
+}
+
+bool ArchiveReader::build_index ()
+{
+    if (! m_key)
+        return false;
+
+    {
+        auto mh = mutex.take ();
+        if (index_get_locked (m_key))
+            return true;
+    }
+
+    archive * a = m_source.open ();
+    archive_entry * entry = nullptr;
+
+    if (! a)
+        return false;
+
+    ArchiveIndex * index = new ArchiveIndex;
+    index->key = m_key;
 
     while (archive_read_next_header (a, & entry) == ARCHIVE_OK)
     {
-        if (! str_compare (archive_entry_pathname (entry), path))
-            return new VFSArchiveReaderImpl (a, entry);
+        const char * name = archive_entry_pathname (entry);
+        if (! name)
+            continue;
+
+        ArchiveEntryInfo & info = index->entries.append ();
+        info.name = String (name);
+        info.header_pos = archive_read_header_position (a);
+        info.data_pos = -1;
+        info.size = archive_entry_size_is_set (entry) ?
+                    archive_entry_size (entry) : -1;
+
+        index->lookup.add (info.name, index->entries.len () - 1);
+    }
+
+    /* data can be read in place only if there is no compression filter
+     * (such as gzip) and the format itself does not compress the entry */
+    bool unfiltered = (archive_filter_code (a, 0) == ARCHIVE_FILTER_NONE);
+    int format = archive_format (a) & ARCHIVE_FORMAT_BASE_MASK;
+
+    m_source.close ();
+
+    if (unfiltered && (format == ARCHIVE_FORMAT_ZIP ||
+                       format == ARCHIVE_FORMAT_TAR))
+    {
+        for (ArchiveEntryInfo & info : index->entries)
+        {
+            if (info.size < 0)
+                continue;
+
+            info.data_pos = (format == ARCHIVE_FORMAT_ZIP)
+                            ? find_zip_data (m_source.file (), info)
+                            : find_tar_data (m_source.file (), info);
+        }
     }
 
-    // on error, cleanup and return nullptr
-    archive_read_free (a);
-    return nullptr;
+    auto mh = mutex.take ();
+    if (index_get_locked (m_key))
+        delete index; /* another thread was faster */
+    else
+        index_add_locked (index);
+
+    return true;
 }
 
-VFSArchiveReaderImpl::VFSArchiveReaderImpl(archive * a, archive_entry * entry) :
-    m_archive (a),
-    m_archive_entry (entry),
-    m_pos (0),
-    m_eof (false)
+EXPORT Index<String> ArchiveReader::read_folder()
 {
-    m_size = archive_entry_size (m_archive_entry);
+    Index<String> files;
+
+    if (! build_index ())
+        return files;
+
+    auto mh = mutex.take ();
+    ArchiveIndex * index = index_get_locked (m_key);
+
+    if (index)
+    {
+        for (const ArchiveEntryInfo & info : index->entries)
+            files.append (info.name);
+    }
+
+    return files;
 }
 
-VFSArchiveReaderImpl::~VFSArchiveReaderImpl()
+EXPORT VFSFile ArchiveReader::open(const char * path)
 {
-    if (m_archive)
-        archive_read_free (m_archive);
+    return VFSFile (path, read_file (path));
+}
 
-    m_archive = nullptr;
+/* reads an entry stored without compression directly from the archive */
+class VFSArchiveStoredImpl : public VFSImpl
+{
+public:
+    VFSArchiveStoredImpl (VFSFile && file, int64_t start, int64_t size) :
+        m_file (std::move (file)),
+        m_start (start),
+        m_size (size) {}
+
+protected:
+    int64_t fread (void * ptr, int64_t size, int64_t nmemb);
+    int fseek (int64_t offset, VFSSeekType whence);
+
+    int64_t ftell () { return m_pos; }
+    int64_t fsize () { return m_size; }
+    bool feof () { return m_eof; }
+
+    int64_t fwrite (const void * ptr, int64_t size, int64_t nmemb) { return 0; }
+    int ftruncate (int64_t) { return -1; }
+    int fflush () { return 0; }
+
+private:
+    VFSFile m_file;
+    int64_t m_start, m_size;
+    int64_t m_pos = 0;
+    bool m_eof = false;
+};
+
+int64_t VFSArchiveStoredImpl::fread (void * ptr, int64_t size, int64_t nmemb)
+{
+    if (size <= 0 || nmemb <= 0)
+        return 0;
+
+    int64_t avail = aud::max (m_size - m_pos, (int64_t) 0);
+    int64_t want = aud::min (nmemb, avail / size);
+    int64_t got = 0;
+
+    if (want > 0 && ! m_file.fseek (m_start + m_pos, VFS_SEEK_SET))
+        got = m_file.fread (ptr, size, want);
+
+    if (got < 0)
+        return -1;
+
+    m_pos += got * size;
+
+    if (got < nmemb)
+        m_eof = true;
+
+    return got;
+}
+
+int VFSArchiveStoredImpl::fseek (int64_t offset, VFSSeekType whence)
+{
+    if (whence == VFS_SEEK_CUR)
+        offset += m_pos;
+    else if (whence == VFS_SEEK_END)
+        offset += m_size;
+
+    if (offset < 0 || offset > m_size)
+        return -1;
+
+    m_pos = offset;
+    m_eof = false;
+    return 0;
+}
+
+VFSImpl * ArchiveReader::read_file(const char * path)
+{
+    if (! build_index ())
+        return nullptr;
+
+    ArchiveEntryInfo info;
+
+    {
+        auto mh = mutex.take ();
+        ArchiveIndex * index = index_get_locked (m_key);
+        int * pos = index ? index->lookup.lookup (String (path)) : nullptr;
+
+        if (! pos)
+            return nullptr;
+
+        info = index->entries[* pos];
+    }
+
+    VFSFile file (m_source.file ().filename (), "r");
+    if (! file)
+        return nullptr;
+
+    if (info.data_pos >= 0)
+        return new VFSArchiveStoredImpl (std::move (file), info.data_pos,
+                                         info.size);
+
+    return new VFSArchiveReaderImpl (std::move (file), m_key, path, info.size);
+}
+
+VFSArchiveReaderImpl::VFSArchiveReaderImpl(VFSFile && archive_file,
+ const String & key, const char * path, int64_t size) :
+    m_source (std::move (archive_file)),
+    m_key (key),
+    m_path (path),
+    m_size (size),
+    m_pos (0),
+    m_eof (false),
+    m_stream_pos (-1),
+    m_block_index (-1)
+{
 }
 
 int64_t VFSArchiveReaderImpl::fsize ()
@@ -136,7 +525,7 @@ bool VFSArchiveReaderImpl::feof ()
 
 int VFSArchiveReaderImpl::ftruncate (int64_t)
 {
-    return 0;
+    return -1;
 }
 
 int VFSArchiveReaderImpl::fflush ()
@@ -151,22 +540,145 @@ int64_t VFSArchiveReaderImpl::fwrite (const void * ptr, int64_t size, int64_t nm
 
 int VFSArchiveReaderImpl::fseek (int64_t offset, VFSSeekType whence)
 {
-    AUDERR("<%p> implement me!\n", this);
-    return -1;
+    if (whence == VFS_SEEK_CUR)
+        offset += m_pos;
+    else if (whence == VFS_SEEK_END)
+    {
+        if (m_size < 0)
+            return -1;
+
+        offset += m_size;
+    }
+
+    if (offset < 0 || (m_size >= 0 && offset > m_size))
+        return -1;
+
+    m_pos = offset;
+    m_eof = false;
+    return 0;
+}
+
+bool VFSArchiveReaderImpl::rewind_stream ()
+{
+    m_stream_pos = -1;
+
+    archive * a = m_source.open ();
+    archive_entry * entry = nullptr;
+
+    if (! a)
+        return false;
+
+    /* headers of the preceding entries are still parsed, but their data is
+     * skipped without being decompressed */
+    while (archive_read_next_header (a, & entry) == ARCHIVE_OK)
+    {
+        if (! str_compare (archive_entry_pathname (entry), m_path))
+        {
+            m_stream_pos = 0;
+            return true;
+        }
+    }
+
+    m_source.close ();
+    return false;
+}
+
+bool VFSArchiveReaderImpl::fetch_block (int64_t index)
+{
+    if (block_get (block_key (m_key, m_path, index), m_block))
+    {
+        m_block_index = index;
+        return true;
+    }
+
+    int64_t start = index * BLOCK_SIZE;
+
+    if (m_stream_pos < 0 || m_stream_pos > start)
+    {
+        if (! rewind_stream ())
+            return false;
+    }
+
+    Index<char> data;
+
+    /* decompress (and cache) every block up to the requested one */
+    while (m_stream_pos <= start)
+    {
+        int64_t block_index = m_stream_pos / BLOCK_SIZE;
+
+        data.clear ();
+        data.insert (0, BLOCK_SIZE);
+
+        int filled = 0;
+        while (filled < BLOCK_SIZE)
+        {
+            auto ret = archive_read_data (m_source.get (),
+                                          data.begin () + filled,
+                                          BLOCK_SIZE - filled);
+            if (ret < 0)
+            {
+                AUDERR ("%s: %s\n", (const char *) m_path,
+                        archive_error_string (m_source.get ()));
+                m_source.close ();
+                m_stream_pos = -1;
+                return false;
+            }
+
+            if (! ret)
+                break;
+
+            filled += ret;
+        }
+
+        data.remove (filled, -1);
+        block_put (block_key (m_key, m_path, block_index), data);
+        m_stream_pos += filled;
+
+        if (filled < BLOCK_SIZE)
+        {
+            /* end of entry; the requested block may lie beyond it */
+            if (block_index != index)
+                data.clear ();
+
+            break;
+        }
+    }
+
+    m_block = std::move (data);
+    m_block_index = index;
+    return true;
 }
 
 int64_t VFSArchiveReaderImpl::fread (void * ptr, int64_t size, int64_t nmemb)
 {
-    auto ret = archive_read_data (m_archive, ptr, (size * nmemb));
-    if (ret < ARCHIVE_OK)
-        return -1;
+    if (size <= 0 || nmemb <= 0)
+        return 0;
 
-    if (! ret)
-        m_eof = true;
+    int64_t want = size * nmemb;
+    int64_t done = 0;
 
-    m_pos += ret;
+    while (done < want)
+    {
+        int64_t index = m_pos / BLOCK_SIZE;
+
+        if (index != m_block_index && ! fetch_block (index))
+            return done ? done / size : -1;
+
+        int64_t offset = m_pos - index * BLOCK_SIZE;
+        int64_t copy = aud::min (want - done, m_block.len () - offset);
+
+        if (copy <= 0)
+        {
+            m_eof = true;
+            break;
+        }
+
+        memcpy ((char *) ptr + done, m_block.begin () + offset, copy);
+        done += copy;
+        m_pos += copy;
+    }
 
-    return ret;
+    return done / size;
 }
 
 #endif // USE_LIBARCHIVE
@@ -30,11 +30,36 @@
 #include <archive_entry.h>
 #include <libaudcore/vfs.h>
 
+/* an archive opened through libarchive, reading from a VFSFile */
+class ArchiveSource
+{
+public:
+    ArchiveSource (VFSFile && file);
+    ~ArchiveSource ();
+
+    VFSFile & file () { return m_file; }
+    archive * get () { return m_archive; }
+
+    /* (re)opens the archive from the beginning; returns nullptr on error */
+    archive * open ();
+    void close ();
+
+private:
+    VFSFile m_file;
+    Index<char> m_buf;
+    archive * m_archive = nullptr;
+
+    static ssize_t reader (archive * a, void * client_data, const void ** buff);
+    static int64_t skipper (archive * a, void * client_data, int64_t request);
+};
+
+/* reads a compressed archive entry, decompressing it in blocks which are kept
+ * in a cache shared by all open entries */
 class VFSArchiveReaderImpl : public VFSImpl
 {
 public:
-    VFSArchiveReaderImpl (archive *, archive_entry *);
-    ~VFSArchiveReaderImpl ();
+    VFSArchiveReaderImpl (VFSFile && archive_file, const String & key,
+                          const char * path, int64_t size);
 
 protected:
     int64_t fread (void * ptr, int64_t size, int64_t nmemb);
@@ -49,11 +74,18 @@ protected:
     int fflush();
 
 private:
-    archive * m_archive;
-    archive_entry * m_archive_entry;
+    ArchiveSource m_source;
+    String m_key, m_path;
     int64_t m_size;
     int64_t m_pos;
     bool m_eof;
+
+    int64_t m_stream_pos;  /* decompressed position of m_source, -1 if closed */
+    int64_t m_block_index; /* index of the block held in m_block, -1 if none */
+    Index<char> m_block;
+
+    bool fetch_block (int64_t index);
+    bool rewind_stream ();
 };
 
 class ArchiveReader
@@ -64,12 +96,11 @@ public:
     VFSFile open (const char * path);
 
 private:
-    VFSFile & m_archive_file;
-    Index<char> m_buf;
-
-    VFSArchiveReaderImpl * read_file (const char * path);
+    ArchiveSource m_source;
+    String m_key;
 
-    static ssize_t reader(archive * a, void * client_data, const void ** buff);
+    bool build_index ();
+    VFSImpl * read_file (const char * path);
 };
 
 #endif
@@ -0,0 +1,106 @@
+/*
+ * audio-internal.h
+ * Copyright 2009-2013 John Lindgren, Michał Lipski, and Anders Johansson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_AUDIO_INTERNAL_H
+#define LIBAUDCORE_AUDIO_INTERNAL_H
+
+#include <stdint.h>
+
+#include "audio.h"
+
+struct packed24_t
+{
+    uint8_t b[3];
+};
+static_assert(sizeof(packed24_t) == 3, "invalid packed 24-bit type");
+
+static constexpr bool is_le(int format)
+{
+    return format == FMT_S16_LE || format == FMT_U16_LE ||
+           format == FMT_S24_LE || format == FMT_U24_LE ||
+           format == FMT_S32_LE || format == FMT_U32_LE ||
+           format == FMT_S24_3LE || format == FMT_U24_3LE;
+}
+
+static constexpr bool is_signed(int format)
+{
+    return (format == FMT_S8 || format == FMT_S16_LE || format == FMT_S16_BE ||
+            format == FMT_S24_LE || format == FMT_S24_BE ||
+            format == FMT_S32_LE || format == FMT_S32_BE ||
+            format == FMT_S24_3LE || format == FMT_S24_3BE);
+}
+
+static constexpr unsigned neg_range(int format)
+{
+    return (format >= FMT_S32_LE && format < FMT_S24_3LE)
+               ? 0x80000000
+               : (format >= FMT_S24_LE)
+                     ? 0x800000
+                     : (format >= FMT_S16_LE) ? 0x8000 : 0x80;
+}
+
+// 0x7fffff80 = largest representable floating-point value before 2^31
+static constexpr unsigned pos_range(int format)
+{
+    return (format >= FMT_S32_LE && format < FMT_S24_3LE)
+               ? 0x7fffff80
+               : (format >= FMT_S24_LE)
+                     ? 0x7fffff
+                     : (format >= FMT_S16_LE) ? 0x7fff : 0x7f;
+}
+
+/* audio.cc */
+
+/* factors for each channel as applied by audio_amplify() with a StereoVolume */
+void audio_volume_factors(StereoVolume volume, int channels, float * factors);
+
+/* audio_amplify() followed by audio_soft_clip() (if <soft_clip> is set), in a
+ * single pass; the results may differ slightly due to rounding */
+void audio_apply_gain(float * data, int channels, int frames,
+                      const float * factors, bool soft_clip);
+
+/* audio-simd.cc */
+
+/* Vectorized conversion kernels.  Each kernel converts as many samples as it
+ * can handle in whole vectors and returns that count; the caller finishes the
+ * remainder with the generic loops in audio.cc.  The results are required to
+ * be bit-identical to those of the generic loops. */
+typedef int (*AudioFromIntKernel)(const void * in, float * out, int samples);
+typedef int (*AudioToIntKernel)(const float * in, void * out, int samples);
+
+enum class SimdLevel
+{
+    None,
+    SSE2,
+    AVX2,
+    NEON
+};
+
+/* level detected at startup; the best one supported by the running CPU */
+SimdLevel audio_simd_detected();
+
+/* level currently in use; can be lowered for testing */
+SimdLevel audio_simd_level();
+bool audio_simd_set_level(SimdLevel level);
+
+/* return nullptr if no kernel is available for the format */
+AudioFromIntKernel audio_simd_from_int(int format);
+AudioToIntKernel audio_simd_to_int(int format);
+
+#endif // LIBAUDCORE_AUDIO_INTERNAL_H
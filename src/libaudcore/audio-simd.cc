@@ -0,0 +1,745 @@
+/*
+ * audio-simd.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "audio-internal.h"
+
+#include <initializer_list>
+#include <stdint.h>
+
+/* The x86 kernels are only enabled on x86-64, where scalar floating-point math
+ * is also done in SSE registers.  On i386 the generic loops may use the x87
+ * unit, whose extended precision would make the results differ. */
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_SSE2_KERNELS
+#define HAVE_AVX2_KERNELS
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON) &&                            \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define HAVE_NEON_KERNELS
+#endif
+
+/* All kernels assume a little-endian host, so big-endian formats are the
+ * ones that need byte-swapping. */
+
+static constexpr bool is_16bit(int format)
+{
+    return format >= FMT_S16_LE && format <= FMT_U16_BE;
+}
+
+static constexpr bool is_padded24(int format)
+{
+    return format >= FMT_S24_LE && format <= FMT_U24_BE;
+}
+
+static constexpr bool is_packed24(int format) { return format >= FMT_S24_3LE; }
+
+#ifdef HAVE_SSE2_KERNELS
+
+struct SSE2Kernels
+{
+    static __m128i bswap16(__m128i v)
+    {
+        return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    }
+
+    static __m128i bswap32(__m128i v)
+    {
+        v = bswap16(v);
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    }
+
+    /* raw 16-bit words -> signed integers (still 16-bit) */
+    template<int format>
+    static __m128i unpack16(__m128i v)
+    {
+        if (!is_le(format))
+            v = bswap16(v);
+        if (!is_signed(format))
+            v = _mm_xor_si128(v, _mm_set1_epi16((short)0x8000));
+        return v;
+    }
+
+    /* raw 32-bit words -> signed integers */
+    template<int format>
+    static __m128i unpack32(__m128i v)
+    {
+        if (!is_le(format))
+            v = bswap32(v);
+        if (!is_signed(format))
+            v = _mm_xor_si128(v, _mm_set1_epi32((int)neg_range(format)));
+        if (is_padded24(format)) /* ignore high byte */
+            v = _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+        return v;
+    }
+
+    template<int format>
+    static __m128i pack32(__m128i v)
+    {
+        if (!is_signed(format))
+            v = _mm_xor_si128(v, _mm_set1_epi32((int)neg_range(format)));
+        if (is_padded24(format)) /* zero high byte */
+            v = _mm_and_si128(v, _mm_set1_epi32(0xffffff));
+        if (!is_le(format))
+            v = bswap32(v);
+        return v;
+    }
+
+    /* same operations (and NaN handling) as aud::clamp() and lrintf() */
+    template<int format>
+    static __m128i to_int32(const float * in)
+    {
+        const __m128 range = _mm_set1_ps(neg_range(format));
+        const __m128 low = _mm_set1_ps(-(float)neg_range(format));
+        const __m128 high = _mm_set1_ps(pos_range(format));
+
+        __m128 f = _mm_mul_ps(_mm_loadu_ps(in), range);
+        f = _mm_min_ps(_mm_max_ps(f, low), high);
+        return _mm_cvtps_epi32(f);
+    }
+
+    template<int format>
+    static int from_int(const void * in_, float * out, int samples)
+    {
+        const __m128 scale = _mm_set1_ps(1.0f / neg_range(format));
+        auto in = (const __m128i *)in_;
+        int done = 0;
+
+        if (is_16bit(format))
+        {
+            for (; done + 8 <= samples; done += 8)
+            {
+                __m128i v = unpack16<format>(_mm_loadu_si128(in++));
+                __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+                __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+                _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+                _mm_storeu_ps(out + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+                out += 8;
+            }
+        }
+        else
+        {
+            for (; done + 4 <= samples; done += 4)
+            {
+                __m128i v = unpack32<format>(_mm_loadu_si128(in++));
+                _mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+                out += 4;
+            }
+        }
+
+        return done;
+    }
+
+    template<int format>
+    static int to_int(const float * in, void * out_, int samples)
+    {
+        auto out = (__m128i *)out_;
+        int done = 0;
+
+        if (is_16bit(format))
+        {
+            for (; done + 8 <= samples; done += 8)
+            {
+                __m128i lo = to_int32<format>(in);
+                __m128i hi = to_int32<format>(in + 4);
+                /* values are already in range, so no saturation occurs */
+                __m128i v = _mm_packs_epi32(lo, hi);
+
+                if (!is_signed(format))
+                    v = _mm_xor_si128(v, _mm_set1_epi16((short)0x8000));
+                if (!is_le(format))
+                    v = bswap16(v);
+
+                _mm_storeu_si128(out++, v);
+                in += 8;
+            }
+        }
+        else
+        {
+            for (; done + 4 <= samples; done += 4)
+            {
+                _mm_storeu_si128(out++, pack32<format>(to_int32<format>(in)));
+                in += 4;
+            }
+        }
+
+        return done;
+    }
+};
+
+#endif // HAVE_SSE2_KERNELS
+
+#ifdef HAVE_AVX2_KERNELS
+
+struct AVX2Kernels
+{
+    AVX2_TARGET static __m256i lanes(__m128i lo, __m128i hi)
+    {
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    }
+
+    AVX2_TARGET static __m256i bswap16(__m256i v)
+    {
+        const __m128i mask =
+            _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+        return _mm256_shuffle_epi8(v, lanes(mask, mask));
+    }
+
+    AVX2_TARGET static __m256i bswap32(__m256i v)
+    {
+        const __m128i mask =
+            _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+        return _mm256_shuffle_epi8(v, lanes(mask, mask));
+    }
+
+    /* moves 4 packed 24-bit samples (12 bytes) into the upper 3 bytes of each
+     * 32-bit word, so that an arithmetic shift will sign-extend them */
+    template<int format>
+    AVX2_TARGET static __m256i unpack24_mask()
+    {
+        const __m128i mask =
+            is_le(format)
+                ? _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9,
+                                10, 11)
+                : _mm_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11,
+                                10, 9);
+        return lanes(mask, mask);
+    }
+
+    /* moves the lower 3 bytes of each 32-bit word into 12 packed bytes */
+    template<int format>
+    AVX2_TARGET static __m256i pack24_mask()
+    {
+        const __m128i mask =
+            is_le(format)
+                ? _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1,
+                                -1, -1)
+                : _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                                -1, -1);
+        return lanes(mask, mask);
+    }
+
+    template<int format>
+    AVX2_TARGET static __m256i unpack16(__m256i v)
+    {
+        if (!is_le(format))
+            v = bswap16(v);
+        if (!is_signed(format))
+            v = _mm256_xor_si256(v, _mm256_set1_epi16((short)0x8000));
+        return v;
+    }
+
+    template<int format>
+    AVX2_TARGET static __m256i unpack32(__m256i v)
+    {
+        if (is_packed24(format))
+        {
+            v = _mm256_shuffle_epi8(v, unpack24_mask<format>());
+            if (!is_signed(format))
+                v = _mm256_xor_si256(v, _mm256_set1_epi32(INT32_MIN));
+            return _mm256_srai_epi32(v, 8);
+        }
+
+        if (!is_le(format))
+            v = bswap32(v);
+        if (!is_signed(format))
+            v = _mm256_xor_si256(v, _mm256_set1_epi32((int)neg_range(format)));
+        if (is_padded24(format)) /* ignore high byte */
+            v = _mm256_srai_epi32(_mm256_slli_epi32(v, 8), 8);
+        return v;
+    }
+
+    template<int format>
+    AVX2_TARGET static __m256i pack32(__m256i v)
+    {
+        if (!is_signed(format))
+            v = _mm256_xor_si256(v, _mm256_set1_epi32((int)neg_range(format)));
+
+        if (is_packed24(format))
+            return _mm256_shuffle_epi8(v, pack24_mask<format>());
+
+        if (is_padded24(format)) /* zero high byte */
+            v = _mm256_and_si256(v, _mm256_set1_epi32(0xffffff));
+        if (!is_le(format))
+            v = bswap32(v);
+        return v;
+    }
+
+    /* same operations (and NaN handling) as aud::clamp() and lrintf() */
+    template<int format>
+    AVX2_TARGET static __m256i to_int32(const float * in)
+    {
+        const __m256 range = _mm256_set1_ps(neg_range(format));
+        const __m256 low = _mm256_set1_ps(-(float)neg_range(format));
+        const __m256 high = _mm256_set1_ps(pos_range(format));
+
+        __m256 f = _mm256_mul_ps(_mm256_loadu_ps(in), range);
+        f = _mm256_min_ps(_mm256_max_ps(f, low), high);
+        return _mm256_cvtps_epi32(f);
+    }
+
+    template<int format>
+    AVX2_TARGET static int from_int(const void * in_, float * out, int samples)
+    {
+        const __m256 scale = _mm256_set1_ps(1.0f / neg_range(format));
+        auto in = (const char *)in_;
+        int done = 0;
+
+        if (is_16bit(format))
+        {
+            for (; done + 16 <= samples; done += 16)
+            {
+                __m256i v = _mm256_loadu_si256((const __m256i *)in);
+                v = unpack16<format>(v);
+
+                __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+                __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+
+                _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+                _mm256_storeu_ps(out + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+                in += 32;
+                out += 16;
+            }
+        }
+        else if (is_packed24(format))
+        {
+            /* each half loads 16 bytes but uses only 12 of them, so keep
+             * 2 samples in reserve to avoid reading past the buffer */
+            for (; done + 10 <= samples; done += 8)
+            {
+                __m256i v = lanes(_mm_loadu_si128((const __m128i *)in),
+                                  _mm_loadu_si128((const __m128i *)(in + 12)));
+                v = unpack32<format>(v);
+
+                _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+                in += 24;
+                out += 8;
+            }
+        }
+        else
+        {
+            for (; done + 8 <= samples; done += 8)
+            {
+                __m256i v = _mm256_loadu_si256((const __m256i *)in);
+                v = unpack32<format>(v);
+
+                _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+                in += 32;
+                out += 8;
+            }
+        }
+
+        return done;
+    }
+
+    template<int format>
+    AVX2_TARGET static int to_int(const float * in, void * out_, int samples)
+    {
+        auto out = (char *)out_;
+        int done = 0;
+
+        if (is_16bit(format))
+        {
+            for (; done + 16 <= samples; done += 16)
+            {
+                __m256i lo = to_int32<format>(in);
+                __m256i hi = to_int32<format>(in + 8);
+                /* values are already in range, so no saturation occurs;
+                 * packing works per 128-bit lane, so restore the order */
+                __m256i v = _mm256_packs_epi32(lo, hi);
+                v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+
+                if (!is_signed(format))
+                    v = _mm256_xor_si256(v, _mm256_set1_epi16((short)0x8000));
+                if (!is_le(format))
+                    v = bswap16(v);
+
+                _mm256_storeu_si256((__m256i *)out, v);
+                in += 16;
+                out += 32;
+            }
+        }
+        else if (is_packed24(format))
+        {
+            /* each half stores 16 bytes, of which the last 4 are overwritten
+             * by the next store, so keep 2 samples in reserve */
+            for (; done + 10 <= samples; done += 8)
+            {
+                __m256i v = pack32<format>(to_int32<format>(in));
+
+                _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(v));
+                _mm_storeu_si128((__m128i *)(out + 12),
+                                 _mm256_extracti128_si256(v, 1));
+                in += 8;
+                out += 24;
+            }
+        }
+        else
+        {
+            for (; done + 8 <= samples; done += 8)
+            {
+                __m256i v = pack32<format>(to_int32<format>(in));
+
+                _mm256_storeu_si256((__m256i *)out, v);
+                in += 8;
+                out += 32;
+            }
+        }
+
+        return done;
+    }
+};
+
+#endif // HAVE_AVX2_KERNELS
+
+#ifdef HAVE_NEON_KERNELS
+
+struct NEONKernels
+{
+    template<int format>
+    static int16x8_t unpack16(int16x8_t v)
+    {
+        if (!is_le(format))
+            v = vreinterpretq_s16_u8(vrev16q_u8(vreinterpretq_u8_s16(v)));
+        if (!is_signed(format))
+            v = veorq_s16(v, vdupq_n_s16(INT16_MIN));
+        return v;
+    }
+
+    template<int format>
+    static int32x4_t unpack32(int32x4_t v)
+    {
+        if (!is_le(format))
+            v = vreinterpretq_s32_u8(vrev32q_u8(vreinterpretq_u8_s32(v)));
+        if (!is_signed(format))
+            v = veorq_s32(v, vdupq_n_s32((int)neg_range(format)));
+        if (is_padded24(format)) /* ignore high byte */
+            v = vshrq_n_s32(vshlq_n_s32(v, 8), 8);
+        return v;
+    }
+
+    template<int format>
+    static int32x4_t pack32(int32x4_t v)
+    {
+        if (!is_signed(format))
+            v = veorq_s32(v, vdupq_n_s32((int)neg_range(format)));
+        if (is_padded24(format)) /* zero high byte */
+            v = vandq_s32(v, vdupq_n_s32(0xffffff));
+        if (!is_le(format))
+            v = vreinterpretq_s32_u8(vrev32q_u8(vreinterpretq_u8_s32(v)));
+        return v;
+    }
+
+    /* same operations (and NaN handling) as aud::clamp() and lrintf() */
+    template<int format>
+    static int32x4_t to_int32(const float * in)
+    {
+        const float32x4_t low = vdupq_n_f32(-(float)neg_range(format));
+        const float32x4_t high = vdupq_n_f32(pos_range(format));
+
+        float32x4_t f = vmulq_n_f32(vld1q_f32(in), neg_range(format));
+        f = vbslq_f32(vcgtq_f32(f, low), f, low);
+        f = vbslq_f32(vcltq_f32(f, high), f, high);
+        return vcvtnq_s32_f32(f);
+    }
+
+    static void store_scaled(float * out, int32x4_t v, float scale)
+    {
+        vst1q_f32(out, vmulq_n_f32(vcvtq_f32_s32(v), scale));
+    }
+
+    template<int format>
+    static int from_int(const void * in_, float * out, int samples)
+    {
+        const float scale = 1.0f / neg_range(format);
+        auto in = (const uint8_t *)in_;
+        int done = 0;
+
+        if (is_16bit(format))
+        {
+            for (; done + 8 <= samples; done += 8)
+            {
+                int16x8_t v = unpack16<format>(vld1q_s16((const int16_t *)in));
+
+                store_scaled(out, vmovl_s16(vget_low_s16(v)), scale);
+                store_scaled(out + 4, vmovl_s16(vget_high_s16(v)), scale);
+                in += 16;
+                out += 8;
+            }
+        }
+        else if (is_packed24(format))
+        {
+            for (; done + 16 <= samples; done += 16)
+            {
+                uint8x16x3_t b = vld3q_u8(in);
+                uint8x16_t lo = is_le(format) ? b.val[0] : b.val[2];
+                uint8x16_t hi = is_le(format) ? b.val[2] : b.val[0];
+
+                if (!is_signed(format))
+                    hi = veorq_u8(hi, vdupq_n_u8(0x80));
+
+                /* build words of bytes [0, lo, mid, hi], then sign-extend */
+                uint8x16x2_t lo16 = vzipq_u8(vdupq_n_u8(0), lo);
+                uint8x16x2_t hi16 = vzipq_u8(b.val[1], hi);
+
+                for (int i = 0; i < 2; i++)
+                {
+                    uint16x8x2_t w = vzipq_u16(vreinterpretq_u16_u8(lo16.val[i]),
+                                               vreinterpretq_u16_u8(hi16.val[i]));
+
+                    for (int j = 0; j < 2; j++)
+                    {
+                        int32x4_t v = vreinterpretq_s32_u16(w.val[j]);
+                        store_scaled(out, vshrq_n_s32(v, 8), scale);
+                        out += 4;
+                    }
+                }
+
+                in += 48;
+            }
+        }
+        else
+        {
+            for (; done + 4 <= samples; done += 4)
+            {
+                int32x4_t v = unpack32<format>(vld1q_s32((const int32_t *)in));
+
+                store_scaled(out, v, scale);
+                in += 16;
+                out += 4;
+            }
+        }
+
+        return done;
+    }
+
+    template<int format>
+    static int to_int(const float * in, void * out_, int samples)
+    {
+        auto out = (uint8_t *)out_;
+        int done = 0;
+
+        if (is_16bit(format))
+        {
+            for (; done + 8 <= samples; done += 8)
+            {
+                /* values are already in range, so no saturation occurs */
+                int16x8_t v = vcombine_s16(vqmovn_s32(to_int32<format>(in)),
+                                           vqmovn_s32(to_int32<format>(in + 4)));
+
+                if (!is_signed(format))
+                    v = veorq_s16(v, vdupq_n_s16(INT16_MIN));
+                if (!is_le(format))
+                    v = vreinterpretq_s16_u8(vrev16q_u8(vreinterpretq_u8_s16(v)));
+
+                vst1q_s16((int16_t *)out, v);
+                in += 8;
+                out += 16;
+            }
+        }
+        else if (is_packed24(format))
+        {
+            for (; done + 16 <= samples; done += 16)
+            {
+                uint16x8_t w[4];
+
+                for (int i = 0; i < 4; i++)
+                {
+                    int32x4_t v = to_int32<format>(in + 4 * i);
+                    if (!is_signed(format))
+                        v = veorq_s32(v, vdupq_n_s32(0x800000));
+                    w[i] = vreinterpretq_u16_s32(v);
+                }
+
+                /* split words into low and high halves, then into bytes */
+                uint16x8x2_t h01 = vuzpq_u16(w[0], w[1]);
+                uint16x8x2_t h23 = vuzpq_u16(w[2], w[3]);
+                uint8x16x2_t lo_mid = vuzpq_u8(vreinterpretq_u8_u16(h01.val[0]),
+                                               vreinterpretq_u8_u16(h23.val[0]));
+                uint8x16x2_t hi_top = vuzpq_u8(vreinterpretq_u8_u16(h01.val[1]),
+                                               vreinterpretq_u8_u16(h23.val[1]));
+
+                uint8x16x3_t b;
+                b.val[0] = is_le(format) ? lo_mid.val[0] : hi_top.val[0];
+                b.val[1] = lo_mid.val[1];
+                b.val[2] = is_le(format) ? hi_top.val[0] : lo_mid.val[0];
+
+                vst3q_u8(out, b);
+                in += 16;
+                out += 48;
+            }
+        }
+        else
+        {
+            for (; done + 4 <= samples; done += 4)
+            {
+                int32x4_t v = pack32<format>(to_int32<format>(in));
+
+                vst1q_s32((int32_t *)out, v);
+                in += 4;
+                out += 16;
+            }
+        }
+
+        return done;
+    }
+};
+
+#endif // HAVE_NEON_KERNELS
+
+struct KernelTable
+{
+    AudioFromIntKernel from_int[FMT_U24_3BE + 1];
+    AudioToIntKernel to_int[FMT_U24_3BE + 1];
+};
+
+template<class Tier, int format>
+static void add_kernels(KernelTable & table)
+{
+    table.from_int[format] = Tier::template from_int<format>;
+    table.to_int[format] = Tier::template to_int<format>;
+}
+
+template<class Tier>
+static void add_word_kernels(KernelTable & table)
+{
+    add_kernels<Tier, FMT_S16_LE>(table);
+    add_kernels<Tier, FMT_S16_BE>(table);
+    add_kernels<Tier, FMT_U16_LE>(table);
+    add_kernels<Tier, FMT_U16_BE>(table);
+    add_kernels<Tier, FMT_S24_LE>(table);
+    add_kernels<Tier, FMT_S24_BE>(table);
+    add_kernels<Tier, FMT_U24_LE>(table);
+    add_kernels<Tier, FMT_U24_BE>(table);
+    add_kernels<Tier, FMT_S32_LE>(table);
+    add_kernels<Tier, FMT_S32_BE>(table);
+    add_kernels<Tier, FMT_U32_LE>(table);
+    add_kernels<Tier, FMT_U32_BE>(table);
+}
+
+template<class Tier>
+static void add_packed_kernels(KernelTable & table)
+{
+    add_kernels<Tier, FMT_S24_3LE>(table);
+    add_kernels<Tier, FMT_S24_3BE>(table);
+    add_kernels<Tier, FMT_U24_3LE>(table);
+    add_kernels<Tier, FMT_U24_3BE>(table);
+}
+
+static KernelTable make_table(SimdLevel level)
+{
+    KernelTable table = KernelTable();
+
+    switch (level)
+    {
+#ifdef HAVE_SSE2_KERNELS
+    case SimdLevel::SSE2:
+        /* packed 24-bit needs a byte shuffle (SSSE3), so it is left to the
+         * generic loops at this level */
+        add_word_kernels<SSE2Kernels>(table);
+        break;
+#endif
+#ifdef HAVE_AVX2_KERNELS
+    case SimdLevel::AVX2:
+        add_word_kernels<AVX2Kernels>(table);
+        add_packed_kernels<AVX2Kernels>(table);
+        break;
+#endif
+#ifdef HAVE_NEON_KERNELS
+    case SimdLevel::NEON:
+        add_word_kernels<NEONKernels>(table);
+        add_packed_kernels<NEONKernels>(table);
+        break;
+#endif
+    default:
+        break;
+    }
+
+    return table;
+}
+
+static bool level_supported(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::None:
+        return true;
+#ifdef HAVE_SSE2_KERNELS
+    case SimdLevel::SSE2:
+        return true;
+#endif
+#ifdef HAVE_AVX2_KERNELS
+    case SimdLevel::AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef HAVE_NEON_KERNELS
+    case SimdLevel::NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+static SimdLevel detect_level()
+{
+    for (SimdLevel level : {SimdLevel::NEON, SimdLevel::AVX2, SimdLevel::SSE2})
+    {
+        if (level_supported(level))
+            return level;
+    }
+
+    return SimdLevel::None;
+}
+
+/* chosen once at startup */
+static const SimdLevel s_detected = detect_level();
+static SimdLevel s_level = s_detected;
+static KernelTable s_table = make_table(s_detected);
+
+SimdLevel audio_simd_detected() { return s_detected; }
+SimdLevel audio_simd_level() { return s_level; }
+
+bool audio_simd_set_level(SimdLevel level)
+{
+    if (!level_supported(level))
+        return false;
+
+    s_level = level;
+    s_table = make_table(level);
+    return true;
+}
+
+AudioFromIntKernel audio_simd_from_int(int format)
+{
+    return (format >= 0 && format <= FMT_U24_3BE) ? s_table.from_int[format]
+                                                  : nullptr;
+}
+
+AudioToIntKernel audio_simd_to_int(int format)
+{
+    return (format >= 0 && format <= FMT_U24_3BE) ? s_table.to_int[format]
+                                                  : nullptr;
+}
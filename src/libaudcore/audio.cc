@@ -20,19 +20,14 @@
 #include <fenv.h>
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
 
 #define WANT_AUD_BSWAP
-#include "audio.h"
+#include "audio-internal.h"
 #include "objects.h"
 
 #define SW_VOLUME_RANGE 40 /* decibels */
 
-struct packed24_t
-{
-    uint8_t b[3];
-};
-static_assert(sizeof(packed24_t) == 3, "invalid packed 24-bit type");
-
 template<class Word>
 void interlace_loop(const void * const * in, int channels, void * out,
                     int frames)
@@ -149,41 +144,6 @@ EXPORT void audio_deinterlace(const void * in, int format, int channels,
     }
 }
 
-static constexpr bool is_le(int format)
-{
-    return format == FMT_S16_LE || format == FMT_U16_LE ||
-           format == FMT_S24_LE || format == FMT_U24_LE ||
-           format == FMT_S32_LE || format == FMT_U32_LE ||
-           format == FMT_S24_3LE || format == FMT_U24_3LE;
-}
-
-static constexpr bool is_signed(int format)
-{
-    return (format == FMT_S8 || format == FMT_S16_LE || format == FMT_S16_BE ||
-            format == FMT_S24_LE || format == FMT_S24_BE ||
-            format == FMT_S32_LE || format == FMT_S32_BE ||
-            format == FMT_S24_3LE || format == FMT_S24_3BE);
-}
-
-static constexpr unsigned neg_range(int format)
-{
-    return (format >= FMT_S32_LE && format < FMT_S24_3LE)
-               ? 0x80000000
-               : (format >= FMT_S24_LE)
-                     ? 0x800000
-                     : (format >= FMT_S16_LE) ? 0x8000 : 0x80;
-}
-
-// 0x7fffff80 = largest representable floating-point value before 2^31
-static constexpr unsigned pos_range(int format)
-{
-    return (format >= FMT_S32_LE && format < FMT_S24_3LE)
-               ? 0x7fffff80
-               : (format >= FMT_S24_LE)
-                     ? 0x7fffff
-                     : (format >= FMT_S16_LE) ? 0x7fff : 0x7f;
-}
-
 template<class T>
 T do_swap(T value)
 {
@@ -295,6 +255,16 @@ void to_int_loop(const float * in, void * out_, int samples)
 EXPORT void audio_from_int(const void * in, int format, float * out,
                            int samples)
 {
+    AudioFromIntKernel kernel = audio_simd_from_int(format);
+
+    if (kernel)
+    {
+        int done = kernel(in, out, samples);
+        in = (const char *)in + done * FMT_SIZEOF(format);
+        out += done;
+        samples -= done;
+    }
+
     switch (format)
     {
     case FMT_S8:
@@ -363,6 +333,16 @@ EXPORT void audio_to_int(const float * in, void * out, int format, int samples)
     int save = fegetround();
     fesetround(FE_TONEAREST);
 
+    AudioToIntKernel kernel = audio_simd_to_int(format);
+
+    if (kernel)
+    {
+        int done = kernel(in, out, samples);
+        in += done;
+        out = (char *)out + done * FMT_SIZEOF(format);
+        samples -= done;
+    }
+
     switch (format)
     {
     case FMT_S8:
@@ -444,17 +424,9 @@ EXPORT void audio_amplify(float * data, int channels, int frames,
     }
 }
 
-EXPORT void audio_amplify(float * data, int channels, int frames,
-                          StereoVolume volume)
+void audio_volume_factors(StereoVolume volume, int channels, float * factors)
 {
-    if (channels < 1 || channels > AUD_MAX_CHANNELS)
-        return;
-
-    if (volume.left == 100 && volume.right == 100)
-        return;
-
     float lfactor = 0, rfactor = 0;
-    float factors[AUD_MAX_CHANNELS];
 
     if (volume.left > 0)
         lfactor =
@@ -473,7 +445,19 @@ EXPORT void audio_amplify(float * data, int channels, int frames,
         for (int c = 0; c < channels; c++)
             factors[c] = aud::max(lfactor, rfactor);
     }
+}
 
+EXPORT void audio_amplify(float * data, int channels, int frames,
+                          StereoVolume volume)
+{
+    if (channels < 1 || channels > AUD_MAX_CHANNELS)
+        return;
+
+    if (volume.left == 100 && volume.right == 100)
+        return;
+
+    float factors[AUD_MAX_CHANNELS];
+    audio_volume_factors(volume, channels, factors);
     audio_amplify(data, channels, frames, factors);
 }
 
@@ -504,3 +488,66 @@ EXPORT void audio_soft_clip(float * data, int samples)
         *data++ = (x > 0) ? y : -y;
     }
 }
+
+#define GAIN_LANES 4
+
+typedef float GainVec __attribute__((vector_size(sizeof(float) * GAIN_LANES)));
+typedef int32_t GainMask
+    __attribute__((vector_size(sizeof(int32_t) * GAIN_LANES)));
+
+static GainVec gain_min(GainVec a, GainVec b)
+{
+    GainMask less = (a < b);
+    return (GainVec)(((GainMask)a & less) | ((GainMask)b & ~less));
+}
+
+/* The soft clipping curve is concave, so each of its segments lies on or above
+ * the others; the curve is thus the lowest of the lines through them. */
+static GainVec soft_clip_vec(GainVec x)
+{
+    const GainMask sign = GainMask{} + (int32_t)0x80000000;
+    GainVec a = (GainVec)((GainMask)x & ~sign);
+
+    GainVec y = gain_min(a, a * 0.8f + 0.08f);
+    y = gain_min(y, a * 0.7f + 0.15f);
+    y = gain_min(y, a * 0.4f + 0.45f);
+    y = gain_min(y, a * 0.15f + 0.775f);
+    y = gain_min(y, GainVec{} + 1.0f);
+
+    return (GainVec)((GainMask)y | ((GainMask)x & sign));
+}
+
+void audio_apply_gain(float * data, int channels, int frames,
+                      const float * factors, bool soft_clip)
+{
+    /* the factors repeat every <channels> samples, and a block of <channels>
+     * vectors always starts on the first channel */
+    GainVec pattern[AUD_MAX_CHANNELS];
+    for (int i = 0; i < channels * GAIN_LANES; i++)
+        pattern[i / GAIN_LANES][i % GAIN_LANES] = factors[i % channels];
+
+    int block = channels * GAIN_LANES;
+    int samples = channels * frames;
+    int vec_samples = samples - samples % block;
+
+    for (int i = 0; i < vec_samples; i += block)
+    {
+        for (int v = 0; v < channels; v++)
+        {
+            GainVec x;
+            memcpy(&x, data + i + v * GAIN_LANES, sizeof x);
+
+            x *= pattern[v];
+            if (soft_clip)
+                x = soft_clip_vec(x);
+
+            memcpy(data + i + v * GAIN_LANES, &x, sizeof x);
+        }
+    }
+
+    int rest = samples - vec_samples;
+    audio_amplify(data + vec_samples, channels, rest / channels, factors);
+
+    if (soft_clip)
+        audio_soft_clip(data + vec_samples, rest);
+}
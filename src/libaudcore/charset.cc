@@ -22,8 +22,11 @@
 
 #include <errno.h>
 #include <iconv.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 
+#include <mutex>
 #include <new>
 
 #include <glib.h>
@@ -35,10 +38,149 @@
 #include "runtime.h"
 #include "threads.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define HAVE_SSE2_ASCII
+#endif
+
+/* returns true if the string contains only 7-bit ASCII characters and no nul
+ * bytes, in which case it is valid UTF-8 as it stands.  Short strings such as
+ * tag fields are checked a word at a time; on x86-64, longer strings are
+ * checked 16 bytes at a time. */
+static bool is_plain_ascii(const char * str, int len)
+{
+    const char * end = str + len;
+
+#ifdef HAVE_SSE2_ASCII
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; end - str >= 16; str += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)str);
+        if (_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, zero))))
+            return false;
+    }
+#endif
+
+    /* subtracting 1 from a zero byte sets its high bit */
+    for (; end - str >= 8; str += 8)
+    {
+        uint64_t word;
+        memcpy(&word, str, sizeof word);
+
+        if (((word - 0x0101010101010101ull) | word) & 0x8080808080808080ull)
+            return false;
+    }
+
+    for (; str < end; str++)
+    {
+        if (!*str || (*str & 0x80))
+            return false;
+    }
+
+    return true;
+}
+
+/* Opening an iconv converter costs much more than converting a short string,
+ * so each thread keeps its most recently used converters open.  Failures to
+ * open a converter are remembered as well. */
+#define CONV_CACHE_SIZE 4
+#define CONV_CHARSET_MAX 32
+
+struct ConvCache
+{
+    struct
+    {
+        char from[CONV_CHARSET_MAX], to[CONV_CHARSET_MAX];
+        iconv_t conv;
+    } entries[CONV_CACHE_SIZE];
+
+    int used, next;
+};
+
+static pthread_key_t conv_key;
+static std::once_flag conv_once;
+
+static void free_conv_cache(void * data)
+{
+    auto cache = (ConvCache *)data;
+
+    for (int i = 0; i < cache->used; i++)
+    {
+        if (cache->entries[i].conv != (iconv_t)-1)
+            iconv_close(cache->entries[i].conv);
+    }
+
+    delete cache;
+}
+
+static void make_conv_key() { pthread_key_create(&conv_key, free_conv_cache); }
+
+/* returns a converter in its initial state, or (iconv_t)-1 on error;
+ * <owned> is set if the converter was not cached and must be closed */
+static iconv_t get_converter(const char * from_charset, const char * to_charset,
+                             bool & owned)
+{
+    owned = false;
+
+    if (strlen(from_charset) >= CONV_CHARSET_MAX ||
+        strlen(to_charset) >= CONV_CHARSET_MAX)
+    {
+        iconv_t conv = iconv_open(to_charset, from_charset);
+        owned = (conv != (iconv_t)-1);
+        return conv;
+    }
+
+    std::call_once(conv_once, make_conv_key);
+
+    auto cache = (ConvCache *)pthread_getspecific(conv_key);
+
+    if (!cache)
+    {
+        cache = new ConvCache();
+        pthread_setspecific(conv_key, cache);
+    }
+
+    for (int i = 0; i < cache->used; i++)
+    {
+        auto & entry = cache->entries[i];
+
+        if (!strcmp(entry.from, from_charset) && !strcmp(entry.to, to_charset))
+        {
+            /* reset any shift state left by the last conversion */
+            if (entry.conv != (iconv_t)-1)
+                iconv(entry.conv, nullptr, nullptr, nullptr, nullptr);
+
+            return entry.conv;
+        }
+    }
+
+    /* replace the entries in turn once the cache is full */
+    int slot = cache->next;
+    auto & entry = cache->entries[slot];
+
+    if (slot < cache->used)
+    {
+        if (entry.conv != (iconv_t)-1)
+            iconv_close(entry.conv);
+    }
+    else
+        cache->used++;
+
+    cache->next = (slot + 1) % CONV_CACHE_SIZE;
+
+    strcpy(entry.from, from_charset);
+    strcpy(entry.to, to_charset);
+    entry.conv = iconv_open(to_charset, from_charset);
+
+    return entry.conv;
+}
+
 EXPORT StringBuf str_convert(const char * str, int len,
                              const char * from_charset, const char * to_charset)
 {
-    iconv_t conv = iconv_open(to_charset, from_charset);
+    bool owned;
+    iconv_t conv = get_converter(from_charset, to_charset, owned);
     if (conv == (iconv_t)-1)
         return StringBuf();
 
@@ -54,11 +196,13 @@ EXPORT StringBuf str_convert(const char * str, int len,
 
     errno = 0;
     size_t ret = iconv(conv, &in, &inbytesleft, &out, &outbytesleft);
+    int error = errno;
 
-    if (ret == (size_t)-1 && errno == E2BIG)
-        throw std::bad_alloc();
+    if (owned)
+        iconv_close(conv);
 
-    iconv_close(conv);
+    if (ret == (size_t)-1 && error == E2BIG)
+        throw std::bad_alloc();
 
     if (ret == (size_t)-1 || inbytesleft)
         return StringBuf();
@@ -81,6 +225,12 @@ EXPORT StringBuf str_from_locale(const char * str, int len)
 {
     const char * charset;
 
+    if (len < 0)
+        len = strlen(str);
+
+    if (is_plain_ascii(str, len))
+        return str_copy(str, len);
+
     if (g_get_charset(&charset))
     {
         /* locale is UTF-8 */
@@ -171,8 +321,11 @@ static StringBuf convert_to_utf8(const char * str, int len)
 
 EXPORT StringBuf str_to_utf8(const char * str, int len)
 {
+    if (len < 0)
+        len = strlen(str);
+
     /* check whether already UTF-8 */
-    if (g_utf8_validate(str, len, nullptr))
+    if (is_plain_ascii(str, len) || g_utf8_validate(str, len, nullptr))
         return str_copy(str, len);
 
     return convert_to_utf8(str, len);
@@ -181,7 +334,8 @@ EXPORT StringBuf str_to_utf8(const char * str, int len)
 EXPORT StringBuf str_to_utf8(StringBuf && str)
 {
     /* check whether already UTF-8 */
-    if (g_utf8_validate(str, str.len(), nullptr))
+    if (is_plain_ascii(str, str.len()) ||
+        g_utf8_validate(str, str.len(), nullptr))
         return std::move(str);
 
     str = convert_to_utf8(str, str.len());
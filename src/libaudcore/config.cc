@@ -28,6 +28,7 @@
 #include "inifile.h"
 #include "multihash.h"
 #include "runtime.h"
+#include "threads.h"
 #include "vfs.h"
 
 #define DEFAULT_SECTION "audacious"
@@ -37,6 +38,7 @@ static const char * const core_defaults[] = {
     /* general */
     "advance_on_delete", "FALSE",
     "always_resume_paused", "TRUE",
+    "async_read_threads", "4",
     "clear_playlist", "TRUE",
     "open_to_temporary", "TRUE",
     "recurse_folders", "TRUE",
@@ -88,6 +90,7 @@ static const char * const core_defaults[] = {
     /* playback */
     "album_shuffle", "FALSE",
     "no_playlist_advance", "FALSE",
+    "prefetch_seconds", "10",
     "repeat", "FALSE",
     "shuffle", "FALSE",
     "step_size", "5",
@@ -95,6 +98,7 @@ static const char * const core_defaults[] = {
 
     /* playlist */
     "chardet_fallback", "ISO-8859-1",
+    "columnar_tuples", "FALSE",
 #ifdef _WIN32
     "convert_backslash", "TRUE",
 #else
@@ -107,6 +111,7 @@ static const char * const core_defaults[] = {
     "show_hours", "TRUE",
     "metadata_fallbacks", "TRUE",
     "metadata_on_play", "FALSE",
+    "scan_threads", "0",
     "show_numbers_in_pl", "FALSE",
     "slow_probe", "FALSE",
     /* clang-format on */
@@ -158,6 +163,9 @@ typedef MultiHash_T<ConfigNode, ConfigOp> ConfigTable;
 static ConfigTable s_defaults, s_config;
 static volatile bool s_modified;
 
+static aud::mutex s_handles_mutex;
+static ConfigHandleBase * s_handles; /* resolved handles */
+
 ConfigNode * ConfigOp::add(const ConfigOp *)
 {
     switch (type)
@@ -280,6 +288,8 @@ void config_load()
         aud_set_int("volume_delta", volume_delta);
         aud_set_str("statusicon", "volume_delta", "");
     }
+
+    config_refresh_handles(nullptr);
 }
 
 void config_save()
@@ -344,18 +354,48 @@ EXPORT void aud_config_set_defaults(const char * section,
 
     while (1)
     {
+        /* the list is terminated by a single nullptr */
         const char * name = *entries++;
+        if (!name)
+            break;
+
         const char * value = *entries++;
-        if (!name || !value)
+        if (!value)
             break;
 
         ConfigOp op = {OP_SET_NO_FLAG, section, name, String(value)};
         config_op_run(op, s_defaults);
     }
+
+    if (!strcmp(section, DEFAULT_SECTION))
+        config_refresh_handles(nullptr);
+}
+
+void config_refresh_handles(const char * name)
+{
+    auto mh = s_handles_mutex.take();
+
+    for (auto handle = s_handles; handle; handle = handle->m_next)
+    {
+        if (!name || !strcmp(handle->m_name, name))
+            handle->refresh();
+    }
 }
 
 void config_cleanup()
 {
+    auto mh = s_handles_mutex.take();
+
+    while (s_handles)
+    {
+        auto handle = s_handles;
+        s_handles = handle->m_next;
+        handle->m_next = nullptr;
+        handle->m_resolved.store(false, std::memory_order_relaxed);
+    }
+
+    mh.unlock();
+
     s_config.clear();
     s_defaults.clear();
 }
@@ -373,7 +413,10 @@ EXPORT void aud_set_str(const char * section, const char * name,
     bool changed = config_op_run(op, s_config);
 
     if (changed && !section)
+    {
+        config_refresh_handles(name);
         event_queue(str_concat({"set ", name}), nullptr);
+    }
 }
 
 EXPORT String aud_get_str(const char * section, const char * name)
@@ -425,3 +468,53 @@ EXPORT double aud_get_double(const char * section, const char * name)
 {
     return str_to_double(aud_get_str(section, name));
 }
+
+EXPORT void ConfigHandleBase::resolve()
+{
+    auto mh = s_handles_mutex.take();
+
+    if (m_resolved.load(std::memory_order_relaxed))
+        return;
+
+    refresh();
+
+    m_next = s_handles;
+    s_handles = this;
+    m_resolved.store(true, std::memory_order_release);
+}
+
+template<>
+EXPORT void ConfigHandle<bool>::refresh()
+{
+    m_value.store(aud_get_bool(name()), std::memory_order_relaxed);
+}
+
+template<>
+EXPORT void ConfigHandle<bool>::set(bool value)
+{
+    aud_set_bool(name(), value);
+}
+
+template<>
+EXPORT void ConfigHandle<int>::refresh()
+{
+    m_value.store(aud_get_int(name()), std::memory_order_relaxed);
+}
+
+template<>
+EXPORT void ConfigHandle<int>::set(int value)
+{
+    aud_set_int(name(), value);
+}
+
+template<>
+EXPORT void ConfigHandle<double>::refresh()
+{
+    m_value.store(aud_get_double(name()), std::memory_order_relaxed);
+}
+
+template<>
+EXPORT void ConfigHandle<double>::set(double value)
+{
+    aud_set_double(name(), value);
+}
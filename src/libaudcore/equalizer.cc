@@ -30,6 +30,8 @@
 #include <math.h>
 #include <string.h>
 
+#include <atomic>
+
 #include "audio.h"
 #include "audstrings.h"
 #include "hook.h"
@@ -47,33 +49,83 @@
 static const float CF[AUD_EQ_NBANDS] = {31.25f, 62.5f, 125,  250,  500,
                                         1000,   2000,  4000, 8000, 16000};
 
-static aud::mutex mutex;
-static bool active;
+/* The filter runs on all channels of a frame at once, one channel per SIMD
+ * lane.  Channels are split into groups of EQ_LANES, and the filter state is
+ * stored per group so that it can be loaded and stored as whole vectors. */
+#define EQ_LANES 4
+#define EQ_GROUPS ((AUD_MAX_CHANNELS + EQ_LANES - 1) / EQ_LANES)
+
+typedef float EqVec __attribute__((vector_size(sizeof(float) * EQ_LANES)));
+
+/* Settings changed from the main thread (via hooks) */
+struct EqSettings
+{
+    bool active;
+    float gains[AUD_EQ_NBANDS]; /* Gain factor for each band */
+};
+
+/* The settings are passed to the audio thread through a triple buffer, so
+ * that neither side ever has to wait for the other.  The writer fills in the
+ * back slot and swaps it with the middle one; the reader swaps the middle
+ * slot with the front one whenever it has been marked as fresh. */
+class EqSettingsBuffer
+{
+public:
+    EqSettings & back() { return m_slots[m_back]; }
+
+    void publish()
+    {
+        m_back = m_middle.exchange(m_back | FRESH) & INDEX;
+    }
+
+    const EqSettings & front()
+    {
+        if (m_middle.load(std::memory_order_relaxed) & FRESH)
+            m_front = m_middle.exchange(m_front) & INDEX;
+
+        return m_slots[m_front];
+    }
+
+private:
+    static constexpr int INDEX = 3, FRESH = 4;
+
+    EqSettings m_slots[3] = {};
+    int m_back = 0;
+    std::atomic<int> m_middle{1};
+    int m_front = 2;
+};
+
+static aud::mutex writer_mutex; /* serializes writers only */
+static EqSettingsBuffer settings;
+
+/* config handles may be read from any thread */
+static ConfigHandle<bool> cfg_active("equalizer_active");
+static ConfigHandle<double> cfg_preamp("equalizer_preamp");
+
+/* The remaining state is only accessed from eq_set_format() and eq_filter(),
+ * which are serialized by the locking in output.cc. */
 static int channels, rate;
-static float a[AUD_EQ_NBANDS][2]; /* A weights */
-static float b[AUD_EQ_NBANDS][2]; /* B weights */
-static float wqv[AUD_MAX_CHANNELS][AUD_EQ_NBANDS]
-                [2]; /* Circular buffer for W data */
-static float gv[AUD_MAX_CHANNELS]
-               [AUD_EQ_NBANDS]; /* Gain factor for each channel and band */
-static int K;                   /* Number of used EQ bands */
+static int K; /* Number of used EQ bands */
+static EqVec a[AUD_EQ_NBANDS][2]; /* A weights */
+static EqVec b[AUD_EQ_NBANDS][2]; /* B weights */
+static EqVec wqv[EQ_GROUPS][AUD_EQ_NBANDS][2]; /* Circular buffer for W data */
+
+static EqVec splat(float x) { return EqVec{} + x; }
 
 /* 2nd order band-pass filter design */
-static void bp2(float * a, float * b, float fc)
+static void bp2(EqVec * a, EqVec * b, float fc)
 {
     float th = 2 * (float)M_PI * fc;
     float C = (1 - tanf(th * Q / 2)) / (1 + tanf(th * Q / 2));
 
-    a[0] = (1 + C) * cosf(th);
-    a[1] = -C;
-    b[0] = (1 - C) / 2;
-    b[1] = -1.005f;
+    a[0] = splat((1 + C) * cosf(th));
+    a[1] = splat(-C);
+    b[0] = splat((1 - C) / 2);
+    b[1] = splat(-1.005f);
 }
 
 void eq_set_format(int new_channels, int new_rate)
 {
-    auto mh = mutex.take();
-
     channels = new_channels;
     rate = new_rate;
 
@@ -89,70 +141,85 @@ void eq_set_format(int new_channels, int new_rate)
         bp2(a[k], b[k], CF[k] / (float)rate);
 
     /* Reset state */
-    memset(wqv[0][0], 0, sizeof wqv);
+    memset(wqv, 0, sizeof wqv);
 }
 
-static void eq_set_bands_real(aud::mutex::holder &, double preamp,
-                              double * values)
+static void eq_set_bands_real(aud::mutex::holder &, bool active,
+                              double preamp, double * values)
 {
-    float adj[AUD_EQ_NBANDS];
+    EqSettings & next = settings.back();
+
+    next.active = active;
 
     for (int i = 0; i < AUD_EQ_NBANDS; i++)
-        adj[i] = preamp + values[i];
+        next.gains[i] = powf(10, (preamp + values[i]) / 20) - 1;
 
-    for (int c = 0; c < AUD_MAX_CHANNELS; c++)
-    {
-        for (int i = 0; i < AUD_EQ_NBANDS; i++)
-            gv[c][i] = powf(10, adj[i] / 20) - 1;
-    }
+    settings.publish();
 }
 
-void eq_filter(float * data, int samples)
+/* Filters one group of channels (lanes) through all the bands */
+static void eq_filter_group(float * data, int samples, int group,
+                            const EqVec * g)
 {
-    auto mh = mutex.take();
-
-    if (!active)
-        return;
+    int first = group * EQ_LANES;
+    int lanes = aud::min(EQ_LANES, channels - first);
+    int bytes = sizeof(float) * lanes;
+    float * end = data + samples;
 
-    for (int channel = 0; channel < channels; channel++)
+    for (float * f = data + first; f < end; f += channels)
     {
-        float * g = gv[channel]; /* Gain factor */
-        float * end = data + samples;
+        EqVec yt{}; /* Current input samples */
 
-        for (float * f = data + channel; f < end; f += channels)
-        {
-            float yt = *f; /* Current input sample */
-
-            for (int k = 0; k < K; k++)
-            {
-                /* Pointer to circular buffer wq */
-                float * wq = wqv[channel][k];
-                /* Calculate output from AR part of current filter */
-                float w = yt * b[k][0] + wq[0] * a[k][0] + wq[1] * a[k][1];
+        if (lanes == EQ_LANES)
+            memcpy(&yt, f, sizeof yt);
+        else
+            memcpy(&yt, f, bytes);
 
-                /* Calculate output from MA part of current filter */
-                yt += (w + wq[1] * b[k][1]) * g[k];
+        for (int k = 0; k < K; k++)
+        {
+            /* Pointer to circular buffer wq */
+            EqVec * wq = wqv[group][k];
+            /* Calculate output from AR part of current filter */
+            EqVec w = yt * b[k][0] + wq[0] * a[k][0] + wq[1] * a[k][1];
 
-                /* Update circular buffer */
-                wq[1] = wq[0];
-                wq[0] = w;
-            }
+            /* Calculate output from MA part of current filter */
+            yt += (w + wq[1] * b[k][1]) * g[k];
 
-            /* Calculate output */
-            *f = yt;
+            /* Update circular buffer */
+            wq[1] = wq[0];
+            wq[0] = w;
         }
+
+        /* Calculate output */
+        if (lanes == EQ_LANES)
+            memcpy(f, &yt, sizeof yt);
+        else
+            memcpy(f, &yt, bytes);
     }
 }
 
-static void eq_update(void *, void *)
+void eq_filter(float * data, int samples)
 {
-    auto mh = mutex.take();
+    const EqSettings & current = settings.front();
+
+    if (!current.active)
+        return;
+
+    EqVec g[AUD_EQ_NBANDS]; /* Gain factor */
+    for (int k = 0; k < K; k++)
+        g[k] = splat(current.gains[k]);
 
-    active = aud_get_bool("equalizer_active");
+    for (int group = 0; group * EQ_LANES < channels; group++)
+        eq_filter_group(data, samples, group, g);
+}
+
+static void eq_update(void *, void *)
+{
+    auto mh = writer_mutex.take();
 
     double values[AUD_EQ_NBANDS];
     aud_eq_get_bands(values);
-    eq_set_bands_real(mh, aud_get_double("equalizer_preamp"), values);
+    eq_set_bands_real(mh, cfg_active.get(), cfg_preamp.get(), values);
 }
 
 void eq_init()
@@ -228,5 +295,5 @@ EXPORT void aud_eq_update_preset(EqualizerPreset & preset)
     for (int i = 0; i < AUD_EQ_NBANDS; i++)
         preset.bands[i] = bands[i];
 
-    preset.preamp = aud_get_double("equalizer_preamp");
+    preset.preamp = cfg_preamp.get();
 }
@@ -1,6 +1,6 @@
 /*
- * fft.c
- * Copyright 2011 John Lindgren
+ * fft.cc
+ * Copyright 2011-2026 John Lindgren and Audacious developers
  *
  * Redistribution and use in source and binary forms, with or without
  * modification, are permitted provided that the following conditions are met:
@@ -17,30 +17,47 @@
  * the use of this software.
  */
 
+#include "fft.h"
 #include "internal.h"
 
-#include <complex>
+#include <atomic>
 #include <math.h>
+#include <string.h>
 
-#define TWO_PI 6.2831853f
+#include "threads.h"
 
-#define N 512  /* size of the DFT */
-#define LOGN 9 /* log N (base 2) */
+#define PI 3.14159265358979323846
 
-typedef std::complex<float> Complex;
+#define LOG_MIN 8  /* log FFTPlan::min_size (base 2) */
+#define LOG_MAX 14 /* log FFTPlan::max_size (base 2) */
 
-static float hamming[N];     /* hamming window, scaled to sum to 1 */
-static int reversed[N];      /* bit-reversal table */
-static Complex roots[N / 2]; /* N-th roots of unity */
-static char generated = 0;   /* set if tables have been generated */
+static_assert(FFTPlan::min_size == 1 << LOG_MIN, "LOG_MIN mismatch");
+static_assert(FFTPlan::max_size == 1 << LOG_MAX, "LOG_MAX mismatch");
 
-/* Reverse the order of the lowest LOGN bits in an integer. */
+/* butterflies are computed four at a time where the span allows */
+#define FFT_LANES 4
 
-static int bit_reverse(int x)
+typedef float FFTVec __attribute__((vector_size(sizeof(float) * FFT_LANES)));
+
+static FFTVec load(const float * p)
+{
+    FFTVec v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static void store(float * p, FFTVec v) { memcpy(p, &v, sizeof v); }
+
+static std::atomic<FFTPlan *> plans[LOG_MAX - LOG_MIN + 1][FFTPlan::n_windows];
+static aud::mutex plans_mutex;
+
+/* Reverse the order of the lowest <bits> bits in an integer. */
+
+static int bit_reverse(int x, int bits)
 {
     int y = 0;
 
-    for (int n = LOGN; n--;)
+    for (int n = bits; n--;)
     {
         y = (y << 1) | (x & 1);
         x >>= 1;
@@ -49,75 +66,224 @@ static int bit_reverse(int x)
     return y;
 }
 
-/* Generate lookup tables. */
+static double window_value(FFTPlan::Window window, int n, int size)
+{
+    double x = n * (2 * PI / size);
+
+    switch (window)
+    {
+    case FFTPlan::Default:
+        return 1 - 0.85 * cos(x);
+    case FFTPlan::Hann:
+        return 0.5 - 0.5 * cos(x);
+    case FFTPlan::Hamming:
+        return 0.54 - 0.46 * cos(x);
+    case FFTPlan::Blackman:
+        return 0.42 - 0.5 * cos(x) + 0.08 * cos(2 * x);
+    default:
+        return 1;
+    }
+}
+
+/* Generate lookup tables.  The real input of size N is packed into a complex
+ * sequence of size M=N/2 (even samples as real parts, odd samples as imaginary
+ * parts), so the tables for the complex transform are of size M. */
+
+FFTPlan::FFTPlan(int size, Window window) : m_size(size), m_window_type(window)
+{
+    int half = size / 2;
+    int bits = 0;
+    while ((1 << bits) < half)
+        bits++;
+
+    m_window.insert(0, size);
+    m_reversed.insert(0, half);
+    m_roots_re.insert(0, half);
+    m_roots_im.insert(0, half);
+    m_split_re.insert(0, half + 1);
+    m_split_im.insert(0, half + 1);
+
+    double sum = 0;
+    for (int n = 0; n < size; n++)
+        sum += window_value(window, n, size);
+    for (int n = 0; n < size; n++)
+        m_window[n] = window_value(window, n, size) * (size / sum);
+
+    for (int n = 0; n < half; n++)
+        m_reversed[n] = bit_reverse(n, bits);
 
-static void generate_tables()
+    /* the twiddle factors for the step with span s are stored contiguously,
+     * starting at index s, so that the butterflies can load them as vectors */
+    for (int span = 1; span < half; span <<= 1)
+    {
+        for (int b = 0; b < span; b++)
+        {
+            m_roots_re[span + b] = cos(b * (PI / span));
+            m_roots_im[span + b] = -sin(b * (PI / span));
+        }
+    }
+
+    for (int k = 0; k <= half; k++)
+    {
+        m_split_re[k] = cos(k * (2 * PI / size));
+        m_split_im[k] = -sin(k * (2 * PI / size));
+    }
+}
+
+EXPORT const FFTPlan * FFTPlan::get(int size, Window window)
 {
-    if (generated)
-        return;
+    if (size < min_size || size > max_size || (size & (size - 1)) ||
+        window < 0 || window >= n_windows)
+        return nullptr;
 
-    for (int n = 0; n < N; n++)
-        hamming[n] = 1 - 0.85f * cosf(n * (TWO_PI / N));
-    for (int n = 0; n < N; n++)
-        reversed[n] = bit_reverse(n);
-    for (int n = 0; n < N / 2; n++)
-        roots[n] = exp(Complex(0, n * (TWO_PI / N)));
+    int log = LOG_MIN;
+    while ((1 << log) < size)
+        log++;
 
-    generated = 1;
+    auto & slot = plans[log - LOG_MIN][window];
+    FFTPlan * plan = slot.load(std::memory_order_acquire);
+
+    if (!plan)
+    {
+        auto mh = plans_mutex.take();
+
+        plan = slot.load(std::memory_order_relaxed);
+        if (!plan)
+        {
+            plan = new FFTPlan(size, window);
+            slot.store(plan, std::memory_order_release);
+        }
+    }
+
+    return plan;
 }
 
-/* Perform the DFT using the Cooley-Tukey algorithm.  At each step s, where
- * s=1..log N (base 2), there are N/(2^s) groups of intertwined butterfly
- * operations.  Each group contains (2^s)/2 butterflies, and each butterfly has
- * a span of (2^s)/2.  The twiddle factors are nth roots of unity where n = 2^s.
- */
+/* Perform the DFT of size M using the Cooley-Tukey algorithm.  At each step,
+ * there are M/(2*span) groups of intertwined butterfly operations.  Each group
+ * contains <span> butterflies, and each butterfly has a span of <span>.  Once
+ * the span reaches the vector width, each group is processed FFT_LANES
+ * butterflies at a time. */
 
-static void do_fft(Complex a[N])
+static void do_fft(float * re, float * im, int half, const float * roots_re,
+                   const float * roots_im)
 {
-    int half = 1;    /* (2^s)/2 */
-    int inv = N / 2; /* N/(2^s) */
+    int span = 1;
 
-    /* loop through steps */
-    while (inv)
+    for (; span < half && span < FFT_LANES; span <<= 1)
     {
-        /* loop through groups */
-        for (int g = 0; g < N; g += half << 1)
+        for (int g = 0; g < half; g += span << 1)
         {
-            /* loop through butterflies */
-            for (int b = 0, r = 0; b < half; b++, r += inv)
+            for (int b = 0; b < span; b++)
             {
-                Complex even = a[g + b];
-                Complex odd = roots[r] * a[g + half + b];
-                a[g + b] = even + odd;
-                a[g + half + b] = even - odd;
+                int e = g + b, o = e + span;
+                float wr = roots_re[span + b], wi = roots_im[span + b];
+                float tr = re[o] * wr - im[o] * wi;
+                float ti = re[o] * wi + im[o] * wr;
+
+                re[o] = re[e] - tr;
+                im[o] = im[e] - ti;
+                re[e] += tr;
+                im[e] += ti;
             }
         }
+    }
+
+    for (; span < half; span <<= 1)
+    {
+        for (int g = 0; g < half; g += span << 1)
+        {
+            for (int b = 0; b < span; b += FFT_LANES)
+            {
+                int e = g + b, o = e + span;
+                FFTVec wr = load(roots_re + span + b);
+                FFTVec wi = load(roots_im + span + b);
+                FFTVec er = load(re + e), ei = load(im + e);
+                FFTVec orr = load(re + o), oi = load(im + o);
+                FFTVec tr = orr * wr - oi * wi;
+                FFTVec ti = orr * wi + oi * wr;
 
-        half <<= 1;
-        inv >>= 1;
+                store(re + o, er - tr);
+                store(im + o, ei - ti);
+                store(re + e, er + tr);
+                store(im + e, ei + ti);
+            }
+        }
     }
 }
 
-/* Input is N=512 PCM samples.
- * Output is intensity of frequencies from 1 to N/2=256. */
+/* Compute the spectrum of the windowed real input and pass each value X[k],
+ * k=0..N/2, to a callback.  X[k] is recovered from the packed transform Z as
+ * E[k] + W^k O[k], where E[k] = (Z[k] + Z*[M-k]) / 2 is the transform of the
+ * even samples and O[k] = (Z[k] - Z*[M-k]) / 2i that of the odd samples. */
 
-void calc_freq(const float data[N], float freq[N / 2])
+template<class F>
+void FFTPlan::real_transform(const float * data, F output) const
 {
-    generate_tables();
+    /* the largest plan needs 64 KiB of stack here */
+    float re[max_size / 2], im[max_size / 2];
+    int half = m_size / 2;
 
-    /* input is filtered by a Hamming window */
+    /* input is filtered by the window function */
     /* input values are in bit-reversed order */
-    Complex a[N];
-    for (int n = 0; n < N; n++)
-        a[reversed[n]] = data[n] * hamming[n];
+    for (int n = 0; n < half; n++)
+    {
+        re[m_reversed[n]] = data[2 * n] * m_window[2 * n];
+        im[m_reversed[n]] = data[2 * n + 1] * m_window[2 * n + 1];
+    }
+
+    do_fft(re, im, half, m_roots_re.begin(), m_roots_im.begin());
+
+    for (int k = 0; k <= half; k++)
+    {
+        int k1 = k & (half - 1), k2 = (half - k) & (half - 1);
 
-    do_fft(a);
+        float er = (re[k1] + re[k2]) * 0.5f;
+        float ei = (im[k1] - im[k2]) * 0.5f;
+        float odr = (im[k1] + im[k2]) * 0.5f;
+        float odi = (re[k2] - re[k1]) * 0.5f;
+
+        output(k, er + m_split_re[k] * odr - m_split_im[k] * odi,
+               ei + m_split_re[k] * odi + m_split_im[k] * odr);
+    }
+}
+
+EXPORT void FFTPlan::transform(const float * data, float * spectrum) const
+{
+    real_transform(data, [spectrum](int k, float xr, float xi) {
+        spectrum[2 * k] = xr;
+        spectrum[2 * k + 1] = xi;
+    });
+}
+
+EXPORT void FFTPlan::calc_freq(const float * data, float * freq) const
+{
+    int size = m_size, half = m_size / 2;
 
     /* output values are divided by N */
     /* frequencies from 1 to N/2-1 are doubled */
-    for (int n = 0; n < N / 2 - 1; n++)
-        freq[n] = 2 * abs(a[1 + n]) / N;
-
     /* frequency N/2 is not doubled */
-    freq[N / 2 - 1] = abs(a[N / 2]) / N;
+    real_transform(data, [freq, size, half](int k, float xr, float xi) {
+        float mag = sqrtf(xr * xr + xi * xi) / size;
+        if (k > 0)
+            freq[k - 1] = (k < half) ? 2 * mag : mag;
+    });
+}
+
+/* Input is N=512 PCM samples.
+ * Output is intensity of frequencies from 1 to N/2=256. */
+
+void calc_freq(const float data[512], float freq[256])
+{
+    FFTPlan::get(512)->calc_freq(data, freq);
+}
+
+void fft_cleanup()
+{
+    auto mh = plans_mutex.take();
+
+    for (auto & row : plans)
+    {
+        for (auto & slot : row)
+            delete slot.exchange(nullptr);
+    }
 }
@@ -0,0 +1,85 @@
+/*
+ * fft.h
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_FFT_H
+#define LIBAUDCORE_FFT_H
+
+#include <libaudcore/export.h>
+#include <libaudcore/index.h>
+
+/* A precomputed plan for the DFT of real input of a fixed power-of-two size.
+ * Plans are created on demand, shared by all callers, and live until
+ * libaudcore is shut down.  A plan is never modified after creation, so the
+ * same plan may be used from several threads at once. */
+class LIBAUDCORE_PUBLIC FFTPlan
+{
+public:
+    /* Windows are scaled so that their average value is 1; hence a full-scale
+     * sine wave yields the same intensity regardless of the window chosen. */
+    enum Window
+    {
+        Default,     /* 1 - 0.85 cos, as used for Visualizer::render_freq() */
+        Rectangular, /* no window */
+        Hann,
+        Hamming,
+        Blackman,
+        n_windows
+    };
+
+    static constexpr int min_size = 256;
+    static constexpr int max_size = 16384;
+
+    /* Returns the plan for the given size, which must be a power of two from
+     * min_size to max_size, or nullptr if the size is invalid.  Thread-safe. */
+    static const FFTPlan * get(int size, Window window = Default);
+
+    FFTPlan(const FFTPlan &) = delete;
+    void operator=(const FFTPlan &) = delete;
+
+    int size() const { return m_size; }
+    Window window() const { return m_window_type; }
+
+    /* Input is size() PCM samples.  Output is the windowed (but not scaled)
+     * spectrum at frequencies 0/size, 1/size, ..., (size/2)/size of sample
+     * rate, as size()/2+1 complex values stored as (real, imaginary) pairs. */
+    void transform(const float * data, float * spectrum) const;
+
+    /* Input is size() PCM samples.  Output is intensity of frequencies 1/size,
+     * 2/size, ..., (size/2)/size of sample rate (size()/2 values), scaled in
+     * the same way as the values passed to Visualizer::render_freq(). */
+    void calc_freq(const float * data, float * freq) const;
+
+private:
+    FFTPlan(int size, Window window);
+
+    template<class F>
+    void real_transform(const float * data, F output) const;
+
+    const int m_size;
+    const Window m_window_type;
+
+    Index<float> m_window;    /* window function */
+    Index<int> m_reversed;    /* bit-reversal table for size/2 */
+    Index<float> m_roots_re;  /* twiddle factors for each step */
+    Index<float> m_roots_im;  /* twiddle factors for each step */
+    Index<float> m_split_re;  /* twiddle factors for the real-input split */
+    Index<float> m_split_im;  /* twiddle factors for the real-input split */
+};
+
+#endif /* LIBAUDCORE_FFT_H */
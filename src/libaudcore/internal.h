@@ -38,6 +38,9 @@ typedef bool (*DirForeachFunc)(const char * path, const char * basename,
 /* adder.cc */
 void adder_cleanup();
 
+/* archive_reader.cc */
+void archive_reader_cleanup();
+
 /* art.cc */
 void art_cache_current(const String & filename, Index<char> && data,
                        String && art_file);
@@ -55,6 +58,7 @@ void chardet_cleanup();
 void config_load();
 void config_save();
 void config_cleanup();
+void config_refresh_handles(const char * name); /* nullptr = all */
 
 /* drct.cc */
 void record_init();
@@ -83,6 +87,7 @@ void event_queue_cancel_all();
 
 /* fft.cc */
 void calc_freq(const float data[512], float freq[256]);
+void fft_cleanup();
 
 /* hook.cc */
 void hook_cleanup();
@@ -96,7 +101,7 @@ void interface_run();
 
 /* playback.cc */
 /* do not call these; use aud_drct_play/stop() instead */
-void playback_play(int seek_time, bool pause);
+void playback_play(int seek_time, bool pause, bool prefetched = false);
 void playback_stop(bool exiting = false);
 
 bool playback_check_serial(int serial);
@@ -111,6 +116,7 @@ InputPlugin * load_input_plugin(PluginHandle * decoder,
 #define PROBE_FLAG_HAS_DECODER (1 << 0)
 #define PROBE_FLAG_MIGHT_HAVE_SUBTUNES (1 << 1)
 int probe_by_filename(const char * filename);
+void probe_cleanup();
 
 /* runtime.cc */
 extern size_t misc_bytes_allocated;
@@ -121,6 +127,30 @@ void string_leak_check();
 /* timer.cc */
 void timer_cleanup();
 
+/* tuple-cache.cc */
+struct FileStamp
+{
+    int64_t size, mtime;
+
+    bool operator==(const FileStamp & b) const
+    {
+        return size == b.size && mtime == b.mtime;
+    }
+    bool operator!=(const FileStamp & b) const { return !operator==(b); }
+};
+
+void tuple_cache_init();
+void tuple_cache_cleanup();
+
+/* only local files can be cached */
+bool tuple_cache_get_stamp(const char * filename, FileStamp & stamp);
+
+/* the stamp should be taken before reading the file */
+bool tuple_cache_lookup(const char * filename, const FileStamp & stamp,
+                        PluginHandle *& decoder, Tuple & tuple);
+void tuple_cache_store(const char * filename, const FileStamp & stamp,
+                       PluginHandle * decoder, const Tuple & tuple);
+
 /* util.cc */
 const char * get_home_utf8();
 bool dir_foreach(const char * path, DirForeachFunc func, void * user_data);
@@ -146,17 +176,26 @@ struct IntHashKey
     unsigned hash() const { return int32_hash(val); }
 };
 
+/* vfs_async.cc */
+void vfs_async_init();
+void vfs_async_cleanup();
+
+/* most requests read at the same time since startup */
+int vfs_async_peak_threads();
+
 /* vis-runner.cc */
 void vis_runner_start_stop(bool playing, bool paused);
 void vis_runner_pass_audio(int time, const Index<float> & data, int channels,
                            int rate);
 void vis_runner_flush();
 void vis_runner_enable(bool enable);
+void vis_runner_set_types(int type_mask);
 
 /* visualization.cc */
 void vis_activate(bool activate);
 void vis_send_clear();
-void vis_send_audio(const float * data, int channels);
+void vis_send_audio(const float * data, int channels, const float * mono,
+                    const float * freq);
 
 bool vis_plugin_start(PluginHandle * plugin);
 void vis_plugin_stop(PluginHandle * plugin);
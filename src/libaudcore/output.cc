@@ -24,6 +24,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "audio-internal.h"
+#include "audstrings.h"
 #include "equalizer.h"
 #include "hook.h"
 #include "i18n.h"
@@ -162,11 +164,120 @@ static bool gain_info_valid;
 static Index<float> buffer1;
 static Index<char> buffer2;
 
+/* A gain (and optional soft clipping) applied in a single pass.  Replay gain
+ * is applied to the decoded audio, while software volume and soft clipping are
+ * applied to the output audio, after effects and equalizer.  Each stage is
+ * computed in advance and updated only when the settings involved change or a
+ * new song or output is set up, rather than looked up for every buffer. */
+struct GainStage
+{
+    int channels = 1;
+    float factors[AUD_MAX_CHANNELS] = {1};
+    bool unity = true;
+    bool soft_clip = false;
+
+    void apply(Index<float> & data) const
+    {
+        if (!unity || soft_clip)
+            audio_apply_gain(data.begin(), channels, data.len() / channels,
+                             factors, soft_clip);
+    }
+};
+
+static GainStage replay_gain_stage, output_gain_stage;
+
+static ConfigHandle<bool> cfg_replay_gain("enable_replay_gain");
+static ConfigHandle<int> cfg_replay_gain_mode("replay_gain_mode");
+static ConfigHandle<double> cfg_replay_gain_preamp("replay_gain_preamp");
+static ConfigHandle<double> cfg_default_gain("default_gain");
+static ConfigHandle<bool> cfg_clipping_prevention("enable_clipping_prevention");
+static ConfigHandle<bool> cfg_shuffle("shuffle");
+static ConfigHandle<bool> cfg_album_shuffle("album_shuffle");
+static ConfigHandle<bool> cfg_sw_volume("software_volume_control");
+static ConfigHandle<int> cfg_sw_volume_left("sw_volume_left");
+static ConfigHandle<int> cfg_sw_volume_right("sw_volume_right");
+static ConfigHandle<bool> cfg_soft_clipping("soft_clipping");
+static ConfigHandle<int> cfg_bit_depth("output_bit_depth");
+static ConfigHandle<bool> cfg_record("record");
+static ConfigHandle<int> cfg_record_stream("record_stream");
+
+/* settings which the gain stages depend on */
+static const char * const gain_settings[] = {"enable_replay_gain",
+                                             "replay_gain_mode",
+                                             "replay_gain_preamp",
+                                             "default_gain",
+                                             "enable_clipping_prevention",
+                                             "shuffle",
+                                             "album_shuffle",
+                                             "software_volume_control",
+                                             "sw_volume_left",
+                                             "sw_volume_right",
+                                             "soft_clipping"};
+
+static void update_replay_gain_stage(SafeLock &)
+{
+    replay_gain_stage.unity = true;
+
+    if (!cfg_replay_gain.get())
+        return;
+
+    float factor = powf(10, cfg_replay_gain_preamp.get() / 20);
+
+    if (gain_info_valid)
+    {
+        float peak;
+
+        auto mode = (ReplayGainMode)cfg_replay_gain_mode.get();
+        if ((mode == ReplayGainMode::Album) ||
+            (mode == ReplayGainMode::Automatic &&
+             (!cfg_shuffle.get() || cfg_album_shuffle.get())))
+        {
+            factor *= powf(10, gain_info.album_gain / 20);
+            peak = gain_info.album_peak;
+        }
+        else
+        {
+            factor *= powf(10, gain_info.track_gain / 20);
+            peak = gain_info.track_peak;
+        }
+
+        if (cfg_clipping_prevention.get() && peak * factor > 1)
+            factor = 1 / peak;
+    }
+    else
+        factor *= powf(10, cfg_default_gain.get() / 20);
+
+    if (factor < 0.99 || factor > 1.01)
+    {
+        replay_gain_stage.factors[0] = factor;
+        replay_gain_stage.unity = false;
+    }
+}
+
+static void update_output_gain_stage(SafeLock &)
+{
+    int channels = aud::max(out_channels, 1);
+    StereoVolume v = {cfg_sw_volume_left.get(), cfg_sw_volume_right.get()};
+
+    output_gain_stage.channels = channels;
+    output_gain_stage.unity = !cfg_sw_volume.get() ||
+                              (v.left == 100 && v.right == 100);
+    output_gain_stage.soft_clip = cfg_soft_clipping.get();
+
+    if (output_gain_stage.unity)
+    {
+        for (int c = 0; c < channels; c++)
+            output_gain_stage.factors[c] = 1;
+    }
+    else
+        audio_volume_factors(v, channels, output_gain_stage.factors);
+}
+
 static inline int get_format(bool & automatic)
 {
     automatic = false;
 
-    switch (aud_get_int("output_bit_depth"))
+    switch (cfg_bit_depth.get())
     {
     case 16:
         return FMT_S16_NE;
@@ -303,6 +414,8 @@ static void setup_output(UnsafeLock & lock, bool new_input, bool pause)
     out_bytes_held = 0;
     out_bytes_written = 0;
 
+    update_output_gain_stage(lock);
+
     apply_pause(lock, pause, true);
 }
 
@@ -314,7 +427,7 @@ static void setup_secondary(SafeLock & lock, bool new_input)
         return;
 
     int rate, channels;
-    record_stream = (OutputStream)aud_get_int("record_stream");
+    record_stream = (OutputStream)cfg_record_stream.get();
 
     if (record_stream < OutputStream::AfterEffects)
     {
@@ -359,41 +472,6 @@ static void flush_output(SafeLock &)
     vis_runner_flush();
 }
 
-static void apply_replay_gain(SafeLock &, Index<float> & data)
-{
-    if (!aud_get_bool("enable_replay_gain"))
-        return;
-
-    float factor = powf(10, aud_get_double("replay_gain_preamp") / 20);
-
-    if (gain_info_valid)
-    {
-        float peak;
-
-        auto mode = (ReplayGainMode)aud_get_int("replay_gain_mode");
-        if ((mode == ReplayGainMode::Album) ||
-            (mode == ReplayGainMode::Automatic &&
-             (!aud_get_bool("shuffle") || aud_get_bool("album_shuffle"))))
-        {
-            factor *= powf(10, gain_info.album_gain / 20);
-            peak = gain_info.album_peak;
-        }
-        else
-        {
-            factor *= powf(10, gain_info.track_gain / 20);
-            peak = gain_info.track_peak;
-        }
-
-        if (aud_get_bool("enable_clipping_prevention") && peak * factor > 1)
-            factor = 1 / peak;
-    }
-    else
-        factor *= powf(10, aud_get_double("default_gain") / 20);
-
-    if (factor < 0.99 || factor > 1.01)
-        audio_amplify(data.begin(), 1, data.len(), &factor);
-}
-
 static void write_secondary(SafeLock &, const Index<float> & data)
 {
     assert(state.secondary());
@@ -424,15 +502,7 @@ static void write_output(UnsafeLock & lock, Index<float> & data)
     if (state.secondary() && record_stream == OutputStream::AfterEqualizer)
         write_secondary(lock, data);
 
-    if (aud_get_bool("software_volume_control"))
-    {
-        StereoVolume v = {aud_get_int("sw_volume_left"),
-                          aud_get_int("sw_volume_right")};
-        audio_amplify(data.begin(), out_channels, data.len() / out_channels, v);
-    }
-
-    if (aud_get_bool("soft_clipping"))
-        audio_soft_clip(data.begin(), data.len());
+    output_gain_stage.apply(data);
 
     const void * out_data = data.begin();
 
@@ -507,7 +577,7 @@ static bool process_audio(UnsafeLock & lock, const void * data, int size,
     if (state.secondary() && record_stream == OutputStream::AsDecoded)
         write_secondary(lock, buffer1);
 
-    apply_replay_gain(lock, buffer1);
+    replay_gain_stage.apply(buffer1);
 
     if (state.secondary() && record_stream == OutputStream::AfterReplayGain)
         write_secondary(lock, buffer1);
@@ -539,6 +609,7 @@ bool output_open_audio(const String & filename, const Tuple & tuple, int format,
 
     seek_time = start_time;
     gain_info_valid = false;
+    update_replay_gain_stage(lock);
 
     in_filename = filename;
     in_tuple = tuple.ref();
@@ -550,7 +621,7 @@ bool output_open_audio(const String & filename, const Tuple & tuple, int format,
     setup_effects(lock);
     setup_output(lock, true, pause);
 
-    if (aud_get_bool("record"))
+    if (cfg_record.get())
         setup_secondary(lock, true);
 
     return true;
@@ -572,6 +643,7 @@ void output_set_replay_gain(const ReplayGainInfo & info)
     {
         gain_info = info;
         gain_info_valid = true;
+        update_replay_gain_stage(lock);
 
         AUDINFO("Replay Gain info:\n");
         AUDINFO(" album gain: %f dB\n", info.album_gain);
@@ -744,7 +816,7 @@ static void output_reset(OutputReset type, OutputPlugin * op)
 
         setup_output(lock2, false, state.paused());
 
-        if (aud_get_bool("record"))
+        if (cfg_record.get())
             setup_secondary(lock2, false);
     }
 
@@ -758,9 +830,8 @@ EXPORT StereoVolume aud_drct_get_volume()
     auto lock = state.lock_safe();
     StereoVolume volume = {0, 0};
 
-    if (aud_get_bool("software_volume_control"))
-        volume = {aud_get_int("sw_volume_left"),
-                  aud_get_int("sw_volume_right")};
+    if (cfg_sw_volume.get())
+        volume = {cfg_sw_volume_left.get(), cfg_sw_volume_right.get()};
     else if (cop)
         volume = cop->get_volume();
 
@@ -774,10 +845,10 @@ EXPORT void aud_drct_set_volume(StereoVolume volume)
     volume.left = aud::clamp(volume.left, 0, 100);
     volume.right = aud::clamp(volume.right, 0, 100);
 
-    if (aud_get_bool("software_volume_control"))
+    if (cfg_sw_volume.get())
     {
-        aud_set_int("sw_volume_left", volume.left);
-        aud_set_int("sw_volume_right", volume.right);
+        cfg_sw_volume_left.set(volume.left);
+        cfg_sw_volume_right.set(volume.right);
     }
     else if (cop)
         cop->set_volume(volume);
@@ -813,7 +884,7 @@ bool output_plugin_set_secondary(PluginHandle * plugin)
     if (sop && !sop->init())
         sop = nullptr;
 
-    if (state.input() && aud_get_bool("record"))
+    if (state.input() && cfg_record.get())
         setup_secondary(lock, false);
 
     return (!plugin || sop);
@@ -823,20 +894,37 @@ static void record_settings_changed(void *, void *)
 {
     auto lock = state.lock_safe();
 
-    if (state.input() && aud_get_bool("record"))
+    if (state.input() && cfg_record.get())
         setup_secondary(lock, false);
     else
         cleanup_secondary(lock);
 }
 
+static void gain_settings_changed(void *, void *)
+{
+    auto lock = state.lock_safe();
+
+    update_replay_gain_stage(lock);
+    update_output_gain_stage(lock);
+}
+
 void output_init()
 {
     hook_associate("set record", record_settings_changed, nullptr);
     hook_associate("set record_stream", record_settings_changed, nullptr);
+
+    for (const char * name : gain_settings)
+        hook_associate(str_concat({"set ", name}), gain_settings_changed,
+                       nullptr);
+
+    gain_settings_changed(nullptr, nullptr);
 }
 
 void output_cleanup()
 {
     hook_dissociate("set record", record_settings_changed);
     hook_dissociate("set record_stream", record_settings_changed);
+
+    for (const char * name : gain_settings)
+        hook_dissociate(str_concat({"set ", name}), gain_settings_changed);
 }
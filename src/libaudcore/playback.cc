@@ -46,6 +46,7 @@
 #include "mainloop.h"
 #include "output.h"
 #include "playlist-internal.h"
+#include "playlist-prefetch.h"
 #include "plugin.h"
 #include "plugins-internal.h"
 #include "plugins.h"
@@ -89,6 +90,7 @@ struct PlaybackInfo
     int channels = 0;
 
     bool ready = false;
+    bool prefetched = false;
     bool ended = false;
     bool error = false;
     String error_s;
@@ -102,9 +104,19 @@ static PlaybackControl pb_control;
 static PlaybackInfo pb_info;
 
 static QueuedFunc end_queue;
+
+static ConfigHandle<bool> cfg_repeat("repeat");
+static ConfigHandle<bool> cfg_no_advance("no_playlist_advance");
+static ConfigHandle<bool> cfg_stop_after("stop_after_current_song");
+static ConfigHandle<bool> cfg_show_numbers("show_numbers_in_pl");
+static ConfigHandle<int> cfg_prefetch("prefetch_seconds");
 static bool song_finished = false;
 static int failed_entries = 0;
 
+// songs which followed another with and without being prefetched
+static int prefetch_hits = 0;
+static int prefetch_stalls = 0;
+
 // check that the playback thread is not lagging
 static bool in_sync(aud::mutex::holder &)
 {
@@ -226,20 +238,20 @@ static void end_cb()
     };
 
     auto do_next = [playlist]() {
-        if (!playlist.next_song(aud_get_bool("repeat")))
+        if (!playlist.next_song(cfg_repeat.get()))
         {
             playlist.set_position(-1);
             hook_call("playlist end reached", nullptr);
         }
     };
 
-    if (aud_get_bool("no_playlist_advance"))
+    if (cfg_no_advance.get())
     {
         // we assume here that repeat is not enabled;
         // single-song repeats are handled in run_playback()
         do_stop();
     }
-    else if (aud_get_bool("stop_after_current_song"))
+    else if (cfg_stop_after.get())
     {
         do_stop();
         do_next();
@@ -315,7 +327,7 @@ static bool check_playback_repeat()
 
     // check whether we need to repeat
     if (pb_control.repeat_a >= 0 ||
-        (aud_get_bool("repeat") && aud_get_bool("no_playlist_advance")))
+        (cfg_repeat.get() && cfg_no_advance.get()))
     {
         // treat the repeat as a seek (takes effect at open_audio())
         pb_control.seek = pb_control.repeat_a;
@@ -437,11 +449,50 @@ static void playback_thread()
     cond.notify_all();
 }
 
+// playback thread helper: near the end of the song, asks the playlist to
+// prepare the next one so that it can start without a gap; the playlist is
+// called without the playback mutex held
+static void check_prefetch(int repeat_b)
+{
+    int seconds = cfg_prefetch.get();
+    if (seconds <= 0)
+        return;
+
+    auto mh = mutex.take();
+    if (!in_sync(mh) || pb_info.prefetched ||
+        !PlaylistPrefetch::due(output_get_time(), pb_info.length, seconds,
+                               repeat_b))
+        return;
+
+    pb_info.prefetched = true;
+    int serial = pb_state.playback_serial;
+
+    mh.unlock();
+
+    if (cfg_no_advance.get() || cfg_stop_after.get())
+        return;
+
+    playback_entry_prefetch(serial, cfg_repeat.get());
+}
+
 // main thread: starts playback of a new song
-void playback_play(int seek_time, bool pause)
+void playback_play(int seek_time, bool pause, bool prefetched)
 {
     auto mh = mutex.take();
 
+    // count songs which were not ready when the previous one finished
+    if (song_finished && cfg_prefetch.get() > 0)
+    {
+        if (prefetched)
+            prefetch_hits++;
+        else
+        {
+            prefetch_stalls++;
+            AUDINFO("Next song was not prefetched (%d stalls, %d hits).\n",
+                    prefetch_stalls, prefetch_hits);
+        }
+    }
+
     // discard audio buffer unless progressing to the next song
     if (!song_finished)
         output_flush(0);
@@ -552,7 +603,10 @@ EXPORT void InputPlugin::write_audio(const void * data, int length)
     // since it will return immediately if output_flush() has been called
     int stop_time = (b >= 0) ? b : pb_info.stop_time;
     if (output_write_audio(data, length, stop_time))
+    {
+        check_prefetch(b);
         return;
+    }
 
     mh.lock();
 
@@ -649,7 +703,7 @@ EXPORT String aud_drct_get_title()
     if (!is_ready(mh))
         return String();
 
-    StringBuf prefix = aud_get_bool("show_numbers_in_pl")
+    StringBuf prefix = cfg_show_numbers.get()
                            ? str_printf("%d. ", 1 + pb_info.entry)
                            : StringBuf(0);
 
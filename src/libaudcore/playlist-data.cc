@@ -22,8 +22,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "playlist-snapshot.h"
+#include "playlist-sort.h"
 #include "runtime.h"
 #include "scanner.h"
+#include "tuple-columns.h"
 #include "tuple-compiler.h"
 
 #define NO_POS                                                                 \
@@ -33,18 +36,44 @@
 
 static TupleCompiler s_tuple_formatter;
 static bool s_use_tuple_fallbacks = false;
+static bool s_use_tuple_columns = false;
+
+/* shared by the entries of all playlists, so that the arrays are not split
+ * into many small ones; protected by the playlist mutex */
+static TupleColumns s_tuple_columns;
 
 struct PlaylistEntry
 {
     PlaylistEntry(PlaylistAddItem && item);
+    PlaylistEntry(const PlaylistSnapshot * snapshot, int row);
     ~PlaylistEntry();
 
-    void format();
     void set_tuple(Tuple && new_tuple);
 
+    /* the tuple of an entry loaded from a snapshot is created on first use;
+     * the tuple of an entry in the column store is created on each use */
+    Tuple get_tuple() const;
+    Tuple::State tuple_state() const;
+    void set_tuple_state(Tuple::State state);
+
+    /* same as the Tuple functions applied to get_tuple(), but for an entry in
+     * the column store, the tuple is created only if the field is unset and
+     * may have a fallback value */
+    bool is_set(Tuple::Field field) const;
+    String get_str(Tuple::Field field) const;
+    int get_int(Tuple::Field field) const;
+
+    /* keeps a formatted tuple either in the entry or in the column store,
+     * according to the "columnar_tuples" setting */
+    void store_tuple(Tuple && new_tuple) const;
+    bool in_columns() const { return column_row >= 0; }
+
     String filename;
     PluginHandle * decoder;
-    Tuple tuple;
+    mutable Tuple tuple;
+    mutable int column_row;
+    mutable const PlaylistSnapshot * snapshot;
+    int snapshot_row;
     String error;
     int number;
     int length;
@@ -52,7 +81,15 @@ struct PlaylistEntry
     bool selected, queued;
 };
 
-void PlaylistEntry::format()
+/* the fields for which Tuple::get_str() may return a fallback value, which is
+ * not kept in the column store */
+static bool has_fallback(Tuple::Field field)
+{
+    return field == Tuple::Title || field == Tuple::Artist ||
+           field == Tuple::Album;
+}
+
+static void prepare_tuple(Tuple & tuple)
 {
     tuple.delete_fallbacks();
 
@@ -60,7 +97,11 @@ void PlaylistEntry::format()
         tuple.generate_fallbacks();
     else
         tuple.generate_title();
+}
 
+static void format_tuple(Tuple & tuple)
+{
+    prepare_tuple(tuple);
     s_tuple_formatter.format(tuple);
 }
 
@@ -71,7 +112,7 @@ void PlaylistEntry::set_tuple(Tuple && new_tuple)
      * in the Tuple::AudioFile.  If Tuple::AudioFile is not set, then assume
      * that the playlist was created by an older version of Audacious, and
      * revert to the former behavior (don't refresh this entry). */
-    if (tuple.is_set(Tuple::StartTime) && !tuple.is_set(Tuple::AudioFile))
+    if (is_set(Tuple::StartTime) && !is_set(Tuple::AudioFile))
         return;
 
     error = String();
@@ -80,29 +121,152 @@ void PlaylistEntry::set_tuple(Tuple && new_tuple)
         new_tuple.set_filename(filename);
 
     length = aud::max(0, new_tuple.get_int(Tuple::Length));
-    tuple = std::move(new_tuple);
 
-    format();
+    format_tuple(new_tuple);
+    store_tuple(std::move(new_tuple));
 }
 
 PlaylistEntry::PlaylistEntry(PlaylistAddItem && item)
-    : filename(item.filename), decoder(item.decoder), number(-1), length(0),
+    : filename(item.filename), decoder(item.decoder), column_row(-1),
+      snapshot(nullptr), snapshot_row(0), number(-1), length(0),
       shuffle_num(0), selected(false), queued(false)
 {
     set_tuple(std::move(item.tuple));
 }
 
-PlaylistEntry::~PlaylistEntry() { pl_signal_entry_deleted(this); }
+PlaylistEntry::PlaylistEntry(const PlaylistSnapshot * snapshot, int row)
+    : filename(snapshot->filename(row)), decoder(nullptr), column_row(-1),
+      snapshot(snapshot), snapshot_row(row), number(-1),
+      length(aud::max(0, snapshot->length(row))), shuffle_num(0),
+      selected(false), queued(false)
+{
+}
+
+Tuple PlaylistEntry::get_tuple() const
+{
+    if (snapshot)
+    {
+        Tuple new_tuple = snapshot->tuple(snapshot_row);
+        snapshot = nullptr;
+
+        if (!new_tuple.valid())
+            new_tuple.set_filename(filename);
+
+        format_tuple(new_tuple);
+        store_tuple(new_tuple.ref());
+        return new_tuple;
+    }
+
+    if (in_columns())
+    {
+        /* the formatted title is stored, but the fallbacks are not */
+        Tuple view = s_tuple_columns.get(column_row);
+        prepare_tuple(view);
+        return view;
+    }
+
+    return tuple.ref();
+}
+
+bool PlaylistEntry::is_set(Tuple::Field field) const
+{
+    if (in_columns())
+    {
+        if (s_tuple_columns.is_set(column_row, field) || !has_fallback(field))
+            return s_tuple_columns.is_set(column_row, field);
+    }
+    else if (!snapshot)
+        return tuple.is_set(field);
+
+    return get_tuple().is_set(field);
+}
+
+String PlaylistEntry::get_str(Tuple::Field field) const
+{
+    if (in_columns())
+    {
+        String str = s_tuple_columns.get_str(column_row, field);
+        if (str || !has_fallback(field))
+            return str;
+    }
+    else if (!snapshot)
+        return tuple.get_str(field);
+
+    return get_tuple().get_str(field);
+}
+
+/* integer fields have no fallbacks */
+int PlaylistEntry::get_int(Tuple::Field field) const
+{
+    if (snapshot)
+        get_tuple();
+
+    return in_columns() ? s_tuple_columns.get_int(column_row, field)
+                        : tuple.get_int(field);
+}
+
+Tuple::State PlaylistEntry::tuple_state() const
+{
+    if (snapshot)
+        return snapshot->state(snapshot_row);
+
+    return in_columns() ? s_tuple_columns.state(column_row) : tuple.state();
+}
+
+void PlaylistEntry::set_tuple_state(Tuple::State state)
+{
+    if (snapshot)
+        get_tuple();
+
+    if (in_columns())
+        s_tuple_columns.set_state(column_row, state);
+    else
+        tuple.set_state(state);
+}
+
+void PlaylistEntry::store_tuple(Tuple && new_tuple) const
+{
+    /* the subtune array is not kept in the column store */
+    if (s_use_tuple_columns && !new_tuple.get_n_subtunes())
+    {
+        if (in_columns())
+            s_tuple_columns.set(column_row, new_tuple);
+        else
+            column_row = s_tuple_columns.add(new_tuple);
+
+        tuple = Tuple();
+    }
+    else
+    {
+        if (in_columns())
+        {
+            s_tuple_columns.remove(column_row);
+            column_row = -1;
+        }
+
+        tuple = std::move(new_tuple);
+    }
+}
+
+PlaylistEntry::~PlaylistEntry()
+{
+    if (in_columns())
+        s_tuple_columns.remove(column_row);
+
+    pl_signal_entry_deleted(this);
+}
 
 void PlaylistData::update_formatter() // static
 {
     s_tuple_formatter.compile(aud_get_str("generic_title_format"));
     s_use_tuple_fallbacks = aud_get_bool("metadata_fallbacks");
+    s_use_tuple_columns = aud_get_bool("columnar_tuples");
 }
 
 void PlaylistData::cleanup_formatter() // static
 {
     s_tuple_formatter.reset();
+    s_tuple_columns.clear();
 }
 
 void PlaylistData::delete_entry(PlaylistEntry * entry) // static
@@ -110,22 +274,49 @@ void PlaylistData::delete_entry(PlaylistEntry * entry) // static
     delete entry;
 }
 
+void PlaylistData::delete_snapshot(PlaylistSnapshot * snapshot) // static
+{
+    delete snapshot;
+}
+
 PlaylistData::PlaylistData(Playlist::ID * id, const char * title)
     : modified(true), scan_status(NotScanning), title(title), resume_time(0),
       m_id(id), m_position(nullptr), m_focus(nullptr), m_selected_count(0),
       m_last_shuffle_num(0), m_total_length(0), m_selected_length(0),
-      m_last_update(), m_next_update(), m_position_changed(false)
+      m_last_update(), m_next_update(), m_position_changed(false),
+      m_scan_priority_at(0), m_scan_priority_end(0), m_next_pick(nullptr),
+      m_next_pick_repeated(false), m_structure_serial(0)
 {
 }
 
 PlaylistData::~PlaylistData() { pl_signal_playlist_deleted(m_id); }
 
+void PlaylistData::set_title(const char * new_title)
+{
+    title = String(new_title);
+    journal.record_title(new_title);
+    modified = true;
+}
+
 void PlaylistData::number_entries(int at, int length)
 {
     for (int i = at; i < at + length; i++)
         m_entries[i]->number = i;
 }
 
+/* records the new order of the entries; must be called after they are moved
+ * but before they are renumbered */
+void PlaylistData::journal_rearrange(int old_len)
+{
+    Index<int> numbers;
+    numbers.insert(0, m_entries.len());
+
+    for (int i = 0; i < m_entries.len(); i++)
+        numbers[i] = m_entries[i]->number;
+
+    journal.record_rearrange(old_len, numbers);
+}
+
 PlaylistEntry * PlaylistData::entry_at(int i)
 {
     return (i >= 0 && i < m_entries.len()) ? m_entries[i].get() : nullptr;
@@ -155,13 +346,19 @@ Tuple PlaylistData::entry_tuple(int i, String * error) const
     auto entry = entry_at(i);
     if (error)
         *error = entry ? entry->error : String();
-    return entry ? entry->tuple.ref() : Tuple();
+    return entry ? entry->get_tuple() : Tuple();
+}
+
+String PlaylistData::entry_str(int i, Tuple::Field field) const
+{
+    auto entry = entry_at(i);
+    return entry ? entry->get_str(field) : String();
 }
 
-static bool same_album(const Tuple & a, const Tuple & b)
+static bool same_album(const PlaylistEntry * a, const PlaylistEntry * b)
 {
-    String album = a.get_str(Tuple::Album);
-    return (album && album == b.get_str(Tuple::Album));
+    String album = a->get_str(Tuple::Album);
+    return (album && album == b->get_str(Tuple::Album));
 }
 
 void PlaylistData::set_entry_tuple(PlaylistEntry * entry, Tuple && tuple)
@@ -180,6 +377,9 @@ void PlaylistData::set_entry_tuple(PlaylistEntry * entry, Tuple && tuple)
 void PlaylistData::queue_update(Playlist::UpdateLevel level, int at, int count,
                                 int flags)
 {
+    if (level == Playlist::Structure)
+        m_structure_serial++;
+
     if (m_next_update.level)
     {
         m_next_update.level = aud::max(m_next_update.level, level);
@@ -229,6 +429,8 @@ void PlaylistData::insert_items(int at, Index<PlaylistAddItem> && items)
     if (at < 0 || at > n_entries)
         at = n_entries;
 
+    journal.record_insert(at, items);
+
     m_entries.insert(at, n_items);
 
     int i = at;
@@ -245,6 +447,29 @@ void PlaylistData::insert_items(int at, Index<PlaylistAddItem> && items)
     queue_update(Playlist::Structure, at, n_items);
 }
 
+/* the entries are not recorded in the journal, since they are already saved */
+void PlaylistData::insert_snapshot(PlaylistSnapshot * snapshot)
+{
+    int at = m_entries.len();
+    int n_rows = snapshot->n_rows();
+
+    m_snapshots.append(snapshot);
+    m_entries.insert(at, n_rows);
+
+    for (int i = 0; i < n_rows; i++)
+    {
+        auto entry = new PlaylistEntry(snapshot, i);
+        m_entries[at + i].capture(entry);
+        m_total_length += entry->length;
+    }
+
+    if (snapshot->title())
+        title = String(snapshot->title());
+
+    number_entries(at, n_rows);
+    queue_update(Playlist::Structure, at, n_rows);
+}
+
 void PlaylistData::remove_entries(int at, int number)
 {
     int n_entries = m_entries.len();
@@ -256,6 +481,8 @@ void PlaylistData::remove_entries(int at, int number)
     if (number < 0 || number > n_entries - at)
         number = n_entries - at;
 
+    m_next_pick = nullptr;
+
     if (m_position && m_position->number >= at &&
         m_position->number < at + number)
     {
@@ -293,6 +520,7 @@ void PlaylistData::remove_entries(int at, int number)
     }
 
     m_entries.remove(at, number);
+    journal.record_remove(n_entries, at, number);
 
     number_entries(at, n_entries - at - number);
     queue_update(Playlist::Structure, at, 0, update_flags);
@@ -311,6 +539,25 @@ int PlaylistData::position() const
     return m_position ? m_position->number : -1;
 }
 
+void PlaylistData::set_scan_priority_range(int at, int number)
+{
+    if (at < 0 || at > m_entries.len())
+        at = m_entries.len();
+    if (number < 0 || number > m_entries.len() - at)
+        number = m_entries.len() - at;
+
+    m_scan_priority_at = at;
+    m_scan_priority_end = at + number;
+}
+
+/* the range is not adjusted when entries are added or removed; the interface
+ * is expected to set it again after each structural update */
+void PlaylistData::get_scan_priority_range(int & at, int & end) const
+{
+    at = aud::min(m_scan_priority_at, m_entries.len());
+    end = aud::min(m_scan_priority_end, m_entries.len());
+}
+
 int PlaylistData::focus() const { return m_focus ? m_focus->number : -1; }
 
 bool PlaylistData::entry_selected(int entry_num) const
@@ -484,6 +731,7 @@ int PlaylistData::shift_entries(int entry_num, int distance)
     }
 
     m_entries.move_from(temp, 0, top, bottom - top, false, true);
+    journal_rearrange(n_entries);
 
     number_entries(top, bottom - top);
     queue_update(Playlist::Structure, top, bottom - top);
@@ -500,6 +748,8 @@ void PlaylistData::remove_selected()
     bool position_changed = false;
     int update_flags = 0;
 
+    m_next_pick = nullptr;
+
     if (m_position && m_position->selected)
     {
         change_position(NO_POS);
@@ -538,8 +788,9 @@ void PlaylistData::remove_selected()
         }
     }
 
+    m_entries.remove(to, -1);
+    journal_rearrange(n_entries);
     n_entries = to;
-    m_entries.remove(n_entries, -1);
 
     m_selected_count = 0;
     m_selected_length = 0;
@@ -557,46 +808,44 @@ void PlaylistData::remove_selected()
     }
 }
 
-void PlaylistData::sort_entries(Index<EntryPtr> & entries,
-                                const CompareData & data) // static
+/* only the field sorted by is read, unless the whole tuple is needed */
+void PlaylistData::fill_sort(PlaylistSort & sort, bool selected_only) const
 {
-    entries.sort([data](const EntryPtr & a, const EntryPtr & b) {
-        if (data.filename_compare)
-            return data.filename_compare(a->filename, b->filename);
-        else
-            return data.tuple_compare(a->tuple, b->tuple);
-    });
-}
+    Tuple::Field field = sort.key_field();
 
-void PlaylistData::sort(const CompareData & data)
-{
-    sort_entries(m_entries, data);
+    for (int i = 0; i < m_entries.len(); i++)
+    {
+        auto & entry = m_entries[i];
+        if (selected_only && !entry->selected)
+            continue;
 
-    number_entries(0, m_entries.len());
-    queue_update(Playlist::Structure, 0, m_entries.len());
+        if (sort.needs_tuple())
+            sort.add(i, entry->filename, entry->get_tuple());
+        else if (field == Tuple::Invalid)
+            sort.add_str(i, entry->filename, String());
+        else if (Tuple::field_get_type(field) == Tuple::Int)
+            sort.add_int(i, entry->filename, entry->is_set(field),
+                         entry->get_int(field));
+        else
+            sort.add_str(i, entry->filename, entry->get_str(field));
+    }
 }
 
-void PlaylistData::sort_selected(const CompareData & data)
+/* the rows that were sorted must not have been moved since fill_sort() */
+void PlaylistData::apply_sort(const PlaylistSort & sort)
 {
     int n_entries = m_entries.len();
+    int n_rows = sort.n_rows();
 
-    Index<EntryPtr> selected;
-
-    for (auto & entry : m_entries)
-    {
-        if (entry->selected)
-            selected.append(std::move(entry));
-    }
-
-    sort_entries(selected, data);
+    Index<EntryPtr> sorted;
+    sorted.insert(0, n_rows);
 
-    int i = 0;
-    for (auto & entry : m_entries)
-    {
-        if (!entry)
-            entry = std::move(selected[i++]);
-    }
+    for (int i = 0; i < n_rows; i++)
+        sorted[i] = std::move(m_entries[sort.sorted_row(i)]);
+    for (int i = 0; i < n_rows; i++)
+        m_entries[sort.row(i)] = std::move(sorted[i]);
 
+    journal_rearrange(n_entries);
     number_entries(0, n_entries);
     queue_update(Playlist::Structure, 0, n_entries);
 }
@@ -608,6 +857,7 @@ void PlaylistData::reverse_order()
     for (int i = 0; i < n_entries / 2; i++)
         std::swap(m_entries[i], m_entries[n_entries - 1 - i]);
 
+    journal_rearrange(n_entries);
     number_entries(0, n_entries);
     queue_update(Playlist::Structure, 0, n_entries);
 }
@@ -632,6 +882,7 @@ void PlaylistData::reverse_selected()
         std::swap(m_entries[top++], m_entries[bottom--]);
     }
 
+    journal_rearrange(n_entries);
     number_entries(0, n_entries);
     queue_update(Playlist::Structure, 0, n_entries);
 }
@@ -643,6 +894,7 @@ void PlaylistData::randomize_order()
     for (int i = 0; i < n_entries; i++)
         std::swap(m_entries[i], m_entries[rand() % n_entries]);
 
+    journal_rearrange(n_entries);
     number_entries(0, n_entries);
     queue_update(Playlist::Structure, 0, n_entries);
 }
@@ -668,6 +920,7 @@ void PlaylistData::randomize_selected()
         std::swap(m_entries[a], m_entries[b]);
     }
 
+    journal_rearrange(n_entries);
     number_entries(0, n_entries);
     queue_update(Playlist::Structure, 0, n_entries);
 }
@@ -832,7 +1085,7 @@ PlaylistData::PosChange PlaylistData::shuffle_pos_after(int ref_pos,
     {
         // look for the next entry in the album
         auto next = entry_at(ref_pos + 1);
-        if (next && same_album(next->tuple, ref_entry->tuple))
+        if (next && same_album(next, ref_entry))
             return {ref_pos + 1, true};
     }
 
@@ -850,8 +1103,7 @@ PlaylistData::PosChange PlaylistData::shuffle_pos_random(bool repeat,
         // skip already played entries (unless repeating)
         // optionally skip all but first entry in album
         if ((entry->shuffle_num == 0 || repeat) &&
-            !(by_album && prev_entry &&
-              same_album(entry->tuple, prev_entry->tuple)))
+            !(by_album && prev_entry && same_album(entry.get(), prev_entry)))
         {
             choices.append(entry.get());
         }
@@ -923,6 +1175,7 @@ PlaylistData::PosChange PlaylistData::pos_new_full(bool repeat, bool shuffle,
 void PlaylistData::change_position(PosChange change)
 {
     m_position = entry_at(change.new_pos);
+    m_next_pick = nullptr;
     resume_time = 0;
 
     /* move entry to top of shuffle list */
@@ -938,15 +1191,34 @@ void PlaylistData::change_position(PosChange change)
     }
 }
 
-bool PlaylistData::change_position_to_next(bool repeat, int hint_pos)
+PlaylistData::PosChange PlaylistData::next_pos_change(bool repeat, int hint_pos,
+                                                       bool & repeated) const
 {
     bool shuffle = aud_get_bool("shuffle");
     bool by_album = aud_get_bool("album_shuffle");
-    bool repeated = false;
+
+    repeated = false;
 
     auto change = pos_after(position(), shuffle, by_album);
-    if (change.new_pos < 0)
-        change = pos_new_full(repeat, shuffle, by_album, hint_pos, repeated);
+    if (change.new_pos >= 0)
+        return change;
+
+    // keep a random choice made by peek_next_song(), so that the entry
+    // prefetched for playback is the one actually played next
+    if (shuffle && m_next_pick && !m_queued.len())
+    {
+        repeated = m_next_pick_repeated;
+        return {m_next_pick->number, true};
+    }
+
+    return pos_new_full(repeat, shuffle, by_album, hint_pos, repeated);
+}
+
+bool PlaylistData::change_position_to_next(bool repeat, int hint_pos)
+{
+    bool repeated = false;
+
+    auto change = next_pos_change(repeat, hint_pos, repeated);
     if (change.new_pos < 0)
         return false;
 
@@ -960,6 +1232,7 @@ bool PlaylistData::change_position_to_next(bool repeat, int hint_pos)
 void PlaylistData::shuffle_reset()
 {
     m_last_shuffle_num = 0;
+    m_next_pick = nullptr;
 
     for (auto & entry : m_entries)
         entry->shuffle_num = 0;
@@ -1026,6 +1299,19 @@ bool PlaylistData::next_song(bool repeat)
     return true;
 }
 
+/* Returns the entry which next_song() would move to, without moving there.
+ * A random choice (in shuffle mode) is remembered and reused by next_song(). */
+int PlaylistData::peek_next_song(bool repeat)
+{
+    bool repeated = false;
+
+    auto change = next_pos_change(repeat, -1, repeated);
+    m_next_pick = entry_at(change.new_pos);
+    m_next_pick_repeated = repeated;
+
+    return change.new_pos;
+}
+
 bool PlaylistData::prev_album()
 {
     bool shuffle = aud_get_bool("shuffle");
@@ -1041,7 +1327,7 @@ bool PlaylistData::prev_album()
         while (1)
         {
             auto prev_entry = entry_at(pos_before(pos, shuffle));
-            if (!prev_entry || !same_album(entry->tuple, prev_entry->tuple))
+            if (!prev_entry || !same_album(entry, prev_entry))
                 break;
 
             pos = prev_entry->number;
@@ -1080,7 +1366,7 @@ bool PlaylistData::next_album(bool repeat)
         change = pos_after(change.new_pos, shuffle, true);
 
         auto next_entry = entry_at(change.new_pos);
-        if (!next_entry || !same_album(entry->tuple, next_entry->tuple))
+        if (!next_entry || !same_album(entry, next_entry))
             break;
 
         skipped.append(change);
@@ -1108,16 +1394,21 @@ bool PlaylistData::next_album(bool repeat)
     return true;
 }
 
-int PlaylistData::next_unscanned_entry(int entry_num) const
+/* searches from <entry_num> up to (but not including) <end>, or to the end of
+ * the playlist if <end> is negative */
+int PlaylistData::next_unscanned_entry(int entry_num, int end) const
 {
     if (entry_num < 0)
         return -1;
 
-    for (; entry_num < m_entries.len(); entry_num++)
+    if (end < 0 || end > m_entries.len())
+        end = m_entries.len();
+
+    for (; entry_num < end; entry_num++)
     {
         auto & entry = *m_entries[entry_num];
 
-        if (entry.tuple.state() == Tuple::Initial &&
+        if (entry.tuple_state() == Tuple::Initial &&
             strncmp(entry.filename, "stdin://", 8)) // blacklist stdin
         {
             return entry_num;
@@ -1127,48 +1418,99 @@ int PlaylistData::next_unscanned_entry(int entry_num) const
     return -1;
 }
 
+/* Appends the unscanned rows that will be played soon, in the order they are
+ * to be scanned: up to <max> queued entries, then up to <max> entries
+ * following the playing one.  The following entries are taken in playlist
+ * order, since the shuffle order is not known in advance. */
+void PlaylistData::scan_upcoming_rows(int max, Index<int> & rows) const
+{
+    auto add = [&](int row) {
+        if (next_unscanned_entry(row, row + 1) < 0)
+            return;
+
+        for (int r : rows)
+        {
+            if (r == row)
+                return;
+        }
+
+        rows.append(row);
+    };
+
+    for (int i = 0; i < aud::min(m_queued.len(), max); i++)
+        add(m_queued[i]->number);
+
+    if (m_position)
+    {
+        int end = aud::min(m_position->number + 1 + max, m_entries.len());
+        for (int row = m_position->number + 1; row < end; row++)
+            add(row);
+    }
+}
+
 ScanRequest * PlaylistData::create_scan_request(PlaylistEntry * entry,
                                                 ScanRequest::Callback callback,
                                                 int extra_flags)
 {
     int flags = extra_flags;
-    if (!entry->tuple.valid())
+    if (entry->tuple_state() != Tuple::Valid)
         flags |= SCAN_TUPLE;
 
     /* scanner uses Tuple::AudioFile from existing tuple, if valid */
     return new ScanRequest(entry->filename, flags, callback, entry->decoder,
-                           (flags & SCAN_TUPLE) ? Tuple() : entry->tuple.ref());
+                           (flags & SCAN_TUPLE) ? Tuple() : entry->get_tuple());
 }
 
-void PlaylistData::update_entry_from_scan(PlaylistEntry * entry,
-                                          ScanRequest * request,
-                                          int update_flags)
+/* applies a batch of scan results, queuing a single update for all the
+ * entries changed */
+void PlaylistData::update_entries_from_scan(Index<ScanResult> & results,
+                                            int update_flags)
 {
-    if (!entry->decoder)
-        entry->decoder = request->decoder;
+    int first = m_entries.len(), last = -1;
 
-    if (!entry->tuple.valid() && request->tuple.valid())
+    for (auto & result : results)
     {
-        set_entry_tuple(entry, std::move(request->tuple));
-        queue_update(Playlist::Metadata, entry->number, 1, update_flags);
-    }
+        PlaylistEntry * entry = result.entry;
+        bool changed = false;
 
-    if (!entry->decoder || !entry->tuple.valid())
-        entry->error = request->error;
+        if (!entry->decoder)
+            entry->decoder = result.decoder;
 
-    if (entry->tuple.state() == Tuple::Initial)
-    {
-        entry->tuple.set_state(Tuple::Failed);
-        queue_update(Playlist::Metadata, entry->number, 1, update_flags);
+        if (entry->tuple_state() != Tuple::Valid && result.tuple.valid())
+        {
+            set_entry_tuple(entry, std::move(result.tuple));
+            changed = true;
+        }
+
+        if (!entry->decoder || entry->tuple_state() != Tuple::Valid)
+            entry->error = result.error;
+
+        if (entry->tuple_state() == Tuple::Initial)
+        {
+            entry->set_tuple_state(Tuple::Failed);
+            changed = true;
+        }
+
+        if (changed)
+        {
+            journal.record_tuple(entry->number, entry->get_tuple());
+            first = aud::min(first, entry->number);
+            last = aud::max(last, entry->number);
+        }
     }
+
+    if (last >= first)
+        queue_update(Playlist::Metadata, first, last + 1 - first,
+                     update_flags);
 }
 
 void PlaylistData::update_playback_entry(Tuple && tuple)
 {
     /* don't update cuesheet entries with stream metadata */
-    if (m_position && !m_position->tuple.is_set(Tuple::StartTime))
+    if (m_position && !m_position->is_set(Tuple::StartTime))
     {
         set_entry_tuple(m_position, std::move(tuple));
+        journal.record_tuple(m_position->number, m_position->get_tuple());
         queue_update(Playlist::Metadata, m_position->number, 1);
     }
 }
@@ -1181,13 +1523,40 @@ bool PlaylistData::entry_needs_rescan(PlaylistEntry * entry, bool need_decoder,
 
     // check whether requested data (decoder and/or tuple) has been read
     return (need_decoder && !entry->decoder) ||
-           (need_tuple && !entry->tuple.valid());
+           (need_tuple && entry->tuple_state() != Tuple::Valid);
 }
 
 void PlaylistData::reformat_titles()
 {
+    Index<Tuple *> tuples;
+    Index<Tuple> views;
+
+    /* tuples still in a snapshot are formatted when they are created; tuples
+     * going into or out of the column store are formatted as copies, which
+     * are then stored (this is also how the store is switched on or off) */
+    auto use_copy = [](const PlaylistEntry & entry) {
+        return !entry.snapshot && (entry.in_columns() || s_use_tuple_columns);
+    };
+
+    for (auto & entry : m_entries)
+    {
+        if (use_copy(*entry))
+            views.append(entry->get_tuple());
+        else if (!entry->snapshot)
+            tuples.append(&entry->tuple);
+    }
+
+    for (auto & view : views)
+        tuples.append(&view);
+
+    s_tuple_formatter.format_many(tuples.begin(), tuples.len(), prepare_tuple);
+
+    int i = 0;
     for (auto & entry : m_entries)
-        entry->format();
+    {
+        if (use_copy(*entry))
+            entry->store_tuple(std::move(views[i++]));
+    }
 
     queue_update(Playlist::Metadata, 0, m_entries.len());
 }
@@ -1197,7 +1566,10 @@ void PlaylistData::reset_tuples(bool selected_only)
     for (auto & entry : m_entries)
     {
         if (!selected_only || entry->selected)
+        {
             set_entry_tuple(entry.get(), Tuple());
+            journal.record_tuple(entry->number, entry->get_tuple());
+        }
     }
 
     queue_update(Playlist::Metadata, 0, m_entries.len());
@@ -1213,6 +1585,7 @@ void PlaylistData::reset_tuple_of_file(const char * filename)
         if (!strcmp(entry->filename, filename))
         {
             set_entry_tuple(entry.get(), Tuple());
+            journal.record_tuple(entry->number, entry->get_tuple());
             queue_update(Playlist::Metadata, entry->number, 1);
             found = true;
         }
@@ -1222,6 +1595,188 @@ void PlaylistData::reset_tuple_of_file(const char * filename)
         pl_signal_rescan_needed(m_id);
 }
 
+void PlaylistData::get_items(Index<PlaylistAddItem> & items) const
+{
+    for (auto & entry : m_entries)
+    {
+        if (entry->snapshot)
+            items.append(entry->filename,
+                         entry->snapshot->tuple(entry->snapshot_row));
+        else
+            items.append(entry->filename, entry->get_tuple());
+    }
+}
+
+void PlaylistData::fill_snapshot(SnapshotWriter & writer) const
+{
+    writer.set_title(title);
+
+    for (auto & entry : m_entries)
+    {
+        if (entry->snapshot)
+            writer.add(entry->filename, *entry->snapshot, entry->snapshot_row);
+        else
+            writer.add(entry->filename, entry->get_tuple());
+    }
+}
+
+bool PlaylistData::replay_rearrange(JournalReader & reader)
+{
+    int n_entries = m_entries.len();
+    int n_runs = reader.get_int();
+
+    Index<int> numbers;
+    Index<bool> used;
+    used.insert(0, n_entries);
+
+    for (int run = 0; run < n_runs && reader.ok(); run++)
+    {
+        int first = reader.get_int();
+        int length = reader.get_int();
+        if (!length || length < -n_entries || length > n_entries ||
+            first < 0 || first >= n_entries)
+            return false;
+
+        int step = (length < 0) ? -1 : 1;
+        int last = first + length - step;
+
+        if (last < 0 || last >= n_entries)
+            return false;
+
+        for (int i = first; i != last + step; i += step)
+        {
+            if (used[i])
+                return false;
+
+            used[i] = true;
+            numbers.append(i);
+        }
+    }
+
+    if (!reader.ok())
+        return false;
+
+    int update_flags = 0;
+    m_next_pick = nullptr;
+
+    for (int i = 0; i < n_entries; i++)
+    {
+        if (used[i])
+            continue;
+
+        PlaylistEntry * entry = m_entries[i].get();
+
+        if (entry == m_position)
+            change_position(NO_POS);
+        if (entry == m_focus)
+            m_focus = nullptr;
+
+        if (entry->queued)
+        {
+            m_queued.remove(m_queued.find(entry), 1);
+            update_flags |= QueueChanged;
+        }
+
+        if (entry->selected)
+        {
+            m_selected_count--;
+            m_selected_length -= entry->length;
+        }
+
+        m_total_length -= entry->length;
+    }
+
+    Index<EntryPtr> entries;
+    entries.insert(0, numbers.len());
+
+    for (int i = 0; i < numbers.len(); i++)
+        entries[i] = std::move(m_entries[numbers[i]]);
+
+    m_entries = std::move(entries);
+
+    number_entries(0, m_entries.len());
+    queue_update(Playlist::Structure, 0, m_entries.len(), update_flags);
+
+    return true;
+}
+
+int64_t PlaylistData::replay_journal(const char * data, int64_t len)
+{
+    JournalReader reader(data, len);
+    int op;
+
+    while ((op = reader.next()))
+    {
+        switch (op)
+        {
+        case PlaylistJournal::Insert:
+        {
+            int at = reader.get_int();
+            int count = reader.get_int();
+
+            Index<PlaylistAddItem> items;
+            for (int i = 0; i < count && reader.ok(); i++)
+            {
+                String filename = reader.get_str();
+                Tuple tuple = reader.get_tuple();
+                items.append(filename, std::move(tuple));
+            }
+
+            if (reader.ok() && at >= 0 && at <= m_entries.len() && count >= 0)
+                insert_items(at, std::move(items));
+            else
+                reader.fail();
+
+            break;
+        }
+
+        case PlaylistJournal::Rearrange:
+            if (!replay_rearrange(reader))
+                reader.fail();
+
+            break;
+
+        case PlaylistJournal::SetTuple:
+        {
+            int entry_num = reader.get_int();
+            Tuple tuple = reader.get_tuple();
+            PlaylistEntry * entry = entry_at(entry_num);
+
+            if (reader.ok() && entry)
+            {
+                set_entry_tuple(entry, std::move(tuple));
+                queue_update(Playlist::Metadata, entry_num, 1);
+            }
+            else
+                reader.fail();
+
+            break;
+        }
+
+        case PlaylistJournal::SetTitle:
+        {
+            String new_title = reader.get_str();
+
+            if (reader.ok() && new_title)
+                title = new_title;
+            else
+                reader.fail();
+
+            break;
+        }
+
+        default:
+            reader.fail();
+            break;
+        }
+    }
+
+    /* the changes replayed are already saved */
+    journal.clear();
+
+    return reader.valid_length();
+}
+
 PlaylistEntry * PlaylistData::find_unselected_focus()
 {
     if (!m_focus || !m_focus->selected)
@@ -20,9 +20,13 @@
 #ifndef PLAYLIST_DATA_H
 #define PLAYLIST_DATA_H
 
+#include "playlist-journal.h"
 #include "playlist.h"
 #include "scanner.h"
 
+class PlaylistSnapshot;
+class PlaylistSort;
+class SnapshotWriter;
 class TupleCompiler;
 struct PlaylistEntry;
 
@@ -44,31 +48,44 @@ public:
         ScanEnding
     };
 
-    struct CompareData
+    /* what was read for an entry by a ScanRequest */
+    struct ScanResult
     {
-        Playlist::StringCompareFunc filename_compare;
-        Playlist::TupleCompareFunc tuple_compare;
+        PlaylistEntry * entry;
+        PluginHandle * decoder;
+        Tuple tuple;
+        String error;
     };
 
     PlaylistData(Playlist::ID * m_id, const char * title);
     ~PlaylistData();
 
+    /* sets the title, recording the change to be saved */
+    void set_title(const char * new_title);
+
     PlaylistEntry * entry_at(int i);
     const PlaylistEntry * entry_at(int i) const;
 
     String entry_filename(int i) const;
     PluginHandle * entry_decoder(int i, String * error = nullptr) const;
     Tuple entry_tuple(int i, String * error = nullptr) const;
+    /* same as entry_tuple(i).get_str(field), usually without creating the
+     * tuple */
+    String entry_str(int i, Tuple::Field field) const;
 
     void cancel_updates();
     void swap_updates(bool & position_changed);
 
     void insert_items(int at, Index<PlaylistAddItem> && items);
+    void insert_snapshot(PlaylistSnapshot * snapshot);
     void remove_entries(int at, int number);
 
     int position() const;
     int focus() const;
 
+    void set_scan_priority_range(int at, int number);
+    void get_scan_priority_range(int & at, int & end) const;
+
     bool entry_selected(int entry_num) const;
     int n_selected(int at, int number) const;
 
@@ -79,8 +96,8 @@ public:
     int shift_entries(int entry_num, int distance);
     void remove_selected();
 
-    void sort(const CompareData & data);
-    void sort_selected(const CompareData & data);
+    void fill_sort(PlaylistSort & sort, bool selected_only) const;
+    void apply_sort(const PlaylistSort & sort);
 
     void reverse_order();
     void randomize_order();
@@ -102,28 +119,42 @@ public:
 
     bool prev_song();
     bool next_song(bool repeat);
+    int peek_next_song(bool repeat);
     bool prev_album();
     bool next_album(bool repeat);
 
-    int next_unscanned_entry(int entry_num) const;
+    int next_unscanned_entry(int entry_num, int end = -1) const;
+    void scan_upcoming_rows(int max, Index<int> & rows) const;
     bool entry_needs_rescan(PlaylistEntry * entry, bool need_decoder,
                             bool need_tuple);
     ScanRequest * create_scan_request(PlaylistEntry * entry,
                                       ScanRequest::Callback callback,
                                       int extra_flags);
-    void update_entry_from_scan(PlaylistEntry * entry, ScanRequest * request,
-                                int update_flags);
+    void update_entries_from_scan(Index<ScanResult> & results,
+                                  int update_flags);
     void update_playback_entry(Tuple && tuple);
 
     void reformat_titles();
     void reset_tuples(bool selected_only);
     void reset_tuple_of_file(const char * filename);
 
+    /* copies the entries for saving, without creating any tuples that are
+     * still in a snapshot */
+    void get_items(Index<PlaylistAddItem> & items) const;
+    void fill_snapshot(SnapshotWriter & writer) const;
+
+    /* applies changes recorded by a PlaylistJournal; returns the length of
+     * the data applied (see JournalReader::valid_length()) */
+    int64_t replay_journal(const char * data, int64_t len);
+
     Playlist::ID * id() const { return m_id; }
 
     int n_entries() const { return m_entries.len(); }
     int n_queued() const { return m_queued.len(); }
 
+    /* changes whenever entries are added, removed, or moved */
+    int structure_serial() const { return m_structure_serial; }
+
     int64_t total_length() const { return m_total_length; }
     int64_t selected_length() const { return m_selected_length; }
 
@@ -146,15 +177,17 @@ private:
     static void delete_entry(PlaylistEntry * entry);
     typedef SmartPtr<PlaylistEntry, delete_entry> EntryPtr;
 
+    static void delete_snapshot(PlaylistSnapshot * snapshot);
+    typedef SmartPtr<PlaylistSnapshot, delete_snapshot> SnapshotPtr;
+
     void number_entries(int at, int length);
+    void journal_rearrange(int old_len);
+    bool replay_rearrange(JournalReader & reader);
     void set_entry_tuple(PlaylistEntry * entry, Tuple && tuple);
     void queue_update(Playlist::UpdateLevel level, int at, int count,
                       int flags = 0);
     void queue_position_change();
 
-    static void sort_entries(Index<EntryPtr> & entries,
-                             const CompareData & data);
-
     int shuffle_pos_before(int ref_pos) const;
     PosChange shuffle_pos_after(int ref_pos, bool by_album) const;
     PosChange shuffle_pos_random(bool repeat, bool by_album) const;
@@ -166,6 +199,8 @@ private:
     PosChange pos_new_full(bool repeat, bool shuffle, bool by_album,
                            int hint_pos, bool & repeated) const;
 
+    PosChange next_pos_change(bool repeat, int hint_pos, bool & repeated) const;
+
     void change_position(PosChange change);
     bool change_position_to_next(bool repeat, int hint_pos);
     void shuffle_reset();
@@ -177,9 +212,11 @@ public:
     ScanStatus scan_status;
     String filename, title;
     int resume_time;
+    PlaylistJournal journal; /* changes not yet saved */
 
 private:
     Playlist::ID * m_id;
+    Index<SnapshotPtr> m_snapshots; /* must outlive m_entries */
     Index<EntryPtr> m_entries;
     PlaylistEntry *m_position, *m_focus;
     int m_selected_count;
@@ -188,6 +225,10 @@ private:
     int64_t m_total_length, m_selected_length;
     Playlist::Update m_last_update, m_next_update;
     bool m_position_changed;
+    int m_scan_priority_at, m_scan_priority_end;
+    PlaylistEntry * m_next_pick; /* set by peek_next_song() */
+    bool m_next_pick_repeated;
+    int m_structure_serial;
 };
 
 /* callbacks or "signals" (in the QObject sense) */
@@ -114,24 +114,8 @@ bool PlaylistEx::insert_flat_playlist(const char * filename) const
     return true;
 }
 
-EXPORT bool Playlist::save_to_file(const char * filename, GetMode mode) const
+PlaylistPlugin * playlist_get_saver(const char * filename)
 {
-    String title = get_title();
-
-    Index<PlaylistAddItem> items;
-    items.insert(0, n_entries());
-
-    int i = 0;
-    for (PlaylistAddItem & item : items)
-    {
-        item.filename = entry_filename(i);
-        item.tuple = entry_tuple(i, mode);
-        item.tuple.delete_fallbacks();
-        i++;
-    }
-
-    AUDINFO("Saving playlist %s.\n", filename);
-
     StringBuf ext = uri_get_extension(filename);
 
     if (ext)
@@ -147,27 +131,55 @@ EXPORT bool Playlist::save_to_file(const char * filename, GetMode mode) const
             if (!pp || !pp->can_save)
                 continue;
 
-            VFSFile file(filename, "w");
-            if (!file)
-            {
-                aud_ui_show_error(str_printf(_("Error opening %s:\n%s"),
-                                             filename, file.error()));
-                return false;
-            }
-
-            if (pp->save(filename, file, title, items) && file.fflush() == 0)
-                return true;
-
-            aud_ui_show_error(str_printf(_("Error saving %s."), filename));
-            return false;
+            return pp;
         }
     }
 
     aud_ui_show_error(str_printf(
         _("Cannot save %s: unsupported file name extension."), filename));
+    return nullptr;
+}
+
+bool playlist_save(PlaylistPlugin * pp, const char * filename,
+                   const char * title, const Index<PlaylistAddItem> & items)
+{
+    AUDINFO("Saving playlist %s.\n", filename);
+
+    VFSFile file(filename, "w");
+    if (!file)
+    {
+        aud_ui_show_error(str_printf(_("Error opening %s:\n%s"), filename,
+                                     file.error()));
+        return false;
+    }
+
+    if (pp->save(filename, file, title, items) && file.fflush() == 0)
+        return true;
+
+    aud_ui_show_error(str_printf(_("Error saving %s."), filename));
     return false;
 }
 
+EXPORT bool Playlist::save_to_file(const char * filename, GetMode mode) const
+{
+    String title = get_title();
+
+    Index<PlaylistAddItem> items;
+    items.insert(0, n_entries());
+
+    int i = 0;
+    for (PlaylistAddItem & item : items)
+    {
+        item.filename = entry_filename(i);
+        item.tuple = entry_tuple(i, mode);
+        item.tuple.delete_fallbacks();
+        i++;
+    }
+
+    PlaylistPlugin * pp = playlist_get_saver(filename);
+    return pp && playlist_save(pp, filename, title, items);
+}
+
 EXPORT Index<Playlist::SaveFormat> Playlist::save_formats()
 {
     Index<Playlist::SaveFormat> formats;
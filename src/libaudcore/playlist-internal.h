@@ -24,6 +24,9 @@
 #include "vfs.h"
 
 class InputPlugin;
+class PlaylistPlugin;
+class PlaylistSnapshot;
+class SnapshotWriter;
 
 struct DecodeInfo
 {
@@ -49,6 +52,22 @@ public:
 
     bool insert_flat_playlist(const char * filename) const;
     void insert_flat_items(int at, Index<PlaylistAddItem> && items) const;
+
+    /* returns the changes recorded since the last call, and optionally the
+     * contents of the playlist in the same state */
+    Index<char> take_journal(String * title = nullptr,
+                             Index<PlaylistAddItem> * items = nullptr) const;
+
+    /* applies recorded changes; returns the length of the data applied */
+    int64_t replay_journal(const char * data, int64_t len) const;
+
+    /* the playlist takes ownership of the snapshot */
+    void insert_snapshot(PlaylistSnapshot * snapshot) const;
+    void fill_snapshot(SnapshotWriter & writer) const;
+
+    /* same as entry_tuple(entry_num, mode).get_str(field) */
+    String entry_str(int entry_num, Tuple::Field field,
+                     GetMode mode = Wait) const;
 };
 
 /* playlist.cc */
@@ -61,6 +80,7 @@ void playlist_load_state();
 void playlist_save_state();
 
 DecodeInfo playback_entry_read(int serial);
+void playback_entry_prefetch(int serial, bool repeat);
 void playback_entry_set_tuple(int serial, Tuple && tuple);
 
 /* playlist-cache.cc */
@@ -70,6 +90,23 @@ void playlist_cache_clear();
 /* playlist-files.cc */
 bool playlist_load(const char * filename, String & title,
                    Index<PlaylistAddItem> & items);
+PlaylistPlugin * playlist_get_saver(const char * filename);
+bool playlist_save(PlaylistPlugin * pp, const char * filename,
+                   const char * title, const Index<PlaylistAddItem> & items);
+
+/* playlist-journal.cc */
+bool playlist_snapshot_load(PlaylistEx playlist, const char * folder);
+void playlist_snapshot_save(PlaylistEx playlist, const char * folder);
+void playlist_snapshot_remove(int stamp, const char * folder);
+
+/* if <replay> is false, the playlist was loaded from a snapshot that already
+ * includes the changes in the journal */
+void playlist_journal_load(PlaylistEx playlist, const char * folder,
+                           bool replay = true);
+void playlist_journal_save(PlaylistEx playlist, const char * folder,
+                           bool exiting);
+void playlist_journal_prune(const Index<int> & stamps);
+void playlist_journal_end();
 
 /* playlist-utils.cc */
 void load_playlists();
@@ -0,0 +1,801 @@
+/*
+ * playlist-journal.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "playlist-journal.h"
+#include "playlist-internal.h"
+#include "playlist-snapshot.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <thread>
+
+#include "audstrings.h"
+#include "internal.h"
+#include "multihash.h"
+#include "runtime.h"
+
+/* Each saved playlist (<stamp>.audpl) may have a journal (<stamp>.audpl.journal)
+ * holding the changes made since the playlist file was written.  At autosave,
+ * only the newly recorded changes are appended to the journal.  When the
+ * journal grows past a quarter of the size of the playlist file, a new
+ * playlist file is written in the background and the journal started over.
+ *
+ * The journal begins with a header identifying (by size and modification time)
+ * the playlist file it applies to, so that a journal left over from an older
+ * playlist file is never applied to a newer one.  A new playlist file is
+ * written under a temporary name and renamed into place only once the journal
+ * of changes made after it (<stamp>.audpl.journal.new) has been written; on
+ * loading, whichever journal matches the playlist file is used.
+ *
+ * At exit, a snapshot of each playlist (<stamp>.audpl.snap) is written as well,
+ * recording the playlist and journal files it is equivalent to.  At startup,
+ * if both files are unchanged, the snapshot is loaded in place of them.  The
+ * snapshot of a playlist is removed whenever the playlist is saved again. */
+
+#define JOURNAL_SUFFIX ".journal"
+#define NEW_SUFFIX ".new"
+#define TEMP_SUFFIX ".tmp"
+#define SNAPSHOT_SUFFIX ".snap"
+
+#define MIN_COMPACT_SIZE (256 * 1024)
+
+static const char journal_magic[8] = {'A', 'U', 'D', 'J', 'R', 'N', 'L', '1'};
+
+struct JournalHeader
+{
+    char magic[8];
+    FileStamp base; /* of the playlist file */
+};
+
+struct JournalState
+{
+    FileStamp base;
+    int64_t journal_size = 0; /* 0 if there is no journal file */
+
+    /* background compaction */
+    bool compacting = false;
+    std::thread thread;
+    std::atomic<bool> done{false};
+    bool compact_ok = false; /* set by the thread */
+    FileStamp new_base;      /* set by the thread */
+    Index<char> since_snapshot;
+
+    ~JournalState()
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+};
+
+static SimpleHash<IntHashKey, SmartPtr<JournalState>> states;
+
+/* --- RECORDING --- */
+
+static uint32_t checksum(const char * data, int len)
+{
+    uint32_t sum = 2166136261u; /* FNV-1a */
+    for (int i = 0; i < len; i++)
+        sum = (sum ^ (unsigned char)data[i]) * 16777619u;
+
+    return sum;
+}
+
+void PlaylistJournal::begin(Op op)
+{
+    m_start = m_data.len();
+    put((uint32_t)0); /* length */
+    put((uint32_t)0); /* checksum */
+    put((uint8_t)op);
+}
+
+void PlaylistJournal::end()
+{
+    int start = m_start + 2 * sizeof(uint32_t);
+    uint32_t len = m_data.len() - start;
+    uint32_t sum = checksum(&m_data[start], len);
+
+    memcpy(&m_data[m_start], &len, sizeof len);
+    memcpy(&m_data[m_start + sizeof len], &sum, sizeof sum);
+}
+
+void PlaylistJournal::put_str(const char * str)
+{
+    uint32_t len = str ? strlen(str) : 0;
+    put(len);
+    m_data.insert(str, -1, len);
+}
+
+void PlaylistJournal::put_tuple(const Tuple & orig)
+{
+    /* fallback fields are regenerated when the tuple is loaded */
+    Tuple tuple = orig.ref();
+    tuple.delete_fallbacks();
+
+    put((uint8_t)tuple.state());
+
+    uint16_t n_fields = 0;
+    int count_at = m_data.len();
+    put(n_fields);
+
+    for (auto field : Tuple::all_fields())
+    {
+        /* the formatted title depends on settings and is not saved */
+        auto type = tuple.get_value_type(field);
+        if (type == Tuple::Empty || field == Tuple::FormattedTitle)
+            continue;
+
+        put_str(Tuple::field_get_name(field));
+        put((uint8_t)type);
+
+        if (type == Tuple::Int)
+            put((int32_t)tuple.get_int(field));
+        else
+            put_str(tuple.get_str(field));
+
+        n_fields++;
+    }
+
+    memcpy(&m_data[count_at], &n_fields, sizeof n_fields);
+}
+
+void PlaylistJournal::record_insert(int at, const Index<PlaylistAddItem> & items)
+{
+    begin(Insert);
+    put((int32_t)at);
+    put((int32_t)items.len());
+
+    for (auto & item : items)
+    {
+        put_str(item.filename);
+        put_tuple(item.tuple);
+    }
+
+    end();
+}
+
+void PlaylistJournal::record_remove(int old_len, int at, int number)
+{
+    if (!number)
+        return;
+
+    int after = old_len - at - number;
+
+    begin(Rearrange);
+    put((int32_t)((at > 0) + (after > 0)));
+
+    if (at > 0)
+    {
+        put((int32_t)0);
+        put((int32_t)at);
+    }
+
+    if (after > 0)
+    {
+        put((int32_t)(at + number));
+        put((int32_t)after);
+    }
+
+    end();
+}
+
+void PlaylistJournal::record_rearrange(int old_len, const Index<int> & numbers)
+{
+    int n = numbers.len();
+    bool same = (n == old_len);
+
+    for (int i = 0; same && i < n; i++)
+        same = (numbers[i] == i);
+
+    if (same)
+        return;
+
+    begin(Rearrange);
+
+    int32_t n_runs = 0;
+    int count_at = m_data.len();
+    put(n_runs);
+
+    for (int i = 0; i < n;)
+    {
+        int first = numbers[i];
+        int len = 1;
+
+        if (i + 1 < n && numbers[i + 1] == first - 1)
+        {
+            while (i + len < n && numbers[i + len] == first - len)
+                len++;
+
+            put((int32_t)first);
+            put((int32_t)-len);
+        }
+        else
+        {
+            while (i + len < n && numbers[i + len] == first + len)
+                len++;
+
+            put((int32_t)first);
+            put((int32_t)len);
+        }
+
+        i += len;
+        n_runs++;
+    }
+
+    memcpy(&m_data[count_at], &n_runs, sizeof n_runs);
+
+    end();
+}
+
+void PlaylistJournal::record_tuple(int entry, const Tuple & tuple)
+{
+    begin(SetTuple);
+    put((int32_t)entry);
+    put_tuple(tuple);
+    end();
+}
+
+void PlaylistJournal::record_title(const char * title)
+{
+    begin(SetTitle);
+    put_str(title);
+    end();
+}
+
+/* --- READING --- */
+
+bool JournalReader::check(int64_t len)
+{
+    if (!m_ok || len < 0 || len > m_end - m_pos)
+        return (m_ok = false);
+
+    m_pos += len;
+    return true;
+}
+
+int JournalReader::next()
+{
+    if (!m_ok)
+        return 0;
+
+    m_start = m_pos = m_end;
+
+    uint32_t len, sum;
+    if (m_len - m_pos < (int64_t)(sizeof len + sizeof sum))
+    {
+        m_ok = (m_pos == m_len); /* a partial header is damage */
+        return 0;
+    }
+
+    memcpy(&len, m_data + m_pos, sizeof len);
+    memcpy(&sum, m_data + m_pos + sizeof len, sizeof sum);
+    m_pos += sizeof len + sizeof sum;
+
+    if (!len || len > m_len - m_pos || checksum(m_data + m_pos, len) != sum)
+    {
+        m_ok = false;
+        return 0;
+    }
+
+    m_end = m_pos + len;
+    return (unsigned char)m_data[m_pos++];
+}
+
+int JournalReader::get_int()
+{
+    int32_t val = 0;
+    if (check(sizeof val))
+        memcpy(&val, m_data + m_pos - sizeof val, sizeof val);
+
+    return val;
+}
+
+String JournalReader::get_str()
+{
+    uint32_t len = 0;
+    if (check(sizeof len))
+        memcpy(&len, m_data + m_pos - sizeof len, sizeof len);
+
+    if (!check(len))
+        return String();
+
+    return String(str_copy(m_data + m_pos - len, len));
+}
+
+Tuple JournalReader::get_tuple()
+{
+    Tuple tuple;
+
+    uint8_t state = 0;
+    uint16_t n_fields = 0;
+
+    if (check(sizeof state))
+        state = m_data[m_pos - 1];
+    if (check(sizeof n_fields))
+        memcpy(&n_fields, m_data + m_pos - sizeof n_fields, sizeof n_fields);
+
+    for (int i = 0; i < n_fields && m_ok; i++)
+    {
+        String name = get_str();
+        Tuple::Field field = name ? Tuple::field_by_name(name) : Tuple::Invalid;
+
+        uint8_t type = Tuple::Empty;
+        if (check(sizeof type))
+            type = m_data[m_pos - 1];
+
+        if (type == Tuple::Int)
+        {
+            int val = get_int();
+            if (field >= 0 && Tuple::field_get_type(field) == Tuple::Int)
+                tuple.set_int(field, val);
+        }
+        else
+        {
+            String str = get_str();
+            if (field >= 0 && str &&
+                Tuple::field_get_type(field) == Tuple::String)
+                tuple.set_str(field, str);
+        }
+    }
+
+    if (state <= Tuple::Failed)
+        tuple.set_state((Tuple::State)state);
+
+    return tuple;
+}
+
+/* --- JOURNAL FILES --- */
+
+static StringBuf playlist_path(const char * folder, int stamp,
+                               const char * suffix = "")
+{
+    return filename_build(
+        {folder, str_concat({int_to_str(stamp), ".audpl", suffix})});
+}
+
+static bool get_stamp(const char * path, FileStamp & stamp)
+{
+    GStatBuf info;
+    if (g_stat(path, &info) < 0)
+        return false;
+
+    stamp.size = info.st_size;
+    stamp.mtime = info.st_mtime;
+    return true;
+}
+
+/* a missing file has size -1 */
+static FileStamp get_stamp_or_missing(const char * path)
+{
+    FileStamp stamp;
+    if (!get_stamp(path, stamp))
+        stamp = {-1, -1};
+
+    return stamp;
+}
+
+static bool finish_write(FILE * file, bool success)
+{
+    success = success && fflush(file) == 0;
+#ifndef _WIN32
+    success = success && fsync(fileno(file)) == 0;
+#endif
+    return !fclose(file) && success;
+}
+
+static bool write_journal(const char * path, const FileStamp & base,
+                          const char * data, int64_t len)
+{
+    FILE * file = g_fopen(path, "wb");
+    if (!file)
+        return false;
+
+    JournalHeader header;
+    memcpy(header.magic, journal_magic, sizeof journal_magic);
+    header.base = base;
+
+    bool success = fwrite(&header, sizeof header, 1, file) == 1 &&
+                   fwrite(data, 1, len, file) == (size_t)len;
+
+    return finish_write(file, success);
+}
+
+static bool append_journal(const char * path, const Index<char> & records)
+{
+    FILE * file = g_fopen(path, "ab");
+    if (!file)
+        return false;
+
+    bool success = fwrite(records.begin(), 1, records.len(), file) ==
+                   (size_t)records.len();
+
+    return finish_write(file, success);
+}
+
+static bool replace_file(const char * from, const char * to)
+{
+#ifdef _WIN32
+    g_unlink(to);
+#endif
+
+    return g_rename(from, to) == 0;
+}
+
+/* Writing out a large playlist is what compaction is meant to keep off the main
+ * thread, so the plugin is called here.  This is safe because:
+ *  - playlist plugins are already called from other threads (load() runs in
+ *    the adder thread), and save() is given its own copy of the entries;
+ *  - playlist_save() reports errors with aud_ui_show_error(), which only
+ *    queues an event;
+ *  - playlist plugins have no start/stop and are unloaded only at shutdown,
+ *    after playlist_journal_end() has joined this thread. */
+static void compact_worker(JournalState * state, PlaylistPlugin * pp,
+                           String path, String title,
+                           Index<PlaylistAddItem> items)
+{
+    for (auto & item : items)
+        item.tuple.delete_fallbacks();
+
+    state->compact_ok = playlist_save(pp, filename_to_uri(path), title, items) &&
+                        get_stamp(path, state->new_base);
+
+    state->done.store(true);
+}
+
+static void stop_compaction(JournalState * state, const char * folder,
+                            int stamp)
+{
+    if (state->thread.joinable())
+        state->thread.join();
+    state->compacting = false;
+    state->done.store(false);
+    state->since_snapshot.clear();
+
+    g_unlink(playlist_path(folder, stamp, TEMP_SUFFIX));
+}
+
+static void finish_compaction(JournalState * state, const char * folder,
+                              int stamp)
+{
+    state->thread.join();
+
+    StringBuf path = playlist_path(folder, stamp);
+    StringBuf temp = playlist_path(folder, stamp, TEMP_SUFFIX);
+    StringBuf journal = playlist_path(folder, stamp, JOURNAL_SUFFIX);
+    StringBuf journal_new =
+        playlist_path(folder, stamp, JOURNAL_SUFFIX NEW_SUFFIX);
+
+    auto & since = state->since_snapshot;
+
+    if (state->compact_ok &&
+        write_journal(journal_new, state->new_base, since.begin(), since.len()))
+    {
+        if (replace_file(temp, path))
+        {
+            replace_file(journal_new, journal);
+
+            state->base = state->new_base;
+            state->journal_size = sizeof(JournalHeader) + since.len();
+        }
+        else
+        {
+            AUDERR("Failed to rename %s.\n", (const char *)temp);
+            g_unlink(journal_new);
+        }
+    }
+
+    stop_compaction(state, folder, stamp);
+}
+
+/* writes the whole playlist and starts a new (empty) journal */
+static void save_full(PlaylistEx playlist, const char * folder)
+{
+    int stamp = playlist.stamp();
+
+    SmartPtr<JournalState> * ptr = states.lookup(stamp);
+    if (ptr && (*ptr)->compacting)
+        stop_compaction(ptr->get(), folder, stamp);
+
+    String title;
+    Index<PlaylistAddItem> items;
+    playlist.take_journal(&title, &items);
+
+    for (auto & item : items)
+        item.tuple.delete_fallbacks();
+
+    StringBuf path = playlist_path(folder, stamp);
+    StringBuf temp = playlist_path(folder, stamp, TEMP_SUFFIX);
+
+    PlaylistPlugin * pp = playlist_get_saver(path);
+    FileStamp base;
+
+    if (!pp || !playlist_save(pp, filename_to_uri(temp), title, items) ||
+        !get_stamp(temp, base) || !replace_file(temp, path))
+    {
+        g_unlink(temp);
+        states.remove(stamp);
+        return;
+    }
+
+    g_unlink(playlist_path(folder, stamp, JOURNAL_SUFFIX));
+    g_unlink(playlist_path(folder, stamp, JOURNAL_SUFFIX NEW_SUFFIX));
+
+    JournalState * state = new JournalState;
+    state->base = base;
+    states.add(stamp, SmartPtr<JournalState>(state));
+}
+
+void playlist_journal_load(PlaylistEx playlist, const char * folder,
+                           bool replay)
+{
+    int stamp = playlist.stamp();
+
+    StringBuf path = playlist_path(folder, stamp);
+    StringBuf journal = playlist_path(folder, stamp, JOURNAL_SUFFIX);
+    StringBuf journal_new =
+        playlist_path(folder, stamp, JOURNAL_SUFFIX NEW_SUFFIX);
+
+    /* the entries just loaded are already saved */
+    playlist.take_journal();
+
+    FileStamp base;
+    if (!get_stamp(path, base))
+        return;
+
+    JournalState * state = new JournalState;
+    state->base = base;
+    states.add(stamp, SmartPtr<JournalState>(state));
+
+    if (!replay)
+    {
+        FileStamp journal_stamp;
+        if (get_stamp(journal, journal_stamp))
+            state->journal_size = journal_stamp.size;
+
+        return;
+    }
+
+    for (bool is_new : {true, false})
+    {
+        const char * name = is_new ? journal_new : journal;
+
+        /* journals can be larger than VFSFile::read_file() allows */
+        GMappedFile * mapped = g_mapped_file_new(name, false, nullptr);
+        if (!mapped)
+            continue;
+
+        const char * data = g_mapped_file_get_contents(mapped);
+        int64_t data_len = g_mapped_file_get_length(mapped);
+
+        JournalHeader header = JournalHeader();
+        if (data_len >= (int64_t)sizeof header)
+            memcpy(&header, data, sizeof header);
+
+        if (memcmp(header.magic, journal_magic, sizeof journal_magic) ||
+            header.base != base)
+        {
+            g_mapped_file_unref(mapped);
+            continue;
+        }
+
+        AUDINFO("Replaying %s.\n", name);
+
+        const char * records = data + sizeof header;
+        int64_t len = data_len - sizeof header;
+        int64_t valid = playlist.replay_journal(records, len);
+
+        /* drop a damaged tail, so that new records are not appended after it;
+         * the data is copied since the file must be closed to replace it */
+        bool rewrite = (valid < len || is_new);
+
+        Index<char> kept;
+        if (rewrite)
+            kept.insert(records, 0, valid);
+
+        g_mapped_file_unref(mapped);
+
+        if (rewrite && (!write_journal(journal_new, base, kept.begin(), valid) ||
+                        !replace_file(journal_new, journal)))
+        {
+            AUDERR("Failed to rewrite %s.\n", (const char *)journal);
+            break;
+        }
+
+        state->journal_size = sizeof header + valid;
+        break;
+    }
+
+    g_unlink(journal_new);
+    g_unlink(playlist_path(folder, stamp, TEMP_SUFFIX));
+}
+
+void playlist_journal_save(PlaylistEx playlist, const char * folder,
+                           bool exiting)
+{
+    int stamp = playlist.stamp();
+
+    SmartPtr<JournalState> * ptr = states.lookup(stamp);
+    if (!ptr)
+    {
+        save_full(playlist, folder);
+        return;
+    }
+
+    JournalState * state = ptr->get();
+
+    if (state->compacting && (exiting || state->done.load()))
+        finish_compaction(state, folder, stamp);
+
+    bool compact =
+        !exiting && !state->compacting &&
+        state->journal_size > aud::max((int64_t)MIN_COMPACT_SIZE,
+                                       state->base.size / 4);
+
+    PlaylistPlugin * pp = nullptr;
+    if (compact && !(pp = playlist_get_saver(playlist_path(folder, stamp))))
+        compact = false;
+
+    String title;
+    Index<PlaylistAddItem> items;
+    Index<char> records = compact ? playlist.take_journal(&title, &items)
+                                  : playlist.take_journal();
+
+    if (records.len())
+    {
+        StringBuf journal = playlist_path(folder, stamp, JOURNAL_SUFFIX);
+
+        bool success =
+            state->journal_size
+                ? append_journal(journal, records)
+                : write_journal(journal, state->base, records.begin(),
+                                records.len());
+
+        if (!success)
+        {
+            AUDERR("Failed to write %s.\n", (const char *)journal);
+
+            /* the changes are not lost; they are in the playlist itself */
+            save_full(playlist, folder);
+            return;
+        }
+
+        state->journal_size = aud::max(state->journal_size,
+                                       (int64_t)sizeof(JournalHeader)) +
+                              records.len();
+
+        if (state->compacting)
+            state->since_snapshot.insert(records.begin(), -1, records.len());
+    }
+
+    if (compact)
+    {
+        AUDINFO("Compacting journal of playlist %d.\n", stamp);
+
+        state->compacting = true;
+        state->compact_ok = false;
+        state->thread =
+            std::thread(compact_worker, state, pp,
+                        String(playlist_path(folder, stamp, TEMP_SUFFIX)),
+                        std::move(title), std::move(items));
+    }
+}
+
+/* returns the snapshot of a playlist if it matches the playlist and journal
+ * files, or nullptr */
+static PlaylistSnapshot * open_snapshot(const char * folder, int stamp)
+{
+    /* an interrupted compaction is left to playlist_journal_load() */
+    if (get_stamp_or_missing(
+            playlist_path(folder, stamp, JOURNAL_SUFFIX NEW_SUFFIX))
+            .size >= 0)
+        return nullptr;
+
+    StringBuf path = playlist_path(folder, stamp, SNAPSHOT_SUFFIX);
+    SmartPtr<PlaylistSnapshot> snapshot(PlaylistSnapshot::open(path));
+
+    if (!snapshot ||
+        snapshot->playlist_stamp() !=
+            get_stamp_or_missing(playlist_path(folder, stamp)) ||
+        snapshot->journal_stamp() !=
+            get_stamp_or_missing(playlist_path(folder, stamp, JOURNAL_SUFFIX)))
+        return nullptr;
+
+    return snapshot.release();
+}
+
+bool playlist_snapshot_load(PlaylistEx playlist, const char * folder)
+{
+    int stamp = playlist.stamp();
+
+    PlaylistSnapshot * snapshot = open_snapshot(folder, stamp);
+    if (!snapshot)
+        return false;
+
+    AUDINFO("Loading playlist %d from snapshot.\n", stamp);
+    playlist.insert_snapshot(snapshot);
+
+    return true;
+}
+
+void playlist_snapshot_save(PlaylistEx playlist, const char * folder)
+{
+    int stamp = playlist.stamp();
+
+    /* playlists that were never saved as .audpl are not snapshotted */
+    FileStamp base;
+    if (!get_stamp(playlist_path(folder, stamp), base))
+        return;
+
+    /* still up to date if the playlist was not changed since it was loaded */
+    SmartPtr<PlaylistSnapshot> current(open_snapshot(folder, stamp));
+    if (current)
+        return;
+
+    SnapshotWriter writer;
+    playlist.fill_snapshot(writer);
+
+    FileStamp journal =
+        get_stamp_or_missing(playlist_path(folder, stamp, JOURNAL_SUFFIX));
+    Index<char> data = writer.finish(base, journal);
+
+    StringBuf path = playlist_path(folder, stamp, SNAPSHOT_SUFFIX);
+    StringBuf temp = playlist_path(folder, stamp, SNAPSHOT_SUFFIX TEMP_SUFFIX);
+
+    FILE * file = g_fopen(temp, "wb");
+    bool success = false;
+
+    if (file)
+        success = finish_write(
+            file, fwrite(data.begin(), 1, data.len(), file) == (size_t)data.len());
+
+    if (!success || !replace_file(temp, path))
+    {
+        AUDERR("Failed to write %s.\n", (const char *)path);
+        g_unlink(temp);
+    }
+}
+
+void playlist_snapshot_remove(int stamp, const char * folder)
+{
+    g_unlink(playlist_path(folder, stamp, SNAPSHOT_SUFFIX));
+}
+
+void playlist_journal_prune(const Index<int> & stamps)
+{
+    Index<int> removed;
+
+    states.iterate([&](const IntHashKey & key, SmartPtr<JournalState> &) {
+        if (stamps.find(key) < 0)
+            removed.append(key);
+    });
+
+    /* the destructor waits for any compaction in progress; the files are
+     * removed along with the playlist file */
+    for (int stamp : removed)
+        states.remove(stamp);
+}
+
+void playlist_journal_end() { states.clear(); }
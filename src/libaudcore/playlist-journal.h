@@ -0,0 +1,115 @@
+/*
+ * playlist-journal.h
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_PLAYLIST_JOURNAL_H
+#define LIBAUDCORE_PLAYLIST_JOURNAL_H
+
+#include <stdint.h>
+
+#include "index.h"
+#include "tuple.h"
+
+/* The changes made to a playlist, recorded as they are made so that they can
+ * be appended to the playlist's journal file at the next autosave, instead of
+ * rewriting the whole playlist (see playlist-journal.cc).
+ *
+ * Each record is framed as a uint32 length and a uint32 checksum of the
+ * payload, followed by the payload: a uint8 operation and its arguments, all
+ * in native byte order.  A string is a uint32 length followed by the bytes; a
+ * tuple is a uint8 state, a uint16 number of fields, and for each field its
+ * name (as a string), a uint8 type, and either an int32 or a string value.
+ *
+ *   Insert:    int32 position, int32 count, count * (string filename, tuple)
+ *   Rearrange: int32 number of runs, runs * (int32 first, int32 length)
+ *              where the new list of entries is the concatenation of the runs
+ *              of old entries (first, first + 1, ... or, for a negative
+ *              length, first, first - 1, ...); entries in no run are removed
+ *   SetTuple:  int32 entry, tuple
+ *   SetTitle:  string title */
+class PlaylistJournal
+{
+public:
+    enum Op
+    {
+        Insert = 1,
+        Rearrange,
+        SetTuple,
+        SetTitle
+    };
+
+    bool empty() const { return !m_data.len(); }
+    Index<char> take() { return std::move(m_data); }
+    void clear() { m_data.clear(); }
+
+    void record_insert(int at, const Index<PlaylistAddItem> & items);
+    void record_remove(int old_len, int at, int number);
+    /* <numbers> holds the former number of each entry in the new order */
+    void record_rearrange(int old_len, const Index<int> & numbers);
+    void record_tuple(int entry, const Tuple & tuple);
+    void record_title(const char * title);
+
+private:
+    Index<char> m_data;
+    int m_start = 0;
+
+    void begin(Op op);
+    void end();
+
+    template<class T>
+    void put(const T & val)
+    {
+        m_data.insert((const char *)&val, -1, sizeof val);
+    }
+
+    void put_str(const char * str);
+    void put_tuple(const Tuple & tuple);
+};
+
+/* Reads the records written by PlaylistJournal, stopping at the first one that
+ * is incomplete or damaged (as the last one may be after a crash). */
+class JournalReader
+{
+public:
+    JournalReader(const char * data, int64_t len) : m_data(data), m_len(len) {}
+
+    /* moves to the next record and returns its operation, or 0 at the end */
+    int next();
+
+    /* true if the arguments read so far from the current record were valid */
+    bool ok() const { return m_ok; }
+
+    /* length of the data up to the end of the last record fully applied;
+     * call fail() for a record that could not be applied */
+    int64_t valid_length() const { return m_ok ? m_end : m_start; }
+    void fail() { m_ok = false; }
+
+    int get_int();
+    String get_str();
+    Tuple get_tuple();
+
+private:
+    const char * m_data;
+    int64_t m_len;
+    int64_t m_start = 0, m_pos = 0, m_end = 0;
+    bool m_ok = true;
+
+    bool check(int64_t len);
+};
+
+#endif // LIBAUDCORE_PLAYLIST_JOURNAL_H
@@ -0,0 +1,66 @@
+/*
+ * playlist-prefetch.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "playlist-prefetch.h"
+
+bool PlaylistPrefetch::due(int time, int length, int seconds, int repeat_b)
+{
+    return seconds > 0 && length > 0 && repeat_b < 0 &&
+           time >= length - 1000 * seconds;
+}
+
+void PlaylistPrefetch::start(PlaylistEntry * entry, ScanRequest * request)
+{
+    cancel();
+
+    m_entry = entry;
+    m_request = request;
+}
+
+void PlaylistPrefetch::finish(ScanRequest * request, Result && result)
+{
+    if (!request || request != m_request)
+        return;
+
+    m_request = nullptr;
+    m_ready = true;
+    m_result = std::move(result);
+}
+
+bool PlaylistPrefetch::claim(PlaylistEntry * entry)
+{
+    if (!entry || entry != m_entry || !m_ready)
+    {
+        cancel();
+        return false;
+    }
+
+    m_claimed = true;
+    return true;
+}
+
+bool PlaylistPrefetch::take(PlaylistEntry * entry, Result & result)
+{
+    if (!m_claimed || entry != m_entry)
+        return false;
+
+    result = std::move(m_result);
+    cancel();
+    return true;
+}
@@ -0,0 +1,87 @@
+/*
+ * playlist-prefetch.h
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_PLAYLIST_PREFETCH_H
+#define LIBAUDCORE_PLAYLIST_PREFETCH_H
+
+#include "index.h"
+#include "objects.h"
+#include "vfs.h"
+
+class InputPlugin;
+class ScanRequest;
+struct PlaylistEntry;
+
+/* The entry to be played next is scanned and its file opened ahead of time
+ * (see playback_entry_prefetch()), so that the playback thread can start on it
+ * without waiting for the device.  Once the scan is finished, the open file
+ * and album art are kept here until playback of the entry begins.  The caller
+ * provides the locking. */
+class PlaylistPrefetch
+{
+public:
+    /* what the scan read, handed over to the playback thread */
+    struct Result
+    {
+        String filename;
+        InputPlugin * ip = nullptr;
+        VFSFile file;
+        Index<char> image_data;
+        String image_file;
+        String error;
+    };
+
+    /* whether the next song should be prefetched, <time> milliseconds into a
+     * song of <length>; never while repeating from A to B (<repeat_b> >= 0),
+     * since the next song is then not needed */
+    static bool due(int time, int length, int seconds, int repeat_b);
+
+    PlaylistEntry * entry() const { return m_entry; }
+
+    /* replaces any previous prefetch */
+    void start(PlaylistEntry * entry, ScanRequest * request);
+    /* ignored unless <request> belongs to the current prefetch */
+    void finish(ScanRequest * request, Result && result);
+
+    /* called as playback of <entry> begins; returns true if it was prefetched
+     * and is ready, otherwise discards the prefetch */
+    bool claim(PlaylistEntry * entry);
+    /* called from the playback thread; hands over the result of a claimed
+     * prefetch of <entry> and returns true */
+    bool take(PlaylistEntry * entry, Result & result);
+
+    /* a scan still running is not canceled; its result is still applied to
+     * the entry, but the file it opened is closed */
+    void cancel() { *this = PlaylistPrefetch(); }
+
+    void entry_deleted(PlaylistEntry * entry)
+    {
+        if (entry == m_entry)
+            cancel();
+    }
+
+private:
+    PlaylistEntry * m_entry = nullptr;  /* null if none */
+    ScanRequest * m_request = nullptr; /* null once the scan is finished */
+    bool m_ready = false;              /* scan finished */
+    bool m_claimed = false;            /* playback of the entry has begun */
+    Result m_result;
+};
+
+#endif // LIBAUDCORE_PLAYLIST_PREFETCH_H
@@ -0,0 +1,337 @@
+/*
+ * playlist-snapshot.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "playlist-snapshot.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "runtime.h"
+
+/* A snapshot file consists of, in native byte order:
+ *   the header,
+ *   the rows (one per entry, fixed width),
+ *   the field table (a string index per field, giving the field's name),
+ *   the string table (an offset into the string data per string),
+ *   the tuple data, and
+ *   the string data (nul-terminated strings, each stored once).
+ * A tuple is a uint16 number of fields followed, for each field, by a uint8
+ * index into the field table, a uint8 type, and a uint32 value (either the
+ * integer itself or a string index).  Fields are identified by name, so that
+ * the file survives changes to the order of Tuple::Field. */
+
+#define NO_STRING 0xffffffffu
+#define FIELD_SIZE 6 /* bytes per field of a tuple */
+
+static const char snapshot_magic[8] = {'A', 'U', 'D', 'S', 'N', 'A', 'P', '1'};
+
+/* checks that <count> items of <size> bytes at <offset> lie within <len> */
+static bool fits(int64_t offset, int64_t count, int64_t size, int64_t len,
+                 int align = 1)
+{
+    return offset >= 0 && offset <= len && offset % align == 0 && count >= 0 &&
+           count <= (len - offset) / size;
+}
+
+PlaylistSnapshot * PlaylistSnapshot::open(const char * path)
+{
+    GMappedFile * mapped = g_mapped_file_new(path, false, nullptr);
+    if (!mapped)
+        return nullptr;
+
+    auto snapshot = new PlaylistSnapshot(mapped);
+
+    if (!snapshot->init(g_mapped_file_get_contents(mapped),
+                        g_mapped_file_get_length(mapped)))
+    {
+        AUDWARN("Ignoring invalid playlist snapshot %s.\n", path);
+        delete snapshot;
+        return nullptr;
+    }
+
+    return snapshot;
+}
+
+PlaylistSnapshot::~PlaylistSnapshot() { g_mapped_file_unref(m_mapped); }
+
+bool PlaylistSnapshot::init(const char * data, int64_t len)
+{
+    /* the mapping is page-aligned, so the structures within it can be
+     * accessed in place once their offsets are checked */
+    if (!data || len < (int64_t)sizeof(Header))
+        return false;
+
+    auto header = (const Header *)data;
+
+    if (memcmp(header->magic, snapshot_magic, sizeof snapshot_magic) ||
+        !fits(header->rows, header->n_rows, sizeof(Row), len, alignof(Row)) ||
+        !fits(header->fields, header->n_fields, sizeof(uint32_t), len,
+              alignof(uint32_t)) ||
+        header->n_fields > 256 ||
+        !fits(header->strings, header->n_strings, sizeof(uint32_t), len,
+              alignof(uint32_t)) ||
+        !fits(header->tuples, header->tuples_len, 1, len) ||
+        !fits(header->string_data, header->string_data_len, 1, len) ||
+        (header->string_data_len &&
+         data[header->string_data + header->string_data_len - 1]))
+        return false;
+
+    m_header = header;
+    m_rows = (const Row *)(data + header->rows);
+    m_strings = (const uint32_t *)(data + header->strings);
+    m_tuples = (const unsigned char *)(data + header->tuples);
+    m_string_data = data + header->string_data;
+
+    /* every row is checked here, so that the accessors need not check */
+    for (int i = 0; i < header->n_rows; i++)
+    {
+        const Row & row = m_rows[i];
+        if (!get_str(row.filename) || row.tuple < 0 ||
+            row.tuple >= header->tuples_len || row.state < Tuple::Initial ||
+            row.state > Tuple::Failed)
+            return false;
+    }
+
+    auto fields = (const uint32_t *)(data + header->fields);
+
+    for (int i = 0; i < header->n_fields; i++)
+    {
+        const char * name = get_str(fields[i]);
+        m_fields.append(name ? Tuple::field_by_name(name) : Tuple::Invalid);
+    }
+
+    return true;
+}
+
+const char * PlaylistSnapshot::get_str(uint32_t index) const
+{
+    if (index >= (uint32_t)m_header->n_strings)
+        return nullptr;
+
+    uint32_t offset = m_strings[index];
+    if (offset >= m_header->string_data_len)
+        return nullptr;
+
+    return m_string_data + offset;
+}
+
+template<class F>
+bool PlaylistSnapshot::read_tuple(int row, F func) const
+{
+    int64_t pos = m_rows[row].tuple;
+    int64_t len = m_header->tuples_len;
+
+    uint16_t n_fields;
+    if (len - pos < (int64_t)sizeof n_fields)
+        return false;
+
+    memcpy(&n_fields, m_tuples + pos, sizeof n_fields);
+    pos += sizeof n_fields;
+
+    if ((len - pos) / FIELD_SIZE < n_fields)
+        return false;
+
+    for (int i = 0; i < n_fields; i++, pos += FIELD_SIZE)
+    {
+        int field = m_tuples[pos];
+        int type = m_tuples[pos + 1];
+
+        uint32_t value;
+        memcpy(&value, m_tuples + pos + 2, sizeof value);
+
+        if (field >= m_fields.len())
+            return false;
+
+        func(field, type, value);
+    }
+
+    return true;
+}
+
+Tuple PlaylistSnapshot::tuple(int row) const
+{
+    Tuple tuple;
+
+    bool ok = read_tuple(row, [&](int index, int type, uint32_t value) {
+        Tuple::Field field = m_fields[index];
+        if (field < 0 || Tuple::field_get_type(field) != type)
+            return;
+
+        if (type == Tuple::Int)
+            tuple.set_int(field, (int32_t)value);
+        else
+            tuple.set_str(field, get_str(value));
+    });
+
+    /* a damaged record is treated like an entry that was never scanned */
+    if (ok)
+        tuple.set_state(state(row));
+    else
+        tuple = Tuple();
+
+    return tuple;
+}
+
+SnapshotWriter::SnapshotWriter() : m_title(NO_STRING) {}
+
+void SnapshotWriter::set_title(const char * title)
+{
+    m_title = title ? add_str(title) : NO_STRING;
+}
+
+uint32_t SnapshotWriter::add_str(const char * str)
+{
+    String key(str);
+    uint32_t * index = m_string_map.lookup(key);
+    if (index)
+        return *index;
+
+    uint32_t new_index = m_strings.len();
+    m_strings.append(m_string_data.len());
+    m_string_data.insert(str, -1, strlen(str) + 1);
+    m_string_map.add(key, std::move(new_index));
+
+    return new_index;
+}
+
+void SnapshotWriter::put_field(int field, int type, uint32_t value)
+{
+    unsigned char buf[FIELD_SIZE] = {(unsigned char)field, (unsigned char)type};
+    memcpy(buf + 2, &value, sizeof value);
+    m_tuples.insert(buf, -1, FIELD_SIZE);
+}
+
+void SnapshotWriter::add(const String & filename, const Tuple & orig)
+{
+    /* fallback fields are regenerated when the tuple is created */
+    Tuple tuple = orig.ref();
+    tuple.delete_fallbacks();
+
+    Row & row = m_rows.append();
+    row.tuple = m_tuples.len();
+    row.filename = add_str(filename);
+    row.length = tuple.get_int(Tuple::Length);
+    row.state = tuple.state();
+
+    uint16_t n_fields = 0;
+    m_tuples.insert(-1, sizeof n_fields);
+    int count_at = row.tuple;
+
+    for (auto field : Tuple::all_fields())
+    {
+        /* the formatted title depends on settings and is not saved */
+        auto type = tuple.get_value_type(field);
+        if (type == Tuple::Empty || field == Tuple::FormattedTitle)
+            continue;
+
+        if (type == Tuple::Int)
+            put_field(field, type, (uint32_t)tuple.get_int(field));
+        else
+            put_field(field, type, add_str(tuple.get_str(field)));
+
+        n_fields++;
+    }
+
+    memcpy(&m_tuples[count_at], &n_fields, sizeof n_fields);
+}
+
+void SnapshotWriter::add(const String & filename,
+                         const PlaylistSnapshot & snapshot, int row_num)
+{
+    Row & row = m_rows.append();
+    row.tuple = m_tuples.len();
+    row.filename = add_str(filename);
+    row.length = snapshot.length(row_num);
+    row.state = snapshot.state(row_num);
+
+    uint16_t n_fields = 0;
+    m_tuples.insert(-1, sizeof n_fields);
+    int count_at = row.tuple;
+
+    bool ok = snapshot.read_tuple(row_num, [&](int index, int type,
+                                               uint32_t value) {
+        Tuple::Field field = snapshot.m_fields[index];
+        if (field < 0 || Tuple::field_get_type(field) != type)
+            return;
+
+        if (type == Tuple::String)
+        {
+            const char * str = snapshot.get_str(value);
+            if (!str)
+                return;
+
+            value = add_str(str);
+        }
+
+        put_field(field, type, value);
+        n_fields++;
+    });
+
+    if (!ok)
+    {
+        m_tuples.remove(count_at + sizeof n_fields, -1);
+        n_fields = 0;
+        row.state = Tuple::Initial;
+    }
+
+    memcpy(&m_tuples[count_at], &n_fields, sizeof n_fields);
+}
+
+Index<char> SnapshotWriter::finish(const FileStamp & playlist,
+                                   const FileStamp & journal)
+{
+    Index<uint32_t> fields;
+    for (auto field : Tuple::all_fields())
+        fields.append(add_str(Tuple::field_get_name(field)));
+
+    Header header = Header();
+    memcpy(header.magic, snapshot_magic, sizeof snapshot_magic);
+    header.playlist = playlist;
+    header.journal = journal;
+    header.n_rows = m_rows.len();
+    header.n_fields = fields.len();
+    header.n_strings = m_strings.len();
+    header.title = m_title;
+
+    /* sections are laid out in order of decreasing alignment */
+    header.rows = sizeof header;
+    header.fields = header.rows + sizeof(Row) * m_rows.len();
+    header.strings = header.fields + sizeof(uint32_t) * fields.len();
+    header.tuples = header.strings + sizeof(uint32_t) * m_strings.len();
+    header.tuples_len = m_tuples.len();
+    header.string_data = header.tuples + m_tuples.len();
+    header.string_data_len = m_string_data.len();
+
+    Index<char> data;
+    data.insert(0, header.string_data + header.string_data_len);
+
+    auto put = [&](int64_t offset, const void * src, int64_t len) {
+        if (len)
+            memcpy(&data[offset], src, len);
+    };
+
+    put(0, &header, sizeof header);
+    put(header.rows, m_rows.begin(), sizeof(Row) * m_rows.len());
+    put(header.fields, fields.begin(), sizeof(uint32_t) * fields.len());
+    put(header.strings, m_strings.begin(), sizeof(uint32_t) * m_strings.len());
+    put(header.tuples, m_tuples.begin(), m_tuples.len());
+    put(header.string_data, m_string_data.begin(), m_string_data.len());
+
+    return data;
+}
@@ -0,0 +1,137 @@
+/*
+ * playlist-snapshot.h
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_PLAYLIST_SNAPSHOT_H
+#define LIBAUDCORE_PLAYLIST_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "index.h"
+#include "internal.h"
+#include "multihash.h"
+#include "tuple.h"
+
+typedef struct _GMappedFile GMappedFile;
+
+/* A binary copy of a playlist, written at exit so that the playlist can be
+ * loaded at startup without parsing it through the playlist plugin.  The file
+ * is mapped into memory; entries are created from the fixed-width rows, and
+ * the tuple of each row is only read out of the file when the entry is first
+ * accessed (see playlist-snapshot.cc for the layout). */
+class PlaylistSnapshot
+{
+public:
+    /* returns nullptr if the file is missing or damaged */
+    static PlaylistSnapshot * open(const char * path);
+
+    ~PlaylistSnapshot();
+
+    PlaylistSnapshot(const PlaylistSnapshot &) = delete;
+    void operator=(const PlaylistSnapshot &) = delete;
+
+    /* the playlist and journal files that were current when the snapshot was
+     * written (size -1 if the file did not exist) */
+    const FileStamp & playlist_stamp() const { return m_header->playlist; }
+    const FileStamp & journal_stamp() const { return m_header->journal; }
+
+    const char * title() const { return get_str(m_header->title); }
+
+    int n_rows() const { return m_header->n_rows; }
+
+    const char * filename(int row) const { return get_str(m_rows[row].filename); }
+    int length(int row) const { return m_rows[row].length; }
+    Tuple::State state(int row) const { return (Tuple::State)m_rows[row].state; }
+
+    /* reads the tuple of a row out of the file */
+    Tuple tuple(int row) const;
+
+private:
+    friend class SnapshotWriter;
+
+    struct Header
+    {
+        char magic[8];
+        FileStamp playlist, journal;
+        int32_t n_rows, n_fields, n_strings;
+        uint32_t title; /* string index */
+        int64_t rows, fields, strings, tuples, string_data; /* offsets */
+        int64_t tuples_len, string_data_len;
+    };
+
+    struct Row
+    {
+        int64_t tuple;     /* offset into the tuple data */
+        uint32_t filename; /* string index */
+        int32_t length;
+        int32_t state;
+        int32_t reserved;
+    };
+
+    PlaylistSnapshot(GMappedFile * mapped) : m_mapped(mapped) {}
+
+    bool init(const char * data, int64_t len);
+    const char * get_str(uint32_t index) const;
+
+    /* calls func(field, type, value) for each field of a row's tuple, where
+     * value is either an integer or a string index; returns false if the
+     * record is damaged */
+    template<class F>
+    bool read_tuple(int row, F func) const;
+
+    GMappedFile * m_mapped;
+    const Header * m_header = nullptr;
+    const Row * m_rows = nullptr;
+    const uint32_t * m_strings = nullptr;
+    const unsigned char * m_tuples = nullptr;
+    const char * m_string_data = nullptr;
+    Index<Tuple::Field> m_fields; /* snapshot field index -> Tuple::Field */
+};
+
+/* Builds the contents of a snapshot file. */
+class SnapshotWriter
+{
+public:
+    SnapshotWriter();
+
+    void set_title(const char * title);
+
+    void add(const String & filename, const Tuple & tuple);
+
+    /* copies a row from an existing snapshot without creating its tuple */
+    void add(const String & filename, const PlaylistSnapshot & snapshot,
+             int row);
+
+    Index<char> finish(const FileStamp & playlist, const FileStamp & journal);
+
+private:
+    typedef PlaylistSnapshot::Header Header;
+    typedef PlaylistSnapshot::Row Row;
+
+    uint32_t add_str(const char * str);
+    void put_field(int field, int type, uint32_t value);
+
+    Index<Row> m_rows;
+    Index<unsigned char> m_tuples;
+    Index<uint32_t> m_strings;
+    Index<char> m_string_data;
+    SimpleHash<String, uint32_t> m_string_map;
+    uint32_t m_title;
+};
+
+#endif // LIBAUDCORE_PLAYLIST_SNAPSHOT_H
@@ -0,0 +1,509 @@
+/*
+ * playlist-sort.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "playlist-sort.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+/* rows are handed out to the threads in chunks of this size */
+static constexpr int chunk_size = 16384;
+/* initial runs are sorted by insertion */
+static constexpr int run_size = 32;
+/* fewer rows than this per thread are not worth another thread */
+static constexpr int min_per_thread = 32768;
+static constexpr int max_threads = 8;
+
+typedef PlaylistSort::SortRow SortRow;
+
+/* calls func(0) through func(n_items - 1), spread over up to n_threads
+ * threads including the calling one */
+template<class F>
+static void run_parallel(int n_threads, int n_items, const F & func)
+{
+    std::atomic<int> next(0);
+
+    auto worker = [&]() {
+        int item;
+        while ((item = next.fetch_add(1)) < n_items)
+            func(item);
+    };
+
+    n_threads = aud::min(n_threads, n_items);
+
+    std::thread threads[max_threads];
+
+    for (int i = 1; i < n_threads; i++)
+        threads[i] = std::thread(worker);
+
+    worker();
+
+    for (int i = 1; i < n_threads; i++)
+        threads[i].join();
+}
+
+static const char * get_basename(const char * filename)
+{
+    const char * slash = strrchr(filename, '/');
+    return slash ? slash + 1 : filename;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return 0;
+}
+
+/* Appends a binary key for the string <s> of length <len> to <out>.  Comparing
+ * two keys byte by byte (a key sorting first if it is a prefix of the other)
+ * gives the same order as str_compare() on the original strings.  Letters are
+ * folded to lower case, and each run of digits is replaced by the number of
+ * significant digits followed by those digits, so that numbers compare by
+ * value.  The count is written as a character from '0' to '8' (or as '9' and
+ * a byte holding the count, if 9 or more), so that a number still compares
+ * against other characters as a digit does.  If <decode> is set, the string is
+ * percent-decoded first, as in str_compare_encoded(). */
+static void append_key(Index<unsigned char> & out, const char * s, int len,
+                       bool decode, Index<char> & scratch)
+{
+    if (decode && memchr(s, '%', len))
+    {
+        scratch.resize(0);
+
+        for (int i = 0; i < len; i++)
+        {
+            if (s[i] == '%' && i + 2 < len)
+            {
+                scratch.append((hex_value(s[i + 1]) << 4) | hex_value(s[i + 2]));
+                i += 2;
+            }
+            else
+                scratch.append(s[i]);
+        }
+
+        s = scratch.begin();
+        len = scratch.len();
+    }
+
+    auto p = (const unsigned char *)s;
+    auto end = p + len;
+
+    while (p < end)
+    {
+        unsigned char c = *p;
+
+        if (c >= '0' && c <= '9')
+        {
+            while (p < end && *p == '0')
+                p++;
+
+            auto digits = p;
+            while (p < end && *p >= '0' && *p <= '9')
+                p++;
+
+            int n_digits = p - digits;
+
+            if (n_digits < 9)
+                out.append('0' + n_digits);
+            else
+            {
+                out.append('9');
+                out.append(aud::min(n_digits, 255));
+            }
+
+            out.insert(digits, -1, n_digits);
+        }
+        else
+        {
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+
+            out.append(c);
+            p++;
+        }
+    }
+}
+
+static uint64_t key_prefix(const unsigned char * key, int len)
+{
+    uint64_t prefix = 0;
+
+    for (int i = 0; i < 8; i++)
+        prefix = (prefix << 8) | (i < len ? key[i] : 0);
+
+    return prefix;
+}
+
+struct KeyLess
+{
+    bool operator()(const SortRow & a, const SortRow & b) const
+    {
+        if (a.prefix != b.prefix)
+            return a.prefix < b.prefix;
+
+        /* if either key fits in the prefix, it is a prefix of the other */
+        if (a.len <= 8 || b.len <= 8)
+            return a.len < b.len;
+
+        int cmp = memcmp(a.key + 8, b.key + 8, aud::min(a.len, b.len) - 8);
+        return cmp ? (cmp < 0) : (a.len < b.len);
+    }
+};
+
+template<class Less>
+static void insertion_sort(SortRow * rows, int n, const Less & less)
+{
+    for (int i = 1; i < n; i++)
+    {
+        SortRow row = rows[i];
+        int j = i;
+
+        for (; j > 0 && less(row, rows[j - 1]); j--)
+            rows[j] = rows[j - 1];
+
+        rows[j] = row;
+    }
+}
+
+/* Returns how many of the first <k> rows of the merged output come from <a>.
+ * On ties, rows from <a> are taken first, which keeps the merge stable. */
+template<class Less>
+static int co_rank(int k, const SortRow * a, int a_len, const SortRow * b,
+                   int b_len, const Less & less)
+{
+    int low = aud::max(0, k - b_len);
+    int high = aud::min(k, a_len);
+
+    while (low < high)
+    {
+        int i = (low + high) / 2;
+        int j = k - i;
+
+        if (j > 0 && !less(b[j - 1], a[i]))
+            low = i + 1;
+        else
+            high = i;
+    }
+
+    return low;
+}
+
+template<class Less>
+static void merge(const SortRow * a, const SortRow * a_end, const SortRow * b,
+                  const SortRow * b_end, SortRow * out, const Less & less)
+{
+    while (a < a_end && b < b_end)
+    {
+        if (less(*b, *a))
+            *out++ = *b++;
+        else
+            *out++ = *a++;
+    }
+
+    while (a < a_end)
+        *out++ = *a++;
+    while (b < b_end)
+        *out++ = *b++;
+}
+
+PlaylistSort::PlaylistSort(Playlist::SortType scheme)
+    : m_type(StringKey), m_field(Tuple::Title), m_filename_compare(nullptr),
+      m_tuple_compare(nullptr)
+{
+    switch (scheme)
+    {
+    case Playlist::Path:
+        m_type = PathKey;
+        break;
+    case Playlist::Filename:
+        m_type = BasenameKey;
+        break;
+    case Playlist::Title:
+        m_field = Tuple::Title;
+        break;
+    case Playlist::Album:
+        m_field = Tuple::Album;
+        break;
+    case Playlist::Artist:
+        m_field = Tuple::Artist;
+        break;
+    case Playlist::AlbumArtist:
+        m_field = Tuple::AlbumArtist;
+        break;
+    case Playlist::Date:
+        m_type = IntKey;
+        m_field = Tuple::Year;
+        break;
+    case Playlist::Genre:
+        m_field = Tuple::Genre;
+        break;
+    case Playlist::Track:
+        m_type = IntKey;
+        m_field = Tuple::Track;
+        break;
+    case Playlist::FormattedTitle:
+        m_field = Tuple::FormattedTitle;
+        break;
+    case Playlist::Length:
+        m_type = IntKey;
+        m_field = Tuple::Length;
+        break;
+    case Playlist::Comment:
+        m_field = Tuple::Comment;
+        break;
+    default:
+        break;
+    }
+}
+
+PlaylistSort::PlaylistSort(Playlist::StringCompareFunc filename_compare,
+                           Playlist::TupleCompareFunc tuple_compare)
+    : m_type(CustomKey), m_field(Tuple::Title),
+      m_filename_compare(filename_compare), m_tuple_compare(tuple_compare)
+{
+}
+
+void PlaylistSort::clear()
+{
+    m_rows.clear();
+    m_strings.clear();
+    m_tuples.clear();
+    m_order.clear();
+    m_key_data.clear();
+}
+
+Tuple::Field PlaylistSort::key_field() const
+{
+    return (m_type == StringKey || m_type == IntKey) ? m_field : Tuple::Invalid;
+}
+
+PlaylistSort::SortRow & PlaylistSort::add_row(int row)
+{
+    SortRow & sort_row = m_order.append();
+    sort_row.index = m_rows.len();
+    m_rows.append(row);
+    return sort_row;
+}
+
+void PlaylistSort::add(int row, const String & filename, const Tuple & tuple)
+{
+    switch (m_type)
+    {
+    case StringKey:
+        add_str(row, filename, tuple.get_str(m_field));
+        break;
+
+    case IntKey:
+        add_int(row, filename, tuple.get_value_type(m_field) == Tuple::Int,
+                tuple.get_int(m_field));
+        break;
+
+    case CustomKey:
+        if (!m_filename_compare)
+        {
+            add_row(row);
+            m_tuples.append(tuple.ref());
+            break;
+        }
+
+        /* fall through */
+
+    default:
+        add_str(row, filename, String());
+        break;
+    }
+}
+
+void PlaylistSort::add_str(int row, const String & filename, const String & str)
+{
+    assert(!needs_tuple() && m_type != IntKey);
+
+    add_row(row);
+    m_strings.append((m_type == StringKey) ? str : filename);
+}
+
+void PlaylistSort::add_int(int row, const String & filename, bool set, int val)
+{
+    assert(m_type == IntKey);
+
+    /* unset values sort first */
+    SortRow & sort_row = add_row(row);
+    if (set)
+        sort_row.prefix = (uint64_t)((int64_t)val - INT_MIN) + 1;
+}
+
+void PlaylistSort::build_keys(int n_threads)
+{
+    int n_rows = m_order.len();
+    int n_chunks = (n_rows + chunk_size - 1) / chunk_size;
+
+    m_key_data.clear();
+    m_key_data.insert(0, n_chunks);
+
+    run_parallel(n_threads, n_chunks, [this, n_rows](int chunk) {
+        int start = chunk * chunk_size;
+        int stop = aud::min(start + chunk_size, n_rows);
+
+        Index<unsigned char> & data = m_key_data[chunk];
+        Index<char> scratch;
+        Index<int> offsets;
+
+        for (int i = start; i < stop; i++)
+        {
+            SortRow & row = m_order[i];
+            const char * str = m_strings[row.index];
+
+            offsets.append(data.len());
+
+            if (m_type == StringKey)
+            {
+                /* a leading byte puts unset fields ahead of empty ones */
+                if (str)
+                {
+                    data.append(1);
+                    append_key(data, str, strlen(str), false, scratch);
+                }
+            }
+            else
+            {
+                const char * base = get_basename(str);
+
+                /* the folder is followed by a byte sorting ahead of any
+                 * character, so that files in a folder come before those in
+                 * its subfolders */
+                if (m_type == PathKey)
+                {
+                    append_key(data, str, base - str, true, scratch);
+                    data.append(1);
+                }
+
+                append_key(data, base, strlen(base), true, scratch);
+            }
+
+            row.len = data.len() - offsets[i - start];
+        }
+
+        /* the data does not move any more */
+        for (int i = start; i < stop; i++)
+        {
+            SortRow & row = m_order[i];
+            row.key = data.begin() + offsets[i - start];
+            row.prefix = key_prefix(row.key, row.len);
+        }
+    });
+}
+
+template<class Less>
+void PlaylistSort::merge_sort(const Less & less, int n_threads)
+{
+    int n_rows = m_order.len();
+    int n_chunks = (n_rows + chunk_size - 1) / chunk_size;
+
+    Index<SortRow> temp;
+    temp.resize(n_rows);
+
+    SortRow * src = m_order.begin();
+    SortRow * dest = temp.begin();
+
+    run_parallel(n_threads, n_chunks, [&](int chunk) {
+        int start = chunk * chunk_size;
+        int stop = aud::min(start + chunk_size, n_rows);
+
+        for (int i = start; i < stop; i += run_size)
+            insertion_sort(src + i, aud::min(run_size, stop - i), less);
+    });
+
+    /* Each pass merges pairs of sorted runs into runs twice as long.  So that
+     * all the threads are kept busy even in the last passes (with only one
+     * or two long runs), the work is divided by position in the output, and
+     * the corresponding ranges of the input runs are found by binary search. */
+    for (int width = run_size; width < n_rows; width *= 2)
+    {
+        run_parallel(n_threads, n_chunks, [&](int chunk) {
+            int start = chunk * chunk_size;
+            int stop = aud::min(start + chunk_size, n_rows);
+
+            for (int pair = start / (2 * width) * (2 * width); pair < stop;
+                 pair += 2 * width)
+            {
+                const SortRow * a = src + pair;
+                int a_len = aud::min(width, n_rows - pair);
+                const SortRow * b = a + a_len;
+                int b_len = aud::clamp(n_rows - pair - width, 0, width);
+
+                int k0 = aud::max(start, pair) - pair;
+                int k1 = aud::min(stop, pair + a_len + b_len) - pair;
+                int i0 = co_rank(k0, a, a_len, b, b_len, less);
+                int i1 = co_rank(k1, a, a_len, b, b_len, less);
+
+                merge(a + i0, a + i1, b + (k0 - i0), b + (k1 - i1),
+                      dest + pair + k0, less);
+            }
+        });
+
+        std::swap(src, dest);
+    }
+
+    if (src != m_order.begin())
+        m_order = std::move(temp);
+}
+
+void PlaylistSort::run()
+{
+    int n_rows = m_order.len();
+
+    int n_threads = 1;
+    if (m_type == CustomKey)
+        ; /* user comparison callbacks are not known to be thread-safe */
+    else if (m_threads > 0)
+        n_threads = aud::min(m_threads, max_threads);
+    else
+        n_threads = aud::clamp((int)aud::min(std::thread::hardware_concurrency(),
+                                             (unsigned)(n_rows / min_per_thread)),
+                               1, max_threads);
+
+    if (m_type != IntKey && m_type != CustomKey)
+        build_keys(n_threads);
+
+    if (m_type == CustomKey)
+    {
+        merge_sort(
+            [this](const SortRow & a, const SortRow & b) {
+                if (m_filename_compare)
+                    return m_filename_compare(m_strings[a.index],
+                                              m_strings[b.index]) < 0;
+                else
+                    return m_tuple_compare(m_tuples[a.index],
+                                           m_tuples[b.index]) < 0;
+            },
+            1);
+    }
+    else
+        merge_sort(KeyLess(), n_threads);
+}
@@ -0,0 +1,127 @@
+/*
+ * playlist-sort.h
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_PLAYLIST_SORT_H
+#define LIBAUDCORE_PLAYLIST_SORT_H
+
+#include <stdint.h>
+
+#include "index.h"
+#include "playlist.h"
+#include "tuple.h"
+
+/* The sort engine behind the Playlist::sort_* functions.  The data needed for
+ * sorting is copied out of the playlist row by row (with the playlist locked),
+ * after which run() may be called without the lock held.  For the preset
+ * schemes, a binary key is built once per row, so that the rows can then be
+ * compared with memcmp() instead of str_compare(); the rows are sorted with a
+ * merge sort that is divided between several threads for long playlists. */
+class PlaylistSort
+{
+public:
+    /* sorts by a preset scheme */
+    explicit PlaylistSort(Playlist::SortType scheme);
+
+    /* sorts by a caller-supplied comparison; exactly one of the two must be
+     * given.  The comparison is called from one thread only, since it is not
+     * known to be thread-safe. */
+    PlaylistSort(Playlist::StringCompareFunc filename_compare,
+                 Playlist::TupleCompareFunc tuple_compare);
+
+    PlaylistSort(const PlaylistSort &) = delete;
+    void operator=(const PlaylistSort &) = delete;
+
+    /* discards the rows added so far and any previous result */
+    void clear();
+
+    /* copies what is needed for sorting out of one playlist row; rows must be
+     * added in increasing order */
+    void add(int row, const String & filename, const Tuple & tuple);
+
+    /* Most sorts need at most one field of the tuple, which can then be given
+     * in place of the tuple: key_field() is the field needed (Tuple::Invalid
+     * if none), and add_str() or add_int() is called according to its type,
+     * with <str> ignored if no field is needed.  For an integer, <set> is
+     * false if the field is unset.  Only custom comparisons of tuples need
+     * add() to be called instead. */
+    Tuple::Field key_field() const;
+    bool needs_tuple() const
+    {
+        return m_type == CustomKey && !m_filename_compare;
+    }
+
+    void add_str(int row, const String & filename, const String & str);
+    void add_int(int row, const String & filename, bool set, int val);
+
+    /* sets the number of threads used by run(), up to a limit; the default
+     * (0) chooses according to the number of rows and processors */
+    void set_threads(int n_threads) { m_threads = n_threads; }
+
+    /* builds the keys and sorts the rows */
+    void run();
+
+    int n_rows() const { return m_rows.len(); }
+
+    /* the i-th row passed to add() */
+    int row(int i) const { return m_rows[i]; }
+
+    /* after run(), the row (as passed to add()) that belongs in the place of
+     * the i-th row passed to add() */
+    int sorted_row(int i) const { return m_rows[m_order[i].index]; }
+
+    struct SortRow
+    {
+        uint64_t prefix;           /* first 8 bytes of the key (big-endian),
+                                    * or the biased value of an integer */
+        const unsigned char * key; /* entire key, null for integers */
+        int len;                   /* length of the key */
+        int index;                 /* index into m_rows */
+    };
+
+private:
+    enum KeyType
+    {
+        PathKey,     /* folder and base name of the filename */
+        BasenameKey, /* base name of the filename */
+        StringKey,   /* string field of the tuple */
+        IntKey,      /* integer field of the tuple */
+        CustomKey    /* caller-supplied comparison */
+    };
+
+    SortRow & add_row(int row);
+    void build_keys(int n_threads);
+
+    template<class Less>
+    void merge_sort(const Less & less, int n_threads);
+
+    KeyType m_type;
+    Tuple::Field m_field;
+    Playlist::StringCompareFunc m_filename_compare;
+    Playlist::TupleCompareFunc m_tuple_compare;
+
+    Index<int> m_rows;
+    Index<String> m_strings;
+    Index<Tuple> m_tuples;
+    Index<SortRow> m_order;
+    Index<Index<unsigned char>> m_key_data; /* key storage, one per chunk */
+
+    int m_threads = 0;
+};
+
+#endif // LIBAUDCORE_PLAYLIST_SORT_H
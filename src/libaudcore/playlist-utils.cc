@@ -155,22 +155,6 @@ static_assert(aud::n_elems(filename_comparisons) == Playlist::n_sort_types &&
                   aud::n_elems(tuple_comparisons) == Playlist::n_sort_types,
               "Update playlist comparison functions");
 
-EXPORT void Playlist::sort_entries(SortType scheme) const
-{
-    if (filename_comparisons[scheme])
-        sort_by_filename(filename_comparisons[scheme]);
-    else if (tuple_comparisons[scheme])
-        sort_by_tuple(tuple_comparisons[scheme]);
-}
-
-EXPORT void Playlist::sort_selected(SortType scheme) const
-{
-    if (filename_comparisons[scheme])
-        sort_selected_by_filename(filename_comparisons[scheme]);
-    else if (tuple_comparisons[scheme])
-        sort_selected_by_tuple(tuple_comparisons[scheme]);
-}
-
 /* FIXME: this considers empty fields as duplicates */
 EXPORT void Playlist::remove_duplicates(SortType scheme) const
 {
@@ -184,7 +168,7 @@ EXPORT void Playlist::remove_duplicates(SortType scheme) const
     {
         StringCompareFunc compare = filename_comparisons[scheme];
 
-        sort_by_filename(compare);
+        sort_entries(scheme);
         String last = entry_filename(0);
 
         for (int i = 1; i < entries; i++)
@@ -201,7 +185,7 @@ EXPORT void Playlist::remove_duplicates(SortType scheme) const
     {
         TupleCompareFunc compare = tuple_comparisons[scheme];
 
-        sort_by_tuple(compare);
+        sort_entries(scheme);
         Tuple last = entry_tuple(0);
 
         for (int i = 1; i < entries; i++)
@@ -259,8 +243,7 @@ EXPORT void Playlist::select_by_patterns(const Tuple & patterns) const
             if (!entry_selected(i))
                 continue;
 
-            Tuple tuple = entry_tuple(i);
-            String string = tuple.get_str(field);
+            String string = PlaylistEx(*this).entry_str(i, field);
 
             if (!string ||
                 !g_regex_match(regex, string, (GRegexMatchFlags)0, nullptr))
@@ -317,15 +300,28 @@ static void load_playlists_real()
 
         PlaylistEx playlist =
             PlaylistEx::insert_with_stamp(count + i, atoi(number));
-        playlist.insert_flat_playlist(filename_to_uri(path));
-        playlist.set_modified(g_str_has_suffix(path, ".xspf"));
+
+        if (g_str_has_suffix(path, ".xspf"))
+        {
+            playlist.insert_flat_playlist(filename_to_uri(path));
+            playlist.set_modified(true);
+        }
+        else
+        {
+            bool from_snapshot = playlist_snapshot_load(playlist, folder);
+            if (!from_snapshot)
+                playlist.insert_flat_playlist(filename_to_uri(path));
+
+            playlist_journal_load(playlist, folder, !from_snapshot);
+            playlist.set_modified(false);
+        }
     }
 
     if (!Playlist::n_playlists())
         Playlist::insert_playlist(0);
 }
 
-static void save_playlists_real()
+static void save_playlists_real(bool exiting)
 {
     int lists = Playlist::n_playlists();
     const char * folder = aud_get_path(AudPath::PlaylistDir);
@@ -333,6 +329,7 @@ static void save_playlists_real()
     /* save playlists */
 
     Index<String> order;
+    Index<int> stamps;
     SimpleHash<String, bool> saved;
 
     for (int i = 0; i < lists; i++)
@@ -341,17 +338,26 @@ static void save_playlists_real()
         StringBuf number = int_to_str(playlist.stamp());
         StringBuf name = str_concat({number, ".audpl"});
 
-        if (playlist.get_modified())
+        /* on exit, also finish any compaction in progress */
+        if (playlist.get_modified() || exiting)
         {
-            StringBuf path = filename_build({folder, name});
-            playlist.save_to_file(filename_to_uri(path), Playlist::NoWait);
+            if (playlist.get_modified())
+                playlist_snapshot_remove(playlist.stamp(), folder);
+
             playlist.set_modified(false);
+            playlist_journal_save(playlist, folder, exiting);
         }
 
+        if (exiting)
+            playlist_snapshot_save(playlist, folder);
+
         order.append(String(number));
+        stamps.append(playlist.stamp());
         saved.add(String(name), true);
     }
 
+    playlist_journal_prune(stamps);
+
     StringBuf order_string = index_to_str_list(order, " ");
     StringBuf order_path = filename_build({folder, "order"});
     auto old_order_string = VFSFile::read_file(
@@ -373,10 +379,14 @@ static void save_playlists_real()
     while ((name = g_dir_read_name(dir)))
     {
         if (!g_str_has_suffix(name, ".audpl") &&
-            !g_str_has_suffix(name, ".xspf"))
+            !g_str_has_suffix(name, ".xspf") && !strstr(name, ".audpl."))
             continue;
 
-        if (!saved.lookup(String(name)))
+        /* journals, snapshots, and temporary files go with the playlist */
+        const char * ext = strstr(name, ".audpl");
+        StringBuf base = ext ? str_copy(name, ext + 6 - name) : str_copy(name);
+
+        if (!saved.lookup(String(base)))
             g_unlink(filename_build({folder, name}));
     }
 
@@ -413,7 +423,7 @@ void load_playlists()
 
 void save_playlists(bool exiting)
 {
-    save_playlists_real();
+    save_playlists_real(exiting);
 
     /* on exit, save resume states */
     if (state_changed || exiting)
@@ -422,6 +432,9 @@ void save_playlists(bool exiting)
         state_changed = false;
     }
 
+    if (exiting)
+        playlist_journal_end();
+
     if (exiting && hooks_added)
     {
         hook_dissociate("playlist update", update_cb);
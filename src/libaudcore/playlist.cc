@@ -36,6 +36,8 @@
 #include "multihash.h"
 #include "parse.h"
 #include "playlist-data.h"
+#include "playlist-prefetch.h"
+#include "playlist-sort.h"
 #include "runtime.h"
 #include "threads.h"
 
@@ -64,6 +66,10 @@ enum class UpdateState
 
 #define STATE_FILE "playlist-state"
 
+/* number of entries following the playing one that are scanned ahead of the
+ * rest of the playlist */
+#define SCAN_UPCOMING 8
+
 #define ENTER_GET_PLAYLIST(...)                                                \
     auto mh = mutex.take();                                                    \
     PlaylistData * playlist = m_id ? m_id->data : nullptr;                     \
@@ -123,22 +129,51 @@ struct ScanItem : public ListNode
     ScanItem(PlaylistData * playlist, PlaylistEntry * entry,
              ScanRequest * request, bool for_playback)
         : playlist(playlist), entry(entry), request(request),
-          for_playback(for_playback), handled_by_playback(false)
+          filename(request->filename), for_playback(for_playback),
+          handled_by_playback(false)
     {
     }
 
-    PlaylistData * playlist;
-    PlaylistEntry * entry;
-    ScanRequest * request;
+    PlaylistData * playlist; /* null if canceled */
+    PlaylistEntry * entry;   /* null if canceled */
+    ScanRequest * request; /* may be freed once the scan is finished */
+    String filename;
     bool for_playback;
     bool handled_by_playback;
 };
 
+/* Completed scans are collected here by the scanner threads and applied in
+ * batches, so that a burst of completions takes the playlist mutex and queues
+ * a playlist update only once.  The request pointer is used only to find the
+ * matching ScanItem; the request itself may already have been freed. */
+struct ScanDone
+{
+    ScanDone(ScanRequest * request)
+        : request(request), decoder(request->decoder),
+          tuple(request->tuple.ref()), error(request->error)
+    {
+    }
+
+    ScanRequest * request;
+    PluginHandle * decoder;
+    Tuple tuple;
+    String error;
+};
+
+/* amount read ahead into the probe buffer of a prefetched file */
+static constexpr int PREFETCH_BYTES = 128 * 1024;
+
+static PlaylistPrefetch prefetch;
+
 static bool scan_enabled_nominal, scan_enabled;
 static int scan_playlist, scan_row;
 static List<ScanItem> scan_list;
 
+static aud::spinlock scan_done_lock;
+static Index<ScanDone> scan_done;
+
 static void scan_finish(ScanRequest * request);
+static void scan_schedule();
 static void scan_cancel(PlaylistEntry * entry);
 static void scan_restart();
 
@@ -263,6 +298,13 @@ EXPORT bool Playlist::scan_in_progress() const
     return (playlist->scan_status != PlaylistData::NotScanning);
 }
 
+EXPORT void Playlist::set_scan_priority_range(int at, int number) const
+{
+    ENTER_GET_PLAYLIST();
+    playlist->set_scan_priority_range(at, number);
+    scan_schedule();
+}
+
 EXPORT bool Playlist::scan_in_progress_any()
 {
     auto mh = mutex.take();
@@ -331,11 +373,69 @@ static void scan_check_complete(PlaylistData * playlist)
     event_queue("playlist scan complete", nullptr);
 }
 
+/* queues the first unscanned entry from <at> up to <end>, if any */
+static bool scan_queue_range(PlaylistData * playlist, int at, int end)
+{
+    for (int row = at; (row = playlist->next_unscanned_entry(row, end)) >= 0;
+         row++)
+    {
+        auto entry = playlist->entry_at(row);
+        if (!scan_list_find_entry(entry))
+        {
+            scan_queue_entry(playlist, entry);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Entries are scanned in this order: queued entries and those following the
+ * playing one, then the priority range of each playlist being scanned
+ * (starting with the active one), then the remaining entries from the start
+ * of the first playlist to the end of the last. */
+static bool scan_queue_priority_entry()
+{
+    PlaylistData * playing = playing_id ? playing_id->data : nullptr;
+
+    if (playing && playing->scan_status != PlaylistData::NotScanning)
+    {
+        Index<int> rows;
+        playing->scan_upcoming_rows(SCAN_UPCOMING, rows);
+
+        for (int row : rows)
+        {
+            if (scan_queue_range(playing, row, row + 1))
+                return true;
+        }
+    }
+
+    PlaylistData * active = active_id ? active_id->data : nullptr;
+
+    for (int i = -1; i < playlists.len(); i++)
+    {
+        PlaylistData * playlist = (i < 0) ? active : playlists[i].get();
+        if (!playlist || (i >= 0 && playlist == active) ||
+            playlist->scan_status == PlaylistData::NotScanning)
+            continue;
+
+        int at, end;
+        playlist->get_scan_priority_range(at, end);
+        if (at < end && scan_queue_range(playlist, at, end))
+            return true;
+    }
+
+    return false;
+}
+
 static bool scan_queue_next_entry()
 {
     if (!scan_enabled)
         return false;
 
+    if (scan_queue_priority_entry())
+        return true;
+
     while (scan_playlist < playlists.len())
     {
         PlaylistData * playlist = playlists[scan_playlist].get();
@@ -369,63 +469,171 @@ static bool scan_queue_next_entry()
     return false;
 }
 
+/* The number of scans in progress is limited according to where the most
+ * recently queued entry is stored; apart from the few priority entries, they
+ * are queued in order, so this follows the scan from one device to the next.
+ * Canceled scans still running are counted as well. */
 static void scan_schedule()
 {
     int scheduled = 0;
 
     for (ScanItem * item = scan_list.head(); item; item = scan_list.next(item))
+        scheduled++;
+
+    while (1)
     {
-        if (++scheduled >= SCAN_THREADS)
+        ScanItem * last = scan_list.tail();
+        const char * filename = last ? (const char *)last->filename : nullptr;
+
+        if (scheduled >= scanner_concurrency(filename))
             return;
-    }
 
-    while (scan_queue_next_entry())
-    {
-        if (++scheduled >= SCAN_THREADS)
+        if (!scan_queue_next_entry())
             return;
+
+        scheduled++;
     }
 }
 
-static void scan_finish(ScanRequest * request)
+static void scan_apply_batch(Index<ScanDone> & batch)
 {
-    auto mh = mutex.take();
-
-    auto match = [request](const ScanItem & item) {
-        return item.request == request;
+    struct PlaylistResults
+    {
+        PlaylistData * playlist;
+        Index<PlaylistData::ScanResult> results;
     };
 
-    ScanItem * item = scan_list.find(match);
-    if (!item)
-        return;
+    Index<PlaylistResults> changes;
+
+    for (auto & done : batch)
+    {
+        auto match = [&done](const ScanItem & item) {
+            return item.request == done.request;
+        };
+
+        ScanItem * item = scan_list.find(match);
+        if (!item)
+            continue;
+
+        PlaylistData * playlist = item->playlist;
+        PlaylistEntry * entry = item->entry;
+
+        scan_list.remove(item);
+        delete item;
+
+        if (!entry)
+            continue;
 
-    PlaylistData * playlist = item->playlist;
-    PlaylistEntry * entry = item->entry;
+        PlaylistResults * change = nullptr;
+        for (auto & c : changes)
+        {
+            if (c.playlist == playlist)
+                change = &c;
+        }
 
-    scan_list.remove(item);
+        if (!change)
+        {
+            change = &changes.append();
+            change->playlist = playlist;
+        }
 
-    // only use delayed update if a scan is still in progress
-    int update_flags = 0;
-    if (scan_enabled && playlist->scan_status != PlaylistData::NotScanning)
-        update_flags = PlaylistData::DelayedUpdate;
+        auto & result = change->results.append();
+        result.entry = entry;
+        result.decoder = done.decoder;
+        result.tuple = std::move(done.tuple);
+        result.error = std::move(done.error);
+    }
 
-    playlist->update_entry_from_scan(entry, request, update_flags);
+    for (auto & change : changes)
+    {
+        PlaylistData * playlist = change.playlist;
 
-    delete item;
+        // only use delayed update if a scan is still in progress
+        int update_flags = 0;
+        if (scan_enabled && playlist->scan_status != PlaylistData::NotScanning)
+            update_flags = PlaylistData::DelayedUpdate;
+
+        playlist->update_entries_from_scan(change.results, update_flags);
+        scan_check_complete(playlist);
+    }
 
-    scan_check_complete(playlist);
     scan_schedule();
+}
+
+/* Called from the scanner threads and the playback thread.  Results are
+ * queued before taking the playlist mutex, and whichever thread takes it next
+ * applies all of them, including any added by threads still waiting for it.
+ * The queue is only drained with the mutex held, and the mutex is held until
+ * the drained batch is applied, so once the caller has the mutex its own
+ * result has been applied, either by itself or by the thread that drained it.
+ * A caller that takes the mutex after this returns will therefore see its own
+ * result as well. */
+static void scan_finish(ScanRequest * request)
+{
+    {
+        auto lh = scan_done_lock.take();
+        scan_done.append(request);
+    }
+
+    auto mh = mutex.take();
+
+    Index<ScanDone> batch;
+
+    {
+        auto lh = scan_done_lock.take();
+        batch = std::move(scan_done);
+    }
+
+    if (!batch.len())
+        return;
 
+    scan_apply_batch(batch);
     condvar.notify_all();
 }
 
+/* The item is left in the list until the scan finishes, so that its request
+ * cannot be confused with a new one allocated at the same address. */
 static void scan_cancel(PlaylistEntry * entry)
 {
     ScanItem * item = scan_list_find_entry(entry);
     if (!item)
         return;
 
-    scan_list.remove(item);
-    delete (item);
+    item->playlist = nullptr;
+    item->entry = nullptr;
+}
+
+/* called from the scanner threads */
+static void prefetch_finish(ScanRequest * request)
+{
+    /* the file is rewound to the start, so reading ahead fills the probe
+     * buffer, from which the decoder will read without touching the device */
+    if (request->file)
+    {
+        Index<char> buf;
+        buf.resize(PREFETCH_BYTES);
+        int64_t len = request->file.fread(buf.begin(), 1, buf.len());
+
+        /* if nothing could be read, the file is given up without trying to
+         * rewind it, and the decoder will open it again */
+        if (len <= 0 || request->file.fseek(0, VFS_SEEK_SET) < 0)
+            request->file = VFSFile();
+    }
+
+    /* apply the scan result to the entry before marking it ready; once
+     * scan_finish() returns, the result has been applied under the mutex */
+    scan_finish(request);
+
+    PlaylistPrefetch::Result result;
+    result.filename = request->filename;
+    result.ip = request->ip;
+    result.file = std::move(request->file);
+    result.image_data = std::move(request->image_data);
+    result.image_file = std::move(request->image_file);
+    result.error = request->error;
+
+    auto mh = mutex.take();
+    prefetch.finish(request, std::move(result));
 }
 
 static void scan_restart()
@@ -471,13 +679,20 @@ static void start_playback_locked(int seek_time, bool pause)
     art_clear_current();
     scan_reset_playback();
 
-    playback_play(seek_time, pause);
-
     auto playlist = playing_id->data;
     auto entry = playlist->entry_at(playlist->position());
 
-    // playback always begins with a rescan of the current entry in order to
-    // open the file, ensure a valid tuple, and read album art
+    // if the entry was prefetched, playback begins with the file opened and
+    // the album art read by the prefetch
+    bool prefetched = prefetch.claim(entry);
+
+    playback_play(seek_time, pause, prefetched);
+
+    if (prefetched)
+        return;
+
+    // otherwise, playback always begins with a rescan of the current entry in
+    // order to open the file, ensure a valid tuple, and read album art
     scan_cancel(entry);
     scan_queue_entry(playlist, entry, true);
 }
@@ -486,11 +701,16 @@ static void stop_playback_locked()
 {
     art_clear_current();
     scan_reset_playback();
+    prefetch.cancel();
 
     playback_stop();
 }
 
-void pl_signal_entry_deleted(PlaylistEntry * entry) { scan_cancel(entry); }
+void pl_signal_entry_deleted(PlaylistEntry * entry)
+{
+    scan_cancel(entry);
+    prefetch.entry_deleted(entry);
+}
 
 void pl_signal_position_changed(Playlist::ID * id)
 {
@@ -578,6 +798,7 @@ void playlist_init()
 
     mh.unlock();
 
+    hook_associate("set columnar_tuples", pl_hook_reformat_titles, nullptr);
     hook_associate("set generic_title_format", pl_hook_reformat_titles,
                    nullptr);
     hook_associate("set leading_zero", pl_hook_reformat_titles, nullptr);
@@ -613,6 +834,7 @@ void playlist_clear_updates()
 
 void playlist_end()
 {
+    hook_dissociate("set columnar_tuples", pl_hook_reformat_titles);
     hook_dissociate("set generic_title_format", pl_hook_reformat_titles);
     hook_dissociate("set leading_zero", pl_hook_reformat_titles);
     hook_dissociate("set metadata_fallbacks", pl_hook_reformat_titles);
@@ -627,6 +849,7 @@ void playlist_end()
     /* playback should already be stopped */
     assert(!playing_id);
     assert(!scan_list.head());
+    assert(!prefetch.entry());
 
     queued_update.stop();
 
@@ -701,22 +924,76 @@ EXPORT void Playlist::remove_selected() const
     SIMPLE_VOID_WRAPPER(remove_selected);
 }
 
+/* Sorts a playlist, releasing the lock while the sort keys are built and
+ * sorted.  If entries are added, removed, or moved meanwhile, the sort is
+ * started over.  Returns with the lock held. */
+static void run_sort(aud::mutex::holder & mh, Playlist::ID * id,
+                     PlaylistSort & sort, bool selected)
+{
+    PlaylistData * playlist;
+
+    while ((playlist = id->data))
+    {
+        int serial = playlist->structure_serial();
+
+        sort.clear();
+        playlist->fill_sort(sort, selected);
+
+        mh.unlock();
+        sort.run();
+        mh.lock();
+
+        if (id->data == playlist &&
+            playlist->structure_serial() == serial)
+        {
+            playlist->apply_sort(sort);
+            break;
+        }
+    }
+}
+
+static void sort_playlist(Playlist::ID * id, PlaylistSort & sort,
+                          bool selected)
+{
+    auto mh = mutex.take();
+    if (!id || !id->data)
+        return;
+
+    run_sort(mh, id, sort, selected);
+}
+
 EXPORT void Playlist::sort_by_filename(StringCompareFunc compare) const
 {
-    SIMPLE_VOID_WRAPPER(sort, {compare, nullptr});
+    PlaylistSort sort(compare, nullptr);
+    sort_playlist(m_id, sort, false);
 }
 EXPORT void Playlist::sort_by_tuple(TupleCompareFunc compare) const
 {
-    SIMPLE_VOID_WRAPPER(sort, {nullptr, compare});
+    PlaylistSort sort(nullptr, compare);
+    sort_playlist(m_id, sort, false);
 }
 EXPORT void Playlist::sort_selected_by_filename(StringCompareFunc compare) const
 {
-    SIMPLE_VOID_WRAPPER(sort_selected, {compare, nullptr});
+    PlaylistSort sort(compare, nullptr);
+    sort_playlist(m_id, sort, true);
 }
 EXPORT void Playlist::sort_selected_by_tuple(TupleCompareFunc compare) const
 {
-    SIMPLE_VOID_WRAPPER(sort_selected, {nullptr, compare});
+    PlaylistSort sort(nullptr, compare);
+    sort_playlist(m_id, sort, true);
 }
+
+EXPORT void Playlist::sort_entries(SortType scheme) const
+{
+    PlaylistSort sort(scheme);
+    sort_playlist(m_id, sort, false);
+}
+EXPORT void Playlist::sort_selected(SortType scheme) const
+{
+    PlaylistSort sort(scheme);
+    sort_playlist(m_id, sort, true);
+}
+
 EXPORT void Playlist::reverse_order() const
 {
     SIMPLE_VOID_WRAPPER(reverse_order);
@@ -793,6 +1070,36 @@ void PlaylistEx::insert_flat_items(int at,
     SIMPLE_VOID_WRAPPER(insert_items, at, std::move(items));
 }
 
+Index<char> PlaylistEx::take_journal(String * title,
+                                     Index<PlaylistAddItem> * items) const
+{
+    ENTER_GET_PLAYLIST(Index<char>());
+
+    if (title)
+        *title = playlist->title;
+
+    if (items)
+        playlist->get_items(*items);
+
+    return playlist->journal.take();
+}
+
+int64_t PlaylistEx::replay_journal(const char * data, int64_t len) const
+{
+    SIMPLE_WRAPPER(int64_t, 0, replay_journal, data, len);
+}
+
+void PlaylistEx::insert_snapshot(PlaylistSnapshot * snapshot) const
+{
+    ENTER_GET_PLAYLIST();
+    playlist->insert_snapshot(snapshot);
+}
+
+void PlaylistEx::fill_snapshot(SnapshotWriter & writer) const
+{
+    SIMPLE_VOID_WRAPPER(fill_snapshot, writer);
+}
+
 EXPORT int Playlist::index() const
 {
     ENTER_GET_PLAYLIST(-1);
@@ -944,8 +1251,7 @@ EXPORT void Playlist::set_title(const char * title) const
 {
     ENTER_GET_PLAYLIST();
 
-    playlist->title = String(title);
-    playlist->modified = true;
+    playlist->set_title(title);
 
     queue_global_update(Metadata);
 }
@@ -1074,7 +1380,7 @@ EXPORT Playlist Playlist::temporary_playlist()
     if (!id)
     {
         id = get_blank_locked();
-        id->data->title = String(title);
+        id->data->set_title(title);
     }
 
     return Playlist(id);
@@ -1096,6 +1402,14 @@ EXPORT Tuple Playlist::entry_tuple(int entry_num, GetMode mode,
     return playlist->entry_tuple(entry_num, error);
 }
 
+String PlaylistEx::entry_str(int entry_num, Tuple::Field field,
+                             GetMode mode) const
+{
+    ENTER_GET_PLAYLIST(String());
+    wait_for_entry(mh, playlist, entry_num, false, (mode == Wait));
+    return playlist->entry_str(entry_num, field);
+}
+
 EXPORT void Playlist::rescan_file(const char * filename)
 {
     auto mh = mutex.take();
@@ -1115,6 +1429,22 @@ DecodeInfo playback_entry_read(int serial)
         auto playlist = playing_id->data;
         auto entry = playlist->entry_at(playlist->position());
 
+        PlaylistPrefetch::Result result;
+        if (prefetch.take(entry, result))
+        {
+            int pos = playlist->position();
+            playback_set_info(pos, playlist->entry_tuple(pos));
+
+            art_cache_current(result.filename, std::move(result.image_data),
+                              std::move(result.image_file));
+
+            dec.filename = std::move(result.filename);
+            dec.ip = result.ip;
+            dec.file = std::move(result.file);
+            dec.error = std::move(result.error);
+            return dec;
+        }
+
         ScanItem * item = scan_list_find_entry(entry);
         assert(item && item->for_playback);
 
@@ -1147,6 +1477,32 @@ DecodeInfo playback_entry_read(int serial)
     return dec;
 }
 
+// called from playback thread, shortly before the end of the current song
+void playback_entry_prefetch(int serial, bool repeat)
+{
+    auto mh = mutex.take();
+
+    if (!playback_check_serial(serial))
+        return;
+
+    auto playlist = playing_id->data;
+    auto current = playlist->entry_at(playlist->position());
+    auto entry = playlist->entry_at(playlist->peek_next_song(repeat));
+
+    if (!entry || entry == current || entry == prefetch.entry())
+        return;
+
+    scan_cancel(entry);
+
+    auto request = playlist->create_scan_request(entry, prefetch_finish,
+                                                 SCAN_IMAGE | SCAN_FILE);
+
+    scan_list.append(new ScanItem(playlist, entry, request, false));
+    prefetch.start(entry, request);
+
+    scanner_request(request);
+}
+
 // called from playback thread
 void playback_entry_set_tuple(int serial, Tuple && tuple)
 {
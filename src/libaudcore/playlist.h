@@ -367,6 +367,13 @@ public:
     bool scan_in_progress() const;
     static bool scan_in_progress_any();
 
+    /* Asks for a range of entries (such as those visible in the interface) to
+     * be scanned ahead of the rest of the playlist.  Entries about to be
+     * played are scanned ahead of both.  The range is not adjusted as entries
+     * are added or removed, so it should be set again after a Structure
+     * update.  Pass <number> = 0 to clear it. */
+    void set_scan_priority_range(int at, int number) const;
+
     /* --- UTILITY API --- */
 
     /* Sorts entries according to a preset scheme. */
@@ -22,6 +22,8 @@
 #include <errno.h>
 #include <string.h>
 
+#include <atomic>
+
 #include <glib/gstdio.h>
 
 #include "audstrings.h"
@@ -105,6 +107,7 @@ static aud::array<PluginType, Index<PluginHandle *>> plugins;
 static aud::array<PluginType, Index<PluginHandle *>> compatible;
 static aud::mutex mutex;
 static bool modified = false;
+static std::atomic<int> serial(0);
 
 static StringBuf get_basename(const char * path)
 {
@@ -209,6 +212,8 @@ void plugin_registry_cleanup()
 
     for (auto & list : compatible)
         list.clear();
+
+    serial++;
 }
 
 static void transport_plugin_parse(PluginHandle * plugin, TextParser & parser)
@@ -445,6 +450,8 @@ void plugin_registry_prune()
         compatible[type].insert(plugins[type].begin(), 0, plugins[type].len());
         compatible[type].remove_if(check_incompatible);
     }
+
+    serial++;
 }
 
 /* Note: If there are multiple plugins with the same basename, this returns only
@@ -660,10 +667,13 @@ PluginEnabled plugin_get_enabled(PluginHandle * plugin)
 void plugin_set_enabled(PluginHandle * plugin, PluginEnabled enabled)
 {
     plugin->enabled = enabled;
+    serial++;
     plugin_call_watches(plugin);
     modified = true;
 }
 
+int plugin_registry_serial() { return serial; }
+
 void plugin_set_failed(PluginHandle * plugin)
 {
     plugin->header = nullptr;
@@ -189,7 +189,8 @@ public:
     virtual bool load(const char * path, VFSFile & file, String & title,
                       Index<PlaylistAddItem> & items) = 0;
 
-    /* path: URI of playlist file (in)
+    /* Like load(), may be called from a thread other than the main thread.
+     * path: URI of playlist file (in)
      * file: VFS handle of playlist file (in, write-only file, not seekable)
      * title: title of playlist (in)
      * items: playlist entries (in) */
@@ -58,6 +58,9 @@ PluginEnabled plugin_get_enabled(PluginHandle * plugin);
 void plugin_set_enabled(PluginHandle * plugin, PluginEnabled enabled);
 void plugin_set_failed(PluginHandle * plugin);
 
+/* incremented whenever a plugin is enabled, disabled, added, or removed */
+int plugin_registry_serial();
+
 const Index<String> & transport_plugin_get_schemes(PluginHandle * plugin);
 bool transport_plugin_has_scheme(PluginHandle * plugin, const char * scheme);
 bool playlist_plugin_can_save(PluginHandle * plugin);
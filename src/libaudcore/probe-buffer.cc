@@ -22,7 +22,7 @@
 
 #include <string.h>
 
-static constexpr int MAXBUF = 256 * 1024;
+static constexpr int MAXBUF = PROBE_BUFFER_SIZE;
 
 ProbeBuffer::ProbeBuffer(const char * filename, VFSImpl * file)
     : m_filename(filename), m_file(file)
@@ -36,6 +36,9 @@
 
 #include "vfs.h"
 
+/* size of the bufferable area */
+static constexpr int PROBE_BUFFER_SIZE = 256 * 1024;
+
 class ProbeBuffer : public VFSImpl
 {
 public:
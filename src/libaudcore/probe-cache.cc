@@ -0,0 +1,143 @@
+/*
+ * probe-cache.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "probe-cache.h"
+
+#include "audstrings.h"
+#include "vfs.h"
+
+static constexpr int PROBE_SIGNATURE_LEN = 4;
+static constexpr int PROBE_CACHE_MAX = 1024;
+
+template<class T>
+static void cache_add(SimpleHash<String, T> & cache, const String & key,
+                      T && value)
+{
+    if (cache.n_items() >= PROBE_CACHE_MAX)
+        cache.clear();
+
+    cache.add(key, std::move(value));
+}
+
+String ProbeCache::key(const char * scheme, const char * ext)
+{
+    return String(str_concat({scheme ? scheme : "", "\n", ext ? ext : ""}));
+}
+
+/* The signature is the first four bytes of the file, which hold the "magic"
+ * identifying most formats (and only rarely vary between files of a format). */
+String ProbeCache::content_key(const char * ext, const char * mime,
+                               VFSFile & file)
+{
+    unsigned char sig[PROBE_SIGNATURE_LEN] = {};
+    if (file.fread(sig, 1, sizeof sig) < 0 || file.fseek(0, VFS_SEEK_SET))
+        return String();
+
+    StringBuf key = str_concat({ext ? ext : "", "\n", mime ? mime : "", "\n"});
+    int len = key.len();
+
+    key.resize(len + 2 * sizeof sig);
+    for (unsigned i = 0; i < sizeof sig; i++)
+    {
+        key[len + 2 * i] = "0123456789abcdef"[sig[i] >> 4];
+        key[len + 2 * i + 1] = "0123456789abcdef"[sig[i] & 15];
+    }
+
+    return String(key);
+}
+
+/* must be called with m_mutex held; a result computed from an outdated
+ * plugin list may still be added, but is dropped at the next lookup */
+void ProbeCache::check_serial(int serial)
+{
+    if (serial == m_serial)
+        return;
+
+    m_key_cache.clear();
+    m_content_cache.clear();
+    m_serial = serial;
+}
+
+bool ProbeCache::lookup(int serial, const String & key, KeyMatches & matches)
+{
+    auto mh = m_mutex.take();
+    check_serial(serial);
+
+    KeyMatches * cached = m_key_cache.lookup(key);
+    if (!cached)
+        return false;
+
+    matches.scheme_match = cached->scheme_match;
+    matches.ext_matches.clear();
+    matches.ext_matches.insert(cached->ext_matches.begin(), 0,
+                               cached->ext_matches.len());
+    return true;
+}
+
+void ProbeCache::add(int serial, const String & key, const KeyMatches & matches)
+{
+    auto mh = m_mutex.take();
+    check_serial(serial);
+
+    KeyMatches cached = {matches.scheme_match};
+    cached.ext_matches.insert(matches.ext_matches.begin(), 0,
+                              matches.ext_matches.len());
+    cache_add(m_key_cache, key, std::move(cached));
+}
+
+void ProbeCache::order_candidates(int serial, const String & content_key,
+                                  Index<PluginHandle *> & list)
+{
+    auto mh = m_mutex.take();
+    check_serial(serial);
+
+    PluginHandle ** cached = m_content_cache.lookup(content_key);
+    if (!cached)
+        return;
+
+    PluginHandle * plugin = *cached;
+
+    for (int i = 0; i < list.len(); i++)
+    {
+        if (list[i] == plugin)
+        {
+            list.remove(i, 1);
+            list.insert(&plugin, 0, 1);
+            break;
+        }
+    }
+}
+
+void ProbeCache::add_match(int serial, const String & content_key,
+                           PluginHandle * plugin)
+{
+    auto mh = m_mutex.take();
+    check_serial(serial);
+
+    cache_add(m_content_cache, content_key, std::move(plugin));
+}
+
+void ProbeCache::clear()
+{
+    auto mh = m_mutex.take();
+
+    m_key_cache.clear();
+    m_content_cache.clear();
+    m_serial = -1;
+}
@@ -0,0 +1,81 @@
+/*
+ * probe-cache.h
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_PROBE_CACHE_H
+#define LIBAUDCORE_PROBE_CACHE_H
+
+#include "index.h"
+#include "multihash.h"
+#include "objects.h"
+#include "threads.h"
+
+class PluginHandle;
+class VFSFile;
+
+/* Results of aud_file_find_decoder() are cached so that files of a kind already
+ * seen are matched without walking the whole plugin list.  The first cache maps
+ * URI scheme and extension to the plugins accepting them; these keys are
+ * declared by the plugins, so the result is known without opening the file.
+ *
+ * The second, used when content has to be examined, is keyed by extension, MIME
+ * type, and the first few bytes of the file, and records the plugin that last
+ * accepted such a file.  Those bytes do not determine the result of
+ * is_our_file() (Ogg Vorbis, Opus, and FLAC all begin with "OggS"), so no
+ * plugin is ever skipped because of them: the plugin that matched before is
+ * only tried first, and then the others in order of priority.
+ *
+ * Each call gives the current plugin registry serial; the cached results are
+ * dropped whenever it changes.  All functions are thread-safe. */
+class ProbeCache
+{
+public:
+    struct KeyMatches
+    {
+        PluginHandle * scheme_match;
+        Index<PluginHandle *> ext_matches;
+    };
+
+    static String key(const char * scheme, const char * ext);
+    /* reads the first bytes of <file> and seeks back to the start; returns
+     * an empty string on error */
+    static String content_key(const char * ext, const char * mime,
+                              VFSFile & file);
+
+    bool lookup(int serial, const String & key, KeyMatches & matches);
+    void add(int serial, const String & key, const KeyMatches & matches);
+
+    /* moves the plugin that last accepted a file with the same content key
+     * to the front of <list>; the order is otherwise left unchanged */
+    void order_candidates(int serial, const String & content_key,
+                          Index<PluginHandle *> & list);
+    void add_match(int serial, const String & content_key,
+                   PluginHandle * plugin);
+
+    void clear();
+
+private:
+    aud::mutex m_mutex;
+    int m_serial = -1;
+    SimpleHash<String, KeyMatches> m_key_cache;
+    SimpleHash<String, PluginHandle *> m_content_cache;
+
+    void check_serial(int serial);
+};
+
+#endif /* LIBAUDCORE_PROBE_CACHE_H */
@@ -27,6 +27,7 @@
 #include "playlist.h"
 #include "plugin.h"
 #include "plugins-internal.h"
+#include "probe-cache.h"
 #include "runtime.h"
 
 bool open_input_file(const char * filename, const char * mode, InputPlugin * ip,
@@ -83,32 +84,60 @@ int probe_by_filename(const char * filename)
     return flags;
 }
 
-EXPORT PluginHandle * aud_file_find_decoder(const char * filename, bool fast,
-                                            VFSFile & file, String * error)
+static ProbeCache cache;
+
+void probe_cleanup() { cache.clear(); }
+
+static void find_key_matches(const char * scheme, const char * ext,
+                             ProbeCache::KeyMatches & matches)
 {
-    AUDINFO("%s %s.\n", fast ? "Fast-probing" : "Probing", filename);
+    String key = ProbeCache::key(scheme, ext);
+    int serial = plugin_registry_serial();
 
-    auto & list = aud_plugin_list(PluginType::Input);
+    if (cache.lookup(serial, key, matches))
+        return;
 
-    StringBuf scheme = uri_get_scheme(filename);
-    StringBuf ext = uri_get_extension(filename);
-    Index<PluginHandle *> ext_matches;
+    matches.scheme_match = nullptr;
 
-    for (PluginHandle * plugin : list)
+    for (PluginHandle * plugin : aud_plugin_list(PluginType::Input))
     {
         if (!aud_plugin_get_enabled(plugin))
             continue;
 
         if (scheme && input_plugin_has_key(plugin, InputKey::Scheme, scheme))
         {
-            AUDINFO("Matched %s by URI scheme.\n", aud_plugin_get_name(plugin));
-            return plugin;
+            matches.scheme_match = plugin;
+            matches.ext_matches.clear();
+            break;
         }
 
         if (ext && input_plugin_has_key(plugin, InputKey::Ext, ext))
-            ext_matches.append(plugin);
+            matches.ext_matches.append(plugin);
     }
 
+    cache.add(serial, key, matches);
+}
+
+EXPORT PluginHandle * aud_file_find_decoder(const char * filename, bool fast,
+                                            VFSFile & file, String * error)
+{
+    AUDINFO("%s %s.\n", fast ? "Fast-probing" : "Probing", filename);
+
+    StringBuf scheme = uri_get_scheme(filename);
+    StringBuf ext = uri_get_extension(filename);
+    ProbeCache::KeyMatches matches;
+
+    find_key_matches(scheme, ext, matches);
+
+    if (matches.scheme_match)
+    {
+        AUDINFO("Matched %s by URI scheme.\n",
+                aud_plugin_get_name(matches.scheme_match));
+        return matches.scheme_match;
+    }
+
+    Index<PluginHandle *> & ext_matches = matches.ext_matches;
+
     if (ext_matches.len() == 1)
     {
         AUDINFO("Matched %s by extension.\n",
@@ -129,6 +158,7 @@ EXPORT PluginHandle * aud_file_find_decoder(const char * filename, bool fast,
         return nullptr;
     }
 
+    auto & list = aud_plugin_list(PluginType::Input);
     String mime = file.get_metadata("content-type");
 
     if (mime)
@@ -147,9 +177,21 @@ EXPORT PluginHandle * aud_file_find_decoder(const char * filename, bool fast,
         }
     }
 
+    int serial = plugin_registry_serial();
+    String key = ProbeCache::content_key(ext, mime, file);
+
+    Index<PluginHandle *> candidates;
+    if (ext_matches.len())
+        candidates = std::move(ext_matches);
+    else
+        candidates.insert(list.begin(), 0, list.len());
+
+    if (key)
+        cache.order_candidates(serial, key, candidates);
+
     file.set_limit_to_buffer(true);
 
-    for (PluginHandle * plugin : (ext_matches.len() ? ext_matches : list))
+    for (PluginHandle * plugin : candidates)
     {
         if (!aud_plugin_get_enabled(plugin))
             continue;
@@ -164,6 +206,10 @@ EXPORT PluginHandle * aud_file_find_decoder(const char * filename, bool fast,
         {
             AUDINFO("Matched %s by content.\n", aud_plugin_get_name(plugin));
             file.set_limit_to_buffer(false);
+
+            if (key)
+                cache.add_match(serial, key, plugin);
+
             return plugin;
         }
 
@@ -196,3 +196,133 @@ EXPORT void RingBufBase::move_out(IndexBase & index, int to, int len)
     void * ptr = index.insert(to, len);
     move_out(ptr, len, nullptr);
 }
+
+EXPORT void AtomicRingBufBase::alloc(int size)
+{
+    assert(size >= 0 && size <= (1 << 29));
+
+    destroy();
+
+    if (!size)
+        return;
+
+    m_data = malloc(size);
+    if (!m_data)
+        throw std::bad_alloc();
+
+    __sync_add_and_fetch(&misc_bytes_allocated, size);
+
+    m_size = size;
+}
+
+EXPORT void AtomicRingBufBase::destroy()
+{
+    if (m_data)
+    {
+        __sync_sub_and_fetch(&misc_bytes_allocated, m_size);
+        free(m_data);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+
+    m_head.store(0, std::memory_order_relaxed);
+    m_tail.store(0, std::memory_order_relaxed);
+    m_head_cache = m_tail_cache = 0;
+}
+
+void AtomicRingBufBase::get_areas(int pos, int len, Areas & areas)
+{
+    int start = (pos >= m_size) ? pos - m_size : pos;
+    int part = aud::min(len, m_size - start);
+
+    areas.area1 = (char *)m_data + start;
+    areas.area2 = m_data;
+    areas.len1 = part;
+    areas.len2 = len - part;
+}
+
+EXPORT void AtomicRingBufBase::get_write_areas(int len, Areas & areas)
+{
+    int head = m_head.load(std::memory_order_relaxed);
+    int space = m_size - used(head, m_tail_cache);
+
+    /* refresh our view of the consumer only when it looks like we need to */
+    if (len < 0 || len > space)
+    {
+        m_tail_cache = m_tail.load(std::memory_order_acquire);
+        space = m_size - used(head, m_tail_cache);
+    }
+
+    if (len < 0 || len > space)
+        len = space;
+
+    get_areas(head, len, areas);
+}
+
+EXPORT void AtomicRingBufBase::commit_write(int len)
+{
+    int head = m_head.load(std::memory_order_relaxed);
+    assert(len >= 0 && len <= m_size - used(head, m_tail_cache));
+
+    m_head.store(advance(head, len), std::memory_order_release);
+}
+
+EXPORT void AtomicRingBufBase::get_read_areas(int len, Areas & areas)
+{
+    int tail = m_tail.load(std::memory_order_relaxed);
+    int avail = used(m_head_cache, tail);
+
+    /* refresh our view of the producer only when it looks like we need to */
+    if (len < 0 || len > avail)
+    {
+        m_head_cache = m_head.load(std::memory_order_acquire);
+        avail = used(m_head_cache, tail);
+    }
+
+    if (len < 0 || len > avail)
+        len = avail;
+
+    get_areas(tail, len, areas);
+}
+
+EXPORT void AtomicRingBufBase::commit_read(int len)
+{
+    int tail = m_tail.load(std::memory_order_relaxed);
+    assert(len >= 0 && len <= used(m_head_cache, tail));
+
+    m_tail.store(advance(tail, len), std::memory_order_release);
+}
+
+EXPORT int AtomicRingBufBase::write(const void * from, int len)
+{
+    Areas areas;
+    get_write_areas(len, areas);
+
+    memcpy(areas.area1, from, areas.len1);
+    memcpy(areas.area2, (const char *)from + areas.len1, areas.len2);
+
+    commit_write(areas.len1 + areas.len2);
+    return areas.len1 + areas.len2;
+}
+
+EXPORT int AtomicRingBufBase::read(void * to, int len)
+{
+    Areas areas;
+    get_read_areas(len, areas);
+
+    memcpy(to, areas.area1, areas.len1);
+    memcpy((char *)to + areas.len1, areas.area2, areas.len2);
+
+    commit_read(areas.len1 + areas.len2);
+    return areas.len1 + areas.len2;
+}
+
+EXPORT int AtomicRingBufBase::discard(int len)
+{
+    Areas areas;
+    get_read_areas(len, areas);
+
+    commit_read(areas.len1 + areas.len2);
+    return areas.len1 + areas.len2;
+}
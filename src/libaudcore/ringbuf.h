@@ -20,6 +20,8 @@
 #ifndef LIBAUDCORE_RINGBUF_H
 #define LIBAUDCORE_RINGBUF_H
 
+#include <atomic>
+
 #include <libaudcore/index.h>
 
 /*
@@ -169,4 +171,172 @@ private:
     static constexpr int cooked(int len) { return len / sizeof(T); }
 };
 
+/*
+ * AtomicRingBuf is a variant of RingBuf for passing data from one thread (the
+ * producer) to exactly one other thread (the consumer) without any locking:
+ *  - The write and read positions are published with release/acquire ordering
+ *    and are kept on separate cache lines, so that the two threads do not
+ *    contend for the same line on every access.
+ *  - Only basic types can be stored, since data is copied with memcpy().
+ *  - Data can be read and written in place through "areas" (at most two
+ *    linear regions), avoiding an extra copy.
+ *  - alloc() and destroy() are not thread-safe; they must be called while
+ *    neither thread is using the buffer.
+ */
+
+class AtomicRingBufBase
+{
+public:
+    struct Areas
+    {
+        void *area1, *area2;
+        int len1, len2;
+    };
+
+    constexpr AtomicRingBufBase()
+        : m_data(nullptr), m_size(0), m_head(0), m_tail_cache(0), m_tail(0),
+          m_head_cache(0)
+    {
+    }
+
+    AtomicRingBufBase(const AtomicRingBufBase &) = delete;
+    AtomicRingBufBase & operator=(const AtomicRingBufBase &) = delete;
+
+    // allocated size of the buffer
+    int size() const { return m_size; }
+
+    // number of bytes that can be read (consumer side)
+    int len() const
+    {
+        return used(m_head.load(std::memory_order_acquire),
+                    m_tail.load(std::memory_order_relaxed));
+    }
+
+    // number of bytes that can be written (producer side)
+    int space() const
+    {
+        return m_size - used(m_head.load(std::memory_order_relaxed),
+                             m_tail.load(std::memory_order_acquire));
+    }
+
+    void alloc(int size);
+    void destroy();
+
+    // producer side: get up to <len> bytes of free space (-1 = as much as
+    // possible), fill (part of) it, then commit the number of bytes written
+    void get_write_areas(int len, Areas & areas);
+    void commit_write(int len);
+
+    // consumer side: get up to <len> bytes of data (-1 = as much as possible),
+    // use (part of) it, then commit the number of bytes consumed
+    void get_read_areas(int len, Areas & areas);
+    void commit_read(int len);
+
+    // convenience wrappers; return the number of bytes actually copied
+    int write(const void * from, int len);
+    int read(void * to, int len);
+    int discard(int len = -1);
+
+private:
+    static constexpr int CacheLine = 64;
+
+    /* positions run from 0 to 2 * size - 1 so that a full buffer can be told
+     * apart from an empty one */
+    int used(int head, int tail) const
+    {
+        return (head >= tail) ? head - tail : head + 2 * m_size - tail;
+    }
+
+    int advance(int pos, int len) const
+    {
+        pos += len;
+        return (pos >= 2 * m_size) ? pos - 2 * m_size : pos;
+    }
+
+    void get_areas(int pos, int len, Areas & areas);
+
+    /* constant while the buffer is in use */
+    void * m_data;
+    int m_size;
+
+    /* written by the producer; m_tail_cache is its last view of m_tail */
+    alignas(CacheLine) std::atomic<int> m_head;
+    int m_tail_cache;
+
+    /* written by the consumer; m_head_cache is its last view of m_head */
+    alignas(CacheLine) std::atomic<int> m_tail;
+    int m_head_cache;
+};
+
+template<class T>
+class AtomicRingBuf : private AtomicRingBufBase
+{
+public:
+    static_assert(std::is_trivial<T>::value, "for basic types only");
+
+    struct Areas
+    {
+        T *area1, *area2;
+        int len1, len2;
+    };
+
+    constexpr AtomicRingBuf() : AtomicRingBufBase() {}
+
+    ~AtomicRingBuf() { destroy(); }
+
+    int size() const { return cooked(AtomicRingBufBase::size()); }
+    int len() const { return cooked(AtomicRingBufBase::len()); }
+    int space() const { return cooked(AtomicRingBufBase::space()); }
+
+    void alloc(int size) { AtomicRingBufBase::alloc(raw(size)); }
+    void destroy() { AtomicRingBufBase::destroy(); }
+
+    // producer side
+    void get_write_areas(int len, Areas & areas)
+    {
+        AtomicRingBufBase::Areas raw_areas;
+        AtomicRingBufBase::get_write_areas(raw(len), raw_areas);
+        areas = cooked(raw_areas);
+    }
+    void commit_write(int len) { AtomicRingBufBase::commit_write(raw(len)); }
+
+    int write(const T * from, int len)
+    {
+        return cooked(AtomicRingBufBase::write(from, raw(len)));
+    }
+
+    bool push(const T & item) { return write(&item, 1) == 1; }
+
+    // consumer side
+    void get_read_areas(int len, Areas & areas)
+    {
+        AtomicRingBufBase::Areas raw_areas;
+        AtomicRingBufBase::get_read_areas(raw(len), raw_areas);
+        areas = cooked(raw_areas);
+    }
+    void commit_read(int len) { AtomicRingBufBase::commit_read(raw(len)); }
+
+    int read(T * to, int len)
+    {
+        return cooked(AtomicRingBufBase::read(to, raw(len)));
+    }
+
+    int discard(int len = -1)
+    {
+        return cooked(AtomicRingBufBase::discard(raw(len)));
+    }
+
+    bool pop(T & item) { return read(&item, 1) == 1; }
+
+private:
+    static constexpr int raw(int len) { return len * sizeof(T); }
+    static constexpr int cooked(int len) { return len / sizeof(T); }
+
+    static Areas cooked(const AtomicRingBufBase::Areas & areas)
+    {
+        return {(T *)areas.area1, (T *)areas.area2, cooked(areas.len1),
+                cooked(areas.len2)};
+    }
+};
+
 #endif // LIBAUDCORE_RINGBUF_H
@@ -316,10 +316,12 @@ EXPORT void aud_init()
     eq_init();
     output_init();
     playlist_init();
+    vfs_async_init();
 
     start_plugins_one();
 
     record_init();
+    tuple_cache_init();
     scanner_init();
     load_playlists();
 }
@@ -362,13 +364,20 @@ EXPORT void aud_cleanup()
 
     adder_cleanup();
     scanner_cleanup();
+    tuple_cache_cleanup();
+    probe_cleanup();
     record_cleanup();
+    vfs_async_cleanup();
 
     stop_plugins_one();
 
     art_cleanup();
+#ifdef USE_LIBARCHIVE
+    archive_reader_cleanup();
+#endif
     chardet_cleanup();
     eq_cleanup();
+    fft_cleanup();
     output_cleanup();
     playlist_end();
 
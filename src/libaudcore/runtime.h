@@ -20,6 +20,9 @@
 #ifndef LIBAUDCORE_RUNTIME_H
 #define LIBAUDCORE_RUNTIME_H
 
+#include <atomic>
+
+#include <libaudcore/export.h>
 #include <libaudcore/objects.h>
 
 enum class AudPath
@@ -188,6 +191,73 @@ static inline double aud_get_double(const char * name)
     return aud_get_double(nullptr, name);
 }
 
+/* A cached, typed view of a setting in the main config section, for code that
+ * reads it very often (such as once per audio buffer).  The value is parsed on
+ * first use and refreshed whenever the setting changes, at the point where the
+ * "set <name>" hook is queued, so get() returns what aud_get_bool() etc. would
+ * but without a hash table lookup.  Handles must have static storage duration
+ * and are thread-safe. */
+class LIBAUDCORE_PUBLIC ConfigHandleBase
+{
+public:
+    const char * name() const { return m_name; }
+
+    ConfigHandleBase(const ConfigHandleBase &) = delete;
+    void operator=(const ConfigHandleBase &) = delete;
+
+protected:
+    explicit ConfigHandleBase(const char * name) : m_name(name) {}
+
+    void resolve();
+    virtual void refresh() = 0;
+
+    std::atomic<bool> m_resolved{false};
+
+private:
+    const char * const m_name;
+    ConfigHandleBase * m_next = nullptr;
+
+    friend void config_refresh_handles(const char * name);
+    friend void config_cleanup();
+};
+
+/* T may be bool, int, or double. */
+template<class T>
+class ConfigHandle : public ConfigHandleBase
+{
+public:
+    explicit ConfigHandle(const char * name) : ConfigHandleBase(name) {}
+
+    T get()
+    {
+        if (!m_resolved.load(std::memory_order_acquire))
+            resolve();
+
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+    /* same as aud_set_bool() etc.; the handle is updated before returning */
+    void set(T value);
+
+private:
+    std::atomic<T> m_value{T()};
+
+    void refresh() override;
+};
+
+template<>
+void ConfigHandle<bool>::refresh();
+template<>
+void ConfigHandle<bool>::set(bool value);
+template<>
+void ConfigHandle<int>::refresh();
+template<>
+void ConfigHandle<int>::set(int value);
+template<>
+void ConfigHandle<double>::refresh();
+template<>
+void ConfigHandle<double>::set(double value);
+
 void aud_init();
 void aud_resume();
 void aud_run();
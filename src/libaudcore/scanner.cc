@@ -20,22 +20,58 @@
 #include "scanner.h"
 
 #include <glib.h> /* for GThreadPool */
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include <atomic>
 
 #include "audstrings.h"
 #include "cue-cache.h"
+#include "hook.h"
 #include "i18n.h"
 #include "internal.h"
+#include "multihash.h"
 #include "plugins.h"
 #include "probe.h"
+#include "runtime.h"
+#include "threads.h"
 #include "tuple.h"
 #include "vfs.h"
 
+enum class ScanStorage
+{
+    Unknown,
+    SSD,
+    Rotational,
+    Remote
+};
+
 static GThreadPool * pool;
+static std::atomic<int> limit_override;
+
+/* storage type of each directory scanned so far; the file system is only
+ * probed from the scanner threads, so that scanner_concurrency() never waits
+ * for it on the main thread */
+#define STORAGE_DIRS_MAX 1024
+
+static aud::mutex storage_mutex;
+static SimpleHash<String, ScanStorage> storage_dirs;
+
+static std::atomic<int> stat_queued, stat_running;
+static std::atomic<int64_t> stat_completed, stat_wait_us, stat_run_us,
+    stat_max_us;
 
 ScanRequest::ScanRequest(const String & filename, int flags, Callback callback,
                          PluginHandle * decoder, Tuple && tuple)
     : filename(filename), flags(flags), callback(callback), decoder(decoder),
-      tuple(std::move(tuple)), ip(nullptr)
+      tuple(std::move(tuple)), ip(nullptr), queued_at(0)
 {
     /* If this is a cuesheet entry (and it has not already been loaded), capture
      * a reference to the cache immediately.  During a playlist scan, requests
@@ -73,6 +109,32 @@ void ScanRequest::run()
     bool need_tuple = (flags & SCAN_TUPLE) && !tuple.valid();
     bool need_image = (flags & SCAN_IMAGE);
 
+    /* use the persistent cache if the file has not changed since it was
+     * last read (cuesheet entries have their own cache) */
+    FileStamp stamp;
+    bool can_cache = !cue_cache && (need_tuple || !decoder) &&
+                     tuple_cache_get_stamp(audio_file, stamp);
+
+    if (can_cache)
+    {
+        PluginHandle * cached_decoder;
+        Tuple cached_tuple;
+
+        if (tuple_cache_lookup(filename, stamp, cached_decoder, cached_tuple))
+        {
+            if (!decoder)
+                decoder = cached_decoder;
+
+            if (need_tuple)
+            {
+                tuple = std::move(cached_tuple);
+                need_tuple = false;
+            }
+
+            can_cache = false; /* nothing new to store */
+        }
+    }
+
     if (!decoder)
         decoder = aud_file_find_decoder(audio_file, false, file, &error);
     if (!decoder)
@@ -91,6 +153,9 @@ void ScanRequest::run()
                                &error))
             goto err;
 
+        if (can_cache && need_tuple)
+            tuple_cache_store(filename, stamp, decoder, tuple);
+
         if (need_image && !image_data.len())
             image_file = art_search(audio_file);
     }
@@ -108,21 +173,247 @@ void ScanRequest::run()
     callback(this);
 }
 
+#ifdef __linux__
+static bool is_remote_fs(long type)
+{
+    switch ((unsigned long)type)
+    {
+    case 0x6969:     /* NFS */
+    case 0x517b:     /* SMB */
+    case 0xff534d42: /* CIFS */
+    case 0xfe534d42: /* SMB2 */
+    case 0x65735546: /* FUSE (sshfs etc.) */
+    case 0x00c36400: /* Ceph */
+    case 0x01021997: /* 9P */
+        return true;
+    default:
+        return false;
+    }
+}
+
+static ScanStorage check_block_device(dev_t dev)
+{
+    /* for a partition, the queue belongs to the parent device */
+    for (const char * queue : {"queue", "../queue"})
+    {
+        StringBuf path = str_printf("/sys/dev/block/%u:%u/%s/rotational",
+                                    major(dev), minor(dev), queue);
+
+        FILE * file = fopen(path, "r");
+        if (!file)
+            continue;
+
+        int c = fgetc(file);
+        fclose(file);
+
+        if (c == '0')
+            return ScanStorage::SSD;
+        if (c == '1')
+            return ScanStorage::Rotational;
+    }
+
+    return ScanStorage::Unknown;
+}
+#endif
+
+static ScanStorage check_storage(const char * dir)
+{
+#ifdef __linux__
+    StringBuf path = uri_to_filename(dir);
+    if (!path)
+        return ScanStorage::Unknown;
+
+    struct statfs fs;
+    if (statfs(path, &fs) == 0 && is_remote_fs(fs.f_type))
+        return ScanStorage::Remote;
+
+    struct stat st;
+    if (stat(path, &st) == 0)
+        return check_block_device(st.st_dev);
+#endif
+
+    return ScanStorage::Unknown;
+}
+
+static StringBuf get_dir(const char * filename)
+{
+    const char * slash = strrchr(filename, '/');
+    return slash ? str_copy(filename, slash + 1 - filename) : StringBuf();
+}
+
+/* called from the scanner threads */
+static void probe_storage(const char * filename)
+{
+    StringBuf dir = get_dir(filename);
+    if (!dir || strncmp(dir, "file://", 7))
+        return;
+
+    String key(dir);
+
+    {
+        auto mh = storage_mutex.take();
+        if (storage_dirs.lookup(key))
+            return;
+    }
+
+    ScanStorage type = check_storage(dir);
+
+    auto mh = storage_mutex.take();
+
+    if (storage_dirs.n_items() >= STORAGE_DIRS_MAX)
+        storage_dirs.clear();
+
+    storage_dirs.add(key, std::move(type));
+}
+
+/* returns Unknown for a local directory that has not been probed yet */
+static ScanStorage get_storage(const char * filename)
+{
+    StringBuf dir = get_dir(filename);
+    if (!dir)
+        return ScanStorage::Unknown;
+
+    /* anything not handled by the local file transport counts as remote */
+    if (strncmp(dir, "file://", 7))
+        return ScanStorage::Remote;
+
+    auto mh = storage_mutex.take();
+    ScanStorage * type = storage_dirs.lookup(String(dir));
+
+    return type ? *type : ScanStorage::Unknown;
+}
+
+static int automatic_limit(ScanStorage storage)
+{
+    int cpus = aud::clamp((int)g_get_num_processors(), 1, SCAN_THREADS_MAX);
+
+    switch (storage)
+    {
+    case ScanStorage::SSD:
+        return aud::max(cpus, 2);
+    case ScanStorage::Rotational:
+        /* more threads would only add seeking */
+        return 2;
+    case ScanStorage::Remote:
+        /* latency-bound; a few extra requests in flight hide the round trips
+         * without flooding the server */
+        return 8;
+    default:
+        return aud::clamp(cpus / 2, 2, 8);
+    }
+}
+
+int scanner_concurrency(const char * filename)
+{
+    int limit = limit_override.load(std::memory_order_relaxed);
+    if (limit > 0)
+        return limit;
+
+    return automatic_limit(filename ? get_storage(filename)
+                                    : ScanStorage::Unknown);
+}
+
+/* enough threads for the highest limit that may be chosen */
+static int pool_threads()
+{
+    int limit = limit_override.load(std::memory_order_relaxed);
+    if (limit > 0)
+        return limit;
+
+    return aud::max(automatic_limit(ScanStorage::SSD),
+                    automatic_limit(ScanStorage::Remote));
+}
+
+void scanner_set_limit(int limit)
+{
+    limit_override.store(aud::clamp(limit, 0, SCAN_THREADS_MAX),
+                         std::memory_order_relaxed);
+
+    if (pool)
+        g_thread_pool_set_max_threads(pool, pool_threads(), nullptr);
+}
+
+static void scan_threads_changed(void *, void *)
+{
+    scanner_set_limit(aud_get_int("scan_threads"));
+}
+
+ScanStats scanner_get_stats()
+{
+    ScanStats stats;
+
+    stats.queued = stat_queued.load(std::memory_order_relaxed);
+    stats.running = stat_running.load(std::memory_order_relaxed);
+    stats.completed = stat_completed.load(std::memory_order_relaxed);
+    stats.wait_us = stat_wait_us.load(std::memory_order_relaxed);
+    stats.run_us = stat_run_us.load(std::memory_order_relaxed);
+    stats.max_us = stat_max_us.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
 static void scan_worker(void * data, void *)
 {
-    ((ScanRequest *)data)->run();
-    delete (ScanRequest *)data;
+    auto request = (ScanRequest *)data;
+    int64_t start = g_get_monotonic_time();
+
+    stat_queued.fetch_sub(1, std::memory_order_relaxed);
+    stat_running.fetch_add(1, std::memory_order_relaxed);
+
+    probe_storage(request->filename);
+    request->run();
+
+    int64_t end = g_get_monotonic_time();
+    int64_t latency = end - request->queued_at;
+
+    stat_running.fetch_sub(1, std::memory_order_relaxed);
+    stat_completed.fetch_add(1, std::memory_order_relaxed);
+    stat_wait_us.fetch_add(start - request->queued_at,
+                           std::memory_order_relaxed);
+    stat_run_us.fetch_add(end - start, std::memory_order_relaxed);
+
+    int64_t max = stat_max_us.load(std::memory_order_relaxed);
+    while (latency > max && !stat_max_us.compare_exchange_weak(
+                                max, latency, std::memory_order_relaxed))
+        ;
+
+    delete request;
 }
 
 void scanner_init()
 {
-    pool =
-        g_thread_pool_new(scan_worker, nullptr, SCAN_THREADS, false, nullptr);
+    limit_override.store(aud::clamp(aud_get_int("scan_threads"), 0,
+                                    SCAN_THREADS_MAX),
+                         std::memory_order_relaxed);
+
+    pool = g_thread_pool_new(scan_worker, nullptr, pool_threads(), false,
+                             nullptr);
+
+    hook_associate("set scan_threads", scan_threads_changed, nullptr);
 }
 
 void scanner_request(ScanRequest * request)
 {
+    request->queued_at = g_get_monotonic_time();
+    stat_queued.fetch_add(1, std::memory_order_relaxed);
+
     g_thread_pool_push(pool, request, nullptr);
 }
 
-void scanner_cleanup() { g_thread_pool_free(pool, false, true); }
+void scanner_cleanup()
+{
+    hook_dissociate("set scan_threads", scan_threads_changed);
+
+    g_thread_pool_free(pool, false, true);
+    pool = nullptr;
+
+    storage_dirs.clear();
+
+    ScanStats stats = scanner_get_stats();
+    if (stats.completed)
+        AUDINFO("Scanned %" PRId64 " files: average %.1f ms waiting, "
+                "%.1f ms processing, longest %.1f ms.\n",
+                stats.completed, stats.wait_us / 1000.0 / stats.completed,
+                stats.run_us / 1000.0 / stats.completed,
+                stats.max_us / 1000.0);
+}
@@ -20,6 +20,8 @@
 #ifndef LIBAUDCORE_SCANNER_H
 #define LIBAUDCORE_SCANNER_H
 
+#include <stdint.h>
+
 #include "cue-cache.h"
 #include "index.h"
 #include "objects.h"
@@ -33,7 +35,8 @@ class PluginHandle;
 #define SCAN_IMAGE (1 << 1)
 #define SCAN_FILE (1 << 2)
 
-#define SCAN_THREADS 2
+/* upper limit for the "scan_threads" setting */
+#define SCAN_THREADS_MAX 64
 
 struct ScanRequest
 {
@@ -58,14 +61,39 @@ struct ScanRequest
 
     void run();
 
+    int64_t queued_at; /* monotonic time of scanner_request(), microseconds */
+
 private:
     SmartPtr<CueCacheRef> cue_cache;
 
     void read_cuesheet_entry();
 };
 
+struct ScanStats
+{
+    int queued;        /* requests waiting for a thread */
+    int running;       /* requests being processed */
+    int64_t completed; /* requests finished since startup */
+    int64_t wait_us;   /* total time completed requests spent waiting */
+    int64_t run_us;    /* total time completed requests spent processing */
+    int64_t max_us;    /* longest latency (waiting + processing) so far */
+};
+
 void scanner_init();
 void scanner_request(ScanRequest * request);
 void scanner_cleanup();
 
+/* Returns how many requests should be in progress at once while scanning
+ * files like the given one (nullptr if not known).  This is the limit set by
+ * scanner_set_limit(), if any; otherwise it is chosen from the number of
+ * processors and the kind of storage the file is on.  The storage is probed by
+ * the scanner threads, so this function does no I/O; until a file from the
+ * same folder has been scanned, the storage counts as unknown. */
+int scanner_concurrency(const char * filename);
+
+/* 0 = automatic; called with the "scan_threads" setting whenever it changes */
+void scanner_set_limit(int limit);
+
+ScanStats scanner_get_stats();
+
 #endif
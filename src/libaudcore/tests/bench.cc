@@ -0,0 +1,1259 @@
+/*
+ * bench.cc - Benchmarks for libaudcore
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "audio-internal.h"
+#include "audstrings.h"
+#include "cue-cache.h"
+#include "fft.h"
+#include "internal.h"
+#include "mainloop.h"
+#include "playlist-snapshot.h"
+#include "playlist-sort.h"
+#include "probe.h"
+#include "ringbuf.h"
+#include "runtime.h"
+#include "scanner.h"
+#include "threads.h"
+#include "tuple-columns.h"
+#include "tuple-compiler.h"
+#include "vfs.h"
+#include "vfs_async.h"
+#include "vfs_local.h"
+
+#include <libaudtag/builtin.h>
+
+#include <assert.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <iconv.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+
+MainloopType aud_get_mainloop_type() { return MainloopType::GLib; }
+
+/* keeps results from being optimized away */
+static volatile float sink;
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static void report(const char * name, double ms, double items,
+                   const char * unit)
+{
+    printf("%-40s %10.1f ms %14.1f %s/s\n", name, ms, items * 1000 / ms, unit);
+}
+
+/* Passes PCM in 1024-sample chunks from one thread to another, through a
+ * RingBuf guarded by a mutex and through an AtomicRingBuf.  Both sides yield
+ * when the buffer is full or empty, as a real decoder and output would wait. */
+static void bench_ringbuf()
+{
+    const int chunk = 1024;
+    const int total = 64 * 1024 * 1024 / sizeof(float);
+    const int size = 16 * chunk;
+
+    {
+        RingBuf<float> ring;
+        aud::mutex mutex;
+
+        ring.alloc(size);
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::thread producer([&]() {
+            float data[chunk] = {};
+            for (int sent = 0; sent < total;)
+            {
+                auto mh = mutex.take();
+                int len = aud::min(chunk, ring.space());
+                ring.copy_in(data, len);
+                mh.unlock();
+
+                if (!len)
+                    std::this_thread::yield();
+
+                sent += len;
+            }
+        });
+
+        float data[chunk];
+        for (int received = 0; received < total;)
+        {
+            auto mh = mutex.take();
+            int len = aud::min(chunk, ring.len());
+            ring.move_out(data, len);
+            mh.unlock();
+
+            if (!len)
+                std::this_thread::yield();
+
+            received += len;
+        }
+
+        producer.join();
+        report("RingBuf + mutex", elapsed_ms(start), total, "samples");
+    }
+
+    {
+        AtomicRingBuf<float> ring;
+
+        ring.alloc(size);
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::thread producer([&]() {
+            float data[chunk] = {};
+            for (int sent = 0; sent < total;)
+            {
+                int len = ring.write(data, chunk);
+                if (!len)
+                    std::this_thread::yield();
+
+                sent += len;
+            }
+        });
+
+        float data[chunk];
+        for (int received = 0; received < total;)
+        {
+            int len = ring.read(data, chunk);
+            if (!len)
+                std::this_thread::yield();
+
+            received += len;
+        }
+
+        producer.join();
+        report("AtomicRingBuf", elapsed_ms(start), total, "samples");
+    }
+
+    {
+        AtomicRingBuf<float> ring;
+
+        ring.alloc(size);
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::thread producer([&]() {
+            for (int sent = 0; sent < total;)
+            {
+                AtomicRingBuf<float>::Areas areas;
+                ring.get_write_areas(chunk, areas);
+                memset(areas.area1, 0, sizeof(float) * areas.len1);
+                memset(areas.area2, 0, sizeof(float) * areas.len2);
+                int len = areas.len1 + areas.len2;
+                ring.commit_write(len);
+
+                if (!len)
+                    std::this_thread::yield();
+
+                sent += len;
+            }
+        });
+
+        for (int received = 0; received < total;)
+        {
+            AtomicRingBuf<float>::Areas areas;
+            ring.get_read_areas(chunk, areas);
+            int len = areas.len1 + areas.len2;
+            if (len)
+                sink = areas.area1[0];
+            else
+                std::this_thread::yield();
+
+            ring.commit_read(len);
+            received += len;
+        }
+
+        producer.join();
+        report("AtomicRingBuf (in place)", elapsed_ms(start), total, "samples");
+    }
+}
+
+/* Computes spectra of 16 million frames of PCM at several transform sizes, as
+ * a spectrum analyzer would, with the default window. */
+static void bench_fft()
+{
+    const int total = 16 * 1024 * 1024;
+
+    Index<float> pcm, freq;
+    pcm.insert(0, FFTPlan::max_size);
+    freq.insert(0, FFTPlan::max_size / 2);
+
+    for (int n = 0; n < FFTPlan::max_size; n++)
+        pcm[n] = sinf(n * 0.01f) * 0.5f;
+
+    for (int size : {512, 2048, FFTPlan::max_size})
+    {
+        auto plan = FFTPlan::get(size);
+        auto start = std::chrono::steady_clock::now();
+
+        for (int done = 0; done < total; done += size)
+        {
+            plan->calc_freq(pcm.begin(), freq.begin());
+            sink = freq[0];
+        }
+
+        char name[64];
+        snprintf(name, sizeof name, "FFTPlan::calc_freq (%d)", size);
+        report(name, elapsed_ms(start), total, "frames");
+    }
+}
+
+/* Applies replay gain, software volume and soft clipping to 64 million samples
+ * of stereo audio in 4096-sample buffers, in separate passes as before and in
+ * the fused output gain stage. */
+static void bench_gain()
+{
+    const int total = 64 * 1024 * 1024;
+    const int len = 4096;
+
+    float source[len], data[len];
+    for (int i = 0; i < len; i++)
+        source[i] = sinf(i * 0.01f) * 1.5f;
+
+    float replay_gain = 1.2f;
+    StereoVolume volume = {95, 90};
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int done = 0; done < total; done += len)
+        {
+            memcpy(data, source, sizeof data);
+            audio_amplify(data, 1, len, &replay_gain);
+            audio_amplify(data, 2, len / 2, volume);
+            audio_soft_clip(data, len);
+            sink = data[0];
+        }
+
+        report("gain, separate passes", elapsed_ms(start), total, "samples");
+    }
+
+    {
+        float factors[2];
+        audio_volume_factors(volume, 2, factors);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (int done = 0; done < total; done += len)
+        {
+            memcpy(data, source, sizeof data);
+            audio_apply_gain(data, 1, len, &replay_gain, false);
+            audio_apply_gain(data, 2, len / 2, factors, true);
+            sink = data[0];
+        }
+
+        report("gain, fused stages", elapsed_ms(start), total, "samples");
+    }
+}
+
+/* Reads the settings which the output path consults for each buffer, once
+ * for each of 64 thousand buffers, through aud_get_*() and through cached
+ * config handles. */
+static void bench_config()
+{
+    const int buffers = 64 * 1024;
+
+    static const char * const defaults[] = {
+        "enable_replay_gain", "TRUE", "replay_gain_mode", "0",
+        "replay_gain_preamp", "0", "default_gain", "0",
+        "enable_clipping_prevention", "TRUE", "software_volume_control", "FALSE",
+        "sw_volume_left", "100", "sw_volume_right", "100",
+        "soft_clipping", "FALSE", "record", "FALSE", nullptr};
+
+    aud_config_set_defaults(nullptr, defaults);
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < buffers; i++)
+        {
+            int sum = aud_get_bool("enable_replay_gain") +
+                      aud_get_int("replay_gain_mode") +
+                      aud_get_bool("enable_clipping_prevention") +
+                      aud_get_bool("software_volume_control") +
+                      aud_get_int("sw_volume_left") +
+                      aud_get_int("sw_volume_right") +
+                      aud_get_bool("soft_clipping") + aud_get_bool("record");
+            sink = sum + aud_get_double("replay_gain_preamp") +
+                   aud_get_double("default_gain");
+        }
+
+        report("config, aud_get_*()", elapsed_ms(start), buffers, "buffers");
+    }
+
+    {
+        static ConfigHandle<bool> replay_gain("enable_replay_gain");
+        static ConfigHandle<int> mode("replay_gain_mode");
+        static ConfigHandle<bool> clipping("enable_clipping_prevention");
+        static ConfigHandle<bool> sw_volume("software_volume_control");
+        static ConfigHandle<int> left("sw_volume_left");
+        static ConfigHandle<int> right("sw_volume_right");
+        static ConfigHandle<bool> soft_clip("soft_clipping");
+        static ConfigHandle<bool> record("record");
+        static ConfigHandle<double> preamp("replay_gain_preamp");
+        static ConfigHandle<double> default_gain("default_gain");
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < buffers; i++)
+        {
+            int sum = replay_gain.get() + mode.get() + clipping.get() +
+                      sw_volume.get() + left.get() + right.get() +
+                      soft_clip.get() + record.get();
+            sink = sum + preamp.get() + default_gain.get();
+        }
+
+        report("config, ConfigHandle::get()", elapsed_ms(start), buffers,
+               "buffers");
+    }
+
+    config_cleanup();
+}
+
+/* Formats a million tuples with the default title format, one at a time as
+ * PlaylistEntry::format() does and then in a batch as reformat_titles() does
+ * (using several threads if the machine has them). */
+static void bench_tuple_format()
+{
+    const int count = 1000000;
+
+    TupleCompiler compiler;
+    compiler.compile("${?artist:${artist} - }${?album:${album} - }${title}");
+
+    Index<Tuple> tuples;
+    Index<Tuple *> pointers;
+
+    for (int i = 0; i < count; i++)
+    {
+        Tuple & tuple = tuples.append();
+        tuple.set_str(Tuple::Title, int_to_str(i));
+        tuple.set_int(Tuple::Track, i % 20);
+
+        if (i % 4)
+            tuple.set_str(Tuple::Artist, "Artist");
+        if (i % 3)
+            tuple.set_str(Tuple::Album, "Album");
+    }
+
+    for (Tuple & tuple : tuples)
+        pointers.append(&tuple);
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (Tuple & tuple : tuples)
+            compiler.format(tuple);
+
+        report("tuple format, format()", elapsed_ms(start), count, "tuples");
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        compiler.format_many(pointers.begin(), count);
+
+        report("tuple format, format_many()", elapsed_ms(start), count,
+               "tuples");
+    }
+}
+
+/* Converts 1M tag-sized strings: plain ASCII and accented UTF-8 through
+ * str_to_utf8(), and UTF-16 through str_convert(), whose converter is now
+ * cached per thread.  For comparison, the UTF-16 strings are also converted
+ * with a converter opened and closed for each string, as str_convert() used to
+ * do. */
+static void bench_charset()
+{
+    const int count = 1000000;
+    const char ascii[] = "The Artist Formerly Known - Track Title 12";
+    const char accented[] = "Élodie Frégé - La Fille de l'été";
+
+    StringBuf utf16 = str_convert(ascii, -1, "UTF-8", "UTF-16LE");
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < count; i++)
+            sink += str_to_utf8(ascii, sizeof ascii - 1).len();
+
+        report("charset, ASCII to UTF-8", elapsed_ms(start), count, "strings");
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < count; i++)
+            sink += str_to_utf8(accented, sizeof accented - 1).len();
+
+        report("charset, UTF-8 to UTF-8", elapsed_ms(start), count, "strings");
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < count; i++)
+            sink += str_convert(utf16, utf16.len(), "UTF-16LE", "UTF-8").len();
+
+        report("charset, UTF-16 to UTF-8", elapsed_ms(start), count, "strings");
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        int64_t bytes = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            char out[256];
+            iconv_t conv = iconv_open("UTF-8", "UTF-16LE");
+
+            size_t inbytesleft = utf16.len(), outbytesleft = sizeof out;
+            ICONV_CONST char * in = (ICONV_CONST char *)(const char *)utf16;
+            char * outp = out;
+
+            iconv(conv, &in, &inbytesleft, &outp, &outbytesleft);
+            iconv_close(conv);
+
+            bytes += sizeof out - outbytesleft;
+        }
+
+        sink += bytes;
+        report("charset, UTF-16 to UTF-8, iconv_open() each", elapsed_ms(start),
+               count, "strings");
+    }
+
+    /* long strings, where the vectorized ASCII check matters most */
+    StringBuf long_ascii(65536);
+    for (int i = 0; i < long_ascii.len(); i++)
+        long_ascii[i] = 'a' + i % 26;
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < 10000; i++)
+            sink += str_to_utf8(long_ascii, long_ascii.len()).len();
+
+        report("charset, 64 KB ASCII to UTF-8", elapsed_ms(start),
+               10000.0 * long_ascii.len() / 1048576, "MB");
+    }
+}
+
+/* Sorts 500k tuples by album, first as PlaylistData::sort() used to, calling
+ * str_compare() on the fields for every comparison, and then with keys built
+ * once per row by PlaylistSort. */
+static void bench_playlist_sort()
+{
+    const int count = 500000;
+
+    Index<Tuple> tuples;
+    Index<const Tuple *> pointers;
+
+    srand(1);
+
+    for (int i = 0; i < count; i++)
+    {
+        Tuple & tuple = tuples.append();
+        tuple.set_str(Tuple::Album,
+                      str_printf("Album %d", rand() % (count / 10)));
+    }
+
+    for (const Tuple & tuple : tuples)
+        pointers.append(&tuple);
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        pointers.sort([](const Tuple * a, const Tuple * b) {
+            return str_compare(a->get_str(Tuple::Album),
+                               b->get_str(Tuple::Album));
+        });
+
+        report("playlist sort, per-comparison", elapsed_ms(start), count,
+               "rows");
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        PlaylistSort sort(Playlist::Album);
+        for (int i = 0; i < count; i++)
+            sort.add(i, String(), tuples[i]);
+
+        sort.run();
+
+        report("playlist sort, PlaylistSort", elapsed_ms(start), count,
+               "rows");
+    }
+}
+
+/* Loads a 500000-row playlist from a snapshot, first creating every tuple (as
+ * loading through the playlist plugin must) and then only reading what is
+ * needed to create the entries, leaving the tuples in the file. */
+static void bench_playlist_snapshot()
+{
+    const int count = 500000;
+    const FileStamp stamp = {0, 0};
+    StringBuf path = filename_build({g_get_tmp_dir(), "aud-bench.audpl.snap"});
+
+    {
+        SnapshotWriter writer;
+        srand(1);
+
+        for (int i = 0; i < count; i++)
+        {
+            int album = rand() % (count / 10);
+
+            Tuple tuple;
+            tuple.set_str(Tuple::Title, str_printf("Title %d", i));
+            tuple.set_str(Tuple::Artist, str_printf("Artist %d", album / 4));
+            tuple.set_str(Tuple::Album, str_printf("Album %d", album));
+            tuple.set_int(Tuple::Track, i % 20);
+            tuple.set_int(Tuple::Length, 200000 + i % 1000);
+            tuple.set_state(Tuple::Valid);
+
+            writer.add(String(str_printf("file:///music/%d/%d.mp3", album, i)),
+                       tuple);
+        }
+
+        Index<char> data = writer.finish(stamp, stamp);
+        g_file_set_contents(path, data.begin(), data.len(), nullptr);
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        PlaylistSnapshot * snapshot = PlaylistSnapshot::open(path);
+        Index<Tuple> tuples;
+
+        for (int i = 0; i < count; i++)
+            tuples.append(snapshot->tuple(i));
+
+        report("playlist load, all tuples", elapsed_ms(start), count, "rows");
+        delete snapshot;
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        PlaylistSnapshot * snapshot = PlaylistSnapshot::open(path);
+        Index<String> filenames;
+        int64_t total = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            filenames.append(snapshot->filename(i));
+            total += snapshot->length(i);
+        }
+
+        report("playlist load, lazy tuples", elapsed_ms(start), count, "rows");
+        sink = total;
+        delete snapshot;
+    }
+
+    g_unlink(path);
+}
+
+/* resident memory of the process in bytes, or -1 if unknown */
+static int64_t resident_bytes()
+{
+#ifdef __linux__
+    long pages = -1;
+    FILE * file = fopen("/proc/self/statm", "r");
+    if (file)
+    {
+        if (fscanf(file, "%*d %ld", &pages) != 1)
+            pages = -1;
+        fclose(file);
+    }
+    return (pages < 0) ? -1 : (int64_t)pages * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
+
+static void report_memory(const char * name, int64_t rss, int64_t arrays,
+                          int rows)
+{
+    int64_t total = (rss >= 0) ? rss : arrays;
+    printf("%-40s %7.1f MB RSS %7.1f MB arrays %6.1f bytes/row\n", name,
+           rss / 1048576.0, arrays / 1048576.0, (double)total / rows);
+}
+
+/* Stores a million tuples, as a large playlist would, first in a TupleColumns
+ * and then as separate Tuples, and compares the memory used and the time
+ * taken to search one field and to create tuples from the columns.  The
+ * strings are created beforehand and shared by both layouts, so that only the
+ * layouts themselves are measured.  "arrays" is the storage of all Index
+ * objects (including the values within each Tuple); "RSS" also includes the
+ * Tuple objects themselves (on Linux only). */
+static void bench_tuple_columns()
+{
+    const int count = 1000000;
+    Index<String> titles, artists, albums, paths;
+    srand(1);
+
+    for (int i = 0; i < count; i++)
+    {
+        int album = rand() % (count / 10);
+        titles.append(String(str_printf("Title %d", i)));
+        artists.append(String(str_printf("Artist %d", album / 4)));
+        albums.append(String(str_printf("Album %d", album)));
+        paths.append(String(str_printf("/music/%d/", album)));
+    }
+
+    auto make_tuple = [&](int i) {
+        Tuple tuple;
+        tuple.set_str(Tuple::Title, titles[i]);
+        tuple.set_str(Tuple::Artist, artists[i]);
+        tuple.set_str(Tuple::Album, albums[i]);
+        tuple.set_str(Tuple::Path, paths[i]);
+        tuple.set_str(Tuple::FormattedTitle, titles[i]);
+        tuple.set_int(Tuple::Track, i % 20);
+        tuple.set_int(Tuple::Length, 200000 + i % 1000);
+        tuple.set_state(Tuple::Valid);
+        return tuple;
+    };
+
+    const String target = artists[count / 2];
+
+    {
+        int64_t rss = resident_bytes();
+        int64_t arrays = misc_bytes_allocated;
+        auto start = std::chrono::steady_clock::now();
+
+        TupleColumns columns;
+        for (int i = 0; i < count; i++)
+            columns.add(make_tuple(i));
+
+        report("TupleColumns::add", elapsed_ms(start), count, "rows");
+        report_memory("  columns", (rss < 0) ? -1 : resident_bytes() - rss,
+                      misc_bytes_allocated - arrays, count);
+
+        start = std::chrono::steady_clock::now();
+        int found = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (columns.get_str(i, Tuple::Artist) == target)
+                found++;
+        }
+
+        report("columns, search artist", elapsed_ms(start), count, "rows");
+        sink = found;
+
+        start = std::chrono::steady_clock::now();
+        int64_t total = 0;
+        for (int i = 0; i < count; i++)
+            total += columns.get(i).get_int(Tuple::Length);
+
+        report("columns, create tuples", elapsed_ms(start), count, "rows");
+        sink = total;
+    }
+
+    {
+        int64_t rss = resident_bytes();
+        int64_t arrays = misc_bytes_allocated;
+        auto start = std::chrono::steady_clock::now();
+
+        Index<Tuple> tuples;
+        for (int i = 0; i < count; i++)
+            tuples.append(make_tuple(i));
+
+        report("separate tuples, create", elapsed_ms(start), count, "rows");
+        report_memory("  separate tuples",
+                      (rss < 0) ? -1 : resident_bytes() - rss,
+                      misc_bytes_allocated - arrays, count);
+
+        start = std::chrono::steady_clock::now();
+        int found = 0;
+        for (auto & tuple : tuples)
+        {
+            if (tuple.get_str(Tuple::Artist) == target)
+                found++;
+        }
+
+        report("separate tuples, search artist", elapsed_ms(start), count,
+               "rows");
+        sink = found;
+    }
+}
+
+static void report_latency(const char * name, Index<double> & latencies)
+{
+    latencies.sort([](const double & a, const double & b) {
+        return (a > b) - (a < b);
+    });
+
+    auto at = [&](double p) {
+        return latencies[aud::min((int)(latencies.len() * p),
+                                  latencies.len() - 1)];
+    };
+
+    printf("%-40s p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms\n", name,
+           at(0.5), at(0.9), at(0.99), at(1));
+}
+
+/* Answers status queries from another thread while the main loop is kept busy
+ * (20 ms of work every 25 ms, as a UI redrawing a long playlist might), first
+ * by running each query in the main thread, as the D-Bus server used to, and
+ * then by reading a copy of the state published by the main thread. */
+static void bench_published_state()
+{
+    const int queries = 400;
+
+    struct State
+    {
+        int position;
+        String title;
+    };
+
+    aud::published<State> published;
+    int position = 0; /* main thread only */
+    QueuedFunc quit;
+
+    QueuedFunc busy;
+    busy.start(25, [&]() {
+        auto start = std::chrono::steady_clock::now();
+        while (elapsed_ms(start) < 20)
+            ;
+
+        position++;
+        published.set({position, String("Title")});
+    });
+
+    std::thread client([&]() {
+        aud::mutex mutex;
+        aud::condvar cond;
+        QueuedFunc hop;
+        Index<double> latencies;
+
+        for (int i = 0; i < queries; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            bool done = false;
+
+            hop.queue([&]() {
+                auto mh = mutex.take();
+                sink = position;
+                done = true;
+                cond.notify_all();
+            });
+
+            auto mh = mutex.take();
+            while (!done)
+                cond.wait(mh);
+
+            mh.unlock();
+            latencies.append(elapsed_ms(start));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        report_latency("query in main thread", latencies);
+        latencies.clear();
+
+        for (int i = 0; i < queries * 10; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            sink = published.get().position;
+            latencies.append(elapsed_ms(start));
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        report_latency("query of published state", latencies);
+        quit.queue(mainloop_quit);
+    });
+
+    mainloop_run();
+    client.join();
+    busy.stop();
+}
+
+/* Fires 4000 requests at once, as a UI showing album art for a long list
+ * might, first with a thread per request (as vfs_async.cc used to) and then
+ * through the worker pool.  The most threads alive at once is shown in
+ * parentheses. */
+static void bench_vfs_async()
+{
+    const int total = 4000;
+    static int delivered;
+
+    {
+        std::atomic<int> alive(0), peak(0);
+        Index<std::thread *> threads;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < total; i++)
+        {
+            threads.append(new std::thread([&alive, &peak]() {
+                int now = ++alive;
+                int max = peak.load();
+                while (now > max && !peak.compare_exchange_weak(max, now))
+                    ;
+
+                VFSFile file("file:///bench", "r");
+                if (file)
+                    file.read_all();
+
+                alive--;
+            }));
+        }
+
+        for (std::thread * thread : threads)
+        {
+            thread->join();
+            delete thread;
+        }
+
+        char name[64];
+        snprintf(name, sizeof name, "vfs_async, thread per request (%d)",
+                 peak.load());
+        report(name, elapsed_ms(start), total, "requests");
+    }
+
+    aud_set_int("async_read_threads", 4);
+    vfs_async_init();
+
+    auto start = std::chrono::steady_clock::now();
+    delivered = 0;
+
+    for (int i = 0; i < total; i++)
+    {
+        vfs_async_file_get_contents("file:///bench",
+                                    [](const char *, const Index<char> &) {
+                                        if (++delivered == total)
+                                            mainloop_quit();
+                                    });
+    }
+
+    mainloop_run();
+
+    char name[64];
+    snprintf(name, sizeof name, "vfs_async, worker pool (%d)",
+             vfs_async_peak_threads());
+    report(name, elapsed_ms(start), total, "requests");
+
+    vfs_async_cleanup();
+}
+
+/* Reads 2000 local files of 256 KiB as a tag reader and decoder probe would:
+ * the ID3v2 header, the ID3v1 and APE footers, 64 atom headers spread over
+ * the file, and then the first 64 KiB.  This is done through stdio (which
+ * LocalTransport uses for files opened read-write) and through a mapping,
+ * where the first 64 KiB are also read in place through a window. */
+static void bench_vfs_local()
+{
+    const int files = 2000;
+    const int size = 256 * 1024;
+
+    char base[] = "/tmp/aud-bench-XXXXXX";
+    if (!mkdtemp(base))
+        return;
+
+    Index<char> data;
+    data.insert(0, size);
+
+    Index<String> uris;
+    for (int f = 0; f < files; f++)
+    {
+        StringBuf path = str_printf("%s/%04d.mp3", base, f);
+        FILE * file = fopen(path, "wb");
+        fwrite(data.begin(), 1, size, file);
+        fclose(file);
+
+        uris.append(String(filename_to_uri(path)));
+    }
+
+    LocalTransport transport;
+
+    static const struct
+    {
+        const char * name, *mode;
+    } methods[] = {{"tag scan, stdio", "r+"}, {"tag scan, mapped", "r"}};
+
+    for (auto & method : methods)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (auto & uri : uris)
+        {
+            String error;
+            SmartPtr<VFSImpl> file(transport.fopen(uri, method.mode, error));
+            char buf[65536];
+
+            bool ok = file->fread(buf, 1, 10) == 10 &&
+                      !file->fseek(-128, VFS_SEEK_END) &&
+                      file->fread(buf, 1, 128) == 128 &&
+                      !file->fseek(-32, VFS_SEEK_END) &&
+                      file->fread(buf, 1, 32) == 32;
+
+            for (int atom = 0; atom < 64; atom++)
+                ok = ok && !file->fseek(atom * 4096, VFS_SEEK_SET) &&
+                     file->fread(buf, 1, 8) == 8;
+
+            ok = ok && !file->fseek(0, VFS_SEEK_SET) &&
+                 file->fread(buf, 1, sizeof buf) == sizeof buf;
+            sink = buf[sizeof buf - 1];
+
+            assert(ok);
+        }
+
+        report(method.name, elapsed_ms(start), files, "files");
+    }
+
+    for (auto & uri : uris)
+        g_unlink(uri_to_filename(uri));
+
+    g_rmdir(base);
+}
+
+/* passes reads through to another file, counting the bytes read */
+class CountingFile : public VFSImpl
+{
+public:
+    CountingFile(VFSImpl * file, int64_t & bytes_read)
+        : m_file(file), m_bytes_read(bytes_read)
+    {
+    }
+
+    int64_t fread(void * ptr, int64_t size, int64_t nmemb)
+    {
+        int64_t items = m_file->fread(ptr, size, nmemb);
+        m_bytes_read += items * size;
+        return items;
+    }
+
+    int fseek(int64_t offset, VFSSeekType whence)
+    {
+        return m_file->fseek(offset, whence);
+    }
+
+    int64_t ftell() { return m_file->ftell(); }
+    int64_t fsize() { return m_file->fsize(); }
+    bool feof() { return m_file->feof(); }
+
+    int64_t fwrite(const void *, int64_t, int64_t) { return 0; }
+    int ftruncate(int64_t) { return -1; }
+    int fflush() { return 0; }
+
+private:
+    SmartPtr<VFSImpl> m_file;
+    int64_t & m_bytes_read;
+};
+
+static void append_id3_frame(Index<char> & tag, const char * key,
+                             const char * contents, int len)
+{
+    uint32_t size = (len & 0x7f) | (len & 0x3f80) << 1 |
+                    (len & 0x1fc000) << 2 | (len & 0xfe00000) << 3;
+    char header[10] = {key[0], key[1], key[2], key[3], (char)(size >> 24),
+                       (char)(size >> 16), (char)(size >> 8), (char)size};
+
+    tag.insert(header, -1, 10);
+    tag.insert(contents, -1, len);
+}
+
+/* Reads the ID3v2.4 tags of 200 local files, each with 1 MiB of cover art
+ * between the text frames, first with and then without the cover art. */
+static void bench_id3v2_tags()
+{
+    const int files = 200;
+    const int pic_size = 1024 * 1024;
+
+    char base[] = "/tmp/aud-bench-XXXXXX";
+    if (!mkdtemp(base))
+        return;
+
+    Index<char> frames, apic;
+    apic.insert("\0image/jpeg\0\3Cover", 0, 18);
+    apic.insert(-1, pic_size + 1);
+
+    append_id3_frame(frames, "TIT2", "\0Title", 6);
+    append_id3_frame(frames, "TALB", "\0Album", 6);
+    append_id3_frame(frames, "APIC", apic.begin(), apic.len());
+    append_id3_frame(frames, "TPE1", "\0Artist", 7);
+
+    int len = frames.len();
+    char header[10] = {'I', 'D', '3', 4, 0, 0, (char)(len >> 21 & 0x7f),
+                       (char)(len >> 14 & 0x7f), (char)(len >> 7 & 0x7f),
+                       (char)(len & 0x7f)};
+
+    Index<String> uris;
+    for (int f = 0; f < files; f++)
+    {
+        StringBuf path = str_printf("%s/%04d.mp3", base, f);
+        FILE * file = fopen(path, "wb");
+        fwrite(header, 1, sizeof header, file);
+        fwrite(frames.begin(), 1, frames.len(), file);
+        fclose(file);
+
+        uris.append(String(filename_to_uri(path)));
+    }
+
+    LocalTransport transport;
+    audtag::ID3v24TagModule module;
+
+    for (bool want_image : {true, false})
+    {
+        int64_t bytes_read = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        for (auto & uri : uris)
+        {
+            String error;
+            VFSFile file(uri, new CountingFile(transport.fopen(uri, "r", error),
+                                               bytes_read));
+            Tuple tuple;
+            Index<char> image;
+
+            bool ok = module.read_tag(file, tuple, want_image ? &image : nullptr);
+            assert(ok && tuple.get_str(Tuple::Artist));
+            assert(image.len() == (want_image ? pic_size : 0));
+        }
+
+        double ms = elapsed_ms(start);
+        StringBuf name = str_printf("id3v2 read, %s, %.1f KiB/file",
+                                    want_image ? "with image" : "no image",
+                                    bytes_read / 1024.0 / files);
+        report(name, ms, files, "files");
+    }
+
+    for (auto & uri : uris)
+        g_unlink(uri_to_filename(uri));
+
+    g_rmdir(base);
+}
+
+/* The scanner is run with the plugin layer replaced by the following stubs,
+ * which read the head and tail of each file as a typical tag reader would. */
+
+static char fake_plugin; /* never dereferenced */
+
+PluginHandle * aud_file_find_decoder(const char * filename, bool, VFSFile &,
+                                     String *)
+{
+    FILE * file = fopen(uri_to_filename(filename), "rb");
+    if (!file)
+        return nullptr;
+
+    char header[4096];
+    size_t len = fread(header, 1, sizeof header, file);
+    fclose(file);
+
+    return len ? (PluginHandle *)&fake_plugin : nullptr;
+}
+
+bool aud_file_read_tag(const char * filename, PluginHandle *, VFSFile &,
+                       Tuple & tuple, Index<char> *, String *)
+{
+    FILE * file = fopen(uri_to_filename(filename), "rb");
+    if (!file)
+        return false;
+
+    char tag[129] = {};
+    bool success = !fseek(file, -128, SEEK_END) && fread(tag, 1, 128, file);
+    fclose(file);
+
+    tuple.set_filename(filename);
+    tuple.set_str(Tuple::Title, tag);
+
+    if (success)
+        tuple.set_state(Tuple::Valid);
+
+    return success;
+}
+
+InputPlugin * load_input_plugin(PluginHandle *, String *)
+{
+    return (InputPlugin *)&fake_plugin;
+}
+
+bool open_input_file(const char *, const char *, InputPlugin *, VFSFile &,
+                     String *)
+{
+    return false;
+}
+
+String art_search(const char *) { return String(); }
+
+CueCacheRef::CueCacheRef(const char * filename) : m_node(nullptr) {}
+CueCacheRef::~CueCacheRef() {}
+
+const Index<PlaylistAddItem> & CueCacheRef::load()
+{
+    static Index<PlaylistAddItem> none;
+    return none;
+}
+
+static struct
+{
+    aud::mutex mutex;
+    aud::condvar cond;
+    Index<String> files;
+    int next, in_flight, done;
+} scan_bench;
+
+/* mirrors scan_schedule() in playlist.cc */
+static void scan_bench_schedule()
+{
+    while (scan_bench.next < scan_bench.files.len())
+    {
+        int last = scan_bench.next - 1;
+        if (scan_bench.in_flight >=
+            scanner_concurrency(last >= 0 ? (const char *)scan_bench.files[last]
+                                          : nullptr))
+            break;
+
+        scanner_request(new ScanRequest(scan_bench.files[scan_bench.next++],
+                                        SCAN_TUPLE, [](ScanRequest * request) {
+                                            auto mh = scan_bench.mutex.take();
+                                            assert(request->tuple.valid());
+                                            scan_bench.in_flight--;
+                                            scan_bench.done++;
+                                            scan_bench_schedule();
+                                            scan_bench.cond.notify_all();
+                                        }));
+
+        scan_bench.in_flight++;
+    }
+}
+
+/* Scans a synthetic tree of 4000 files of 32 KiB each (in 16 folders, as an
+ * album-structured library would be) with several concurrency limits. */
+static void bench_scanner()
+{
+    const int folders = 16, files_per_folder = 250;
+
+    char base[] = "/tmp/aud-bench-XXXXXX";
+    if (!mkdtemp(base))
+        return;
+
+    char data[32768];
+    for (int i = 0; i < (int)sizeof data; i++)
+        data[i] = 'a' + i % 26;
+
+    for (int d = 0; d < folders; d++)
+    {
+        StringBuf dir = str_printf("%s/%02d", base, d);
+        g_mkdir(dir, 0755);
+
+        for (int f = 0; f < files_per_folder; f++)
+        {
+            StringBuf path = str_printf("%s/%03d.mp3", (const char *)dir, f);
+            FILE * file = fopen(path, "wb");
+            fwrite(data, 1, sizeof data, file);
+            fclose(file);
+
+            scan_bench.files.append(String(filename_to_uri(path)));
+        }
+    }
+
+    scanner_init();
+
+    for (int limit : {1, 2, 0})
+    {
+        scanner_set_limit(limit);
+
+        ScanStats before = scanner_get_stats();
+        auto start = std::chrono::steady_clock::now();
+
+        auto mh = scan_bench.mutex.take();
+        scan_bench.next = scan_bench.done = 0;
+        scan_bench_schedule();
+
+        while (scan_bench.done < scan_bench.files.len())
+            scan_bench.cond.wait(mh);
+
+        mh.unlock();
+
+        double ms = elapsed_ms(start);
+        ScanStats after = scanner_get_stats();
+        int64_t completed = after.completed - before.completed;
+
+        int64_t latency = (after.wait_us + after.run_us - before.wait_us -
+                           before.run_us) /
+                          aud::max(completed, (int64_t)1);
+
+        char name[64];
+        snprintf(name, sizeof name, "scanner, %s %d (%d us latency)",
+                 limit ? "limit" : "automatic",
+                 scanner_concurrency(scan_bench.files[0]), (int)latency);
+        report(name, ms, scan_bench.files.len(), "tracks");
+    }
+
+    scanner_cleanup();
+
+    for (auto & uri : scan_bench.files)
+        g_unlink(uri_to_filename(uri));
+    for (int d = 0; d < folders; d++)
+        g_rmdir(str_printf("%s/%02d", base, d));
+
+    g_rmdir(base);
+    scan_bench.files.clear();
+}
+
+int main(int argc, const char ** argv)
+{
+    static const struct
+    {
+        const char * name;
+        void (*func)();
+    } benchmarks[] = {{"ringbuf", bench_ringbuf},
+                      {"fft", bench_fft},
+                      {"gain", bench_gain},
+                      {"config", bench_config},
+                      {"tuple_format", bench_tuple_format},
+                      {"charset", bench_charset},
+                      {"playlist_sort", bench_playlist_sort},
+                      {"playlist_snapshot", bench_playlist_snapshot},
+                      {"tuple_columns", bench_tuple_columns},
+                      {"published_state", bench_published_state},
+                      {"vfs_async", bench_vfs_async},
+                      {"vfs_local", bench_vfs_local},
+                      {"id3v2_tags", bench_id3v2_tags},
+                      {"scanner", bench_scanner}};
+
+    for (auto & b : benchmarks)
+    {
+        bool selected = (argc < 2);
+        for (int i = 1; i < argc; i++)
+        {
+            if (!strcmp(argv[i], b.name))
+                selected = true;
+        }
+
+        if (selected)
+        {
+            printf("== %s ==\n", b.name);
+            b.func();
+        }
+    }
+
+    return 0;
+}
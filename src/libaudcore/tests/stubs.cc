@@ -1,5 +1,13 @@
+#include "audstrings.h"
+#include "hook.h"
 #include "internal.h"
+#include "plugins.h"
+#include "runtime.h"
 #include "vfs.h"
+#include "vfs_local.h"
+
+#include <glib.h>
+#include <string.h>
 
 extern "C" const char * libguess_determine_encoding(const char *, int,
                                                     const char *)
@@ -7,8 +15,58 @@ extern "C" const char * libguess_determine_encoding(const char *, int,
     return nullptr;
 }
 
-bool aud_get_bool(const char *, const char *) { return false; }
-String aud_get_str(const char *, const char *) { return String(""); }
+/* existing local files can be opened for reading (as by the archive reader),
+ * but the config is never loaded from or saved to disk */
+VFSFile::VFSFile(const char * filename, const char * mode)
+    : m_filename(filename)
+{
+    StringBuf path = uri_to_filename(filename);
+
+    if (!strcmp(mode, "r") && path && g_file_test(path, G_FILE_TEST_EXISTS))
+        m_impl.capture(LocalTransport().fopen(filename, mode, m_error));
+}
+
+bool VFSFile::test_file(const char *, VFSFileTest) { return false; }
+
+int64_t VFSFile::fread(void * ptr, int64_t size, int64_t nmemb)
+{
+    return m_impl ? m_impl->fread(ptr, size, nmemb) : 0;
+}
+
+int VFSFile::fseek(int64_t offset, VFSSeekType whence)
+{
+    return m_impl ? m_impl->fseek(offset, whence) : -1;
+}
+
+int64_t VFSFile::ftell() { return m_impl ? m_impl->ftell() : -1; }
+int64_t VFSFile::fsize() { return m_impl ? m_impl->fsize() : -1; }
+bool VFSFile::feof() { return m_impl ? m_impl->feof() : true; }
+
+bool VFSFile::is_mapped() { return false; }
+
+/* tags are read but never written */
+VFSFile VFSFile::tmpfile() { return VFSFile(); }
+int64_t VFSFile::fwrite(const void *, int64_t, int64_t) { return 0; }
+int VFSFile::ftruncate(int64_t) { return -1; }
+Index<char> VFSFile::read_all() { return Index<char>(); }
+int VFSFile::fflush() { return -1; }
 String VFSFile::get_metadata(const char *) { return String(); }
+bool VFSFile::copy_from(VFSFile &, int64_t) { return false; }
+bool VFSFile::replace_with(VFSFile &) { return false; }
+
+void event_queue(const char *, void *, void (*)(void *)) {}
+
+const char * aud_get_path(AudPath) { return g_get_tmp_dir(); }
+
+/* a single enabled plugin named "stub" */
+static char stub_plugin;
+
+PluginHandle * aud_plugin_lookup_basename(const char * basename)
+{
+    return strcmp(basename, "stub") ? nullptr : (PluginHandle *)&stub_plugin;
+}
+
+const char * aud_plugin_get_basename(PluginHandle *) { return "stub"; }
+bool aud_plugin_get_enabled(PluginHandle *) { return true; }
 
 size_t misc_bytes_allocated;
@@ -17,19 +17,49 @@
  * the use of this software.
  */
 
+#include "archive_reader.h"
+#include "audio-internal.h"
 #include "audio.h"
 #include "audstrings.h"
+#include "fft.h"
+#include "hook.h"
 #include "internal.h"
+#include "mainloop.h"
+#include "playlist-data.h"
+#include "playlist-internal.h"
+#include "playlist-journal.h"
+#include "playlist-prefetch.h"
+#include "playlist-snapshot.h"
+#include "playlist-sort.h"
+#include "plugins.h"
+#include "probe-buffer.h"
+#include "probe-cache.h"
 #include "ringbuf.h"
 #include "runtime.h"
+#include "tuple-columns.h"
 #include "tuple-compiler.h"
 #include "tuple.h"
 #include "vfs.h"
+#include "vfs_async.h"
+#include "vfs_local.h"
+
+#include <libaudtag/builtin.h>
 
 #include <assert.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 static bool use_qt = false;
 
@@ -70,6 +100,192 @@ static void test_audio_conversion()
         assert(out[i] == (in[i] & 0xffffff));
 }
 
+static void test_audio_simd()
+{
+    /* vectorized conversions must match the generic loops bit for bit */
+    /* an odd length (and offset) also tests handling of the remainder */
+    static const float special[] = {0.0f, -0.0f,      1.0f,     -1.0f,
+                                    1.5f, -1.5f,      1e-9f,    -1e-9f,
+                                    NAN,  INFINITY,   -INFINITY};
+
+    const int samples = 1021;
+
+    float in[samples];
+    uint8_t raw[4 * samples];
+    uint8_t expect_int[4 * samples], got_int[4 * samples];
+    float expect_float[samples], got_float[samples];
+
+    uint32_t seed = 12345;
+    auto next = [&seed]() { return seed = seed * 1103515245 + 12345; };
+
+    for (int i = 0; i < samples; i++)
+    {
+        if (i < aud::n_elems(special))
+            in[i] = special[i];
+        else if (i % 3 == 0) /* rounding ties at 16-bit precision */
+            in[i] = ((int)(next() % 65536) - 32768 + 0.5f) / 32768;
+        else
+            in[i] = ((int)(next() % 2400001) - 1200000) / 1000000.0f;
+    }
+
+    for (auto & byte : raw)
+        byte = next() >> 24;
+
+    SimdLevel detected = audio_simd_detected();
+
+    for (int format = FMT_S16_LE; format <= FMT_U24_3BE; format++)
+    {
+        int size = FMT_SIZEOF(format);
+
+        audio_simd_set_level(SimdLevel::None);
+        memset(expect_int, 0, sizeof expect_int);
+        audio_to_int(in + 1, expect_int, format, samples - 1);
+        audio_from_int(raw + size, format, expect_float, samples - 1);
+
+        for (auto level : {SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON})
+        {
+            if (!audio_simd_set_level(level))
+                continue;
+
+            memset(got_int, 0, sizeof got_int);
+            audio_to_int(in + 1, got_int, format, samples - 1);
+            audio_from_int(raw + size, format, got_float, samples - 1);
+
+            assert(!memcmp(got_int, expect_int, sizeof got_int));
+            assert(!memcmp(got_float, expect_float,
+                           sizeof(float) * (samples - 1)));
+        }
+    }
+
+    assert(audio_simd_set_level(detected));
+}
+
+static void test_audio_gain()
+{
+    /* the fused pass must match audio_amplify() and audio_soft_clip() */
+    const int frames = 1021;
+    const float factors[] = {0.5f, 1.7f, 1.0f, 0.0f, 2.5f, 0.9f};
+
+    float expect[6 * frames], got[6 * frames];
+
+    for (int channels = 1; channels <= 6; channels++)
+    {
+        int samples = channels * frames;
+
+        for (int i = 0; i < samples; i++)
+            expect[i] = sinf(i * 0.37f) * (i % 7) * 0.4f;
+
+        for (bool soft_clip : {false, true})
+        {
+            memcpy(got, expect, sizeof(float) * samples);
+            audio_apply_gain(got, channels, frames, factors, soft_clip);
+
+            float ref[6 * frames];
+            memcpy(ref, expect, sizeof(float) * samples);
+            audio_amplify(ref, channels, frames, factors);
+            if (soft_clip)
+                audio_soft_clip(ref, samples);
+
+            for (int i = 0; i < samples; i++)
+                assert(fabsf(got[i] - ref[i]) < 1e-6f);
+        }
+    }
+
+    /* volume factors as used by audio_amplify() */
+    float vol[2];
+    audio_volume_factors({100, 50}, 2, vol);
+    assert(vol[0] == 1 && fabsf(vol[1] - 0.1f) < 1e-6f);
+    audio_volume_factors({0, 50}, 1, vol);
+    assert(fabsf(vol[0] - 0.1f) < 1e-6f);
+}
+
+static void test_fft()
+{
+    assert(!FFTPlan::get(128));
+    assert(!FFTPlan::get(768));
+    assert(!FFTPlan::get(32768));
+    assert(FFTPlan::get(1024, FFTPlan::Hann) ==
+           FFTPlan::get(1024, FFTPlan::Hann));
+    assert(FFTPlan::get(1024, FFTPlan::Hann) != FFTPlan::get(1024));
+
+    /* compare against a direct DFT computed in double precision */
+    const int size = 1024;
+    float data[size], spectrum[size + 2], freq[size / 2];
+
+    uint32_t seed = 54321;
+    for (int n = 0; n < size; n++)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[n] = sinf(n * 0.3f) * 0.5f + (int)(seed >> 16) / 131072.0f - 0.25f;
+    }
+
+    for (int w = 0; w < FFTPlan::n_windows; w++)
+    {
+        auto plan = FFTPlan::get(size, (FFTPlan::Window)w);
+        assert(plan && plan->size() == size && plan->window() == w);
+
+        plan->transform(data, spectrum);
+        plan->calc_freq(data, freq);
+
+        /* recover the window from the DC term of each impulse response */
+        float window[size];
+        double window_sum = 0;
+        for (int n = 0; n < size; n++)
+        {
+            float impulse[size] = {};
+            impulse[n] = 1;
+
+            float out[size + 2];
+            plan->transform(impulse, out);
+            window[n] = out[0];
+            window_sum += out[0];
+        }
+
+        /* windows are scaled to an average of 1 */
+        assert(fabs(window_sum - size) < 0.01 * size);
+
+        for (int k = 0; k <= size / 2; k++)
+        {
+            double re = 0, im = 0;
+            for (int n = 0; n < size; n++)
+            {
+                double x = data[n] * (double)window[n];
+                re += x * cos(2 * M_PI * k * n / size);
+                im -= x * sin(2 * M_PI * k * n / size);
+            }
+
+            assert(fabs(spectrum[2 * k] - re) < 1e-3);
+            assert(fabs(spectrum[2 * k + 1] - im) < 1e-3);
+
+            if (k > 0)
+            {
+                double mag = sqrt(re * re + im * im) / size;
+                if (k < size / 2)
+                    mag *= 2;
+
+                assert(fabs(freq[k - 1] - mag) < 1e-5);
+            }
+        }
+    }
+
+    /* the largest size should locate a pure tone exactly */
+    const int big = FFTPlan::max_size;
+    Index<float> tone, big_freq;
+    tone.insert(0, big);
+    big_freq.insert(0, big / 2);
+
+    for (int n = 0; n < big; n++)
+        tone[n] = sinf(2 * (float)M_PI * 1000 * n / big);
+
+    FFTPlan::get(big, FFTPlan::Rectangular)->calc_freq(tone.begin(),
+                                                       big_freq.begin());
+
+    for (int k = 0; k < big / 2; k++)
+        assert(k == 999 ? fabsf(big_freq[k] - 1) < 1e-3 : big_freq[k] < 1e-3);
+
+    fft_cleanup();
+}
+
 static void test_case_conversion()
 {
     const char in[] = "AÄaäEÊeêIÌiìOÕoõUÚuú";
@@ -320,6 +536,324 @@ static void test_tuple_formats()
     test_tuple_format("x${(empty)?artist:Empty}", tuple, "x");
     test_tuple_format("x${(empty)?album:Empty}", tuple, "xEmpty");
     test_tuple_format("x${(empty)?\"Literal\":Empty}", tuple, "Song Title");
+
+    /* nesting tests */
+    const char * nested = "${?title:<${?artist:${artist} - }${title}>}"
+                          "${==year,0:${?album:(${album})}}";
+    tuple.unset(Tuple::Artist);
+    test_tuple_format(nested, tuple, "<Song Title>");
+    tuple.set_str(Tuple::Artist, "Artist");
+    tuple.set_str(Tuple::Album, "Album");
+    test_tuple_format(nested, tuple, "<Artist - Song Title>(Album)");
+    tuple.set_int(Tuple::Year, 1990);
+    test_tuple_format(nested, tuple, "<Artist - Song Title>");
+}
+
+static std::atomic<int> prepared;
+
+static void prepare_for_format(Tuple & tuple) { prepared++; }
+
+static void test_tuple_format_many()
+{
+    const int count = 20000;
+    const char * format = "${?artist:${artist} - }${title}${?year: (${year})}";
+
+    TupleCompiler compiler;
+    compiler.compile(format);
+
+    Index<Tuple> tuples;
+    Index<Tuple *> pointers;
+
+    for (int i = 0; i < count; i++)
+    {
+        Tuple & tuple = tuples.append();
+        tuple.set_str(Tuple::Title, int_to_str(i));
+        if (i % 3)
+            tuple.set_str(Tuple::Artist, "Artist");
+        if (i % 5)
+            tuple.set_int(Tuple::Year, i);
+    }
+
+    for (Tuple & tuple : tuples)
+        pointers.append(&tuple);
+
+    compiler.format_many(pointers.begin(), count, prepare_for_format);
+    assert(prepared == count);
+
+    for (int i = 0; i < count; i++)
+    {
+        Tuple copy = tuples[i].ref();
+        compiler.format(copy);
+        assert(tuples[i].get_str(Tuple::FormattedTitle) ==
+               copy.get_str(Tuple::FormattedTitle));
+    }
+}
+
+static void test_playlist_sort()
+{
+    /* enough rows for the merge to be divided between threads */
+    const int count = 98304;
+    const char chars[] = "aB9 0/_~";
+
+    Index<String> filenames;
+    Index<Tuple> tuples;
+
+    srand(1);
+
+    for (int i = 0; i < count; i++)
+    {
+        char buf[16];
+        int len = rand() % 10;
+
+        for (int j = 0; j < len; j++)
+            buf[j] = chars[rand() % (sizeof chars - 1)];
+
+        buf[len] = 0;
+
+        filenames.append(String(str_concat({"file:///", buf})));
+
+        Tuple & tuple = tuples.append();
+        if (i % 7)
+            tuple.set_str(Tuple::Album, buf);
+        if (i % 5)
+            tuple.set_int(Tuple::Track, rand() % 100 - 10);
+    }
+
+    auto album_less = [&](int a, int b) {
+        return str_compare(tuples[a].get_str(Tuple::Album),
+                           tuples[b].get_str(Tuple::Album)) < 0;
+    };
+
+    auto track_less = [&](int a, int b) {
+        bool set_a = tuples[a].is_set(Tuple::Track);
+        bool set_b = tuples[b].is_set(Tuple::Track);
+        if (set_a && set_b)
+            return tuples[a].get_int(Tuple::Track) <
+                   tuples[b].get_int(Tuple::Track);
+        return set_a < set_b;
+    };
+
+    auto name_less = [&](int a, int b) {
+        return str_compare_encoded(strrchr(filenames[a], '/') + 1,
+                                   strrchr(filenames[b], '/') + 1) < 0;
+    };
+
+    Index<int> album_order, track_order, name_order;
+    for (int i = 0; i < count; i++)
+    {
+        album_order.append(i);
+        track_order.append(i);
+        name_order.append(i);
+    }
+
+    std::stable_sort(album_order.begin(), album_order.end(), album_less);
+    std::stable_sort(track_order.begin(), track_order.end(), track_less);
+    std::stable_sort(name_order.begin(), name_order.end(), name_less);
+
+    /* keyed sorting must give the same order as a stable sort using the
+     * comparison functions, however many threads it is divided between */
+    PlaylistSort by_album(Playlist::Album);
+    PlaylistSort by_track(Playlist::Track);
+    PlaylistSort by_name(Playlist::Filename);
+
+    for (int i = 0; i < count; i++)
+    {
+        by_album.add(i, filenames[i], tuples[i]);
+        by_track.add(i, filenames[i], tuples[i]);
+        by_name.add(i, filenames[i], tuples[i]);
+    }
+
+    for (int threads : {1, 3, 4, 0})
+    {
+        by_album.set_threads(threads);
+        by_track.set_threads(threads);
+        by_name.set_threads(threads);
+
+        by_album.run();
+        by_track.run();
+        by_name.run();
+
+        for (int i = 0; i < count; i++)
+        {
+            assert(by_album.sorted_row(i) == album_order[i]);
+            assert(by_track.sorted_row(i) == track_order[i]);
+            assert(by_name.sorted_row(i) == name_order[i]);
+        }
+    }
+
+    /* passing only the key field gives the same result as the whole tuple */
+    PlaylistSort album_field(Playlist::Album);
+    PlaylistSort track_field(Playlist::Track);
+
+    assert(album_field.key_field() == Tuple::Album);
+    assert(track_field.key_field() == Tuple::Track);
+    assert(by_name.key_field() == Tuple::Invalid && !by_name.needs_tuple());
+
+    for (int i = 0; i < count; i++)
+    {
+        album_field.add_str(i, filenames[i], tuples[i].get_str(Tuple::Album));
+        track_field.add_int(i, filenames[i], tuples[i].is_set(Tuple::Track),
+                            tuples[i].get_int(Tuple::Track));
+    }
+
+    album_field.run();
+    track_field.run();
+
+    for (int i = 0; i < count; i++)
+    {
+        assert(album_field.sorted_row(i) == by_album.sorted_row(i));
+        assert(track_field.sorted_row(i) == by_track.sorted_row(i));
+    }
+
+    /* a custom comparison gives the same result */
+    PlaylistSort custom(nullptr, [](const Tuple & a, const Tuple & b) {
+        return str_compare(a.get_str(Tuple::Album), b.get_str(Tuple::Album));
+    });
+
+    for (int i = 0; i < count; i += 2)
+        custom.add(i, filenames[i], tuples[i]);
+
+    assert(custom.needs_tuple() && custom.key_field() == Tuple::Invalid);
+    custom.run();
+
+    for (int i = 0; i < custom.n_rows(); i++)
+        assert(custom.row(i) == 2 * i);
+    for (int i = 1; i < custom.n_rows(); i++)
+    {
+        int a = custom.sorted_row(i - 1), b = custom.sorted_row(i);
+        int cmp = str_compare(tuples[a].get_str(Tuple::Album),
+                              tuples[b].get_str(Tuple::Album));
+        assert(cmp < 0 || (cmp == 0 && a < b));
+    }
+
+    /* numbers compare by value, regardless of leading zeros */
+    PlaylistSort numbers(Playlist::Title);
+    const char * const titles[] = {"track 10", "Track 9", "track 009b",
+                                   "track 1000000000", "track", "track 0"};
+
+    for (int i = 0; i < aud::n_elems(titles); i++)
+    {
+        Tuple tuple;
+        tuple.set_str(Tuple::Title, titles[i]);
+        numbers.add(i, String(), tuple);
+    }
+
+    numbers.run();
+
+    const int expected[] = {4, 5, 1, 2, 0, 3};
+    for (int i = 0; i < aud::n_elems(expected); i++)
+        assert(numbers.sorted_row(i) == expected[i]);
+}
+
+static void test_playlist_snapshot()
+{
+    StringBuf path = filename_build({g_get_tmp_dir(), "aud-test.audpl.snap"});
+    const FileStamp playlist = {1234, 5678}, journal = {-1, -1};
+
+    Tuple tuple;
+    tuple.set_filename("file:///music/track.mp3");
+    tuple.set_str(Tuple::Title, "Title");
+    tuple.set_str(Tuple::Album, "Album");
+    tuple.set_int(Tuple::Track, -3);
+    tuple.set_int(Tuple::Length, 180000);
+    tuple.set_str(Tuple::FormattedTitle, "not saved");
+    tuple.set_state(Tuple::Valid);
+
+    SnapshotWriter writer;
+    writer.set_title("Playlist");
+    writer.add(String("file:///music/track.mp3"), tuple);
+    writer.add(String("file:///music/other.mp3"), Tuple());
+
+    Index<char> data = writer.finish(playlist, journal);
+    assert(g_file_set_contents(path, data.begin(), data.len(), nullptr));
+
+    PlaylistSnapshot * snapshot = PlaylistSnapshot::open(path);
+    assert(snapshot);
+    assert(snapshot->playlist_stamp() == playlist);
+    assert(snapshot->journal_stamp() == journal);
+    assert(!strcmp(snapshot->title(), "Playlist"));
+    assert(snapshot->n_rows() == 2);
+
+    assert(!strcmp(snapshot->filename(0), "file:///music/track.mp3"));
+    assert(snapshot->length(0) == 180000);
+    assert(snapshot->state(0) == Tuple::Valid);
+    assert(!strcmp(snapshot->filename(1), "file:///music/other.mp3"));
+    assert(snapshot->state(1) == Tuple::Initial);
+
+    Tuple copy = snapshot->tuple(0);
+    assert(copy.state() == Tuple::Valid);
+    assert(copy.get_str(Tuple::Title) == String("Title"));
+    assert(copy.get_str(Tuple::Album) == String("Album"));
+    assert(copy.get_str(Tuple::Basename) == String("track"));
+    assert(copy.get_int(Tuple::Track) == -3);
+    assert(!copy.is_set(Tuple::FormattedTitle));
+
+    /* rows copied from a snapshot are the same as the originals */
+    SnapshotWriter writer2;
+    writer2.add(String(snapshot->filename(0)), *snapshot, 0);
+    data = writer2.finish(playlist, journal);
+
+    delete snapshot;
+    assert(g_file_set_contents(path, data.begin(), data.len(), nullptr));
+
+    snapshot = PlaylistSnapshot::open(path);
+    assert(snapshot && snapshot->n_rows() == 1 && !snapshot->title());
+    assert(snapshot->tuple(0) == copy);
+    delete snapshot;
+
+    /* damaged files are rejected */
+    assert(g_file_set_contents(path, data.begin(), data.len() / 2, nullptr));
+    assert(!PlaylistSnapshot::open(path));
+
+    g_unlink(path);
+}
+
+static void test_tuple_columns()
+{
+    Tuple tuple;
+    tuple.set_filename("file:///media/Artist/Album/track.mp3");
+    tuple.set_str(Tuple::Title, "Title");
+    tuple.set_int(Tuple::Track, -1);
+    tuple.set_int(Tuple::Length, 180000);
+    tuple.set_state(Tuple::Valid);
+    tuple.generate_fallbacks();
+
+    TupleColumns columns;
+    int row = columns.add(tuple);
+    int row2 = columns.add(Tuple());
+    assert(row != row2 && columns.n_rows() == 2);
+
+    assert(columns.state(row) == Tuple::Valid);
+    assert(columns.get_str(row, Tuple::Title) == String("Title"));
+    assert(columns.get_int(row, Tuple::Track) == -1);
+    assert(columns.is_set(row, Tuple::Track));
+    assert(!columns.is_set(row2, Tuple::Track));
+    assert(columns.get_int(row2, Tuple::Track) == -1);
+
+    /* fallbacks are not stored */
+    assert(tuple.get_str(Tuple::Album));
+    assert(!columns.is_set(row, Tuple::Album));
+
+    Tuple copy = columns.get(row);
+    tuple.delete_fallbacks();
+    assert(copy == tuple);
+
+    /* changing a row leaves no stale values */
+    Tuple tuple2;
+    tuple2.set_str(Tuple::Artist, "Artist");
+    columns.set(row, tuple2);
+    assert(!columns.is_set(row, Tuple::Title));
+    assert(columns.get(row) == tuple2);
+
+    /* removed rows are reused */
+    columns.remove(row2);
+    assert(columns.n_rows() == 1);
+    assert(columns.add(tuple) == row2);
+    assert(columns.get(row2) == tuple);
+
+    columns.remove(row);
+    columns.remove(row2);
+    assert(!columns.n_rows() && !columns.bytes_used());
 }
 
 static void test_ringbuf()
@@ -454,6 +988,89 @@ static void test_ringbuf()
     string_leak_check();
 }
 
+static void test_atomic_ringbuf()
+{
+    AtomicRingBuf<int> ring;
+    AtomicRingBuf<int>::Areas areas;
+    int nums[10], out[10];
+
+    for (int i = 0; i < 10; i++)
+        nums[i] = i;
+
+    ring.alloc(7);
+
+    assert(ring.size() == 7);
+    assert(ring.write(nums, 10) == 7);
+    assert(ring.len() == 7);
+    assert(ring.space() == 0);
+    assert(!ring.push(nums[7]));
+
+    assert(ring.read(out, 5) == 5);
+    for (int i = 0; i < 5; i++)
+        assert(out[i] == i);
+
+    assert(ring.write(nums + 7, 3) == 3);
+    assert(ring.len() == 5);
+    assert(ring.space() == 2);
+
+    /* data now wraps around the end of the buffer */
+    ring.get_read_areas(-1, areas);
+    assert(areas.len1 == 2 && areas.len2 == 3);
+    assert(areas.area1[0] == 5 && areas.area1[1] == 6);
+    assert(areas.area2[0] == 7 && areas.area2[2] == 9);
+    ring.commit_read(3);
+
+    ring.get_write_areas(4, areas);
+    assert(areas.len1 == 4 && areas.len2 == 0);
+    areas.area1[0] = 10;
+    ring.commit_write(1);
+
+    assert(ring.len() == 3);
+    assert(ring.pop(out[0]) && out[0] == 8);
+    assert(ring.discard() == 2);
+    assert(ring.len() == 0);
+    assert(!ring.pop(out[0]));
+
+    /* pass a counting sequence between two threads */
+    const int total = 1000000;
+    ring.alloc(1000);
+
+    std::thread producer([&ring]() {
+        int next = 0;
+        while (next < total)
+        {
+            AtomicRingBuf<int>::Areas areas;
+            ring.get_write_areas(aud::min(total - next, 77), areas);
+
+            for (int i = 0; i < areas.len1; i++)
+                areas.area1[i] = next++;
+            for (int i = 0; i < areas.len2; i++)
+                areas.area2[i] = next++;
+
+            ring.commit_write(areas.len1 + areas.len2);
+
+            if (!areas.len1)
+                std::this_thread::yield();
+        }
+    });
+
+    int expect = 0;
+    while (expect < total)
+    {
+        int got = ring.read(out, 10);
+        for (int i = 0; i < got; i++)
+            assert(out[i] == expect++);
+
+        if (!got)
+            std::this_thread::yield();
+    }
+
+    producer.join();
+    assert(ring.len() == 0);
+
+    ring.destroy();
+}
+
 static StringBuf str_recursive_insert(const char * str, int level)
 {
     StringBuf buf = str_copy(str);
@@ -481,6 +1098,142 @@ static StringBuf str_repeated_nest(const char * str, int level)
     return buf2;
 }
 
+static void test_config_handle()
+{
+    static ConfigHandle<bool> flag("test_flag");
+    static ConfigHandle<int> number("test_number");
+    static ConfigHandle<double> ratio("test_ratio");
+
+    static const char * const defaults[] = {"test_flag", "TRUE",
+                                            "test_number", "42", nullptr};
+
+    assert(!flag.get() && number.get() == 0 && ratio.get() == 0);
+
+    /* defaults set later are picked up */
+    aud_config_set_defaults(nullptr, defaults);
+    assert(flag.get() && number.get() == 42);
+
+    aud_set_bool("test_flag", false);
+    aud_set_int("test_number", -7);
+    ratio.set(0.25);
+
+    assert(!flag.get() && number.get() == -7 && ratio.get() == 0.25);
+    assert(aud_get_double("test_ratio") == 0.25);
+
+    /* resetting to the default clears the stored value */
+    number.set(42);
+    assert(number.get() == 42 && !strcmp(aud_get_str("test_number"), "42"));
+
+    /* other sections are not tracked */
+    aud_set_bool("other", "test_flag", true);
+    assert(!flag.get());
+
+    config_cleanup();
+    assert(flag.get() == false && number.get() == 0);
+}
+
+static void test_tuple_cache()
+{
+    StringBuf path = filename_build({g_get_tmp_dir(), "aud-test-track.mp3"});
+    StringBuf uri = filename_to_uri(path);
+    StringBuf cache = filename_build({g_get_tmp_dir(), "tuple-cache"});
+
+    FILE * file = fopen(path, "wb");
+    fputs("not really audio", file);
+    fclose(file);
+
+    g_unlink(cache);
+    tuple_cache_init();
+
+    FileStamp stamp;
+    PluginHandle * decoder = nullptr;
+    Tuple tuple;
+
+    assert(tuple_cache_get_stamp(uri, stamp));
+    assert(!tuple_cache_get_stamp("http://example.com/stream.mp3", stamp));
+    assert(!tuple_cache_lookup(uri, stamp, decoder, tuple));
+
+    tuple.set_filename(uri);
+    tuple.set_str(Tuple::Title, "Song Title");
+    tuple.set_int(Tuple::Length, 180000);
+    tuple.set_subtunes(3, nullptr);
+    tuple.set_state(Tuple::Valid);
+
+    tuple_cache_store(uri, stamp, aud_plugin_lookup_basename("stub"), tuple);
+
+    /* a few changes do not make an autosave rewrite the file */
+    for (int i = 0; i < 20; i++)
+    {
+        tuple_cache_store(str_printf("%s.%d", (const char *)uri, i), stamp,
+                          aud_plugin_lookup_basename("stub"), tuple);
+        hook_call("config save", nullptr);
+    }
+
+    assert(!g_file_test(cache, G_FILE_TEST_EXISTS));
+
+    /* many do, from a worker thread; lookups go on while the file is being
+     * saved, and see both the entries being saved and those made meanwhile */
+    std::atomic<bool> stop(false);
+    std::thread reader([&]() {
+        PluginHandle * found_decoder;
+        Tuple found;
+
+        while (!stop)
+        {
+            assert(tuple_cache_lookup(uri, stamp, found_decoder, found));
+            assert(found == tuple);
+        }
+    });
+
+    const int n_many = 3000;
+
+    for (int i = 20; i < n_many; i++)
+    {
+        tuple_cache_store(str_printf("%s.%d", (const char *)uri, i), stamp,
+                          aud_plugin_lookup_basename("stub"), tuple);
+        hook_call("config save", nullptr);
+    }
+
+    for (int i = 0; i < 500 && !g_file_test(cache, G_FILE_TEST_EXISTS); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    assert(g_file_test(cache, G_FILE_TEST_EXISTS));
+
+    stop = true;
+    reader.join();
+
+    for (int i = 0; i < n_many; i++)
+    {
+        Tuple found;
+        assert(tuple_cache_lookup(str_printf("%s.%d", (const char *)uri, i),
+                                  stamp, decoder, found));
+    }
+
+    /* entries must survive a restart */
+    tuple_cache_cleanup();
+    tuple_cache_init();
+
+    Tuple cached;
+    assert(tuple_cache_lookup(uri, stamp, decoder, cached));
+    assert(decoder == aud_plugin_lookup_basename("stub"));
+    assert(cached.valid());
+    assert(cached == tuple);
+
+    /* a changed file invalidates its entry */
+    FileStamp changed = stamp;
+    changed.size++;
+    assert(!tuple_cache_lookup(uri, changed, decoder, cached));
+
+    tuple_cache_cleanup();
+    tuple_cache_init();
+
+    assert(!tuple_cache_lookup(uri, stamp, decoder, cached));
+
+    tuple_cache_cleanup();
+    g_unlink(cache);
+    g_unlink(path);
+}
+
 static void test_stringbuf()
 {
     char expect[262145];
@@ -516,6 +1269,60 @@ static void test_str_printf()
     assert(!strcmp(problem, "6 * 7 = 42"));
 }
 
+static void test_charset_conversion()
+{
+    /* plain ASCII of every length up to a few SIMD blocks, with and without
+     * a non-ASCII character at each position */
+    char buf[64];
+    for (int len = 0; len < 48; len++)
+    {
+        for (int i = 0; i < len; i++)
+            buf[i] = 'a' + i % 26;
+
+        buf[len] = 0;
+        assert(!strcmp(str_to_utf8(buf, len), buf));
+        assert(!strcmp(str_to_utf8(buf, -1), buf));
+
+        if (len >= 2)
+        {
+            memcpy(buf + len - 2, "\xc3\xa9", 2); /* é */
+            assert(!strcmp(str_to_utf8(buf, -1), buf));
+        }
+    }
+
+    /* converters are cached per thread; use more charset pairs than fit in
+     * the cache, so that entries are replaced */
+    const char * charsets[] = {"ISO-8859-1", "ISO-8859-15", "CP1252",
+                               "UTF-16LE",   "UTF-16BE",    "UTF-32LE"};
+
+    for (int round = 0; round < 3; round++)
+    {
+        for (const char * charset : charsets)
+        {
+            StringBuf enc = str_convert("caf\xc3\xa9", -1, "UTF-8", charset);
+            assert(enc);
+
+            StringBuf dec = str_convert(enc, enc.len(), charset, "UTF-8");
+            assert(dec && !strcmp(dec, "caf\xc3\xa9"));
+        }
+
+        assert(!str_convert("abc", -1, "NO-SUCH-CHARSET", "UTF-8"));
+        assert(!str_convert("\xff", -1, "UTF-8", "ISO-8859-1"));
+    }
+
+    /* a cached converter must be returned to its initial state, so that the
+     * byte order mark is written each time */
+    StringBuf utf16a = str_convert("ab", -1, "UTF-8", "UTF-16");
+    StringBuf utf16b = str_convert("ab", -1, "UTF-8", "UTF-16");
+    assert(utf16a.len() == 6 && utf16b.len() == 6);
+    assert(!memcmp(utf16a, utf16b, 6));
+
+    std::thread([]() {
+        StringBuf dec = str_convert("caf\xe9", -1, "ISO-8859-1", "UTF-8");
+        assert(dec && !strcmp(dec, "caf\xc3\xa9"));
+    }).join();
+}
+
 static void test_uri_construct()
 {
     StringBuf result;
@@ -548,20 +1355,1598 @@ static void test_uri_construct()
     assert(!strcmp(result, "http://folder%20two/test2.mp3?auth=1"));
 }
 
+static void test_mapped_file()
+{
+    char path[] = "/tmp/aud-test-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+
+    char data[300000];
+    for (int i = 0; i < (int)sizeof data; i++)
+        data[i] = i % 251;
+
+    assert(write(fd, data, sizeof data) == sizeof data);
+
+    SmartPtr<MappedFile> file(MappedFile::create(path, fd));
+    close(fd);
+    g_unlink(path);
+
+    assert(file && file->fsize() == sizeof data);
+
+    char buf[16];
+    assert(file->fread(buf, 1, 10) == 10 && !memcmp(buf, data, 10));
+    assert(file->ftell() == 10);
+
+    assert(file->fseek(-128, VFS_SEEK_END) == 0);
+    assert(file->ftell() == sizeof data - 128);
+    assert(file->fseek(120, VFS_SEEK_CUR) == 0);
+
+    /* a short read reports end of file */
+    assert(!file->feof());
+    assert(file->fread(buf, 4, 4) == 2 && !memcmp(buf, data + 299992, 8));
+    assert(file->feof());
+
+    assert(file->fseek(-1, VFS_SEEK_SET) < 0);
+    assert(file->fwrite(buf, 1, 1) == 0 && file->ftruncate(0) < 0);
+
+    /* limited to the probe buffer */
+    file->set_limit_to_buffer(true);
+    assert(file->fseek(0, VFS_SEEK_END) < 0);
+    assert(file->fseek(PROBE_BUFFER_SIZE + 1, VFS_SEEK_SET) < 0);
+    assert(file->fseek(PROBE_BUFFER_SIZE - 8, VFS_SEEK_SET) == 0);
+    assert(file->fread(buf, 1, 16) == 8 && !file->feof());
+
+    file->set_limit_to_buffer(false);
+    assert(file->fread(buf, 1, 16) == 16);
+    assert(!memcmp(buf, data + PROBE_BUFFER_SIZE, 16));
+
+    /* a file truncated while mapped is read directly from then on, once the
+     * copy from the mapping faults past the new end (the rest of the last
+     * page reads as zeros, so the file is cut at a page boundary here) */
+    char path2[] = "/tmp/aud-test-XXXXXX";
+    fd = mkstemp(path2);
+    assert(fd >= 0);
+    assert(write(fd, data, sizeof data) == sizeof data);
+
+    file.capture(MappedFile::create(path2, fd));
+    assert(file && file->fread(buf, 1, 16) == 16);
+
+    int64_t page = sysconf(_SC_PAGESIZE);
+    int64_t cut = 100000 / page * page;
+    assert(cut > 16 && ftruncate(fd, cut) == 0);
+
+    assert(file->fseek(cut - 10, VFS_SEEK_SET) == 0);
+    assert(file->fread(buf, 1, 16) == 10 && !memcmp(buf, data + cut - 10, 10));
+    assert(file->feof());
+
+    assert(file->fseek(200000, VFS_SEEK_SET) == 0);
+    assert(file->fread(buf, 1, 16) == 0 && file->feof());
+
+    assert(file->fsize() == cut);
+    assert(file->fseek(-16, VFS_SEEK_END) == 0);
+    assert(file->fread(buf, 1, 16) == 16 && !memcmp(buf, data + cut - 16, 16));
+
+    close(fd);
+    g_unlink(path2);
+
+    /* pipes are not mapped */
+    int fds[2];
+    assert(pipe(fds) == 0);
+    assert(!MappedFile::create("(pipe)", fds[0]));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* the file is truncated and restored over and over while it is being read;
+ * reads must end early or fall back to pread() rather than raise SIGBUS */
+static void test_mapped_file_truncate_race()
+{
+    const int size = 1 << 20, short_size = 3 * 4096 + 100;
+
+    char path[] = "/tmp/aud-test-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+
+    /* no zeros in the data, so that those from the truncation stand out */
+    Index<char> data;
+    data.insert(0, size);
+    for (int i = 0; i < size; i++)
+        data[i] = 1 + i % 251;
+
+    assert(write(fd, data.begin(), size) == size);
+
+    std::atomic<bool> done(false);
+    std::thread truncater([&]() {
+        while (!done)
+        {
+            assert(ftruncate(fd, short_size) == 0);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            assert(pwrite(fd, data.begin(), size, 0) == size);
+        }
+    });
+
+    for (int pass = 0; pass < 200; pass++)
+    {
+        SmartPtr<MappedFile> file(MappedFile::create(path, fd));
+        assert(file);
+
+        char buf[65536];
+        int64_t pos = 0, got;
+
+        while ((got = file->fread(buf, 1, sizeof buf)) > 0)
+        {
+            for (int64_t i = 0; i < got; i++)
+                assert(!buf[i] || buf[i] == data[pos + i]);
+
+            pos += got;
+            assert(pos <= size && file->ftell() == pos);
+        }
+    }
+
+    done = true;
+    truncater.join();
+
+    close(fd);
+    g_unlink(path);
+}
+
+#ifdef USE_LIBARCHIVE
+
+static Index<char> archive_data(int size, int seed)
+{
+    Index<char> data;
+    data.insert(0, size);
+    for (int i = 0; i < size; i++)
+        data[i] = (i + seed) % 251;
+
+    return data;
+}
+
+struct ArchiveItem
+{
+    const char * name;
+    const Index<char> & data;
+};
+
+enum ArchiveFormat
+{
+    ARCHIVE_TAR,
+    ARCHIVE_ZIP_STORED,
+    ARCHIVE_ZIP_DEFLATED
+};
+
+static void append_le(Index<char> & out, int64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out.append((char)(value >> (8 * i)));
+}
+
+/* writes a zip of stored entries in the simplest form, without data
+ * descriptors or extra fields (the CRCs are left zero) */
+static StringBuf write_stored_zip(const char * path,
+                                  std::initializer_list<ArchiveItem> items)
+{
+    Index<char> out, central;
+
+    for (const ArchiveItem & item : items)
+    {
+        int name_len = strlen(item.name);
+        int64_t offset = out.len();
+
+        out.insert("PK\3\4", -1, 4);
+        append_le(out, 10, 2); /* version needed */
+        append_le(out, 0, 4); /* flags, method */
+        append_le(out, 0x210000, 4); /* time, date (1980-01-01) */
+        append_le(out, 0, 4); /* CRC */
+        append_le(out, item.data.len(), 4);
+        append_le(out, item.data.len(), 4);
+        append_le(out, name_len, 2);
+        append_le(out, 0, 2);
+        out.insert(item.name, -1, name_len);
+        out.insert(item.data.begin(), -1, item.data.len());
+
+        central.insert("PK\1\2", -1, 4);
+        append_le(central, 20, 2); /* version made by */
+        append_le(central, 10, 2);
+        append_le(central, 0, 4);
+        append_le(central, 0x210000, 4);
+        append_le(central, 0, 4);
+        append_le(central, item.data.len(), 4);
+        append_le(central, item.data.len(), 4);
+        append_le(central, name_len, 2);
+        append_le(central, 0, 8); /* extra, comment, disk, attributes */
+        append_le(central, 0, 4);
+        append_le(central, offset, 4);
+        central.insert(item.name, -1, name_len);
+    }
+
+    int64_t central_pos = out.len();
+    out.insert(central.begin(), -1, central.len());
+
+    out.insert("PK\5\6", -1, 4);
+    append_le(out, 0, 4); /* disk numbers */
+    append_le(out, items.size(), 2);
+    append_le(out, items.size(), 2);
+    append_le(out, central.len(), 4);
+    append_le(out, central_pos, 4);
+    append_le(out, 0, 2);
+
+    GError * error = nullptr;
+    assert(g_file_set_contents(path, out.begin(), out.len(), &error));
+
+    return filename_to_uri(path);
+}
+
+static StringBuf write_archive(const char * path, ArchiveFormat format,
+                               std::initializer_list<ArchiveItem> items)
+{
+    if (format == ARCHIVE_ZIP_STORED)
+        return write_stored_zip(path, items);
+
+    archive * a = archive_write_new();
+
+    if (format == ARCHIVE_TAR)
+        archive_write_set_format_ustar(a);
+    else
+    {
+        archive_write_set_format_zip(a);
+        archive_write_zip_set_compression_deflate(a);
+    }
+
+    assert(archive_write_open_filename(a, path) == ARCHIVE_OK);
+
+    for (const ArchiveItem & item : items)
+    {
+        archive_entry * entry = archive_entry_new();
+        archive_entry_set_pathname(entry, item.name);
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_size(entry, item.data.len());
+
+        assert(archive_write_header(a, entry) == ARCHIVE_OK);
+        assert(archive_write_data(a, item.data.begin(), item.data.len()) ==
+               item.data.len());
+
+        archive_entry_free(entry);
+    }
+
+    assert(archive_write_close(a) == ARCHIVE_OK);
+    archive_write_free(a);
+
+    return filename_to_uri(path);
+}
+
+/* reads a whole entry in pieces which do not line up with the blocks */
+static Index<char> read_entry(ArchiveReader & reader, const char * name)
+{
+    VFSFile file = reader.open(name);
+    assert(file);
+
+    Index<char> data;
+    char buf[10000];
+    int64_t got;
+
+    while ((got = file.fread(buf, 1, sizeof buf)) > 0)
+        data.insert(buf, -1, got);
+
+    assert(file.feof());
+    return data;
+}
+
+static bool same_data(const Index<char> & a, const Index<char> & b)
+{
+    return a.len() == b.len() && !memcmp(a.begin(), b.begin(), a.len());
+}
+
+static void check_entries(const char * uri, const Index<char> & small,
+                          const Index<char> & big)
+{
+    ArchiveReader reader(VFSFile(uri, "r"));
+
+    Index<String> names = reader.read_folder();
+    assert(names.len() == 2);
+    assert(!strcmp(names[0], "small") && !strcmp(names[1], "big"));
+
+    assert(same_data(read_entry(reader, "small"), small));
+    assert(same_data(read_entry(reader, "big"), big));
+    assert(!reader.open("missing"));
+
+    /* seeking backwards and reading across block boundaries */
+    VFSFile file = reader.open("big");
+    char buf[20];
+
+    assert(file.fsize() == big.len());
+    assert(!file.fseek(131062, VFS_SEEK_SET));
+    assert(file.fread(buf, 1, 20) == 20 && !memcmp(buf, &big[131062], 20));
+    assert(!file.fseek(65530, VFS_SEEK_SET));
+    assert(file.fread(buf, 1, 20) == 20 && !memcmp(buf, &big[65530], 20));
+    assert(file.ftell() == 65550);
+
+    assert(!file.fseek(-10, VFS_SEEK_END));
+    assert(file.fread(buf, 1, 20) == 10 && file.feof());
+    assert(!memcmp(buf, &big[big.len() - 10], 10));
+}
+
+/* replaces the file, keeping its size and modification time, so that the
+ * reader's caches cannot tell it apart from the original */
+static void replace_archive(const char * path, ArchiveFormat format,
+                            std::initializer_list<ArchiveItem> items)
+{
+    GStatBuf before, after;
+    assert(g_stat(path, &before) == 0);
+
+    StringBuf path2 = str_concat({path, ".new"});
+    write_archive(path2, format, items);
+    assert(g_stat(path2, &after) == 0 && after.st_size == before.st_size);
+    assert(g_rename(path2, path) == 0);
+
+    struct utimbuf times = {before.st_atime, before.st_mtime};
+    assert(utime(path, &times) == 0);
+}
+
+static void test_archive_reader()
+{
+    char folder[] = "/tmp/aud-test-XXXXXX";
+    assert(mkdtemp(folder));
+
+    Index<char> small = archive_data(100, 1);
+    Index<char> big = archive_data(200000, 2);
+
+    /* entries of an uncompressed tar or zip are read directly */
+    StringBuf tar_path = filename_build({folder, "test.tar"});
+    StringBuf tar_uri = write_archive(tar_path, ARCHIVE_TAR,
+                                      {{"small", small}, {"big", big}});
+    check_entries(tar_uri, small, big);
+
+    StringBuf stored_path = filename_build({folder, "stored.zip"});
+    StringBuf stored_uri = write_archive(stored_path, ARCHIVE_ZIP_STORED,
+                                         {{"small", small}, {"big", big}});
+    check_entries(stored_uri, small, big);
+
+    StringBuf deflated_path = filename_build({folder, "deflated.zip"});
+    StringBuf deflated_uri = write_archive(deflated_path, ARCHIVE_ZIP_DEFLATED,
+                                           {{"small", small}, {"big", big}});
+    check_entries(deflated_uri, small, big);
+
+    /* a corrupt header ends the list of entries */
+    GError * error = nullptr;
+    char * contents;
+    gsize len;
+    assert(g_file_get_contents(tar_path, &contents, &len, &error));
+    assert(len > 1024 && !strcmp(contents + 1024, "big"));
+    contents[1024 + 148] ^= 1; /* checksum */
+
+    StringBuf corrupt_path = filename_build({folder, "corrupt.tar"});
+    assert(g_file_set_contents(corrupt_path, contents, len, &error));
+
+    {
+        ArchiveReader reader(VFSFile(filename_to_uri(corrupt_path), "r"));
+        Index<String> names = reader.read_folder();
+        assert(names.len() == 1 && !strcmp(names[0], "small"));
+        assert(same_data(read_entry(reader, "small"), small));
+        assert(!reader.open("big"));
+    }
+
+    /* an entry cut short by the end of the file reads short */
+    contents[1024 + 148] ^= 1;
+    StringBuf truncated_path = filename_build({folder, "truncated.tar"});
+    assert(g_file_set_contents(truncated_path, contents, 1536 + 100000,
+                               &error));
+    g_free(contents);
+
+    {
+        ArchiveReader reader(VFSFile(filename_to_uri(truncated_path), "r"));
+        Index<char> data = read_entry(reader, "big");
+        assert(data.len() == 100000 && !memcmp(data.begin(), big.begin(),
+                                               100000));
+    }
+
+    /* and a compressed one fails partway through */
+    assert(g_file_get_contents(deflated_path, &contents, &len, &error));
+    StringBuf truncated_zip = filename_build({folder, "truncated.zip"});
+    assert(g_file_set_contents(truncated_zip, contents, len / 2, &error));
+    g_free(contents);
+
+    {
+        ArchiveReader reader(VFSFile(filename_to_uri(truncated_zip), "r"));
+        VFSFile file = reader.open("big");
+        char buf[65536];
+        int64_t got, total = 0;
+
+        while (file && (got = file.fread(buf, 1, sizeof buf)) > 0)
+            total += got;
+
+        assert(total < big.len());
+    }
+
+    /* uncompressed entries are read from the file itself, not from cached
+     * blocks, so they change along with it */
+    Index<char> big2 = archive_data(200000, 3);
+
+    const struct
+    {
+        const char * path;
+        ArchiveFormat format;
+    } uncompressed[] = {{tar_path, ARCHIVE_TAR},
+                        {stored_path, ARCHIVE_ZIP_STORED}};
+
+    for (auto & archive : uncompressed)
+    {
+        replace_archive(archive.path, archive.format,
+                        {{"small", small}, {"big", big2}});
+
+        ArchiveReader reader(VFSFile(filename_to_uri(archive.path), "r"));
+        assert(same_data(read_entry(reader, "big"), big2));
+    }
+
+    /* the list of entries is cached for the most recently used archives */
+    StringBuf first_path = filename_build({folder, "first.tar"});
+    StringBuf first_uri =
+        write_archive(first_path, ARCHIVE_TAR, {{"before", small}});
+    assert(!strcmp(ArchiveReader(VFSFile(first_uri, "r")).read_folder()[0],
+                   "before"));
+
+    replace_archive(first_path, ARCHIVE_TAR, {{"after!", small}});
+    assert(!strcmp(ArchiveReader(VFSFile(first_uri, "r")).read_folder()[0],
+                   "before"));
+
+    for (int i = 0; i < 8; i++)
+    {
+        StringBuf path = filename_build({folder, int_to_str(i)});
+        StringBuf uri = write_archive(path, ARCHIVE_TAR, {{"small", small}});
+        assert(ArchiveReader(VFSFile(uri, "r")).read_folder().len() == 1);
+        g_unlink(path);
+    }
+
+    assert(!strcmp(ArchiveReader(VFSFile(first_uri, "r")).read_folder()[0],
+                   "after!"));
+
+    /* as are decompressed blocks, up to a total size */
+    Index<char> xs, ys, zeros;
+    xs.insert(0, 100000);
+    ys.insert(0, 100000);
+    zeros.insert(0, 17 * 1024 * 1024);
+    memset(xs.begin(), 'x', xs.len());
+    memset(ys.begin(), 'y', ys.len());
+
+    StringBuf blocks_path = filename_build({folder, "blocks.zip"});
+    StringBuf blocks_uri = write_archive(blocks_path, ARCHIVE_ZIP_DEFLATED,
+                                         {{"text", xs}, {"zeros", zeros}});
+
+    ArchiveReader blocks(VFSFile(blocks_uri, "r"));
+    assert(same_data(read_entry(blocks, "text"), xs));
+
+    replace_archive(blocks_path, ARCHIVE_ZIP_DEFLATED,
+                    {{"text", ys}, {"zeros", zeros}});
+    assert(same_data(read_entry(blocks, "text"), xs));
+
+    assert(same_data(read_entry(blocks, "zeros"), zeros));
+    assert(same_data(read_entry(blocks, "text"), ys));
+
+    archive_reader_cleanup();
+
+    for (const char * name :
+         {"test.tar", "stored.zip", "deflated.zip", "corrupt.tar",
+          "truncated.tar", "truncated.zip", "first.tar", "blocks.zip"})
+        g_unlink(filename_build({folder, name}));
+
+    g_rmdir(folder);
+}
+
+#endif /* USE_LIBARCHIVE */
+
+/* an in-memory file that counts the bytes read from it */
+class CountingFile : public VFSImpl
+{
+public:
+    CountingFile(const Index<char> & data, int64_t & bytes_read)
+        : m_data(data), m_bytes_read(bytes_read)
+    {
+    }
+
+    int64_t fread(void * ptr, int64_t size, int64_t nmemb)
+    {
+        int64_t avail = aud::max(m_data.len() - m_pos, (int64_t)0);
+        int64_t items = aud::min(avail / size, nmemb);
+
+        memcpy(ptr, m_data.begin() + m_pos, items * size);
+        m_pos += items * size;
+        m_bytes_read += items * size;
+        return items;
+    }
+
+    int fseek(int64_t offset, VFSSeekType whence)
+    {
+        int64_t pos = offset + ((whence == VFS_SEEK_CUR)   ? m_pos
+                                : (whence == VFS_SEEK_END) ? m_data.len()
+                                                           : 0);
+        if (pos < 0)
+            return -1;
+
+        m_pos = pos;
+        return 0;
+    }
+
+    int64_t ftell() { return m_pos; }
+    int64_t fsize() { return m_data.len(); }
+    bool feof() { return m_pos >= m_data.len(); }
+
+    int64_t fwrite(const void *, int64_t, int64_t) { return 0; }
+    int ftruncate(int64_t) { return -1; }
+    int fflush() { return 0; }
+
+private:
+    const Index<char> & m_data;
+    int64_t & m_bytes_read;
+    int64_t m_pos = 0;
+};
+
+static uint32_t id3_syncsafe(uint32_t x)
+{
+    return (x & 0x7f) | (x & 0x3f80) << 1 | (x & 0x1fc000) << 2 |
+           (x & 0xfe00000) << 3;
+}
+
+static void append_be(Index<char> & out, uint32_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--)
+        out.append((char)(value >> (8 * i)));
+}
+
+/* inserts a zero byte after each 0xff, as ID3v2 unsynchronisation does where
+ * needed */
+static Index<char> id3_unsync(const Index<char> & data)
+{
+    Index<char> out;
+    for (char c : data)
+    {
+        out.append(c);
+        if ((unsigned char)c == 0xff)
+            out.append(0);
+    }
+
+    return out;
+}
+
+static void add_id3_frame(Index<char> & tag, int version, const char * key,
+                          const Index<char> & contents, bool unsync)
+{
+    Index<char> body;
+    int flags = 0;
+
+    if (unsync)
+    {
+        /* unsynchronised, with the data length indicator */
+        append_be(body, id3_syncsafe(contents.len()), 4);
+        Index<char> unsynced = id3_unsync(contents);
+        body.move_from(unsynced, 0, -1, -1, true, true);
+        flags = 0x0002 | 0x0001;
+    }
+    else
+        body.insert(contents.begin(), 0, contents.len());
+
+    tag.insert(key, -1, 4);
+    append_be(tag, (version == 4) ? id3_syncsafe(body.len()) : body.len(), 4);
+    append_be(tag, flags, 2);
+    tag.move_from(body, 0, -1, -1, true, true);
+}
+
+static Index<char> id3_text(const char * text)
+{
+    Index<char> contents;
+    contents.append(0); /* ISO-8859-1 */
+    contents.insert(text, -1, strlen(text));
+    return contents;
+}
+
+/* Returns an MP3 file starting with an ID3v2.<version> tag that holds a few
+ * text frames and <picture> as cover art, ahead of the artist.  With <unsync>,
+ * the whole tag (v2.3) or the cover art frame (v2.4) is unsynchronised. */
+static Index<char> make_id3_file(int version, bool unsync,
+                                 const Index<char> & picture)
+{
+    Index<char> frames, apic;
+
+    apic.append(0);
+    apic.insert("image/jpeg", -1, 11);
+    apic.append(3); /* front cover */
+    apic.insert("Cover", -1, 6);
+    apic.insert(picture.begin(), -1, picture.len());
+
+    bool frame_unsync = unsync && version == 4;
+    add_id3_frame(frames, version, "TIT2", id3_text("Title"), false);
+    add_id3_frame(frames, version, "TALB", id3_text("Album"), false);
+    add_id3_frame(frames, version, "PRIV", id3_text("private"), false);
+    add_id3_frame(frames, version, "APIC", apic, frame_unsync);
+    add_id3_frame(frames, version, "TPE1", id3_text("Artist"), false);
+    add_id3_frame(frames, version, "TRCK", id3_text("7"), false);
+    frames.insert(-1, 256); /* padding */
+
+    bool tag_unsync = unsync && version == 3;
+    if (tag_unsync)
+        frames = id3_unsync(frames);
+
+    Index<char> file;
+    file.insert("ID3", 0, 3);
+    file.append(version);
+    file.append(0);
+    file.append(tag_unsync ? 0x80 : 0);
+    append_be(file, id3_syncsafe(frames.len()), 4);
+    file.move_from(frames, 0, -1, -1, true, true);
+
+    for (int i = 0; i < 4096; i++)
+        file.append(0x55); /* "audio" */
+
+    return file;
+}
+
+static int64_t read_id3_file(const Index<char> & data, Tuple & tuple,
+                             Index<char> * image)
+{
+    int64_t bytes_read = 0;
+    VFSFile file("file:///test.mp3", new CountingFile(data, bytes_read));
+    audtag::ID3v24TagModule module;
+
+    assert(module.can_handle_file(file));
+    assert(module.read_tag(file, tuple, image));
+
+    return bytes_read;
+}
+
+static void test_id3v2_tags()
+{
+    const int pic_size = 512 * 1024;
+
+    Index<char> picture;
+    srand(2);
+    for (int i = 0; i < pic_size; i++)
+        picture.append((i % 64) ? rand() : 0xff);
+
+    for (int version : {3, 4})
+    {
+        for (bool unsync : {false, true})
+        {
+            Index<char> data = make_id3_file(version, unsync, picture);
+
+            /* the tuple is the same whether the cover art is read or not */
+            Tuple tuple, tuple2;
+            Index<char> image;
+            int64_t with_image = read_id3_file(data, tuple, &image);
+            int64_t without_image = read_id3_file(data, tuple2, nullptr);
+
+            assert(tuple == tuple2);
+            assert(!strcmp(tuple.get_str(Tuple::Title), "Title"));
+            assert(!strcmp(tuple.get_str(Tuple::Album), "Album"));
+            assert(!strcmp(tuple.get_str(Tuple::Artist), "Artist"));
+            assert(tuple.get_int(Tuple::Track) == 7);
+
+            assert(image.len() == pic_size &&
+                   !memcmp(image.begin(), picture.begin(), pic_size));
+            assert(with_image > pic_size);
+
+            /* the cover art is seeked past, unless the frame boundaries are
+             * only known once the whole tag is decoded */
+            if (unsync && version == 3)
+                assert(without_image > pic_size);
+            else
+                assert(without_image < 1024);
+        }
+    }
+
+    /* a frame running past the end of the tag ends it, keeping the frames
+     * read before */
+    Index<char> data = make_id3_file(4, false, picture);
+    const char * artist =
+        (const char *)memmem(data.begin(), data.len(), "TPE1", 4);
+    int cut = artist - data.begin() - 10 + 13;
+
+    data[6] = cut >> 21 & 0x7f;
+    data[7] = cut >> 14 & 0x7f;
+    data[8] = cut >> 7 & 0x7f;
+    data[9] = cut & 0x7f;
+
+    Tuple tuple, tuple2;
+    Index<char> image;
+    read_id3_file(data, tuple, &image);
+    read_id3_file(data, tuple2, nullptr);
+
+    assert(tuple == tuple2);
+    assert(!strcmp(tuple.get_str(Tuple::Album), "Album"));
+    assert(!tuple.is_set(Tuple::Artist));
+    assert(image.len() == pic_size);
+
+    /* as does a file ending inside a frame */
+    for (int version : {3, 4})
+    {
+        for (bool unsync : {false, true})
+        {
+            Index<char> data = make_id3_file(version, unsync, picture);
+            data.remove(data.len() - 4096 - 256 - 40 - pic_size / 2, -1);
+
+            Tuple tuple, tuple2;
+            Index<char> image;
+            read_id3_file(data, tuple, &image);
+            read_id3_file(data, tuple2, nullptr);
+
+            assert(tuple == tuple2);
+            assert(!strcmp(tuple.get_str(Tuple::Album), "Album"));
+            assert(!tuple.is_set(Tuple::Artist) && !image.len());
+        }
+    }
+}
+
+static Index<PluginHandle *>
+plugin_list(std::initializer_list<PluginHandle *> plugins)
+{
+    Index<PluginHandle *> list;
+    for (PluginHandle * plugin : plugins)
+        list.append(plugin);
+
+    return list;
+}
+
+static bool same_plugins(const Index<PluginHandle *> & list,
+                         std::initializer_list<PluginHandle *> plugins)
+{
+    return list.len() == (int)plugins.size() &&
+           std::equal(plugins.begin(), plugins.end(), list.begin());
+}
+
+static void test_probe_cache()
+{
+    static char handles[3]; /* never dereferenced */
+    auto vorbis = (PluginHandle *)&handles[0];
+    auto opus = (PluginHandle *)&handles[1];
+    auto flac = (PluginHandle *)&handles[2];
+
+    ProbeCache cache;
+    ProbeCache::KeyMatches matches, found;
+
+    /* plugins matching a scheme and extension */
+    String key = ProbeCache::key("file", "ogg");
+    assert(!cache.lookup(1, key, found));
+
+    matches.scheme_match = nullptr;
+    matches.ext_matches = plugin_list({vorbis, opus, flac});
+    cache.add(1, key, matches);
+
+    assert(cache.lookup(1, key, found));
+    assert(!found.scheme_match);
+    assert(same_plugins(found.ext_matches, {vorbis, opus, flac}));
+
+    assert(!cache.lookup(1, ProbeCache::key("file", "oga"), found));
+    assert(!cache.lookup(1, ProbeCache::key("http", "ogg"), found));
+
+    /* a change of plugins drops the results, as does a result added from an
+     * outdated list */
+    assert(!cache.lookup(2, key, found));
+    cache.add(1, key, matches);
+    assert(!cache.lookup(2, key, found));
+
+    /* files in different Ogg codecs have the same content key */
+    char folder[] = "/tmp/aud-test-XXXXXX";
+    assert(mkdtemp(folder));
+
+    StringBuf path1 = filename_build({folder, "1.ogg"});
+    StringBuf path2 = filename_build({folder, "2.ogg"});
+    GError * error = nullptr;
+    assert(g_file_set_contents(path1, "OggS\0\2vorbis", 12, &error));
+    assert(g_file_set_contents(path2, "OggS\0\2OpusHead", 14, &error));
+
+    VFSFile file1(filename_to_uri(path1), "r");
+    VFSFile file2(filename_to_uri(path2), "r");
+    String content_key = ProbeCache::content_key("ogg", nullptr, file1);
+
+    assert(content_key && file1.ftell() == 0);
+    assert(content_key == ProbeCache::content_key("ogg", nullptr, file2));
+    assert(content_key != ProbeCache::content_key("oga", nullptr, file2));
+    assert(content_key != ProbeCache::content_key("ogg", "audio/ogg", file2));
+
+    /* so the plugin that matched last is only tried first; the others are
+     * all still tried, in their usual order */
+    Index<PluginHandle *> candidates = plugin_list({vorbis, opus, flac});
+    cache.order_candidates(2, content_key, candidates);
+    assert(same_plugins(candidates, {vorbis, opus, flac}));
+
+    cache.add_match(2, content_key, flac);
+    cache.order_candidates(2, content_key, candidates);
+    assert(same_plugins(candidates, {flac, vorbis, opus}));
+
+    cache.add_match(2, content_key, opus);
+    candidates = plugin_list({vorbis, opus, flac});
+    cache.order_candidates(2, content_key, candidates);
+    assert(same_plugins(candidates, {opus, vorbis, flac}));
+
+    /* a plugin no longer a candidate is not added */
+    candidates = plugin_list({vorbis, flac});
+    cache.order_candidates(2, content_key, candidates);
+    assert(same_plugins(candidates, {vorbis, flac}));
+
+    /* and a change of plugins drops the match */
+    candidates = plugin_list({vorbis, opus, flac});
+    cache.order_candidates(3, content_key, candidates);
+    assert(same_plugins(candidates, {vorbis, opus, flac}));
+
+    g_unlink(path1);
+    g_unlink(path2);
+    g_rmdir(folder);
+}
+
+static void test_vfs_async()
+{
+    const int total = 2000;
+    static char owner, canceled_owner;
+
+    aud_set_int("async_read_threads", 4);
+    vfs_async_init();
+
+    auto main_thread = std::this_thread::get_id();
+    int delivered = 0;
+    bool ownerless_called = false;
+
+    auto check_done = [&]() {
+        if (delivered == total && ownerless_called)
+            mainloop_quit();
+    };
+
+    auto consume = [&](const char * filename, const Index<char> & buf) {
+        assert(std::this_thread::get_id() == main_thread);
+        assert(!buf.len());
+
+        delivered++;
+        check_done();
+    };
+
+    bool canceled_called = false;
+    auto never_called = [&](const char *, const Index<char> &) {
+        canceled_called = true;
+    };
+
+    for (int i = 0; i < total; i++)
+    {
+        auto priority = (i % 2) ? VFSReadPriority::Background
+                                : VFSReadPriority::Interactive;
+        vfs_async_file_get_contents(str_printf("file:///%d", i), consume,
+                                    priority, &owner);
+    }
+
+    /* canceled requests may still be read, but are never delivered */
+    for (int i = 0; i < 100; i++)
+        vfs_async_file_get_contents("file:///canceled", never_called,
+                                    VFSReadPriority::Background,
+                                    &canceled_owner);
+
+    vfs_async_cancel(&canceled_owner);
+
+    /* requests without an owner are not canceled along with the others */
+    vfs_async_file_get_contents("file:///ownerless",
+                                [&](const char *, const Index<char> &) {
+                                    ownerless_called = true;
+                                    check_done();
+                                });
+    vfs_async_cancel(nullptr);
+
+    mainloop_run();
+
+    assert(delivered == total);
+
+    /* thousands of requests, but never more threads than the limit */
+    int peak = vfs_async_peak_threads();
+    assert(peak >= 1 && peak <= 4);
+
+    /* once the workers are finished, nothing more can be delivered */
+    vfs_async_cleanup();
+    assert(!canceled_called);
+
+    /* requests after shutdown are dropped rather than read */
+    vfs_async_file_get_contents("file:///late", never_called);
+    assert(!canceled_called);
+}
+
+/* playlist-data.cc and playlist-journal.cc are tested without playlist.cc: a
+ * PlaylistEx is backed here directly by a PlaylistData, and the playlist files
+ * "saved" by playlist_save() hold the playlist as journal records */
+struct Playlist::ID
+{
+    int stamp;
+    PlaylistData * data;
+};
+
+int PlaylistEx::stamp() const { return m_id->stamp; }
+
+Index<char> PlaylistEx::take_journal(String * title,
+                                     Index<PlaylistAddItem> * items) const
+{
+    if (title)
+        *title = m_id->data->title;
+    if (items)
+        m_id->data->get_items(*items);
+
+    return m_id->data->journal.take();
+}
+
+int64_t PlaylistEx::replay_journal(const char * data, int64_t len) const
+{
+    return m_id->data->replay_journal(data, len);
+}
+
+void PlaylistEx::insert_snapshot(PlaylistSnapshot * snapshot) const
+{
+    m_id->data->insert_snapshot(snapshot);
+}
+
+void PlaylistEx::fill_snapshot(SnapshotWriter & writer) const
+{
+    m_id->data->fill_snapshot(writer);
+}
+
+void pl_signal_entry_deleted(PlaylistEntry *) {}
+void pl_signal_position_changed(Playlist::ID *) {}
+void pl_signal_update_queued(Playlist::ID *, Playlist::UpdateLevel, int) {}
+void pl_signal_rescan_needed(Playlist::ID *) {}
+void pl_signal_playlist_deleted(Playlist::ID *) {}
+
+/* entries are never scanned here */
+ScanRequest::ScanRequest(const String & filename, int flags, Callback callback,
+                         PluginHandle * decoder, Tuple && tuple)
+    : filename(filename), flags(flags), callback(callback), decoder(decoder),
+      tuple(std::move(tuple))
+{
+    assert(false);
+}
+
+static char test_saver; /* never dereferenced */
+
+/* set to hold a save in progress, e.g. in the compaction thread */
+static std::atomic<bool> save_held(false), save_waiting(false);
+
+PlaylistPlugin * playlist_get_saver(const char *)
+{
+    return (PlaylistPlugin *)&test_saver;
+}
+
+bool playlist_save(PlaylistPlugin * pp, const char * filename,
+                   const char * title, const Index<PlaylistAddItem> & items)
+{
+    assert(pp == (PlaylistPlugin *)&test_saver);
+
+    PlaylistJournal records;
+    records.record_title(title);
+    records.record_insert(0, items);
+    Index<char> data = records.take();
+
+    bool success = g_file_set_contents(uri_to_filename(filename),
+                                       data.begin(), data.len(), nullptr);
+
+    save_waiting.store(true);
+    while (save_held.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    save_waiting.store(false);
+    return success;
+}
+
+static Index<PlaylistAddItem> make_items(int first, int count)
+{
+    Index<PlaylistAddItem> items;
+
+    for (int i = first; i < first + count; i++)
+    {
+        /* long names, so that the journal grows quickly */
+        StringBuf filename = str_printf("file:///music/%0100d.mp3", i);
+
+        Tuple tuple;
+        if (i % 3 == 0)
+        {
+            tuple.set_filename(filename);
+            tuple.set_str(Tuple::Title, int_to_str(i));
+            tuple.set_int(Tuple::Length, 1000 * i);
+            tuple.set_state(Tuple::Valid);
+        }
+
+        items.append(String(filename), std::move(tuple));
+    }
+
+    return items;
+}
+
+static Index<String> entry_names(const PlaylistData & data)
+{
+    Index<String> names;
+    for (int i = 0; i < data.n_entries(); i++)
+        names.append(data.entry_filename(i));
+
+    return names;
+}
+
+static bool same_entries(const PlaylistData & a, const PlaylistData & b)
+{
+    if (a.n_entries() != b.n_entries() || strcmp(a.title, b.title))
+        return false;
+
+    for (int i = 0; i < a.n_entries(); i++)
+    {
+        if (strcmp(a.entry_filename(i), b.entry_filename(i)) ||
+            a.entry_tuple(i) != b.entry_tuple(i))
+            return false;
+    }
+
+    return true;
+}
+
+static void mark_scanned(PlaylistData & data, std::initializer_list<int> rows)
+{
+    Index<PlaylistData::ScanResult> results;
+
+    for (int row : rows)
+    {
+        Tuple tuple;
+        tuple.set_filename(data.entry_filename(row));
+        tuple.set_state(Tuple::Valid);
+
+        results.append(PlaylistData::ScanResult(
+            {data.entry_at(row), nullptr, std::move(tuple), String()}));
+    }
+
+    data.update_entries_from_scan(results, 0);
+}
+
+static bool same_rows(const Index<int> & rows, std::initializer_list<int> expect)
+{
+    if (rows.len() != (int)expect.size())
+        return false;
+
+    int i = 0;
+    for (int row : expect)
+    {
+        if (rows[i++] != row)
+            return false;
+    }
+
+    return true;
+}
+
+static void test_playlist_scan_order()
+{
+    Playlist::ID id = {1, nullptr};
+    PlaylistData data(&id, "Playlist");
+    id.data = &data;
+
+    /* every third entry is already scanned */
+    data.insert_items(0, make_items(0, 300));
+
+    Index<int> rows;
+    data.scan_upcoming_rows(4, rows);
+    assert(!rows.len());
+
+    /* queued entries come first, then those following the playing one;
+     * scanned and repeated rows are left out */
+    data.set_position(100);
+    for (int row : {250, 3, 7, 101, 9})
+        data.queue_insert(-1, row);
+
+    data.scan_upcoming_rows(4, rows);
+    assert(same_rows(rows, {250, 7, 101, 103, 104}));
+
+    mark_scanned(data, {250, 101});
+    rows.clear();
+    data.scan_upcoming_rows(4, rows);
+    assert(same_rows(rows, {7, 103, 104}));
+
+    /* the priority range is searched from its start */
+    data.set_scan_priority_range(200, 30);
+
+    int at, end;
+    data.get_scan_priority_range(at, end);
+    assert(at == 200 && end == 230);
+    assert(data.next_unscanned_entry(at, end) == 200);
+
+    mark_scanned(data, {200, 202});
+    assert(data.next_unscanned_entry(at, end) == 203);
+
+    for (int row = 200; row < 230; row++)
+        mark_scanned(data, {row});
+
+    assert(data.next_unscanned_entry(at, end) < 0);
+
+    /* the range is clipped to the playlist when entries are removed */
+    data.set_scan_priority_range(280, 100);
+    data.get_scan_priority_range(at, end);
+    assert(at == 280 && end == 300);
+
+    data.remove_entries(250, 50);
+    data.get_scan_priority_range(at, end);
+    assert(at == 250 && end == 250);
+}
+
+static void test_playlist_prefetch()
+{
+    Playlist::ID id = {1, nullptr};
+    PlaylistData data(&id, "Playlist");
+    id.data = &data;
+
+    data.insert_items(0, make_items(0, 20));
+
+    /* only the address of a request is used */
+    int request_a, request_b;
+    auto req_a = reinterpret_cast<ScanRequest *>(&request_a);
+    auto req_b = reinterpret_cast<ScanRequest *>(&request_b);
+
+    auto make_result = [](const char * filename) {
+        PlaylistPrefetch::Result result;
+        result.filename = String(filename);
+        return result;
+    };
+
+    PlaylistPrefetch prefetch;
+    PlaylistPrefetch::Result got;
+
+    /* the entry prefetched is the one played next, in shuffle mode (through
+     * repeats of the whole playlist) and with entries queued */
+    bool shuffle = aud_get_bool("shuffle");
+    aud_set_bool("shuffle", true);
+    data.set_position(0);
+
+    for (int i = 0; i < 60; i++)
+    {
+        if (i == 30)
+        {
+            data.queue_insert(-1, 5);
+            data.queue_insert(-1, 6);
+        }
+
+        int next = data.peek_next_song(true);
+        assert(next >= 0 && data.peek_next_song(true) == next);
+
+        prefetch.start(data.entry_at(next), req_a);
+        prefetch.finish(req_a, make_result(data.entry_filename(next)));
+
+        assert(data.next_song(true) && data.position() == next);
+        assert(prefetch.claim(data.entry_at(next)));
+        assert(prefetch.take(data.entry_at(next), got));
+        assert(got.filename == data.entry_filename(next));
+        assert(!prefetch.entry());
+    }
+
+    /* removing entries forgets the choice, which must not be used after the
+     * entry is freed */
+    int next = data.peek_next_song(true);
+    data.remove_entries(next, 1);
+
+    next = data.peek_next_song(true);
+    assert(data.next_song(true) && data.position() == next);
+
+    aud_set_bool("shuffle", shuffle);
+
+    PlaylistEntry * entry_a = data.entry_at(1);
+    PlaylistEntry * entry_b = data.entry_at(2);
+
+    /* a prefetch is used only once its scan has finished */
+    prefetch.start(entry_a, req_a);
+    assert(!prefetch.claim(entry_a) && !prefetch.entry());
+
+    /* and only the result of its own scan is kept */
+    prefetch.start(entry_a, req_a);
+    prefetch.finish(req_b, make_result("wrong"));
+    assert(!prefetch.claim(entry_a));
+
+    /* playing another entry discards it */
+    prefetch.start(entry_a, req_a);
+    prefetch.finish(req_a, make_result("a"));
+    assert(!prefetch.claim(entry_b) && !prefetch.entry());
+
+    /* it is handed over once, and only for its own entry */
+    prefetch.start(entry_a, req_a);
+    prefetch.finish(req_a, make_result("a"));
+    assert(!prefetch.take(entry_a, got));
+    assert(prefetch.claim(entry_a));
+    assert(!prefetch.take(entry_b, got));
+    assert(prefetch.take(entry_a, got) && got.filename == String("a"));
+    assert(!prefetch.take(entry_a, got));
+
+    /* a newer prefetch replaces an older one, whose scan is then ignored */
+    prefetch.start(entry_a, req_a);
+    prefetch.start(entry_b, req_b);
+    prefetch.finish(req_a, make_result("a"));
+    assert(prefetch.entry() == entry_b && !prefetch.claim(entry_b));
+
+    /* deleting the entry discards it */
+    prefetch.start(entry_a, req_a);
+    prefetch.entry_deleted(entry_b);
+    assert(prefetch.entry() == entry_a);
+    prefetch.entry_deleted(entry_a);
+    assert(!prefetch.entry());
+    prefetch.finish(req_a, make_result("a"));
+    assert(!prefetch.claim(entry_a));
+
+    /* the next song is prefetched near the end of the current one, but not
+     * while repeating from A to B, nor if prefetching is turned off */
+    assert(!PlaylistPrefetch::due(100000, 180000, 10, -1));
+    assert(PlaylistPrefetch::due(170000, 180000, 10, -1));
+    assert(PlaylistPrefetch::due(180000, 180000, 10, -1));
+    assert(!PlaylistPrefetch::due(170000, 180000, 10, 175000));
+    assert(!PlaylistPrefetch::due(170000, 180000, 10, 0));
+    assert(!PlaylistPrefetch::due(170000, 180000, 0, -1));
+    assert(!PlaylistPrefetch::due(170000, -1, 10, -1));
+}
+
+static void test_playlist_journal()
+{
+    Playlist::ID id = {1, nullptr};
+    PlaylistData data(&id, "Playlist");
+    id.data = &data;
+
+    /* the records of each step, and the names after it */
+    Index<char> records;
+    Index<int> ends;
+    Index<Index<String>> names;
+
+    auto take = [&]() {
+        Index<char> step = data.journal.take();
+        assert(step.len());
+
+        records.insert(step.begin(), -1, step.len());
+        ends.append(records.len());
+        names.append(entry_names(data));
+    };
+
+    data.insert_items(0, make_items(0, 10));
+    take();
+
+    Tuple tuple;
+    tuple.set_filename(data.entry_filename(1));
+    tuple.set_str(Tuple::Title, "Scanned");
+    tuple.set_state(Tuple::Valid);
+
+    Index<PlaylistData::ScanResult> results;
+    results.append(PlaylistData::ScanResult(
+        {data.entry_at(1), nullptr, std::move(tuple), String()}));
+    data.update_entries_from_scan(results, 0);
+    take();
+
+    data.remove_entries(2, 3);
+    take();
+
+    data.reverse_order();
+    take();
+
+    data.select_entry(0, true);
+    data.select_entry(4, true);
+    data.shift_entries(0, 2);
+    take();
+
+    data.modified = false;
+    data.set_title("Renamed");
+    assert(data.modified);
+    take();
+
+    data.insert_items(3, make_items(10, 2));
+    take();
+
+    int n_steps = ends.len();
+    int last_start = ends[n_steps - 2];
+
+    /* all the records are read */
+    JournalReader reader(records.begin(), records.len());
+    int n_records = 0;
+    while (reader.next())
+        n_records++;
+
+    assert(reader.ok() && n_records == n_steps);
+    assert(reader.valid_length() == records.len());
+
+    /* and replayed to the same playlist */
+    Playlist::ID id2 = {2, nullptr};
+    PlaylistData replayed(&id2, "Playlist");
+    id2.data = &replayed;
+
+    assert(replayed.replay_journal(records.begin(), records.len()) ==
+           records.len());
+    assert(same_entries(data, replayed));
+    assert(!strcmp(replayed.title, "Renamed"));
+    assert(replayed.journal.empty());
+
+    /* a record cut short anywhere is dropped, along with anything after it */
+    for (int cut = last_start + 1; cut < records.len(); cut++)
+    {
+        JournalReader reader(records.begin(), cut);
+        while (reader.next())
+            ;
+
+        assert(reader.valid_length() == last_start);
+    }
+
+    /* as is a damaged record */
+    for (int pos = last_start; pos < records.len(); pos += 7)
+    {
+        Index<char> damaged;
+        damaged.insert(records.begin(), 0, records.len());
+        damaged[pos] ^= 0x40;
+
+        JournalReader reader(damaged.begin(), damaged.len());
+        while (reader.next())
+            ;
+
+        assert(reader.valid_length() == last_start);
+    }
+
+    /* replaying the valid part gives the playlist as it was before the last
+     * step */
+    Playlist::ID id3 = {3, nullptr};
+    PlaylistData partial(&id3, "Playlist");
+    id3.data = &partial;
+
+    assert(partial.replay_journal(records.begin(), records.len() - 1) ==
+           last_start);
+
+    auto & before = names[n_steps - 2];
+    assert(partial.n_entries() == before.len());
+    for (int i = 0; i < before.len(); i++)
+        assert(!strcmp(partial.entry_filename(i), before[i]));
+
+    /* records that do not fit the playlist are not applied */
+    PlaylistJournal bad;
+    bad.record_remove(50, 10, 5);
+
+    Playlist::ID id4 = {4, nullptr};
+    PlaylistData small(&id4, "Playlist");
+    id4.data = &small;
+
+    small.insert_items(0, make_items(0, 5));
+    Index<char> bad_records = bad.take();
+    assert(small.replay_journal(bad_records.begin(), bad_records.len()) == 0);
+    assert(small.n_entries() == 5);
+}
+
+/* a copy of one of the files of a playlist, with its modification time */
+struct PlaylistFile
+{
+    const char * suffix;
+    Index<char> data;
+    time_t mtime;
+};
+
+static Index<char> copy_data(const Index<char> & data)
+{
+    Index<char> copy;
+    copy.insert(data.begin(), 0, data.len());
+    return copy;
+}
+
+static StringBuf playlist_file_path(const char * folder, int stamp,
+                                    const char * suffix)
+{
+    return filename_build({folder, str_printf("%d.audpl%s", stamp, suffix)});
+}
+
+static PlaylistFile read_playlist_file(const char * folder, int stamp,
+                                       const char * suffix)
+{
+    StringBuf path = playlist_file_path(folder, stamp, suffix);
+    PlaylistFile file = {suffix};
+
+    char * contents;
+    gsize len;
+    assert(g_file_get_contents(path, &contents, &len, nullptr));
+    file.data.insert(contents, 0, len);
+    g_free(contents);
+
+    GStatBuf info;
+    assert(g_stat(path, &info) == 0);
+    file.mtime = info.st_mtime;
+
+    return file;
+}
+
+static void write_playlist_file(const char * folder, int stamp,
+                                const PlaylistFile & file)
+{
+    StringBuf path = playlist_file_path(folder, stamp, file.suffix);
+
+    assert(g_file_set_contents(path, file.data.begin(), file.data.len(),
+                               nullptr));
+
+    struct utimbuf times = {file.mtime, file.mtime};
+    assert(utime(path, &times) == 0);
+}
+
+static const char * const playlist_suffixes[] = {
+    "", ".journal", ".journal.new", ".tmp", ".snap"};
+
+static bool playlist_file_exists(const char * folder, int stamp,
+                                 const char * suffix)
+{
+    return g_file_test(playlist_file_path(folder, stamp, suffix),
+                       G_FILE_TEST_EXISTS);
+}
+
+/* loads the playlist as playlist-utils.cc would, from the playlist file and
+ * then the journal */
+static void load_playlist_files(const char * folder, int stamp,
+                                PlaylistData & data)
+{
+    PlaylistFile file = read_playlist_file(folder, stamp, "");
+    assert(data.replay_journal(file.data.begin(), file.data.len()) ==
+           file.data.len());
+
+    playlist_journal_load(PlaylistEx(data.id()), folder);
+    playlist_journal_end();
+}
+
+/* sets up the files as they would be left by a crash and checks that the
+ * playlist is recovered from them, also after being loaded once */
+static void check_playlist_recovery(
+    const char * folder, int stamp,
+    std::initializer_list<const PlaylistFile *> files,
+    const PlaylistData & expected)
+{
+    for (const char * suffix : playlist_suffixes)
+        g_unlink(playlist_file_path(folder, stamp, suffix));
+
+    for (auto file : files)
+        write_playlist_file(folder, stamp, *file);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        Playlist::ID id = {stamp, nullptr};
+        PlaylistData loaded(&id, "");
+        id.data = &loaded;
+
+        load_playlist_files(folder, stamp, loaded);
+        assert(same_entries(loaded, expected));
+
+        assert(!playlist_file_exists(folder, stamp, ".journal.new"));
+        assert(!playlist_file_exists(folder, stamp, ".tmp"));
+    }
+}
+
+static void test_playlist_compaction()
+{
+    char folder[] = "/tmp/aud-test-XXXXXX";
+    assert(mkdtemp(folder));
+
+    const int stamp = 1000;
+    Playlist::ID id = {stamp, nullptr};
+    PlaylistData data(&id, "Playlist");
+    id.data = &data;
+    PlaylistEx playlist(&id);
+
+    /* the first save writes the whole playlist */
+    data.insert_items(0, make_items(0, 100));
+    playlist_journal_save(playlist, folder, false);
+    assert(playlist_file_exists(folder, stamp, ""));
+    assert(!playlist_file_exists(folder, stamp, ".journal"));
+
+    /* later ones append to the journal, until it is large enough to be
+     * compacted at the next save */
+    data.insert_items(-1, make_items(100, 3000));
+    playlist_journal_save(playlist, folder, false);
+    assert(playlist_file_exists(folder, stamp, ".journal"));
+
+    PlaylistFile before = read_playlist_file(folder, stamp, "");
+
+    data.set_title("Compacted");
+
+    save_held.store(true);
+    playlist_journal_save(playlist, folder, false);
+
+    while (!save_waiting.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    /* changes made while the new playlist file is written go in both the old
+     * and the new journal */
+    data.remove_entries(0, 10);
+    playlist_journal_save(playlist, folder, false);
+
+    PlaylistFile journal = read_playlist_file(folder, stamp, ".journal");
+    PlaylistFile temp = read_playlist_file(folder, stamp, ".tmp");
+
+    save_held.store(false);
+    playlist_journal_save(playlist, folder, true);
+    playlist_journal_end();
+
+    PlaylistFile after = read_playlist_file(folder, stamp, "");
+    PlaylistFile new_journal = read_playlist_file(folder, stamp, ".journal");
+
+    /* the playlist file was replaced, and the journal started over */
+    assert(after.data.len() != before.data.len() ||
+           after.mtime != before.mtime);
+    assert(new_journal.data.len() < journal.data.len());
+    assert(!playlist_file_exists(folder, stamp, ".journal.new"));
+    assert(!playlist_file_exists(folder, stamp, ".tmp"));
+
+    /* each step of finishing the compaction: writing <stamp>.audpl.journal.new,
+     * renaming <stamp>.audpl.tmp to <stamp>.audpl, and renaming the new journal
+     * over the old one */
+    PlaylistFile after_temp = {".tmp", copy_data(after.data), after.mtime};
+    PlaylistFile new_journal_new = {".journal.new", copy_data(new_journal.data),
+                                    new_journal.mtime};
+
+    check_playlist_recovery(folder, stamp, {&before, &journal, &temp}, data);
+    check_playlist_recovery(folder, stamp,
+                            {&before, &journal, &new_journal_new, &after_temp},
+                            data);
+    check_playlist_recovery(folder, stamp,
+                            {&after, &journal, &new_journal_new}, data);
+    check_playlist_recovery(folder, stamp, {&after, &new_journal}, data);
+
+    /* a journal written for another playlist file is never applied */
+    Playlist::ID id3 = {stamp, nullptr};
+    PlaylistData old(&id3, "");
+    id3.data = &old;
+
+    old.replay_journal(before.data.begin(), before.data.len());
+    check_playlist_recovery(folder, stamp, {&before, &new_journal}, old);
+
+    for (const char * suffix : playlist_suffixes)
+        g_unlink(playlist_file_path(folder, stamp, suffix));
+
+    /* an empty playlist already saved keeps a title given to it later, as
+     * when it is reused by Playlist::temporary_playlist() */
+    const int blank_stamp = stamp + 1;
+    Playlist::ID blank_id = {blank_stamp, nullptr};
+    PlaylistData blank(&blank_id, "New Playlist");
+    blank_id.data = &blank;
+    PlaylistEx blank_playlist(&blank_id);
+
+    playlist_journal_save(blank_playlist, folder, false);
+    blank.modified = false;
+
+    blank.set_title("Now Playing");
+    assert(blank.modified);
+    playlist_journal_save(blank_playlist, folder, false);
+    playlist_journal_end();
+
+    Playlist::ID loaded_id = {blank_stamp, nullptr};
+    PlaylistData loaded(&loaded_id, "");
+    loaded_id.data = &loaded;
+
+    load_playlist_files(folder, blank_stamp, loaded);
+    assert(!strcmp(loaded.title, "Now Playing"));
+
+    for (const char * suffix : playlist_suffixes)
+        g_unlink(playlist_file_path(folder, blank_stamp, suffix));
+
+    g_rmdir(folder);
+}
+
 int main(int argc, const char ** argv)
 {
     if (argc >= 2 && !strcmp(argv[1], "--qt"))
         use_qt = true;
 
     test_audio_conversion();
+    test_audio_simd();
+    test_audio_gain();
+    test_fft();
     test_case_conversion();
     test_numeric_conversion();
     test_filename_split();
     test_tuple_formats();
+    test_tuple_format_many();
+    test_playlist_sort();
+    test_playlist_snapshot();
+    test_playlist_scan_order();
+    test_playlist_prefetch();
+    test_playlist_journal();
+    test_playlist_compaction();
+    test_tuple_columns();
     test_ringbuf();
+    test_atomic_ringbuf();
+    test_config_handle();
+    test_tuple_cache();
     test_stringbuf();
     test_str_printf();
+    test_charset_conversion();
     test_uri_construct();
+    test_mapped_file();
+    test_mapped_file_truncate_race();
+    test_probe_cache();
+    test_vfs_async();
+#ifdef USE_LIBARCHIVE
+    test_archive_reader();
+#endif
+    test_id3v2_tags();
 
     test_mainloop();
 
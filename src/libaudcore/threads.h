@@ -25,6 +25,7 @@
 #include <condition_variable>
 #include <mutex>
 #include <thread>
+#include <utility>
 
 namespace aud
 {
@@ -83,6 +84,32 @@ private:
     unsigned short m_lock = 0;
 };
 
+/* A value that one thread replaces as a whole and that other threads read
+ * without waiting on that thread.  The lock is held only while the value is
+ * copied out or swapped in, so T should be cheap to copy (a few integers and
+ * refcounted objects such as String or Tuple). */
+template<class T>
+class published
+{
+public:
+    T get() const
+    {
+        auto lh = m_lock.read();
+        return m_value;
+    }
+
+    /* the old value is released after the lock is dropped */
+    void set(T value)
+    {
+        auto lh = m_lock.write();
+        std::swap(m_value, value);
+    }
+
+private:
+    mutable spinlock_rw m_lock;
+    T m_value = T();
+};
+
 /* An alias for std::mutex */
 class mutex : public std::mutex
 {
@@ -0,0 +1,667 @@
+/*
+ * tuple-cache.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "internal.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <thread>
+
+#include "audstrings.h"
+#include "hook.h"
+#include "multihash.h"
+#include "plugins.h"
+#include "runtime.h"
+#include "threads.h"
+#include "tuple.h"
+
+/* The cache file consists of a header, a hash table of fixed-size buckets, and
+ * the records the buckets point to, all in native byte order (the file is not
+ * meant to be shared between machines).  It is mapped into memory and searched
+ * in place, so that opening it takes no time regardless of its size.  Entries
+ * added or found to be outdated are kept in memory until the file is rewritten
+ * at exit, or at an autosave once enough of them have accumulated; since the
+ * file may be large, an autosave writes it from a worker thread.
+ *
+ * Each record holds:
+ *   int64 size, int64 mtime, string uri, string decoder,
+ *   uint16 number of subtunes, uint8 listed, int16 subtunes[] (if listed),
+ *   uint16 number of fields, then for each field:
+ *     string name, uint8 type, and either int32 or string value
+ * where a string is a uint32 length followed by the bytes (no terminator).
+ * Fields are stored by name so that the file survives changes to the order of
+ * Tuple::Field. */
+
+#define CACHE_NAME "tuple-cache"
+#define MAX_ENTRIES 1000000
+/* changed entries needed before an autosave rewrites the file */
+#define SAVE_THRESHOLD 1000
+
+static const char cache_magic[8] = {'A', 'U', 'D', 'T', 'U', 'P', 'L', '1'};
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t n_buckets; /* power of two */
+    uint32_t n_records;
+};
+
+struct CacheBucket
+{
+    uint32_t hash;
+    uint32_t offset; /* from start of file; 0 = empty */
+};
+
+struct CacheEntry
+{
+    FileStamp stamp;
+    String decoder; /* basename */
+    Tuple tuple;
+    bool removed;
+};
+
+class CacheReader
+{
+public:
+    CacheReader(const char * data, size_t len, size_t pos)
+        : m_data(data), m_len(len), m_pos(pos)
+    {
+    }
+
+    bool ok() const { return m_ok; }
+    size_t pos() const { return m_pos; }
+
+    template<class T>
+    T get()
+    {
+        T val = T();
+        if (check(sizeof val))
+            memcpy(&val, m_data + m_pos - sizeof val, sizeof val);
+
+        return val;
+    }
+
+    /* returns a pointer into the mapped file, not nul-terminated */
+    const char * get_str(uint32_t & len)
+    {
+        len = get<uint32_t>();
+        return check(len) ? m_data + m_pos - len : nullptr;
+    }
+
+private:
+    const char * m_data;
+    size_t m_len, m_pos;
+    bool m_ok = true;
+
+    bool check(size_t len)
+    {
+        if (!m_ok || m_pos > m_len || len > m_len - m_pos)
+            return (m_ok = false);
+
+        m_pos += len;
+        return true;
+    }
+};
+
+static aud::mutex mutex;
+static bool initialized;
+
+static GMappedFile * mapped;
+static const char * map_data;
+static size_t map_len;
+static CacheHeader header;
+static Index<char> accessed; /* by bucket; kept if the cache overflows */
+
+static SimpleHash<String, CacheEntry> changes;
+static bool dirty;
+
+/* changes being written to a new file by save(), which does not hold the
+ * mutex meanwhile; lookups check these after <changes> */
+static SimpleHash<String, CacheEntry> saving;
+
+static std::thread save_thread;
+static bool save_running; /* is save_thread still in save()? */
+
+static StringBuf cache_path()
+{
+    return filename_build({aud_get_path(AudPath::UserDir), CACHE_NAME});
+}
+
+static void unmap_file()
+{
+    if (mapped)
+        g_mapped_file_unref(mapped);
+
+    mapped = nullptr;
+    map_data = nullptr;
+    map_len = 0;
+    header = CacheHeader();
+    accessed.clear();
+}
+
+static void map_file()
+{
+    unmap_file();
+
+    mapped = g_mapped_file_new(cache_path(), false, nullptr);
+    if (!mapped)
+        return;
+
+    map_data = g_mapped_file_get_contents(mapped);
+    map_len = g_mapped_file_get_length(mapped);
+
+    CacheReader reader(map_data, map_len, 0);
+    header = reader.get<CacheHeader>();
+
+    if (!reader.ok() || memcmp(header.magic, cache_magic, sizeof cache_magic) ||
+        !header.n_buckets || (header.n_buckets & (header.n_buckets - 1)) ||
+        header.n_buckets > (map_len - sizeof header) / sizeof(CacheBucket))
+    {
+        AUDWARN("Ignoring invalid tuple cache.\n");
+        unmap_file();
+        return;
+    }
+
+    accessed.insert(0, header.n_buckets);
+}
+
+static CacheBucket get_bucket(uint32_t i)
+{
+    CacheBucket bucket;
+    memcpy(&bucket, map_data + sizeof header + sizeof bucket * i,
+           sizeof bucket);
+    return bucket;
+}
+
+static bool str_equal(const char * a, uint32_t a_len, const char * b)
+{
+    return a && a_len == strlen(b) && !memcmp(a, b, a_len);
+}
+
+/* returns the bucket whose record has the given URI, or -1 */
+static int find_bucket(const char * uri)
+{
+    if (!mapped)
+        return -1;
+
+    uint32_t hash = str_calc_hash(uri);
+    uint32_t mask = header.n_buckets - 1;
+
+    for (uint32_t i = hash & mask, probes = 0; probes < header.n_buckets;
+         i = (i + 1) & mask, probes++)
+    {
+        CacheBucket bucket = get_bucket(i);
+        if (!bucket.offset)
+            return -1;
+        if (bucket.hash != hash)
+            continue;
+
+        CacheReader reader(map_data, map_len, bucket.offset);
+        reader.get<FileStamp>();
+
+        uint32_t len;
+        const char * str = reader.get_str(len);
+        if (str_equal(str, len, uri))
+            return i;
+    }
+
+    return -1;
+}
+
+/* reads the part of a record following the URI; if <tuple> is null, only
+ * checks that the record is complete */
+static bool read_record_tail(CacheReader & reader, String * decoder,
+                             Tuple * tuple)
+{
+    uint32_t len;
+    const char * str = reader.get_str(len);
+    if (decoder && str)
+        *decoder = String(str_copy(str, len));
+
+    int n_subtunes = reader.get<uint16_t>();
+    if (n_subtunes)
+    {
+        Index<short> subtunes;
+        if (reader.get<uint8_t>())
+        {
+            for (int i = 0; i < n_subtunes && reader.ok(); i++)
+                subtunes.append(reader.get<int16_t>());
+        }
+
+        if (tuple && reader.ok())
+            tuple->set_subtunes(n_subtunes,
+                                subtunes.len() ? subtunes.begin() : nullptr);
+    }
+
+    int n_fields = reader.get<uint16_t>();
+    for (int i = 0; i < n_fields && reader.ok(); i++)
+    {
+        const char * name = reader.get_str(len);
+        Tuple::Field field = Tuple::Invalid;
+        if (tuple && name)
+            field = Tuple::field_by_name(str_copy(name, len));
+
+        if (reader.get<uint8_t>() == Tuple::Int)
+        {
+            int val = reader.get<int32_t>();
+            if (field >= 0 && Tuple::field_get_type(field) == Tuple::Int)
+                tuple->set_int(field, val);
+        }
+        else
+        {
+            str = reader.get_str(len);
+            if (field >= 0 && str &&
+                Tuple::field_get_type(field) == Tuple::String)
+                tuple->set_str(field, str_copy(str, len));
+        }
+    }
+
+    return reader.ok();
+}
+
+template<class T>
+static void put(Index<char> & buf, const T & val)
+{
+    buf.insert((const char *)&val, -1, sizeof val);
+}
+
+static void put_str(Index<char> & buf, const char * str)
+{
+    uint32_t len = strlen(str);
+    put(buf, len);
+    buf.insert(str, -1, len);
+}
+
+static void write_record(Index<char> & buf, const char * uri,
+                         const CacheEntry & entry)
+{
+    put(buf, entry.stamp);
+    put_str(buf, uri);
+    put_str(buf, entry.decoder);
+
+    uint16_t n_subtunes = aud::max(entry.tuple.get_n_subtunes(), (short)0);
+    put(buf, n_subtunes);
+
+    if (n_subtunes)
+    {
+        /* subtunes numbered 1 to n need not be listed */
+        uint8_t listed = false;
+        for (int i = 0; i < n_subtunes; i++)
+        {
+            if (entry.tuple.get_nth_subtune(i) != i + 1)
+                listed = true;
+        }
+
+        put(buf, listed);
+        for (int i = 0; listed && i < n_subtunes; i++)
+            put(buf, (int16_t)entry.tuple.get_nth_subtune(i));
+    }
+
+    uint16_t n_fields = 0;
+    int count_at = buf.len();
+    put(buf, n_fields);
+
+    for (auto field : Tuple::all_fields())
+    {
+        /* the formatted title depends on settings and is not cached */
+        auto type = entry.tuple.get_value_type(field);
+        if (type == Tuple::Empty || field == Tuple::FormattedTitle)
+            continue;
+
+        put_str(buf, Tuple::field_get_name(field));
+        put(buf, (uint8_t)type);
+
+        if (type == Tuple::Int)
+            put(buf, (int32_t)entry.tuple.get_int(field));
+        else
+            put_str(buf, entry.tuple.get_str(field));
+
+        n_fields++;
+    }
+
+    memcpy(&buf[count_at], &n_fields, sizeof n_fields);
+}
+
+static bool write_file(const char * path, const Index<CacheBucket> & buckets,
+                       const Index<const char *> & records,
+                       const Index<int> & lengths)
+{
+    FILE * file = g_fopen(path, "wb");
+    if (!file)
+        return false;
+
+    CacheHeader new_header;
+    memcpy(new_header.magic, cache_magic, sizeof cache_magic);
+    new_header.n_buckets = buckets.len();
+    new_header.n_records = records.len();
+
+    bool success =
+        fwrite(&new_header, sizeof new_header, 1, file) == 1 &&
+        fwrite(buckets.begin(), sizeof(CacheBucket), buckets.len(), file) ==
+            (size_t)buckets.len();
+
+    for (int i = 0; success && i < records.len(); i++)
+        success = fwrite(records[i], 1, lengths[i], file) == (size_t)lengths[i];
+
+    return !fclose(file) && success;
+}
+
+/* the state of the cache file that save() reads from with the mutex released;
+ * the extra reference keeps the mapping valid */
+struct SaveSource
+{
+    GMappedFile * mapped;
+    const char * data;
+    size_t len;
+    CacheHeader header;
+    Index<char> accessed;
+};
+
+/* builds and writes a new file from <source> and <saving>, without the
+ * mutex held; returns false on error */
+static bool write_new_file(const SaveSource & source, const char * path)
+{
+    Index<const char *> records;
+    Index<int> lengths;
+    Index<uint32_t> hashes;
+
+    /* keep the records from the current file that have not been replaced, or
+     * only those used in this session if there are too many */
+    bool overflow =
+        (int64_t)source.header.n_records + saving.n_items() > MAX_ENTRIES;
+
+    for (uint32_t i = 0; source.mapped && i < source.header.n_buckets; i++)
+    {
+        CacheBucket bucket;
+        memcpy(&bucket, source.data + sizeof(CacheHeader) + sizeof bucket * i,
+               sizeof bucket);
+
+        if (!bucket.offset || (overflow && !source.accessed[i]))
+            continue;
+
+        CacheReader reader(source.data, source.len, bucket.offset);
+        reader.get<FileStamp>();
+
+        uint32_t len;
+        const char * uri = reader.get_str(len);
+        if (!uri || saving.lookup(String(str_copy(uri, len))) ||
+            !read_record_tail(reader, nullptr, nullptr))
+            continue;
+
+        records.append(source.data + bucket.offset);
+        lengths.append(reader.pos() - bucket.offset);
+        hashes.append(bucket.hash);
+    }
+
+    /* serialize new entries into a separate buffer; pointers into it are
+     * filled in only after it is complete, since it may be reallocated */
+    Index<char> fresh;
+    Index<int> fresh_starts;
+    int n_kept = records.len();
+
+    saving.iterate([&](const String & uri, CacheEntry & entry) {
+        if (entry.removed)
+            return;
+
+        int start = fresh.len();
+        write_record(fresh, uri, entry);
+
+        records.append(nullptr);
+        lengths.append(fresh.len() - start);
+        fresh_starts.append(start);
+        hashes.append(str_calc_hash(uri));
+    });
+
+    for (int i = n_kept; i < records.len(); i++)
+        records[i] = &fresh[fresh_starts[i - n_kept]];
+
+    uint32_t n_buckets = 64;
+    while (n_buckets < 2 * (uint32_t)records.len())
+        n_buckets <<= 1;
+
+    Index<CacheBucket> buckets;
+    buckets.insert(0, n_buckets);
+
+    uint32_t mask = n_buckets - 1;
+    uint32_t offset = sizeof(CacheHeader) + sizeof(CacheBucket) * n_buckets;
+
+    for (int r = 0; r < records.len(); r++)
+    {
+        uint32_t i = hashes[r] & mask;
+        while (buckets[i].offset)
+            i = (i + 1) & mask;
+
+        buckets[i] = {hashes[r], offset};
+        offset += lengths[r];
+    }
+
+    return write_file(path, buckets, records, lengths);
+}
+
+/* The new file is built and written with the mutex released, so that lookups
+ * from the scanner threads are not held up; the mutex is taken again only to
+ * replace the mapping.  Changes made meanwhile stay in <changes> for the next
+ * save.  Only one thread at a time calls this function: either save_thread or,
+ * once it has been joined, the main thread. */
+static void save(aud::mutex::holder & mh)
+{
+    if (!dirty)
+        return;
+
+    changes.iterate([](const String & uri, CacheEntry & entry) {
+        saving.add(uri, {entry.stamp, entry.decoder, entry.tuple.ref(),
+                         entry.removed});
+    });
+
+    changes.clear();
+    dirty = false;
+
+    SaveSource source = {mapped ? g_mapped_file_ref(mapped) : nullptr,
+                         map_data, map_len, header};
+    source.accessed.insert(accessed.begin(), 0, accessed.len());
+
+    StringBuf path = cache_path();
+    StringBuf temp = str_concat({path, ".tmp"});
+
+    mh.unlock();
+
+    bool success = write_new_file(source, temp);
+
+    if (source.mapped)
+        g_mapped_file_unref(source.mapped);
+
+    mh.lock();
+
+    if (success)
+    {
+        /* the old file must be closed first on some systems */
+        unmap_file();
+
+#ifdef _WIN32
+        g_unlink(path);
+#endif
+
+        if (g_rename(temp, path) < 0)
+            AUDERR("Failed to rename %s.\n", (const char *)temp);
+
+        map_file();
+    }
+    else
+    {
+        AUDERR("Failed to write %s.\n", (const char *)temp);
+        g_unlink(temp);
+
+        /* keep the unsaved changes, unless replaced meanwhile */
+        saving.iterate([](const String & uri, CacheEntry & entry) {
+            if (!changes.lookup(uri))
+                changes.add(uri, std::move(entry));
+        });
+
+        dirty = true;
+    }
+
+    saving.clear();
+}
+
+static void save_worker()
+{
+    auto mh = mutex.take();
+    save(mh);
+    save_running = false;
+}
+
+static void save_cb(void *, void *)
+{
+    auto mh = mutex.take();
+
+    if (save_running || changes.n_items() < SAVE_THRESHOLD)
+        return;
+
+    /* the previous worker has already left save() */
+    if (save_thread.joinable())
+        save_thread.join();
+
+    save_running = true;
+    save_thread = std::thread(save_worker);
+}
+
+void tuple_cache_init()
+{
+    auto mh = mutex.take();
+
+    map_file();
+    initialized = true;
+
+    hook_associate("config save", save_cb, nullptr);
+}
+
+void tuple_cache_cleanup()
+{
+    hook_dissociate("config save", save_cb);
+
+    if (save_thread.joinable())
+        save_thread.join();
+
+    auto mh = mutex.take();
+
+    save(mh);
+    unmap_file();
+    changes.clear();
+    dirty = false;
+    initialized = false;
+}
+
+bool tuple_cache_get_stamp(const char * filename, FileStamp & stamp)
+{
+    if (strncmp(filename, "file://", 7))
+        return false;
+
+    StringBuf path = uri_to_filename(strip_subtune(filename));
+    if (!path)
+        return false;
+
+    GStatBuf info;
+    if (g_stat(path, &info) < 0 || !S_ISREG(info.st_mode))
+        return false;
+
+    stamp.size = info.st_size;
+    stamp.mtime = info.st_mtime;
+    return true;
+}
+
+bool tuple_cache_lookup(const char * filename, const FileStamp & stamp,
+                        PluginHandle *& decoder, Tuple & tuple)
+{
+    auto mh = mutex.take();
+
+    if (!initialized)
+        return false;
+
+    String key(filename);
+    String decoder_name;
+    Tuple found;
+
+    CacheEntry * entry = changes.lookup(key);
+    if (!entry)
+        entry = saving.lookup(key);
+
+    if (entry)
+    {
+        if (entry->removed || entry->stamp != stamp)
+            return false;
+
+        decoder_name = entry->decoder;
+        found = entry->tuple.ref();
+    }
+    else
+    {
+        int i = find_bucket(filename);
+        if (i < 0)
+            return false;
+
+        CacheReader reader(map_data, map_len, get_bucket(i).offset);
+        FileStamp cached = reader.get<FileStamp>();
+
+        uint32_t len;
+        reader.get_str(len);
+
+        /* drop the outdated entry at the next save */
+        if (cached != stamp)
+        {
+            changes.add(key, {cached, String(), Tuple(), true});
+            dirty = true;
+            return false;
+        }
+
+        if (!read_record_tail(reader, &decoder_name, &found))
+            return false;
+
+        found.set_state(Tuple::Valid);
+        accessed[i] = true;
+    }
+
+    /* the decoder may have been removed or disabled since */
+    PluginHandle * plugin = aud_plugin_lookup_basename(decoder_name);
+    if (!plugin || !aud_plugin_get_enabled(plugin))
+        return false;
+
+    decoder = plugin;
+    tuple = std::move(found);
+    return true;
+}
+
+void tuple_cache_store(const char * filename, const FileStamp & stamp,
+                       PluginHandle * decoder, const Tuple & tuple)
+{
+    if (!decoder || !tuple.valid())
+        return;
+
+    auto mh = mutex.take();
+
+    if (!initialized)
+        return;
+
+    changes.add(String(filename),
+                {stamp, String(aud_plugin_get_basename(decoder)), tuple.ref(),
+                 false});
+    dirty = true;
+}
@@ -0,0 +1,156 @@
+/*
+ * tuple-columns.cc
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "tuple-columns.h"
+
+void TupleColumns::alloc_column(Tuple::Field field)
+{
+    if ((m_columns & bitmask(field)))
+        return;
+
+    if (Tuple::field_get_type(field) == Tuple::Int)
+        m_ints[field].insert(0, m_setmasks.len());
+    else
+        m_strs[field].insert(0, m_setmasks.len());
+
+    m_columns |= bitmask(field);
+}
+
+int TupleColumns::add(const Tuple & tuple)
+{
+    int row;
+
+    if (m_free.len())
+    {
+        row = m_free[m_free.len() - 1];
+        m_free.remove(m_free.len() - 1, 1);
+    }
+    else
+    {
+        row = m_setmasks.len();
+        m_setmasks.append(0);
+        m_states.append(Tuple::Initial);
+
+        for (auto field : Tuple::all_fields())
+        {
+            if (!(m_columns & bitmask(field)))
+                continue;
+
+            if (Tuple::field_get_type(field) == Tuple::Int)
+                m_ints[field].append(-1);
+            else
+                m_strs[field].append();
+        }
+    }
+
+    set(row, tuple);
+    return row;
+}
+
+void TupleColumns::set(int row, const Tuple & orig)
+{
+    /* fallbacks are generated again by the user of the tuple */
+    Tuple tuple = orig.ref();
+    tuple.delete_fallbacks();
+
+    uint64_t setmask = 0;
+
+    for (auto field : Tuple::all_fields())
+    {
+        auto type = tuple.get_value_type(field);
+
+        if (type == Tuple::Empty)
+        {
+            /* release the old string, if any */
+            if ((m_setmasks[row] & bitmask(field)) &&
+                Tuple::field_get_type(field) == Tuple::String)
+                m_strs[field][row] = String();
+
+            continue;
+        }
+
+        alloc_column(field);
+
+        if (type == Tuple::Int)
+            m_ints[field][row] = tuple.get_int(field);
+        else
+            m_strs[field][row] = tuple.get_str(field);
+
+        setmask |= bitmask(field);
+    }
+
+    m_setmasks[row] = setmask;
+    m_states[row] = tuple.state();
+}
+
+void TupleColumns::remove(int row)
+{
+    set(row, Tuple());
+    m_free.append(row);
+
+    if (!n_rows())
+        clear();
+}
+
+void TupleColumns::clear()
+{
+    m_setmasks.clear();
+    m_states.clear();
+    m_free.clear();
+    m_columns = 0;
+
+    for (auto field : Tuple::all_fields())
+    {
+        m_strs[field].clear();
+        m_ints[field].clear();
+    }
+}
+
+Tuple TupleColumns::get(int row) const
+{
+    Tuple tuple;
+    uint64_t setmask = m_setmasks[row];
+
+    /* fields are added in order, so each one is appended to the tuple */
+    for (auto field : Tuple::all_fields())
+    {
+        if (!(setmask & bitmask(field)))
+            continue;
+
+        if (Tuple::field_get_type(field) == Tuple::Int)
+            tuple.set_int(field, m_ints[field][row]);
+        else
+            tuple.set_str(field, m_strs[field][row]);
+    }
+
+    tuple.set_state(state(row));
+    return tuple;
+}
+
+int64_t TupleColumns::bytes_used() const
+{
+    int64_t bytes = m_setmasks.len() * sizeof(uint64_t) +
+                    m_states.len() * sizeof(char) + m_free.len() * sizeof(int);
+
+    for (auto field : Tuple::all_fields())
+        bytes += m_strs[field].len() * sizeof(String) +
+                 m_ints[field].len() * sizeof(int);
+
+    return bytes;
+}
@@ -0,0 +1,78 @@
+/*
+ * tuple-columns.h
+ * Copyright 2026 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LIBAUDCORE_TUPLE_COLUMNS_H
+#define LIBAUDCORE_TUPLE_COLUMNS_H
+
+#include <stdint.h>
+
+#include "index.h"
+#include "tuple.h"
+
+/* A store for many tuples, kept as one packed array per field instead of one
+ * heap object per tuple.  String values are shared with the string pool, so
+ * each distinct string is stored only once.  The array of a field is created
+ * when the field is first set in any row.  Rows that are removed are reused by
+ * later additions, so row numbers stay valid until removed.
+ *
+ * The fallback fields of a tuple (see Tuple::generate_fallbacks()) and its
+ * subtune array are not stored. */
+class TupleColumns
+{
+public:
+    int add(const Tuple & tuple);
+    void set(int row, const Tuple & tuple);
+    void remove(int row);
+    void clear();
+
+    /* builds a tuple holding the values of a row */
+    Tuple get(int row) const;
+
+    Tuple::State state(int row) const { return (Tuple::State)m_states[row]; }
+    void set_state(int row, Tuple::State state) { m_states[row] = state; }
+
+    bool is_set(int row, Tuple::Field field) const
+        { return m_setmasks[row] & bitmask(field); }
+
+    /* same as the Tuple functions, except that fallbacks are not returned */
+    int get_int(int row, Tuple::Field field) const
+        { return is_set(row, field) ? m_ints[field][row] : -1; }
+    String get_str(int row, Tuple::Field field) const
+        { return is_set(row, field) ? m_strs[field][row] : String(); }
+
+    int n_rows() const { return m_setmasks.len() - m_free.len(); }
+
+    /* the memory used by the arrays, not counting the strings themselves */
+    int64_t bytes_used() const;
+
+private:
+    static constexpr uint64_t bitmask(int n) { return (uint64_t)1 << n; }
+
+    void alloc_column(Tuple::Field field);
+
+    Index<uint64_t> m_setmasks;
+    Index<char> m_states;
+    Index<int> m_free;
+    uint64_t m_columns = 0; /* fields whose array has been created */
+
+    Index<String> m_strs[Tuple::n_fields];
+    Index<int> m_ints[Tuple::n_fields];
+};
+
+#endif // LIBAUDCORE_TUPLE_COLUMNS_H
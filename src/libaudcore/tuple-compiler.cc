@@ -22,7 +22,9 @@
 #include <string.h>
 
 #include <glib.h>
+#include <atomic>
 #include <new>
+#include <thread>
 
 #include "audstrings.h"
 #include "runtime.h"
@@ -39,7 +41,8 @@ struct Variable
     } type;
 
     String text;
-    int integer;
+    int text_len; /* precomputed for Text */
+    int integer;  /* for Text, precomputed atoi(text) */
     Tuple::Field field;
 
     bool set(const char * name, bool literal);
@@ -51,6 +54,7 @@ enum class Op
 {
     Invalid = 0,
     Var,
+    Text, /* a Var whose value is known at compile time */
     Exists,
     Equal,
     Unequal,
@@ -61,14 +65,26 @@ enum class Op
     Empty
 };
 
-struct TupleCompiler::Node
+/* The expression is parsed into a tree of nodes, which is then flattened into
+ * a sequence of instructions for evaluation.  A conditional instruction is
+ * followed by the instructions of its body; if the condition is false, the
+ * body is jumped over.  Since each instruction is visited at most once and
+ * there is no recursion, formatting is a single linear pass. */
+struct Node
 {
     Op op;
     Variable var1, var2;
     Index<Node> children;
 };
 
-typedef TupleCompiler::Node Node;
+struct TupleCompiler::Instr
+{
+    Op op;
+    int skip; /* length of the body (for conditionals) */
+    Variable var1, var2;
+};
+
+typedef TupleCompiler::Instr Instr;
 
 bool Variable::set(const char * name, bool literal)
 {
@@ -81,6 +97,8 @@ bool Variable::set(const char * name, bool literal)
     {
         type = Text;
         text = String(name);
+        text_len = strlen(name);
+        integer = atoi(name);
     }
     else
     {
@@ -379,9 +397,10 @@ static bool compile_expression(Index<Node> & nodes, const char *& expression)
 
             buf.resize(set - buf);
 
-            node.op = Op::Var;
+            node.op = Op::Text;
             node.var1.type = Variable::Text;
             node.var1.text = String(buf);
+            node.var1.text_len = buf.len();
         }
     }
 
@@ -389,6 +408,31 @@ static bool compile_expression(Index<Node> & nodes, const char *& expression)
     return true;
 }
 
+static void flatten(const Index<Node> & nodes, Index<Instr> & program)
+{
+    for (const Node & node : nodes)
+    {
+        int pos = program.len();
+        Instr & instr = program.append();
+
+        instr.op = node.op;
+        instr.var1 = node.var1;
+        instr.var2 = node.var2;
+
+        /* integer literals are converted to text once, here */
+        if (instr.op == Op::Var && instr.var1.type == Variable::Integer)
+        {
+            instr.op = Op::Text;
+            instr.var1.type = Variable::Text;
+            instr.var1.text = String(int_to_str(instr.var1.integer));
+            instr.var1.text_len = strlen(instr.var1.text);
+        }
+
+        flatten(node.children, program);
+        program[pos].skip = program.len() - (pos + 1);
+    }
+}
+
 bool TupleCompiler::compile(const char * expr)
 {
     const char * c = expr;
@@ -403,34 +447,99 @@ bool TupleCompiler::compile(const char * expr)
         return false;
     }
 
-    root_nodes = std::move(nodes);
+    program.clear();
+    flatten(nodes, program);
     return true;
 }
 
-void TupleCompiler::reset() { root_nodes.clear(); }
+void TupleCompiler::reset() { program.clear(); }
 
-/* Evaluate tuple in given TupleEval expression in given
- * context and return resulting string. */
-static void eval_expression(const Index<Node> & nodes, const Tuple & tuple,
-                            StringBuf & out)
+static bool eval_condition(const Instr & instr, const Tuple & tuple)
 {
-    for (const Node & node : nodes)
+    String tmps1, tmps2;
+    int tmpi1 = 0, tmpi2 = 0;
+
+    Tuple::ValueType type1 = instr.var1.get(tuple, tmps1, tmpi1);
+    Tuple::ValueType type2 = instr.var2.get(tuple, tmps2, tmpi2);
+
+    if (type1 == Tuple::Empty || type2 == Tuple::Empty)
+        return false;
+
+    int resulti;
+
+    if (type1 == type2)
     {
-        switch (node.op)
-        {
-        case Op::Var:
+        if (type1 == Tuple::String)
+            resulti = strcmp(tmps1, tmps2);
+        else
+            resulti = tmpi1 - tmpi2;
+    }
+    else if (type1 == Tuple::Int)
+    {
+        /* atoi() of a literal is precomputed */
+        int value2 = (instr.var2.type == Variable::Text) ? instr.var2.integer
+                                                          : atoi(tmps2);
+        resulti = tmpi1 - value2;
+    }
+    else
+    {
+        int value1 = (instr.var1.type == Variable::Text) ? instr.var1.integer
+                                                          : atoi(tmps1);
+        resulti = value1 - tmpi2;
+    }
+
+    switch (instr.op)
+    {
+    case Op::Equal:
+        return (resulti == 0);
+
+    case Op::Unequal:
+        return (resulti != 0);
+
+    case Op::Less:
+        return (resulti < 0);
+
+    case Op::LessEqual:
+        return (resulti <= 0);
+
+    case Op::Greater:
+        return (resulti > 0);
+
+    case Op::GreaterEqual:
+        return (resulti >= 0);
+
+    default:
+        g_return_val_if_reached(false);
+    }
+}
+
+/* Evaluate the program for the given tuple, appending the result to the
+ * output buffer. */
+static void eval_program(const Index<Instr> & program, const Tuple & tuple,
+                         StringBuf & out)
+{
+    const Instr * instr = program.begin();
+    const Instr * end = program.end();
+
+    while (instr < end)
+    {
+        bool taken = true;
+
+        switch (instr->op)
         {
-            String tmps;
-            int tmpi;
+        case Op::Text:
+            out.insert(-1, instr->var1.text, instr->var1.text_len);
+            break;
 
-            switch (node.var1.get(tuple, tmps, tmpi))
+        case Op::Var:
+            switch (tuple.get_value_type(instr->var1.field))
             {
             case Tuple::String:
-                out.insert(-1, tmps);
+                out.insert(-1, tuple.get_str(instr->var1.field));
                 break;
 
             case Tuple::Int:
-                str_insert_int(out, -1, tmpi);
+                str_insert_int(out, -1, tuple.get_int(instr->var1.field));
                 break;
 
             default:
@@ -438,7 +547,6 @@ static void eval_expression(const Index<Node> & nodes, const Tuple & tuple,
             }
 
             break;
-        }
 
         case Op::Equal:
         case Op::Unequal:
@@ -446,94 +554,31 @@ static void eval_expression(const Index<Node> & nodes, const Tuple & tuple,
         case Op::LessEqual:
         case Op::Greater:
         case Op::GreaterEqual:
-        {
-            bool result = false;
-            String tmps1, tmps2;
-            int tmpi1 = 0, tmpi2 = 0;
-
-            Tuple::ValueType type1 = node.var1.get(tuple, tmps1, tmpi1);
-            Tuple::ValueType type2 = node.var2.get(tuple, tmps2, tmpi2);
-
-            if (type1 != Tuple::Empty && type2 != Tuple::Empty)
-            {
-                int resulti;
-
-                if (type1 == type2)
-                {
-                    if (type1 == Tuple::String)
-                        resulti = strcmp(tmps1, tmps2);
-                    else
-                        resulti = tmpi1 - tmpi2;
-                }
-                else
-                {
-                    if (type1 == Tuple::Int)
-                        resulti = tmpi1 - atoi(tmps2);
-                    else
-                        resulti = atoi(tmps1) - tmpi2;
-                }
-
-                switch (node.op)
-                {
-                case Op::Equal:
-                    result = (resulti == 0);
-                    break;
-
-                case Op::Unequal:
-                    result = (resulti != 0);
-                    break;
-
-                case Op::Less:
-                    result = (resulti < 0);
-                    break;
-
-                case Op::LessEqual:
-                    result = (resulti <= 0);
-                    break;
-
-                case Op::Greater:
-                    result = (resulti > 0);
-                    break;
-
-                case Op::GreaterEqual:
-                    result = (resulti >= 0);
-                    break;
-
-                default:
-                    g_warn_if_reached();
-                }
-            }
-
-            if (result)
-                eval_expression(node.children, tuple, out);
-
+            taken = eval_condition(*instr, tuple);
             break;
-        }
 
         case Op::Exists:
-            if (node.var1.exists(tuple))
-                eval_expression(node.children, tuple, out);
-
+            taken = instr->var1.exists(tuple);
             break;
 
         case Op::Empty:
-            if (!node.var1.exists(tuple))
-                eval_expression(node.children, tuple, out);
-
+            taken = !instr->var1.exists(tuple);
             break;
 
         default:
             g_warn_if_reached();
         }
+
+        instr += taken ? 1 : 1 + instr->skip;
     }
 }
 
-void TupleCompiler::format(Tuple & tuple) const
+void TupleCompiler::format_with(Tuple & tuple, StringBuf & buf) const
 {
     tuple.unset(Tuple::FormattedTitle); // prevent recursion
 
-    StringBuf buf(0);
-    eval_expression(root_nodes, tuple, buf);
+    buf.resize(0);
+    eval_program(program, tuple, buf);
 
     if (buf[0])
     {
@@ -554,3 +599,52 @@ void TupleCompiler::format(Tuple & tuple) const
 
     tuple.set_str(Tuple::FormattedTitle, "");
 }
+
+void TupleCompiler::format(Tuple & tuple) const
+{
+    StringBuf buf(0);
+    format_with(tuple, buf);
+}
+
+void TupleCompiler::format_many(Tuple * const * tuples, int count,
+                                void (*prepare)(Tuple &)) const
+{
+    /* tuples are handed out to the threads in batches */
+    constexpr int batch = 256;
+    constexpr int min_per_thread = 4096;
+    constexpr int max_threads = 8;
+
+    std::atomic<int> next(0);
+
+    auto worker = [&]() {
+        StringBuf buf(0);
+        int start;
+
+        while ((start = next.fetch_add(batch)) < count)
+        {
+            int stop = aud::min(start + batch, count);
+
+            for (int i = start; i < stop; i++)
+            {
+                if (prepare)
+                    prepare(*tuples[i]);
+
+                format_with(*tuples[i], buf);
+            }
+        }
+    };
+
+    int n_threads = aud::min((int)std::thread::hardware_concurrency(),
+                             aud::min(count / min_per_thread, max_threads));
+
+    std::thread threads[max_threads];
+
+    /* the calling thread does its share of the work as well */
+    for (int i = 1; i < n_threads; i++)
+        threads[i] = std::thread(worker);
+
+    worker();
+
+    for (int i = 1; i < n_threads; i++)
+        threads[i].join();
+}
@@ -43,10 +43,12 @@
 #include <libaudcore/index.h>
 #include <libaudcore/tuple.h>
 
+class StringBuf;
+
 class TupleCompiler
 {
 public:
-    struct Node;
+    struct Instr;
 
     TupleCompiler();
     ~TupleCompiler();
@@ -56,8 +58,16 @@ public:
 
     void format(Tuple & tuple) const;
 
+    /* formats a number of tuples, dividing the work between several threads
+     * if there are enough tuples; <prepare>, if given, is called for each
+     * tuple (in the same thread) just before it is formatted */
+    void format_many(Tuple * const * tuples, int count,
+                     void (*prepare)(Tuple &) = nullptr) const;
+
 private:
-    Index<Node> root_nodes;
+    Index<Instr> program;
+
+    void format_with(Tuple & tuple, StringBuf & buf) const;
 };
 
 #endif /* LIBAUDCORE_TUPLE_COMPILER_H */
@@ -85,6 +85,7 @@ struct TupleData
     TupleVal * lookup(int field, bool add, bool remove);
     void set_int(int field, int x);
     void set_str(int field, const char * str);
+    void set_str(int field, const String & str);
     void set_subtunes(short nsubs, const short * subs);
 
     static TupleData * ref(TupleData * tuple);
@@ -288,6 +289,12 @@ void TupleData::set_str(int field, const char * str)
     new (&val->str) String(str);
 }
 
+void TupleData::set_str(int field, const String & str)
+{
+    TupleVal * val = lookup(field, true, false);
+    new (&val->str) String(str);
+}
+
 void TupleData::set_subtunes(short nsubs, const short * subs)
 {
     nsubtunes = nsubs;
@@ -503,6 +510,20 @@ EXPORT void Tuple::set_str(Field field, const char * str)
     }
 }
 
+EXPORT void Tuple::set_str(Field field, const ::String & str)
+{
+    if (!str || !g_utf8_validate(str, -1, nullptr))
+    {
+        set_str(field, (const char *)str);
+        return;
+    }
+
+    assert(is_valid_field(field) && field_info[field].type == String);
+
+    data = TupleData::copy_on_write(data);
+    data->set_str(field, str);
+}
+
 EXPORT void Tuple::unset(Field field)
 {
     assert(is_valid_field(field));
@@ -167,6 +167,10 @@ public:
      * Equivalent to unset() if <str> is null. */
     void set_str(Field field, const char * str);
 
+    /* Same as above, but shares <str> rather than looking it up again in the
+     * string pool. */
+    void set_str(Field field, const ::String & str);
+
     /* Clears any value that a field is currently set to. */
     void unset(Field field);
 
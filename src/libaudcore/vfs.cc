@@ -98,8 +98,10 @@ EXPORT VFSFile::VFSFile(const char * filename, const char * mode)
     if (!impl)
         return;
 
-    /* enable buffering for read-only handles */
-    if (mode[0] == 'r' && !strchr(mode, '+'))
+    /* enable buffering for read-only handles (except mapped files, which
+     * are already in memory) */
+    if (mode[0] == 'r' && !strchr(mode, '+') &&
+        !dynamic_cast<MappedFile *>(impl))
         impl = new ProbeBuffer(filename, impl);
 
     AUDINFO("<%p> open (mode %s) %s\n", impl, mode, filename);
@@ -275,12 +277,21 @@ EXPORT String VFSFile::get_metadata(const char * field)
 EXPORT void VFSFile::set_limit_to_buffer(bool limit)
 {
     auto buffer = dynamic_cast<ProbeBuffer *>(m_impl.get());
+    auto mapped = dynamic_cast<MappedFile *>(m_impl.get());
+
     if (buffer)
         buffer->set_limit_to_buffer(limit);
+    else if (mapped)
+        mapped->set_limit_to_buffer(limit);
     else
         AUDERR("<%p> buffering not supported!\n", m_impl.get());
 }
 
+EXPORT bool VFSFile::is_mapped()
+{
+    return dynamic_cast<MappedFile *>(m_impl.get()) != nullptr;
+}
+
 EXPORT Index<char> VFSFile::read_all()
 {
     constexpr int maxbuf = 16777216;
@@ -156,6 +156,10 @@ public:
      * buffered region (useful for probing the file type) */
     void set_limit_to_buffer(bool limit);
 
+    /* local files opened in read-only mode are mapped into memory, so that
+     * small reads and seeks on them cost no system calls */
+    bool is_mapped();
+
     /* utility functions */
 
     /* reads the entire file into memory (limited to 16 MB) */
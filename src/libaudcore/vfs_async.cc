@@ -17,30 +17,58 @@
  * the use of this software.
  */
 
+/*
+ * Reads are done by a small pool of worker threads, shared by all callers.
+ * Requests wait in one of two lanes until a worker is free; interactive
+ * requests are always taken before background ones, and in the order they
+ * were made within each lane.  Finished requests are passed to their
+ * consumers in the main thread.  Requests can be canceled by owner at any
+ * point; a canceled request that is already being read is discarded by the
+ * worker afterwards.
+ */
+
 #include "vfs_async.h"
+#include "hook.h"
+#include "internal.h"
 #include "list.h"
 #include "mainloop.h"
+#include "runtime.h"
 #include "threads.h"
 #include "vfs.h"
 
+#include <glib.h>
+
+/* upper limit for the "async_read_threads" setting */
+#define READ_THREADS_MAX 64
+
 struct QueuedData : public ListNode
 {
     const String filename;
     const VFSConsumer2 cons_f;
+    const VFSReadPriority priority;
+    const void * const owner;
 
-    std::thread thread;
     Index<char> buf;
+    bool canceled = false;
 
-    QueuedData(const char * filename, VFSConsumer2 cons_f)
-        : filename(filename), cons_f(cons_f)
+    QueuedData(const char * filename, VFSConsumer2 cons_f,
+               VFSReadPriority priority, const void * owner)
+        : filename(filename), cons_f(cons_f), priority(priority), owner(owner)
     {
     }
 };
 
 static QueuedFunc queued_func;
-static List<QueuedData> queue;
+static List<QueuedData> lanes[2]; /* waiting, indexed by priority */
+static List<QueuedData> reading;  /* being read by a worker */
+static List<QueuedData> queue;    /* finished, waiting for send_data() */
 static aud::mutex mutex;
 
+static GThreadPool * pool; /* null before init and after cleanup */
+static char pool_task;     /* the pool is given this for each request */
+static bool shut_down;
+static int running, peak_running;
+
 static void send_data()
 {
     auto mh = mutex.take();
@@ -52,7 +80,6 @@ static void send_data()
 
         mh.unlock();
 
-        data->thread.join();
         data->cons_f(data->filename, data->buf);
         delete data;
 
@@ -60,13 +87,39 @@ static void send_data()
     }
 }
 
-static void read_worker(QueuedData * data)
+/* each call reads the next waiting request, if it has not been canceled */
+static void read_worker(void *, void *)
 {
+    auto mh = mutex.take();
+
+    QueuedData * data = lanes[(int)VFSReadPriority::Interactive].head();
+    if (!data)
+        data = lanes[(int)VFSReadPriority::Background].head();
+    if (!data)
+        return;
+
+    lanes[(int)data->priority].remove(data);
+    reading.append(data);
+
+    running++;
+    peak_running = aud::max(peak_running, running);
+
+    mh.unlock();
+
     VFSFile file(data->filename, "r");
     if (file)
         data->buf = file.read_all();
 
-    auto mh = mutex.take();
+    mh.lock();
+
+    running--;
+    reading.remove(data);
+
+    if (data->canceled)
+    {
+        delete data;
+        return;
+    }
 
     if (!queue.head())
         queued_func.queue(send_data);
@@ -74,11 +127,112 @@ static void read_worker(QueuedData * data)
     queue.append(data);
 }
 
+template<class MatchFunc>
+static void cancel_requests(MatchFunc match)
+{
+    auto mh = mutex.take();
+
+    for (auto list : {&lanes[0], &lanes[1], &queue})
+    {
+        QueuedData * data;
+        while ((data = list->find(match)))
+        {
+            list->remove(data);
+            delete data;
+        }
+    }
+
+    for (QueuedData * data = reading.head(); data; data = reading.next(data))
+    {
+        if (match(*data))
+            data->canceled = true;
+    }
+}
+
+static int pool_threads()
+{
+    return aud::clamp(aud_get_int("async_read_threads"), 1, READ_THREADS_MAX);
+}
+
+static void read_threads_changed(void *, void *)
+{
+    auto mh = mutex.take();
+    if (pool)
+        g_thread_pool_set_max_threads(pool, pool_threads(), nullptr);
+}
+
+/* requests made before init have been waiting in the lanes */
+void vfs_async_init()
+{
+    auto mh = mutex.take();
+
+    pool = g_thread_pool_new(read_worker, nullptr, pool_threads(), false,
+                             nullptr);
+    shut_down = false;
+
+    for (auto & lane : lanes)
+    {
+        for (QueuedData * data = lane.head(); data; data = lane.next(data))
+            g_thread_pool_push(pool, &pool_task, nullptr);
+    }
+
+    mh.unlock();
+
+    hook_associate("set async_read_threads", read_threads_changed, nullptr);
+}
+
+void vfs_async_cleanup()
+{
+    hook_dissociate("set async_read_threads", read_threads_changed);
+
+    /* consumers are not called once shutdown has begun */
+    cancel_requests([](const QueuedData &) { return true; });
+
+    GThreadPool * old_pool;
+
+    {
+        auto mh = mutex.take();
+        old_pool = pool;
+        pool = nullptr;
+        shut_down = true;
+    }
+
+    /* wait for the workers to finish; reads still waiting are skipped */
+    if (old_pool)
+        g_thread_pool_free(old_pool, false, true);
+
+    queued_func.stop();
+}
+
+int vfs_async_peak_threads()
+{
+    auto mh = mutex.take();
+    return peak_running;
+}
+
+/* Before init, the request waits until there is a pool to read it.  After
+ * cleanup, it is dropped, like any other request pending at shutdown. */
+EXPORT void vfs_async_file_get_contents(const char * filename,
+                                        VFSConsumer2 cons_f,
+                                        VFSReadPriority priority,
+                                        const void * owner)
+{
+    auto mh = mutex.take();
+    if (shut_down)
+        return;
+
+    lanes[(int)priority].append(
+        new QueuedData(filename, cons_f, priority, owner));
+
+    if (pool)
+        g_thread_pool_push(pool, &pool_task, nullptr);
+}
+
 EXPORT void vfs_async_file_get_contents(const char * filename,
                                         VFSConsumer2 cons_f)
 {
-    auto data = new QueuedData(filename, cons_f);
-    data->thread = std::thread(read_worker, data);
+    vfs_async_file_get_contents(filename, cons_f, VFSReadPriority::Interactive,
+                                nullptr);
 }
 
 EXPORT void vfs_async_file_get_contents(const char * filename,
@@ -87,3 +241,13 @@ EXPORT void vfs_async_file_get_contents(const char * filename,
     using namespace std::placeholders;
     vfs_async_file_get_contents(filename, std::bind(cons_f, _1, _2, user));
 }
+
+/* requests made without an owner cannot be canceled */
+EXPORT void vfs_async_cancel(const void * owner)
+{
+    if (!owner)
+        return;
+
+    cancel_requests(
+        [owner](const QueuedData & data) { return data.owner == owner; });
+}
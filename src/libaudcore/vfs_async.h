@@ -29,9 +29,27 @@ typedef std::function<void(const char * filename, const Index<char> & buf)>
 typedef void (*VFSConsumer)(const char * filename, const Index<char> & buf,
                             void * user);
 
+enum class VFSReadPriority
+{
+    Interactive, /* needed to display something right away */
+    Background   /* read ahead, prefetched, etc. */
+};
+
+/* The file is read in a worker thread and passed to the consumer in the main
+ * thread.  If an owner is given, the request can be canceled with
+ * vfs_async_cancel(). */
+void vfs_async_file_get_contents(const char * filename, VFSConsumer2 cons_f,
+                                 VFSReadPriority priority,
+                                 const void * owner = nullptr);
+
+/* same as above, as an interactive request without an owner */
 void vfs_async_file_get_contents(const char * filename, VFSConsumer2 cons_f);
 
 void vfs_async_file_get_contents(const char * filename, VFSConsumer cons_f,
                                  void * user) __attribute__((deprecated));
 
+/* Cancels all requests made with the given owner; their consumers will not be
+ * called.  Call from the main thread, e.g. when the owner is destroyed. */
+void vfs_async_cancel(const void * owner);
+
 #endif
@@ -21,6 +21,15 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifndef _WIN32
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <atomic>
+
 #include <glib/gstdio.h>
 
 /* needs to be after system headers for #undef's to take effect */
@@ -29,6 +38,7 @@
 
 #include "audstrings.h"
 #include "i18n.h"
+#include "probe-buffer.h"
 #include "runtime.h"
 
 #ifdef _WIN32
@@ -38,6 +48,12 @@
 
 #define perror(s) AUDERR("%s: %s\n", (const char *)(s), strerror(errno))
 
+/* how much to read ahead after a long seek in a mapped file */
+#define MAP_READAHEAD (64 * 1024)
+
+/* smallest mapped file for which sequential access is advised */
+#define MAP_SEQUENTIAL_MIN (1024 * 1024)
+
 enum LocalOp
 {
     OP_NONE,
@@ -123,6 +139,17 @@ VFSImpl * LocalTransport::fopen(const char * uri, const char * mode,
         }
     }
 
+    /* read-only access to regular files is done through a mapping */
+    if (mode[0] == 'r' && !strchr(mode, '+'))
+    {
+        MappedFile * mapped = MappedFile::create(path, fileno(stream));
+        if (mapped)
+        {
+            fclose(stream);
+            return mapped;
+        }
+    }
+
     return new LocalFile(path, stream);
 }
 
@@ -321,6 +348,278 @@ ERR:
     return -1;
 }
 
+#ifndef _WIN32
+/* A copy from a mapping records the range being read and a place to jump back
+ * to; a SIGBUS raised within that range (because the file was truncated) ends
+ * the copy early.  Any other SIGBUS is passed on to the previous handler. */
+static thread_local sigjmp_buf * copy_jump;
+static thread_local const char * copy_start, *copy_end;
+
+static struct sigaction prev_sigbus;
+
+static void sigbus_handler(int sig, siginfo_t * info, void * context)
+{
+    auto addr = (const char *)info->si_addr;
+    if (copy_jump && addr >= copy_start && addr < copy_end)
+        siglongjmp(*copy_jump, 1);
+
+    if (prev_sigbus.sa_flags & SA_SIGINFO)
+        prev_sigbus.sa_sigaction(sig, info, context);
+    else if (prev_sigbus.sa_handler != SIG_DFL &&
+             prev_sigbus.sa_handler != SIG_IGN)
+        prev_sigbus.sa_handler(sig);
+    else
+    {
+        /* the fault recurs on return and gets the default action */
+        sigaction(SIGBUS, &prev_sigbus, nullptr);
+    }
+}
+
+static bool install_sigbus_handler()
+{
+    struct sigaction sa = {};
+    sa.sa_sigaction = sigbus_handler;
+    /* SIGBUS is not blocked in the handler, so that no signal mask needs to
+     * be restored after jumping out (saving it would cost a system call) */
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+
+    return sigaction(SIGBUS, &sa, &prev_sigbus) == 0;
+}
+
+/* returns false if the file was truncated under the copy */
+static bool guarded_copy(void * dest, const char * src, int64_t len)
+{
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 0))
+    {
+        copy_jump = nullptr;
+        return false;
+    }
+
+    copy_start = src;
+    copy_end = src + len;
+    copy_jump = &jump;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    memcpy(dest, src, len);
+
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    copy_jump = nullptr;
+
+    return true;
+}
+#endif
+
+MappedFile * MappedFile::create(const char * path, int fd)
+{
+#ifdef _WIN32
+    return nullptr;
+#else
+    struct stat st;
+
+    /* pipes, devices, etc. are left to stdio, as are empty files (which
+     * cannot be mapped) and files too large for the address space */
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+        (uint64_t)st.st_size > SIZE_MAX)
+        return nullptr;
+
+    static bool handler_installed = install_sigbus_handler();
+    if (!handler_installed)
+        return nullptr;
+
+    void * data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return nullptr;
+
+    /* the caller's descriptor is closed along with its stream */
+    int fd2 = dup(fd);
+    if (fd2 < 0)
+    {
+        munmap(data, st.st_size);
+        return nullptr;
+    }
+
+    /* decoders mostly read from start to end; small files are read whole
+     * anyway, so the call would only add overhead */
+    if (st.st_size > MAP_SEQUENTIAL_MIN)
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    return new MappedFile(path, fd2, st.st_ctime, (char *)data, st.st_size);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if (munmap(m_data, m_size) < 0)
+        perror(m_path);
+
+    close(m_fd);
+#endif
+}
+
+/* checks that the file has not been truncated or rewritten since it was
+ * mapped; once it has, the mapping is never touched again.  This costs a
+ * system call, so it is done only where the size matters (not for reads). */
+bool MappedFile::mapping_valid()
+{
+#ifdef _WIN32
+    return false;
+#else
+    if (m_unmapped)
+        return false;
+
+    struct stat st;
+    if (fstat(m_fd, &st) < 0 || st.st_size != m_size || st.st_ctime != m_ctime)
+    {
+        AUDDBG("%s changed while mapped, reading it directly\n",
+               (const char *)m_path);
+        m_unmapped = true;
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+/* reads as stdio would, from wherever the end of the file is now */
+int64_t MappedFile::read_unmapped(void * ptr, int64_t size, int64_t nitems)
+{
+    int64_t want = size * nitems;
+    if (m_limit < m_size)
+        want = aud::min(want, aud::max(m_limit - m_pos, (int64_t)0));
+
+    int64_t done = 0;
+
+#ifndef _WIN32
+    while (done < want)
+    {
+        ssize_t got = pread(m_fd, (char *)ptr + done, want - done, m_pos + done);
+        if (got < 0 && errno == EINTR)
+            continue;
+
+        if (got < 0)
+            perror(m_path);
+        if (got <= 0)
+            break;
+
+        done += got;
+    }
+#endif
+
+    m_pos += done;
+
+    /* stopping at the limit is not end of file */
+    if (done < size * nitems && done < want)
+        m_eof = true;
+
+    return done / size;
+}
+
+int64_t MappedFile::fread(void * ptr, int64_t size, int64_t nitems)
+{
+    if (size <= 0 || nitems <= 0)
+        return 0;
+
+    if (m_unmapped)
+        return read_unmapped(ptr, size, nitems);
+
+    int64_t avail = aud::max(m_limit - m_pos, (int64_t)0);
+    int64_t result = aud::min(nitems, avail / size);
+
+    if (result > 0)
+    {
+#ifndef _WIN32
+        if (!guarded_copy(ptr, m_data + m_pos, size * result))
+        {
+            AUDDBG("%s truncated while mapped, reading it directly\n",
+                   (const char *)m_path);
+            m_unmapped = true;
+            return read_unmapped(ptr, size, nitems);
+        }
+#endif
+
+        m_pos += size * result;
+    }
+
+    /* as with stdio, end of file is reported only after a short read */
+    if (result < nitems && m_pos + size > m_size)
+        m_eof = true;
+
+    return result;
+}
+
+int MappedFile::fseek(int64_t offset, VFSSeekType whence)
+{
+    bool limited = (m_limit < m_size);
+
+    if (whence == VFS_SEEK_CUR)
+        offset += m_pos;
+    else if (whence == VFS_SEEK_END)
+    {
+        if (limited)
+            return -1; /* same as ProbeBuffer */
+
+        int64_t size = fsize();
+        if (size < 0)
+            return -1;
+
+        offset += size;
+    }
+
+    if (offset < 0 || (limited && offset > m_limit))
+        return -1;
+
+#ifndef _WIN32
+    /* after a long jump (e.g. to a tag at the end of the file), start
+     * reading ahead, since the kernel's sequential readahead will not help
+     * there; short seeks are most likely within pages already read */
+    if (!m_unmapped && offset < m_size &&
+        (offset < m_pos - MAP_READAHEAD || offset > m_pos + MAP_READAHEAD))
+    {
+        int64_t page = sysconf(_SC_PAGESIZE);
+        int64_t start = offset / page * page;
+        int64_t len = aud::min(offset + MAP_READAHEAD, m_size) - start;
+
+        madvise(m_data + start, len, MADV_WILLNEED);
+    }
+#endif
+
+    m_pos = offset;
+    m_eof = false;
+
+    return 0;
+}
+
+int64_t MappedFile::fwrite(const void * ptr, int64_t size, int64_t nmemb)
+{
+    return 0; /* not allowed */
+}
+
+int MappedFile::ftruncate(int64_t length) { return -1; /* not allowed */ }
+
+int MappedFile::fflush() { return 0; /* no-op */ }
+
+void MappedFile::set_limit_to_buffer(bool limit)
+{
+    m_limit = limit ? aud::min(m_size, (int64_t)PROBE_BUFFER_SIZE) : m_size;
+}
+
+int64_t MappedFile::fsize()
+{
+    if (mapping_valid())
+        return m_size;
+
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(m_fd, &st) == 0)
+        return st.st_size;
+#endif
+
+    return -1;
+}
+
 VFSFileTest LocalTransport::test_file(const char * uri, VFSFileTest test,
                                       String & error)
 {
@@ -41,6 +41,63 @@ public:
     VFSImpl * fopen(const char * filename, const char * mode, String & error);
 };
 
+/* A regular local file opened read-only is mapped into memory rather than
+ * read through stdio, so that reads and seeks need no system calls.  Since the
+ * whole file is accessible, it is not wrapped in a ProbeBuffer; the limit on
+ * reads while probing is implemented here instead.
+ *
+ * Touching a mapped page past the end of a file that has been truncated raises
+ * SIGBUS, and a file being played may well be truncated by a tag editor (or by
+ * our own tag writers, which rewrite files in place), even in the middle of a
+ * read.  So data is only ever copied out of the mapping, by fread(), with a
+ * handler installed that ends the copy if it faults.  From then on, the file
+ * is read with pread(), with the same results as stdio would give.  (Bytes
+ * between the new end of the file and the end of its last page read as zeros
+ * rather than faulting; fsize() checks for a change in size or ctime.) */
+class MappedFile : public VFSImpl
+{
+public:
+    /* returns nullptr if the file cannot be mapped */
+    static MappedFile * create(const char * path, int fd);
+
+    ~MappedFile();
+
+    int64_t fread(void * ptr, int64_t size, int64_t nmemb);
+    int fseek(int64_t offset, VFSSeekType whence);
+
+    int64_t ftell() { return m_pos; }
+    int64_t fsize();
+    bool feof() { return m_eof; }
+
+    int64_t fwrite(const void * ptr, int64_t size, int64_t nmemb);
+    int ftruncate(int64_t length);
+    int fflush();
+
+    void set_limit_to_buffer(bool limit);
+
+private:
+    MappedFile(const char * path, int fd, int64_t ctime, char * data,
+               int64_t size)
+        : m_path(path), m_fd(fd), m_ctime(ctime), m_data(data), m_size(size),
+          m_limit(size)
+    {
+    }
+
+    bool mapping_valid();
+    int64_t read_unmapped(void * ptr, int64_t size, int64_t nitems);
+
+    String m_path;
+    const int m_fd; /* kept open for fsize() and for pread() */
+    const int64_t m_ctime;
+    bool m_unmapped = false; /* file has changed; mapping is no longer used */
+
+    char * const m_data;
+    const int64_t m_size; /* size of the mapping */
+    int64_t m_limit; /* reads and seeks stop here */
+    int64_t m_pos = 0;
+    bool m_eof = false;
+};
+
 VFSImpl * vfs_tmpfile(String & error);
 
 #endif /* LIBAUDCORE_VFS_LOCAL_H */
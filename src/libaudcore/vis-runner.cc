@@ -23,85 +23,194 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <atomic>
+
+#include "audio.h"
 #include "hook.h"
-#include "list.h"
 #include "mainloop.h"
 #include "output.h"
+#include "ringbuf.h"
+#include "runtime.h"
 #include "threads.h"
+#include "visualizer.h"
 
 #define INTERVAL 33 /* milliseconds */
 #define FRAMES_PER_NODE 512
 
-struct VisNode : public ListNode
-{
-    VisNode(int channels, int time)
-        : channels(channels), time(time),
-          data(new float[channels * FRAMES_PER_NODE])
-    {
-    }
-
-    ~VisNode() { delete[] data; }
+/* allowance for the latency of the output plugin, beyond the output buffer */
+#define EXTRA_LATENCY 250 /* milliseconds */
 
-    const int channels;
+struct VisNode
+{
+    int serial; /* value of flush_serial when the node was started */
     int time;
-    float * data;
+    int channels;
+    bool have_mono, have_freq;
+    float data[AUD_MAX_CHANNELS * FRAMES_PER_NODE];
+    float mono[FRAMES_PER_NODE];
+    float freq[FRAMES_PER_NODE / 2];
 };
 
+/* The nodes are allocated as a fixed arena, sized to cover the output latency,
+ * and passed by index between the output thread (which fills them) and the
+ * main thread (which sends them to the visualizers): filled nodes through
+ * vis_queue and consumed nodes back through vis_pool.  Both rings can hold
+ * every node, so pushing to them never fails.  Only the main thread resizes
+ * the arena, and only while holding the mutex and not using any node. */
+static Index<VisNode> vis_nodes;
+static AtomicRingBuf<int> vis_queue;
+static AtomicRingBuf<int> vis_pool;
+
+/* Flushing cannot remove nodes from vis_queue, since only the main thread may
+ * read from it.  Instead, the serial number is advanced and the main thread
+ * returns any outdated nodes to vis_pool as it comes to them. */
+static std::atomic<int> flush_serial;
+
+/* types of data needed by the visualizers (see Visualizer::type_mask) */
+static std::atomic<int> vis_types;
+
+/* the remaining state is protected by the mutex */
 static aud::mutex mutex;
 static bool enabled = false;
 static bool playing = false, paused = false;
-static VisNode * current_node = nullptr;
-static int current_frames;
-static List<VisNode> vis_list;
-static List<VisNode> vis_pool;
-static QueuedFunc queued_clear;
+static int current_node = -1;   /* taken from vis_pool, not yet queued */
+static int current_frames = -1; /* -1 if current_node has not been started */
+static bool have_last = false;  /* whether last_time is valid */
+static int last_time;           /* time of the most recently queued node */
 
-static void send_audio(void *)
+static bool sending = false; /* main thread only */
+static QueuedFunc queued_clear, queued_resize;
+
+static int wanted_arena_size()
 {
-    /* call before locking mutex to avoid deadlock */
-    int outputted = output_get_raw_time();
+    if (!enabled)
+        return 0;
+
+    /* one node more is needed for the one being filled, and another for the
+     * one being sent to the visualizers */
+    int latency = aud_get_int("output_buffer_size") + EXTRA_LATENCY;
+    return aud::max(latency, 0) / INTERVAL + 2;
+}
+
+/* called from the main thread only */
+static void resize_arena(aud::mutex::holder &)
+{
+    int size = wanted_arena_size();
+    if (size == vis_nodes.len())
+        return;
+
+    vis_queue.destroy();
+    vis_pool.destroy();
+    vis_nodes.clear();
+
+    current_node = -1;
+    current_frames = -1;
+    have_last = false;
 
+    if (!size)
+        return;
+
+    vis_nodes.insert(0, size);
+    vis_queue.alloc(size);
+    vis_pool.alloc(size);
+
+    for (int i = 0; i < size; i++)
+        vis_pool.push(i);
+}
+
+static void resize_arena_cb()
+{
     auto mh = mutex.take();
+    resize_arena(mh);
+}
 
-    if (!enabled || !playing || paused)
+static void send_audio(void *)
+{
+    /* nothing has been allocated yet, or the arena was freed */
+    if (!vis_nodes.len())
         return;
 
-    VisNode * node = nullptr;
-    VisNode * next;
+    int outputted = output_get_raw_time();
+    int serial = flush_serial.load(std::memory_order_acquire);
+
+    int node = -1;
+    AtomicRingBuf<int>::Areas areas;
 
-    while ((next = vis_list.head()))
+    while (vis_queue.get_read_areas(1, areas), areas.len1)
     {
-        /* If we are considering a node, stop searching and use it if it is the
-         * most recent (that is, the next one is in the future).  Otherwise,
-         * consider the next node if it is not in the future by more than the
-         * length of an interval. */
-        if (next->time > outputted + (node ? 0 : INTERVAL))
-            break;
+        int next = areas.area1[0];
+
+        if (vis_nodes[next].serial == serial)
+        {
+            /* If we are considering a node, stop searching and use it if it is
+             * the most recent (that is, the next one is in the future).
+             * Otherwise, consider the next node if it is not in the future by
+             * more than the length of an interval. */
+            if (vis_nodes[next].time > outputted + (node >= 0 ? 0 : INTERVAL))
+                break;
 
-        if (node)
-            vis_pool.prepend(node);
+            if (node >= 0)
+                vis_pool.push(node);
 
-        node = next;
-        vis_list.remove(node);
+            node = next;
+        }
+        else
+            vis_pool.push(next);
+
+        vis_queue.commit_read(1);
     }
 
-    if (!node)
+    if (node < 0)
         return;
 
-    mh.unlock();
-    vis_send_audio(node->data, node->channels);
-    mh.lock();
+    /* mono and frequency data were computed when the node was filled */
+    const VisNode & n = vis_nodes[node];
+
+    sending = true;
+    vis_send_audio(n.data, n.channels, n.have_mono ? n.mono : nullptr,
+                   n.have_freq ? n.freq : nullptr);
+    sending = false;
 
-    vis_pool.prepend(node);
+    vis_pool.push(node);
+}
+
+static void pcm_to_mono(const float * data, float * mono, int channels)
+{
+    if (channels == 1)
+        memcpy(mono, data, sizeof(float) * FRAMES_PER_NODE);
+    else
+    {
+        float * set = mono;
+        while (set < &mono[FRAMES_PER_NODE])
+        {
+            *set++ = (data[0] + data[1]) / 2;
+            data += channels;
+        }
+    }
+}
+
+/* Compute the data needed by the visualizers once for each node, here in the
+ * output thread, so that the main thread only has to pass it on. */
+static void finish_node(VisNode & node)
+{
+    int types = vis_types.load(std::memory_order_relaxed);
+
+    node.have_mono = (types & (Visualizer::MonoPCM | Visualizer::Freq));
+    node.have_freq = (types & Visualizer::Freq);
+
+    if (node.have_mono)
+        pcm_to_mono(node.data, node.mono, node.channels);
+    if (node.have_freq)
+        calc_freq(node.mono, node.freq);
 }
 
 static void flush(aud::mutex::holder &)
 {
-    delete current_node;
-    current_node = nullptr;
+    /* current_node (if any) is kept and started over */
+    current_frames = -1;
+    have_last = false;
 
-    vis_list.clear();
-    vis_pool.clear();
+    flush_serial.fetch_add(1, std::memory_order_release);
 
     if (enabled)
         queued_clear.queue(vis_send_clear);
@@ -116,6 +225,10 @@ void vis_runner_flush()
 static void start_stop(aud::mutex::holder & mh, bool new_playing,
                        bool new_paused)
 {
+    /* pick up any change to the output buffer size */
+    if (enabled && new_playing && !playing)
+        queued_resize.queue(resize_arena_cb);
+
     playing = new_playing;
     paused = new_paused;
 
@@ -141,19 +254,22 @@ void vis_runner_pass_audio(int time, const Index<float> & data, int channels,
 {
     auto mh = mutex.take();
 
-    if (!enabled || !playing)
+    if (!enabled || !playing || !vis_nodes.len())
         return;
 
+    assert(channels <= AUD_MAX_CHANNELS);
+
     /* We can build a single node from multiple calls; we can also build
-     * multiple nodes from the same call.  If current_node is present, it was
-     * partly built in the last call and needs to be finished. */
+     * multiple nodes from the same call.  If current_frames is not -1,
+     * current_node was partly built in the last call and needs to be
+     * finished. */
 
     int at = 0;
 
     while (1)
     {
-        if (current_node)
-            assert(current_node->channels == channels);
+        if (current_frames >= 0)
+            assert(vis_nodes[current_node].channels == channels);
         else
         {
             int node_time = time;
@@ -165,9 +281,8 @@ void vis_runner_pass_audio(int time, const Index<float> & data, int channels,
              * queue, we are at the beginning of the song or had an underrun,
              * and we want to copy the earliest audio data we have. */
 
-            VisNode * tail = vis_list.tail();
-            if (tail)
-                node_time = tail->time + INTERVAL;
+            if (have_last)
+                node_time = last_time + INTERVAL;
 
             at = channels * (int)((int64_t)(node_time - time) * rate / 1000);
 
@@ -176,20 +291,26 @@ void vis_runner_pass_audio(int time, const Index<float> & data, int channels,
             if (at >= data.len())
                 break;
 
-            current_node = vis_pool.head();
-
-            if (current_node)
+            /* If no node is free, the main thread has fallen behind by more
+             * than the output latency.  Skip this data rather than allocate;
+             * the next node will start from the data we have at that time. */
+            if (current_node < 0 && !vis_pool.pop(current_node))
             {
-                assert(current_node->channels == channels);
-                vis_pool.remove(current_node);
-                current_node->time = node_time;
+                current_node = -1;
+                have_last = false;
+                break;
             }
-            else
-                current_node = new VisNode(channels, node_time);
+
+            VisNode & node = vis_nodes[current_node];
+            node.serial = flush_serial.load(std::memory_order_relaxed);
+            node.time = node_time;
+            node.channels = channels;
 
             current_frames = 0;
         }
 
+        VisNode & node = vis_nodes[current_node];
+
         /* Copy as much data as we can, limited by how much we have and how much
          * space is left in the node.  If we cannot fill the node, we return and
          * wait for more data to be passed in the next call.  If we do fill the
@@ -197,15 +318,21 @@ void vis_runner_pass_audio(int time, const Index<float> & data, int channels,
 
         int copy = aud::min(data.len() - at,
                             channels * (FRAMES_PER_NODE - current_frames));
-        memcpy(current_node->data + channels * current_frames, &data[at],
+        memcpy(node.data + channels * current_frames, &data[at],
                sizeof(float) * copy);
         current_frames += copy / channels;
 
         if (current_frames < FRAMES_PER_NODE)
             break;
 
-        vis_list.append(current_node);
-        current_node = nullptr;
+        finish_node(node);
+
+        vis_queue.push(current_node);
+        have_last = true;
+        last_time = node.time;
+
+        current_node = -1;
+        current_frames = -1;
     }
 }
 
@@ -214,4 +341,15 @@ void vis_runner_enable(bool enable)
     auto mh = mutex.take();
     enabled = enable;
     start_stop(mh, playing, paused);
+
+    /* the arena must not be resized while a node is being sent */
+    if (sending)
+        queued_resize.queue(resize_arena_cb);
+    else
+        resize_arena(mh);
+}
+
+void vis_runner_set_types(int type_mask)
+{
+    vis_types.store(type_mask, std::memory_order_relaxed);
 }
@@ -20,8 +20,6 @@
 #include "interface.h"
 #include "internal.h"
 
-#include <string.h>
-
 #include "plugin.h"
 #include "plugins.h"
 #include "runtime.h"
@@ -31,9 +29,19 @@ static Index<Visualizer *> visualizers;
 static int running = false;
 static int num_enabled = 0;
 
+static void update_types()
+{
+    int type_mask = 0;
+    for (Visualizer * vis : visualizers)
+        type_mask |= vis->type_mask;
+
+    vis_runner_set_types(type_mask);
+}
+
 EXPORT void aud_visualizer_add(Visualizer * vis)
 {
     visualizers.append(vis);
+    update_types();
 
     num_enabled++;
     if (num_enabled == 1)
@@ -53,6 +61,7 @@ EXPORT void aud_visualizer_remove(Visualizer * vis)
     };
 
     visualizers.remove_if(is_match, true);
+    update_types();
 
     num_enabled -= num_disabled;
     if (!num_enabled)
@@ -65,48 +74,18 @@ void vis_send_clear()
         vis->clear();
 }
 
-static void pcm_to_mono(const float * data, float * mono, int channels)
+/* mono and freq are computed in advance by vis-runner.cc, but only if some
+ * visualizer needed them at the time; otherwise they are null */
+void vis_send_audio(const float * data, int channels, const float * mono,
+                    const float * freq)
 {
-    if (channels == 1)
-        memcpy(mono, data, sizeof(float) * 512);
-    else
-    {
-        float * set = mono;
-        while (set < &mono[512])
-        {
-            *set++ = (data[0] + data[1]) / 2;
-            data += channels;
-        }
-    }
-}
-
-void vis_send_audio(const float * data, int channels)
-{
-    auto is_active = [](int type_mask) {
-        for (Visualizer * vis : visualizers)
-        {
-            if ((vis->type_mask & type_mask))
-                return true;
-        }
-
-        return false;
-    };
-
-    float mono[512];
-    float freq[256];
-
-    if (is_active(Visualizer::MonoPCM | Visualizer::Freq))
-        pcm_to_mono(data, mono, channels);
-    if (is_active(Visualizer::Freq))
-        calc_freq(mono, freq);
-
     for (Visualizer * vis : visualizers)
     {
-        if ((vis->type_mask & Visualizer::MonoPCM))
+        if ((vis->type_mask & Visualizer::MonoPCM) && mono)
             vis->render_mono_pcm(mono);
         if ((vis->type_mask & Visualizer::MultiPCM))
             vis->render_multi_pcm(data, channels);
-        if ((vis->type_mask & Visualizer::Freq))
+        if ((vis->type_mask & Visualizer::Freq) && freq)
             vis->render_freq(freq);
     }
 }
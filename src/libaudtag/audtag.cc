@@ -28,7 +28,10 @@ namespace audtag {
 
 EXPORT bool read_tag (VFSFile & file, Tuple & tuple, Index<char> * image)
 {
-    TagModule * module = find_tag_module (file, TagType::None);
+    VFSFile windows = open_tag_windows (file);
+    VFSFile & probe = windows ? windows : file;
+
+    TagModule * module = find_tag_module (probe, TagType::None);
 
     if (! module)
     {
@@ -36,12 +39,15 @@ EXPORT bool read_tag (VFSFile & file, Tuple & tuple, Index<char> * image)
         return false;
     }
 
-    return module->read_tag (file, tuple, image);
+    return module->read_tag (probe, tuple, image);
 }
 
 EXPORT bool write_tuple (VFSFile & file, const Tuple & tuple, TagType new_type)
 {
-    TagModule * module = find_tag_module (file, new_type);
+    /* the tag is looked for through the read-only view, then written to the
+     * file itself */
+    VFSFile windows = open_tag_windows (file);
+    TagModule * module = find_tag_module (windows ? windows : file, new_type);
 
     if (! module)
     {
@@ -18,6 +18,7 @@
  * the use of this software.
  */
 
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -309,17 +310,13 @@ static Index<char> read_tag_data (VFSFile & handle, int size, bool syncsafe)
     return data;
 }
 
-static bool read_frame (const char * data, int max_size, int version,
- int * frame_size, GenericFrame & frame)
+/* Converts the fields of a frame header (in place) and checks them against the
+ * space left in the tag.  On success, <skip> is set to the number of bytes of
+ * extra information that precede the actual contents of the frame. */
+static bool parse_frame_header (ID3v24FrameHeader & header, int max_size,
+ int version, unsigned * skip)
 {
-    ID3v24FrameHeader header;
-    unsigned skip = 0;
-
-    if ((max_size -= sizeof (ID3v24FrameHeader)) < 0)
-        return false;
-
-    memcpy (& header, data, sizeof (ID3v24FrameHeader));
-    data += sizeof (ID3v24FrameHeader);
+    * skip = 0;
 
     if (! header.key[0]) /* padding */
         return false;
@@ -342,11 +339,26 @@ static bool read_frame (const char * data, int max_size, int version,
     }
 
     if (header.flags & ID3_FRAME_HAS_GROUP)
-        skip ++;
+        (* skip) ++;
     if (header.flags & ID3_FRAME_HAS_LENGTH)
-        skip += 4;
+        (* skip) += 4;
+
+    return * skip < header.size;
+}
+
+static bool read_frame (const char * data, int max_size, int version,
+ int * frame_size, GenericFrame & frame)
+{
+    ID3v24FrameHeader header;
+    unsigned skip;
+
+    if ((max_size -= sizeof (ID3v24FrameHeader)) < 0)
+        return false;
+
+    memcpy (& header, data, sizeof (ID3v24FrameHeader));
+    data += sizeof (ID3v24FrameHeader);
 
-    if (skip >= header.size)
+    if (! parse_frame_header (header, max_size, version, & skip))
         return false;
 
     * frame_size = sizeof (ID3v24FrameHeader) + header.size;
@@ -382,6 +394,122 @@ static void read_all_frames (const Index<char> & data, int version, FrameDict &
     }
 }
 
+/* Frame IDs are looked up in a table indexed by a multiplicative hash of the
+ * four characters.  The multiplier was chosen so that no two of the IDs in
+ * id3_frames collide; it must be checked again if an ID is added. */
+#define FRAME_HASH_BITS 6
+#define FRAME_HASH_MULT 0xeb8ac8cfu
+
+static unsigned frame_hash (const char * key)
+{
+    uint32_t k = ((uint32_t) (unsigned char) key[0] << 24) |
+     ((uint32_t) (unsigned char) key[1] << 16) |
+     ((uint32_t) (unsigned char) key[2] << 8) | (unsigned char) key[3];
+
+    return (uint32_t) (k * FRAME_HASH_MULT) >> (32 - FRAME_HASH_BITS);
+}
+
+struct FrameTable {
+    signed char ids[1 << FRAME_HASH_BITS];
+
+    FrameTable ()
+    {
+        memset (ids, -1, sizeof ids);
+        for (int id = 0; id < ID3_TAGS_NO; id ++)
+        {
+            unsigned slot = frame_hash (id3_frames[id]);
+            assert (ids[slot] < 0); /* see FRAME_HASH_MULT */
+            ids[slot] = id;
+        }
+    }
+};
+
+/* <key> is the four characters of the ID, not necessarily nul-terminated */
+static int get_frame_id (const char * key)
+{
+    static const FrameTable table;
+
+    int id = table.ids[frame_hash (key)];
+    return (id >= 0 && ! memcmp (key, id3_frames[id], 4)) ? id : -1;
+}
+
+/* Reads the frames of a tag, calling func (id, frame) for each frame for which
+ * want (id) returns true (id is -1 for unknown frames).  Unless the whole tag
+ * is unsynchronised, frames are read straight from the file and the contents
+ * of unwanted frames (such as cover art, PRIV and GEOB) are seeked past
+ * without being read. */
+template<class Want, class Func>
+static void walk_frames (VFSFile & handle, int data_size, int version,
+ bool syncsafe, Want want, Func func)
+{
+    /* with tag-level unsynchronisation, the frame boundaries are not known
+     * until the whole tag has been decoded */
+    if (syncsafe)
+    {
+        Index<char> data = read_tag_data (handle, data_size, syncsafe);
+
+        for (const char * pos = data.begin (); pos < data.end (); )
+        {
+            int frame_size;
+            GenericFrame frame;
+
+            if (! read_frame (pos, data.end () - pos, version, & frame_size, frame))
+                break;
+
+            int id = get_frame_id (frame.key);
+            if (want (id))
+                func (id, frame);
+
+            pos += frame_size;
+        }
+
+        return;
+    }
+
+    while (data_size >= (int) sizeof (ID3v24FrameHeader))
+    {
+        ID3v24FrameHeader header;
+        unsigned skip;
+
+        if (handle.fread (& header, 1, sizeof (ID3v24FrameHeader)) != sizeof (ID3v24FrameHeader))
+            break;
+
+        data_size -= sizeof (ID3v24FrameHeader);
+
+        if (! parse_frame_header (header, data_size, version, & skip))
+            break;
+
+        data_size -= header.size;
+
+        int id = get_frame_id (header.key);
+
+        if (! want (id))
+        {
+            AUDDBG ("Skipping %d bytes of frame %.4s.\n", (int) header.size, header.key);
+
+            if (handle.fseek (header.size, VFS_SEEK_CUR))
+                break;
+
+            continue;
+        }
+
+        GenericFrame frame;
+        frame.key = String (str_copy (header.key, 4));
+        frame.resize (header.size);
+
+        if (handle.fread (frame.begin (), 1, header.size) != header.size)
+            break;
+
+        frame.remove (0, skip);
+
+        if (header.flags & ID3_FRAME_SYNCSAFE)
+            unsyncsafe (frame);
+
+        AUDDBG ("Data size = %d.\n", frame.len ());
+        func (id, frame);
+    }
+}
+
 static bool write_frame (VFSFile & file, const GenericFrame & frame, int version, int * frame_size)
 {
     AUDDBG ("Writing frame %s, size %d\n", (const char *) frame.key, frame.len ());
@@ -438,17 +566,6 @@ static bool write_header (VFSFile & file, int version, int size)
     return file.fwrite (& header, 1, sizeof (ID3v24Header)) == sizeof (ID3v24Header);
 }
 
-static int get_frame_id (const char * key)
-{
-    for (int id = 0; id < ID3_TAGS_NO; id ++)
-    {
-        if (! strcmp (key, id3_frames[id]))
-            return id;
-    }
-
-    return -1;
-}
-
 static GenericFrame & add_generic_frame (int id, int size, FrameDict & dict)
 {
     String key (id3_frames[id]);
@@ -552,18 +669,17 @@ bool ID3v24TagModule::read_tag (VFSFile & handle, Tuple & tuple, Index<char> * i
      & data_size, & footer_size))
         return false;
 
-    Index<char> data = read_tag_data (handle, data_size, syncsafe);
     FrameList rva_frames;
 
-    for (const char * pos = data.begin (); pos < data.end (); )
-    {
-        int frame_size;
-        GenericFrame frame;
-
-        if (! read_frame (pos, data.end () - pos, version, & frame_size, frame))
-            break;
+    /* cover art is often far larger than the rest of the tag, so it is only
+     * read if it was asked for */
+    auto want = [image] (int id)
+        { return id >= 0 && (id != ID3_APIC || image); };
 
-        switch (get_frame_id (frame.key))
+    walk_frames (handle, data_size, version, syncsafe, want,
+     [&] (int id, GenericFrame & frame)
+    {
+        switch (id)
         {
           case ID3_ALBUM:
             id3_associate_string (tuple, Tuple::Album, & frame[0], frame.len ());
@@ -609,16 +725,10 @@ bool ID3v24TagModule::read_tag (VFSFile & handle, Tuple & tuple, Index<char> * i
             rva_frames.append (std::move (frame));
             break;
           case ID3_APIC:
-            if (image)
-                * image = id3_decode_apic (& frame[0], frame.len ());
-            break;
-          default:
-            AUDDBG ("Ignoring unsupported ID3 frame %s.\n", (const char *) frame.key);
+            * image = id3_decode_apic (& frame[0], frame.len ());
             break;
         }
-
-        pos += frame_size;
-    }
+    });
 
     /* only decode RVA2 frames if Replay Gain was not found in TXXX frames */
     if (! tuple.is_set (Tuple::GainDivisor) && ! tuple.is_set (Tuple::PeakDivisor))
@@ -17,6 +17,8 @@
  * the use of this software.
  */
 
+#include <string.h>
+
 #include <libaudcore/index.h>
 #include <libaudcore/runtime.h>
 #include <libaudcore/tuple.h>
@@ -27,8 +29,160 @@
 #include "tag_module.h"
 #include "builtin.h"
 
+/* ID3v2 and APE tags at the start of a file are usually small enough to fit in
+ * the head window, except for any cover art.  The tail window covers an ID3v1
+ * tag (with extension) and an APE tag in front of it. */
+#define HEAD_WINDOW 65536
+#define TAIL_WINDOW 16384
+
 namespace audtag {
 
+/* Reads that fall within the head or tail window are served from memory; the
+ * window itself is fetched the first time it is needed.  Other reads go to the
+ * real file, which is only seeked when such a read is made. */
+class TagWindows : public VFSImpl
+{
+public:
+    TagWindows (VFSFile & file, int64_t size) :
+        m_file (file),
+        m_size (size),
+        m_head_end (aud::min (size, (int64_t) HEAD_WINDOW)),
+        m_tail_start (aud::max (m_head_end, size - TAIL_WINDOW)) {}
+
+    ~TagWindows ()
+    {
+        AUDDBG ("%s: %d reads served by %d window fetches, %d other reads "
+         "(%d reads saved).\n", m_file.filename (), m_window_reads, m_fetches,
+         m_file_reads, m_window_reads - m_fetches);
+    }
+
+    int64_t fread (void * ptr, int64_t size, int64_t nmemb);
+    int fseek (int64_t offset, VFSSeekType whence);
+
+    int64_t ftell () { return m_pos; }
+    int64_t fsize () { return m_size; }
+    bool feof () { return m_pos >= m_size; }
+
+    int64_t fwrite (const void * ptr, int64_t size, int64_t nmemb) { return 0; }
+    int ftruncate (int64_t length) { return -1; }
+    int fflush () { return 0; }
+
+    String get_metadata (const char * field)
+        { return m_file.get_metadata (field); }
+
+private:
+    int64_t read_window (Index<char> & window, int64_t start, int64_t end,
+     char * ptr, int64_t len);
+
+    VFSFile & m_file;
+    const int64_t m_size, m_head_end, m_tail_start;
+    int64_t m_pos = 0;
+    bool m_file_at_pos = false; /* is the real file position the same? */
+    bool m_head_fetched = false, m_tail_fetched = false;
+    Index<char> m_head, m_tail;
+    int m_window_reads = 0, m_file_reads = 0, m_fetches = 0;
+};
+
+int64_t TagWindows::read_window (Index<char> & window, int64_t start,
+ int64_t end, char * ptr, int64_t len)
+{
+    bool & fetched = (& window == & m_head) ? m_head_fetched : m_tail_fetched;
+
+    if (! fetched)
+    {
+        fetched = true;
+        m_fetches ++;
+        m_file_at_pos = false;
+
+        if (! m_file.fseek (start, VFS_SEEK_SET))
+        {
+            window.resize (end - start);
+            window.resize (aud::max (m_file.fread (window.begin (), 1,
+             end - start), (int64_t) 0));
+        }
+    }
+
+    int64_t copy = aud::clamp (start + window.len () - m_pos, (int64_t) 0, len);
+    if (copy)
+    {
+        memcpy (ptr, & window[m_pos - start], copy);
+        m_pos += copy;
+
+        /* the real file does not move along with m_pos */
+        m_file_at_pos = false;
+    }
+
+    return copy;
+}
+
+int64_t TagWindows::fread (void * ptr, int64_t size, int64_t nmemb)
+{
+    int64_t len = size * nmemb;
+    int64_t total = 0;
+
+    if (len <= 0)
+        return 0;
+
+    if (m_pos < m_head_end)
+        total = read_window (m_head, 0, m_head_end, (char *) ptr, len);
+    else if (m_pos >= m_tail_start && m_pos < m_size)
+        total = read_window (m_tail, m_tail_start, m_size, (char *) ptr, len);
+
+    if (total)
+        m_window_reads ++;
+
+    if (total < len && m_pos < m_size)
+    {
+        if (! m_file_at_pos && m_file.fseek (m_pos, VFS_SEEK_SET))
+            return total / size;
+
+        int64_t got = aud::max (m_file.fread ((char *) ptr + total, 1,
+         len - total), (int64_t) 0);
+
+        m_file_reads ++;
+        m_file_at_pos = true;
+        m_pos += got;
+        total += got;
+    }
+
+    return total / size;
+}
+
+int TagWindows::fseek (int64_t offset, VFSSeekType whence)
+{
+    if (whence == VFS_SEEK_CUR)
+        offset += m_pos;
+    else if (whence == VFS_SEEK_END)
+        offset += m_size;
+
+    if (offset < 0 || offset > m_size)
+        return -1;
+
+    if (offset != m_pos)
+    {
+        m_pos = offset;
+        m_file_at_pos = false;
+    }
+
+    return 0;
+}
+
+VFSFile open_tag_windows (VFSFile & file)
+{
+    if (file.fseek (0, VFS_SEEK_SET))
+        return VFSFile ();
+
+    /* reads from a mapped file are cheap, so a copy would gain nothing */
+    if (file.is_mapped ())
+        return VFSFile ();
+
+    int64_t size = file.fsize ();
+    if (size < 0)
+        return VFSFile ();
+
+    return VFSFile (file.filename (), new TagWindows (file, size));
+}
+
 static APETagModule ape;
 static ID3v1TagModule id3v1;
 static ID3v22TagModule id3v22;
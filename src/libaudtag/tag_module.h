@@ -41,6 +41,13 @@ protected:
 
 TagModule * find_tag_module (VFSFile & handle, TagType new_type);
 
+/* Returns a read-only view of <file> in which the start and end of the file
+ * are each fetched with a single read, so that the tag modules can probe for
+ * and read their tags without many small reads of a remote file.  The view
+ * must not outlive <file>.  If <file> is a local file mapped into memory, or
+ * its size is unknown, no view is created and an empty VFSFile is returned. */
+VFSFile open_tag_windows (VFSFile & file);
+
 }
 
 #endif /* TAG_MODULE_H */